@@ -0,0 +1,362 @@
+/*
+ *  el2 control console on the uart
+ *
+ *  the uart page of the guest is trapped instead of passed through: guest
+ *  accesses are forwarded to the uart and each character the guest reads
+ *  is watched for the escape (include/console.h).  the console then owns
+ *  the uart in the trap of that vcpu until "exit".  the vcpu stays stopped
+ *  meanwhile, irqs and msgs are handled as usual.
+ *
+ *  knobs are runtime copies of the tunables of each module (default: the
+ *  macro of the same name in upper case).
+ */
+
+#include "types.h"
+#include "console.h"
+#include "uart.h"
+#include "vmmio.h"
+#include "vcpu.h"
+#include "localnode.h"
+#include "node.h"
+#include "irq.h"
+#include "vgic.h"
+#include "vsm.h"
+#include "vsm-log.h"
+#include "s2mm.h"
+#include "msg.h"
+#include "tlb.h"
+#include "sched.h"
+#include "allocpage.h"
+#include "fault-lat.h"
+#include "exit-stat.h"
+#include "pmuprof.h"
+#include "page-prof.h"
+#include "lib.h"
+#include "log.h"
+#include "printf.h"
+
+#define CONSOLE_LINE_MAX  80
+#define CONSOLE_ARGC_MAX  4
+
+struct console_knob {
+  const char *name;
+  int *val;
+  int min;
+  int max;
+  const char *desc;
+};
+
+static struct console_knob knobs[] = {
+  { "loglevel", &loglevel, 0, LLOG,
+    "print up to this level, the rest is kept for \"log\" (1 warn, 2 log)" },
+  { "log_vsm", &log_cat_level[LC_VSM], 0, LLOG,
+    "vsm fault and protocol log (0 off, 1 warn, 2 log)" },
+  { "log_msg", &log_cat_level[LC_MSG], 0, LLOG, "msg handling log" },
+  { "log_net", &log_cat_level[LC_NET], 0, LLOG, "nic log" },
+  { "log_trap", &log_cat_level[LC_TRAP], 0, LLOG, "guest abort log" },
+  { "log_mmio", &log_cat_level[LC_MMIO], 0, LLOG, "mmio forwarding log" },
+  { "log_vgic", &log_cat_level[LC_VGIC], 0, LLOG, "cross-node virq log" },
+  { "log_page", &log_cat_level[LC_PAGE], 0, LLOG, "periodic hot page report (2: on)" },
+  { "virq_msg_batch", &virq_msg_batch, 1, VIRQ_MSG_BATCH,
+    "virqs coalesced in one cross-node msg" },
+  { "halt_poll_max_us", &halt_poll_max_us, 0, 10000,
+    "max halt-polling window of a trapped wfi" },
+  { "sched_timeslice_us", &sched_timeslice_us, 100, 1000000,
+    "timeslice of vcpus sharing a pcpu" },
+  { "migrate_min_faults", &migrate_min_faults, 1, 1 << 20,
+    "remote faults in a window before a vcpu migrates" },
+  { "migrate_ratio_pct", &migrate_ratio_pct, 0, 101,
+    "share of remote faults served by one node to migrate (101: never)" },
+  {},
+};
+
+static int escape_seen;
+static bool console_active;
+
+static bool parse_num(const char *s, u64 *val) {
+  u64 n = 0;
+  int base = 10;
+
+  if(s[0] == '0' && s[1] == 'x') {
+    base = 16;
+    s += 2;
+  }
+
+  if(!*s)
+    return false;
+
+  for(; *s; s++) {
+    int d;
+
+    if('0' <= *s && *s <= '9')
+      d = *s - '0';
+    else if(base == 16 && 'a' <= *s && *s <= 'f')
+      d = *s - 'a' + 10;
+    else
+      return false;
+
+    n = n * base + d;
+  }
+
+  *val = n;
+  return true;
+}
+
+static struct console_knob *find_knob(const char *name) {
+  for(struct console_knob *k = knobs; k->name; k++) {
+    if(strcmp(k->name, name) == 0)
+      return k;
+  }
+
+  return NULL;
+}
+
+static void knob_print(struct console_knob *k) {
+  printf("%s = %d\t(%d - %d) %s\n", k->name, *k->val, k->min, k->max, k->desc);
+}
+
+static void cmd_get(int argc, char **argv) {
+  struct console_knob *k;
+
+  if(argc < 2) {
+    for(k = knobs; k->name; k++)
+      knob_print(k);
+    return;
+  }
+
+  if(!(k = find_knob(argv[1]))) {
+    printf("no knob %s\n", argv[1]);
+    return;
+  }
+
+  knob_print(k);
+}
+
+static void cmd_set(int argc, char **argv) {
+  struct console_knob *k;
+  u64 val;
+
+  if(argc < 3 || !parse_num(argv[2], &val)) {
+    printf("usage: set <knob> <value>\n");
+    return;
+  }
+
+  if(!(k = find_knob(argv[1]))) {
+    printf("no knob %s\n", argv[1]);
+    return;
+  }
+
+  if(val < (u64)k->min || val > (u64)k->max) {
+    printf("%s: %d - %d\n", k->name, k->min, k->max);
+    return;
+  }
+
+  *k->val = val;
+
+  knob_print(k);
+}
+
+static void cmd_page(int argc, char **argv) {
+  u64 ipa;
+
+  if(argc < 2 || !parse_num(argv[1], &ipa)) {
+    printf("usage: page <ipa>\n");
+    return;
+  }
+
+  vsm_page_dump(ipa);
+}
+
+static void cmd_trace(int argc, char **argv) {
+  u64 n = 64;
+
+  if(argc >= 2 && !parse_num(argv[1], &n)) {
+    printf("usage: trace [n]\n");
+    return;
+  }
+
+  vsm_trace_dump(n);
+}
+
+static void cmd_pages(int argc, char **argv) {
+  u64 n = PAGEPROF_TOP;
+
+  if(argc >= 2 && !parse_num(argv[1], &n)) {
+    printf("usage: pages [n]\n");
+    return;
+  }
+
+  page_prof_report(n);
+}
+
+static void cmd_help(int argc, char **argv);
+
+/* run: command with arguments, dump: statistics without */
+static struct console_cmd {
+  const char *name;
+  void (*run)(int argc, char **argv);
+  void (*dump)(void);
+  const char *desc;
+} cmds[] = {
+  { "help",     cmd_help,   NULL,                 "this help" },
+  { "get",      cmd_get,    NULL,                 "[knob]: show knobs" },
+  { "set",      cmd_set,    NULL,                 "<knob> <value>: change a knob" },
+  { "buddy",    NULL,       buddydump,            "page allocator state" },
+  { "irq",      NULL,       irqstats,             "irq counts and handling time" },
+  { "exits",    NULL,       exit_stat_dump,       "guest exits per vcpu" },
+  { "vsm",      NULL,       vsm_stats,            "vsm fault and protocol counters" },
+  { "page",     cmd_page,   NULL,                 "<ipa>: vsm and stage 2 state of a page" },
+  { "msg",      NULL,       msg_stats,            "msg queue depths" },
+  { "trace",    cmd_trace,  NULL,                 "[n]: last n events of vsm trace rings" },
+  { "pages",    cmd_pages,  NULL,                 "[n]: hottest pages and their sharing pattern" },
+  { "pageprof", NULL,       page_prof_dump,       "all profiled pages (for tools/pageprof)" },
+  { "lat",      NULL,       fault_lat_dump,       "remote fault latency" },
+  { "tlb",      NULL,       tlb_s2_stats_dump,    "stage 2 tlb flushes" },
+  { "sched",    NULL,       sched_stats,          "scheduler" },
+  { "idle",     NULL,       vcpu_idle_stats,      "trapped wfi/wfe" },
+  { "migrate",  NULL,       vcpu_migrate_stats,   "vcpu migration" },
+  { "vmmio",    NULL,       vmmio_stats,          "guest mmio" },
+  { "pmu",      NULL,       pmuprof_dump,         "pmu samples" },
+  { "cluster",  NULL,       node_cluster_dump,    "cluster nodes" },
+  { "log",      NULL,       logflush,             "print the log buffer and rings" },
+  { "exit",     NULL,       NULL,                 "back to the guest" },
+  {},
+};
+
+static void cmd_help(int __unused argc, char ** __unused argv) {
+  for(struct console_cmd *c = cmds; c->name; c++)
+    printf("  %s\t%s\n", c->name, c->desc);
+}
+
+static void console_readline(char *buf, int size) {
+  struct uartchip *uart = localnode.uart;
+  int n = 0;
+
+  for(;;) {
+    int c = uart->getc();
+
+    if(c < 0)
+      continue;
+
+    if(c == '\r' || c == '\n') {
+      uart_puts("\r\n");
+      break;
+    }
+
+    if(c == 0x7f || c == '\b') {
+      if(n > 0) {
+        n--;
+        uart_puts("\b \b");
+      }
+      continue;
+    }
+
+    if(c < ' ' || n == size - 1)
+      continue;
+
+    buf[n++] = c;
+    uart_putc(c);
+  }
+
+  buf[n] = '\0';
+}
+
+/* split in place: lib strtok() loses the last token */
+static int console_split(char *line, char **argv) {
+  int argc = 0;
+
+  while(*line && argc < CONSOLE_ARGC_MAX) {
+    while(*line == ' ')
+      *line++ = '\0';
+
+    if(!*line)
+      break;
+
+    argv[argc++] = line;
+
+    while(*line && *line != ' ')
+      line++;
+  }
+
+  return argc;
+}
+
+static void console_run() {
+  char line[CONSOLE_LINE_MAX];
+  char *argv[CONSOLE_ARGC_MAX];
+  int argc;
+
+  printf("\npocv2 console: node%d cpu%d vcpu%d, \"help\" for commands\n",
+         local_nodeid(), cpuid(), current->vcpuid);
+
+  for(;;) {
+    struct console_cmd *c;
+
+    printf("pocv2> ");
+    console_readline(line, sizeof(line));
+
+    if(!(argc = console_split(line, argv)))
+      continue;
+
+    for(c = cmds; c->name; c++) {
+      if(strcmp(c->name, argv[0]) == 0)
+        break;
+    }
+
+    if(!c->name) {
+      printf("unknown command: %s\n", argv[0]);
+      continue;
+    }
+
+    if(c->run)
+      c->run(argc, argv);
+    else if(c->dump)
+      c->dump();
+    else
+      break;    /* exit */
+  }
+
+  printf("back to the guest\n");
+}
+
+static int console_uart_read(struct vcpu * __unused vcpu, struct mmio_access *mmio) {
+  struct uartchip *uart = localnode.uart;
+  u32 val;
+
+  if(mmio->offset != uart->rx_reg) {
+    mmio->val = uart->reg_read(mmio->offset);
+    return 0;
+  }
+
+  /* input belongs to the console on other pcpu */
+  if(console_active) {
+    mmio->val = 0;
+    return 0;
+  }
+
+  val = uart->reg_read(mmio->offset);
+
+  if((val & 0xff) != CONSOLE_ESCAPE) {
+    escape_seen = 0;
+  } else if(++escape_seen == CONSOLE_ESCAPE_COUNT) {
+    escape_seen = 0;
+    console_active = true;
+    console_run();
+    console_active = false;
+  }
+
+  mmio->val = val;
+
+  return 0;
+}
+
+static int console_uart_write(struct vcpu * __unused vcpu, struct mmio_access *mmio) {
+  localnode.uart->reg_write(mmio->offset, mmio->val);
+
+  return 0;
+}
+
+/* instead of vmiomap_passthrough() of the guest uart */
+void console_guest_uart(u64 ipa, u64 size) {
+  vmmio_reg_handler(ipa, size, console_uart_read, console_uart_write);
+}
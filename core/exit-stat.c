@@ -0,0 +1,185 @@
+/*
+ *  guest exit accounting
+ *
+ *  a vcpu stamps the trap entry, the handler refines the reason (an abort
+ *  becomes a vsm fault, a stage 1 walk or mmio only once it is handled)
+ *  and the time up to the end of the handling is added to the vcpu.
+ *  wfi/wfe include the time the vcpu was blocked.  irqs taken from guest
+ *  are broken down by irq number in irqstats() (core/irq.c).
+ */
+
+#include "aarch64.h"
+#include "vcpu.h"
+#include "pcpu.h"
+#include "irq.h"
+#include "localnode.h"
+#include "exit-stat.h"
+#include "vsm.h"
+#include "allocpage.h"
+#include "lib.h"
+#include "arch-timer.h"
+#include "printf.h"
+
+static const char *exit_reason_name[NR_EXIT_REASON] = {
+  [EXIT_WFI] =            "wfi",
+  [EXIT_WFE] =            "wfe",
+  [EXIT_HVC] =            "hvc",
+  [EXIT_SMC] =            "smc",
+  [EXIT_SYSREG] =         "sysreg",
+  [EXIT_IABT] =           "iabt",
+  [EXIT_IABT_S1PTW] =     "iabt-s1ptw",
+  [EXIT_DABT_VSM_READ] =  "dabt-read",
+  [EXIT_DABT_VSM_WRITE] = "dabt-write",
+  [EXIT_DABT_S1PTW] =     "dabt-s1ptw",
+  [EXIT_DABT_MMIO] =      "dabt-mmio",
+  [EXIT_IRQ] =            "irq",
+};
+
+/* trap entry */
+void exit_stat_enter(struct vcpu *vcpu, int reason) {
+  vcpu->exit.start = now_cycles();
+  vcpu->exit.cur = reason;
+}
+
+void exit_stat_reason(struct vcpu *vcpu, int reason) {
+  vcpu->exit.cur = reason;
+}
+
+/* msr/mrs: rt does not make a different encoding */
+void exit_stat_sysreg(struct vcpu *vcpu, u64 iss) {
+  vcpu->exit.cur = EXIT_SYSREG;
+  vcpu->exit.cur_sysreg = iss & ~(0x1f << 5);
+}
+
+static struct exit_count *sysreg_slot(struct vcpu_exit_stat *e, u32 iss) {
+  for(struct exit_sysreg *s = e->sysreg; s < &e->sysreg[EXIT_SYSREG_MAX]; s++) {
+    if(s->iss == iss && s->c.count)
+      return &s->c;
+
+    if(!s->c.count) {
+      s->iss = iss;
+      return &s->c;
+    }
+  }
+
+  return &e->sysreg_other;
+}
+
+/* end of the handling, before the vcpu may be switched out or migrated */
+void exit_stat_leave(struct vcpu *vcpu) {
+  struct vcpu_exit_stat *e = &vcpu->exit;
+  u64 ticks = now_cycles() - e->start;
+
+  e->reason[e->cur].count++;
+  e->reason[e->cur].ticks += ticks;
+
+  if(e->cur == EXIT_SYSREG) {
+    struct exit_count *c = sysreg_slot(e, e->cur_sysreg);
+
+    c->count++;
+    c->ticks += ticks;
+  }
+}
+
+static void exit_stat_collect(struct exit_stat_report *r) {
+  memset(r, 0, sizeof(*r));
+
+  r->freq = read_sysreg(cntfrq_el0);
+
+  for(struct vcpu *vcpu = localvm.vcpus; vcpu < &localvm.vcpus[localvm.nvcpu]; vcpu++) {
+    int n = r->nvcpu++;
+
+    r->vcpu[n].vcpuid = vcpu->vcpuid;
+    memcpy(r->vcpu[n].reason, vcpu->exit.reason, sizeof(r->vcpu[n].reason));
+    memcpy(r->vcpu[n].sysreg, vcpu->exit.sysreg, sizeof(r->vcpu[n].sysreg));
+    r->vcpu[n].sysreg_other = vcpu->exit.sysreg_other;
+  }
+
+  for(struct irq *irq = irqlist; irq < &irqlist[NIRQ] && r->nirq < EXIT_IRQ_MAX; irq++) {
+    u64 count = 0, ticks = 0;
+
+    for(int i = 0; i < NCPU_MAX; i++) {
+      count += irq->nhandle[i];
+      ticks += irq->handler ? irq->handle_ticks[i] : irq->inject_ticks[i];
+    }
+
+    if(!count)
+      continue;
+
+    r->irq[r->nirq].irq = irq_no(irq);
+    r->irq[r->nirq].c.count = count;
+    r->irq[r->nirq].c.ticks = ticks;
+    r->nirq++;
+  }
+}
+
+/*
+ *  hvc #4: copy struct exit_stat_report to guest ipa
+ *  return copied bytes or -1
+ */
+int exit_stat_copy_to_guest(struct vcpu *vcpu, u64 ipa, u64 size) {
+  struct exit_stat_report *r;
+  int copied;
+
+  /* too large for the hypervisor stack */
+  if(!(r = alloc_pages(1)))
+    return -1;
+
+  exit_stat_collect(r);
+
+  if(size > sizeof(*r))
+    size = sizeof(*r);
+
+  copied = vsm_copy_to_guest(vcpu, ipa, r, size);
+
+  free_pages(r, 1);
+
+  return copied;
+}
+
+static u64 ticks_to_usecs(u64 ticks) {
+  return ticks * 1000000 / read_sysreg(cntfrq_el0);
+}
+
+/* short spans only */
+static u64 ticks_to_nsecs(u64 ticks) {
+  return ticks * 1000000000 / read_sysreg(cntfrq_el0);
+}
+
+static void exit_count_dump(struct exit_count *c) {
+  printf("\tcount %d total %d us avg %d ns\n", c->count, ticks_to_usecs(c->ticks),
+         ticks_to_nsecs(c->ticks / c->count));
+}
+
+void exit_stat_dump() {
+  printf("exit stats: node %d (count, time from trap entry to end of handling)\n", local_nodeid());
+
+  for(struct vcpu *vcpu = localvm.vcpus; vcpu < &localvm.vcpus[localvm.nvcpu]; vcpu++) {
+    struct vcpu_exit_stat *e = &vcpu->exit;
+
+    printf("vcpu%d:\n", vcpu->vcpuid);
+
+    for(int i = 0; i < NR_EXIT_REASON; i++) {
+      if(!e->reason[i].count)
+        continue;
+
+      printf("  %s", exit_reason_name[i]);
+      exit_count_dump(&e->reason[i]);
+    }
+
+    for(struct exit_sysreg *s = e->sysreg; s < &e->sysreg[EXIT_SYSREG_MAX] && s->c.count; s++) {
+      u32 iss = s->iss;
+
+      printf("    %s s%d_%d_c%d_c%d_%d", iss & 1 ? "mrs" : "msr", (iss >> 20) & 0x3,
+             (iss >> 14) & 0x7, (iss >> 10) & 0xf, (iss >> 1) & 0xf, (iss >> 17) & 0x7);
+      exit_count_dump(&s->c);
+    }
+
+    if(e->sysreg_other.count) {
+      printf("    other");
+      exit_count_dump(&e->sysreg_other);
+    }
+  }
+
+  irqstats();
+}
@@ -0,0 +1,196 @@
+/*
+ *  remote fault latency breakdown
+ *
+ *  a vcpu stamps each stage of its fault with cntpct_el0, the remote node
+ *  measures its part and returns the durations in the fetch reply.
+ *  histograms are per pcpu (updated at the end of the trap by the pcpu
+ *  running the vcpu) and summed up on dump.
+ */
+
+#include "aarch64.h"
+#include "vcpu.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "arch-timer.h"
+#include "fault-lat.h"
+#include "vsm.h"
+#include "allocpage.h"
+#include "lib.h"
+#include "printf.h"
+
+struct fault_lat_cpu {
+  u64 nfault;
+  struct fault_lat_hist stage[NR_FL_STAGE];
+} __cacheline_aligned;
+
+static struct fault_lat_cpu flcpu[NCPU_MAX];
+
+static const char *fl_stage_name[NR_FL_STAGE] = {
+  [FL_LOCK] =     "lock",
+  [FL_ISSUE] =    "issue",
+  [FL_NET] =      "net",
+  [FL_FWD] =      "fwd",
+  [FL_RXQ] =      "rxq",
+  [FL_WQ] =       "wq",
+  [FL_SERVE] =    "serve",
+  [FL_WAKE] =     "wake",
+  [FL_MAP] =      "map",
+  [FL_RESUME] =   "resume",
+  [FL_TOTAL] =    "total",
+};
+
+static u64 ticks_to_usecs(u64 ticks) {
+  return ticks * 1000000 / read_sysreg(cntfrq_el0);
+}
+
+static void fl_account(struct fault_lat_hist *h, i64 ticks) {
+  u64 us;
+  int b = 0;
+
+  /* a stage measured on other pcpus may go slightly backwards */
+  if(ticks < 0)
+    ticks = 0;
+
+  us = ticks_to_usecs(ticks);
+
+  while(us && b < FL_NBUCKET - 1) {
+    us >>= 1;
+    b++;
+  }
+
+  h->count++;
+  h->sum += ticks;
+  if((u64)ticks > h->max)
+    h->max = ticks;
+  h->bucket[b]++;
+}
+
+/* vm_dabort()/vm_iabort() entry */
+void fault_lat_trap(struct vcpu *vcpu) {
+  vcpu->flat.trap = now_cycles();
+  vcpu->flat.remote = false;
+}
+
+/* fetch reply arrived: stamps of the reply and remote durations */
+void fault_lat_reply(struct vcpu *vcpu, u64 recv, u32 fwd, u32 rxq, u32 wq, u32 serve) {
+  struct vcpu_fault_lat *f = &vcpu->flat;
+
+  f->recv = recv;
+  f->cb = now_cycles();
+  f->fwd = fwd;
+  f->rxq = rxq;
+  f->wq = wq;
+  f->serve = serve;
+  f->remote = true;
+}
+
+/* end of trap, just before returning to guest */
+void fault_lat_resume(struct vcpu *vcpu) {
+  struct vcpu_fault_lat *f = &vcpu->flat;
+  struct fault_lat_cpu *c;
+  u64 now;
+  i64 remote;
+
+  /* local fault, or a fetch outside of dabort/iabort (e.g. vsm_access()) */
+  if(!f->remote || !f->trap) {
+    f->remote = false;
+    f->trap = 0;
+    return;
+  }
+
+  now = now_cycles();
+  c = &flcpu[cpuid()];
+  remote = (i64)f->fwd + f->rxq + f->wq + f->serve;
+
+  c->nfault++;
+
+  fl_account(&c->stage[FL_LOCK], f->lock - f->trap);
+  fl_account(&c->stage[FL_ISSUE], f->issue - f->lock);
+  fl_account(&c->stage[FL_NET], (i64)(f->recv - f->issue) - remote);
+  fl_account(&c->stage[FL_FWD], f->fwd);
+  fl_account(&c->stage[FL_RXQ], f->rxq);
+  fl_account(&c->stage[FL_WQ], f->wq);
+  fl_account(&c->stage[FL_SERVE], f->serve);
+  fl_account(&c->stage[FL_WAKE], f->cb - f->recv);
+  fl_account(&c->stage[FL_MAP], f->map - f->cb);
+  fl_account(&c->stage[FL_RESUME], now - f->map);
+  fl_account(&c->stage[FL_TOTAL], now - f->trap);
+
+  f->remote = false;
+  f->trap = 0;
+}
+
+static void fault_lat_collect(struct fault_lat_report *r) {
+  memset(r, 0, sizeof(*r));
+
+  r->freq = read_sysreg(cntfrq_el0);
+
+  for(struct fault_lat_cpu *c = flcpu; c < &flcpu[NCPU_MAX]; c++) {
+    r->nfault += c->nfault;
+
+    for(int s = 0; s < NR_FL_STAGE; s++) {
+      struct fault_lat_hist *h = &r->stage[s];
+
+      h->count += c->stage[s].count;
+      h->sum += c->stage[s].sum;
+      if(c->stage[s].max > h->max)
+        h->max = c->stage[s].max;
+
+      for(int b = 0; b < FL_NBUCKET; b++)
+        h->bucket[b] += c->stage[s].bucket[b];
+    }
+  }
+}
+
+/*
+ *  hvc #2: copy struct fault_lat_report to guest ipa
+ *  return copied bytes or -1
+ */
+int fault_lat_copy_to_guest(struct vcpu *vcpu, u64 ipa, u64 size) {
+  struct fault_lat_report *r;
+  int copied;
+
+  /* too large for the hypervisor stack */
+  if(!(r = alloc_page()))
+    return -1;
+
+  fault_lat_collect(r);
+
+  if(size > sizeof(*r))
+    size = sizeof(*r);
+
+  copied = vsm_copy_to_guest(vcpu, ipa, r, size);
+
+  free_page(r);
+
+  return copied;
+}
+
+void fault_lat_dump() {
+  struct fault_lat_report *r;
+
+  if(!(r = alloc_page()))
+    return;
+
+  fault_lat_collect(r);
+
+  printf("fault latency: node %d remote faults %d (usec, log2 buckets from <1us)\n",
+         local_nodeid(), r->nfault);
+
+  for(int s = 0; r->nfault && s < NR_FL_STAGE; s++) {
+    struct fault_lat_hist *h = &r->stage[s];
+
+    if(!h->count)
+      continue;
+
+    printf("%s\tavg %d max %d |", fl_stage_name[s],
+           ticks_to_usecs(h->sum / h->count), ticks_to_usecs(h->max));
+
+    for(int b = 0; b < FL_NBUCKET; b++)
+      printf(" %d", h->bucket[b]);
+
+    printf("\n");
+  }
+
+  free_page(r);
+}
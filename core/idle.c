@@ -0,0 +1,214 @@
+/*
+ *  vcpu idle: trapped WFI/WFE with adaptive halt-polling
+ */
+
+#include "aarch64.h"
+#include "vcpu.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "arch-timer.h"
+#include "s2mm.h"
+#include "printf.h"
+#include "log.h"
+#include "sched.h"
+#include "page-prof.h"
+
+/* halt-polling window (usec) */
+#define HALT_POLL_MIN_US    10
+#define HALT_POLL_MAX_US    200
+
+/* upper bound of one wfi, pcpu is woken up by hyp timer (usec) */
+#define HALT_WFI_MAX_US     10000
+
+/* wfe within this after a remote read fault is a spin on that page (usec) */
+#define WFE_CORRELATE_US    100
+/* upper bound of parking a wfe (usec) */
+#define WFE_PARK_MAX_US     1000
+
+int halt_poll_max_us = HALT_POLL_MAX_US;
+
+static bool vcpu_wakeup_pending(struct vcpu *vcpu) {
+  for(int i = 0; i < VIRQ_MAX / 64; i++) {
+    if(vcpu->pending.bitmap[i])
+      return true;
+  }
+
+  return localnode.irqchip->guest_lr_pending();
+}
+
+/*
+ *  grow the polling window while wakeups come soon after wfi,
+ *  shrink it when the vcpu sleeps long anyway
+ */
+static void halt_poll_adjust(struct vcpu_idle *idle, u64 block, bool polled) {
+  u64 max = usecs_to_ticks(halt_poll_max_us);
+
+  if(polled)
+    return;
+
+  if(block > max) {
+    idle->poll_ticks /= 2;
+  } else if(idle->poll_ticks < max) {
+    if(idle->poll_ticks)
+      idle->poll_ticks *= 2;
+    else
+      idle->poll_ticks = usecs_to_ticks(HALT_POLL_MIN_US);
+
+    if(idle->poll_ticks > max)
+      idle->poll_ticks = max;
+  }
+}
+
+/*
+ *  block current pcpu until a virtual interrupt for vcpu is pending.
+ *  physical irqs (and recv msgs) are handled meanwhile, so a node whose
+ *  vcpu is idle keeps serving vsm requests.
+ */
+void vcpu_wfi(struct vcpu *vcpu) {
+  struct vcpu_idle *idle = &vcpu->idle;
+  u64 start = now_cycles();
+  u64 poll_end = start + idle->poll_ticks;
+  bool polled = false;
+
+  idle->nwfi++;
+
+  /* other vcpus share this pcpu: run them instead of polling and halting */
+  if(sched_multiplexed()) {
+    while(!vcpu_wakeup_pending(vcpu))
+      sched_wait();
+
+    idle->idle_ticks += now_cycles() - start;
+    return;
+  }
+
+  while(now_cycles() < poll_end) {
+    if(vcpu_wakeup_pending(vcpu)) {
+      polled = true;
+      idle->npoll_wakeup++;
+      goto out;
+    }
+
+    log_drain(false);
+  }
+
+  for(;;) {
+    /* into the log ring of this pcpu, drained below */
+    page_prof_tick();
+
+    local_irq_disable();
+
+    if(vcpu_wakeup_pending(vcpu)) {
+      local_irq_enable();
+      break;
+    }
+
+    /* idle pcpu writes out the log rings of busy ones */
+    log_drain(false);
+
+    hyp_timer_oneshot(usecs_to_ticks(HALT_WFI_MAX_US));
+
+    idle->nhalt++;
+
+    /* pending irq wakes up wfi even if masked */
+    wfi();
+
+    local_irq_enable();
+  }
+
+  hyp_timer_cancel();
+
+out:
+  idle->idle_ticks += now_cycles() - start;
+  halt_poll_adjust(idle, now_cycles() - start, polled);
+}
+
+/*
+ *  a guest spinning on a lock in a page owned by other node: remote
+ *  writes never raise a local event, so re-reading only steals the page
+ *  back from the writer.  park the vcpu until the page is invalidated
+ *  (its lock word may have changed) or ownership moved, then let it re-read.
+ */
+void vcpu_wfe(struct vcpu *vcpu) {
+  struct vcpu_idle *idle = &vcpu->idle;
+  u64 ipa = idle->rfault_ipa;
+  u64 start = now_cycles();
+  u64 deadline;
+
+  idle->nwfe++;
+
+  /* the lock holder may be waiting for this pcpu */
+  if(sched_multiplexed()) {
+    sched_yield();
+    return;
+  }
+
+  if(!ipa || start - idle->rfault_stamp > usecs_to_ticks(WFE_CORRELATE_US))
+    return;
+
+  idle->wfe_wait_ipa = ipa;
+  dsb(ish);
+
+  /* already invalidated? */
+  if(!s2_readable_pte(ipa)) {
+    idle->wfe_wait_ipa = 0;
+    idle->rfault_ipa = 0;
+    return;
+  }
+
+  idle->npark++;
+
+  deadline = start + usecs_to_ticks(WFE_PARK_MAX_US);
+  hyp_timer_oneshot(usecs_to_ticks(WFE_PARK_MAX_US));
+
+  /* every irq_entry() and vcpu_wfe_wake() raise an event */
+  while(idle->wfe_wait_ipa == ipa && now_cycles() < deadline &&
+        !vcpu_wakeup_pending(vcpu))
+    wfe();
+
+  hyp_timer_cancel();
+
+  idle->idle_ticks += now_cycles() - start;
+
+  if(idle->wfe_wait_ipa != ipa) {
+    /* next read faults and fetches fresh page */
+    idle->npark_wakeup++;
+    idle->rfault_ipa = 0;
+  } else {
+    /* still spinning on the same page: keep parking next wfe */
+    idle->rfault_stamp = now_cycles();
+  }
+
+  idle->wfe_wait_ipa = 0;
+}
+
+/*
+ *  called when page_ipa is invalidated or its ownership changed
+ */
+void vcpu_wfe_wake(u64 page_ipa) {
+  bool wake = false;
+
+  for(struct vcpu *vcpu = localvm.vcpus; vcpu < &localvm.vcpus[localvm.nvcpu]; vcpu++) {
+    if(vcpu->idle.wfe_wait_ipa == page_ipa) {
+      vcpu->idle.wfe_wait_ipa = 0;
+      wake = true;
+    }
+  }
+
+  if(wake) {
+    dsb(ish);
+    sev();
+  }
+}
+
+void vcpu_idle_stats() {
+  printf("vcpu idle stats\n");
+
+  for(struct vcpu *vcpu = localvm.vcpus; vcpu < &localvm.vcpus[localvm.nvcpu]; vcpu++) {
+    struct vcpu_idle *idle = &vcpu->idle;
+
+    printf("vcpu%d: wfi %d (poll wakeup %d halt %d) wfe %d (park %d inv wakeup %d) "
+           "idle %d ticks poll window %d ticks\n",
+           vcpu->vcpuid, idle->nwfi, idle->npoll_wakeup, idle->nhalt, idle->nwfe,
+           idle->npark, idle->npark_wakeup, idle->idle_ticks, idle->poll_ticks);
+  }
+}
@@ -19,6 +19,10 @@
 #include "iomem.h"
 #include "arch-timer.h"
 #include "panic.h"
+#include "lib.h"
+#include "partition.h"
+#include "shmnet.h"
+#include "pmuprof.h"
 
 #define KiB   (1024)
 #define MiB   (1024 * 1024)
@@ -39,7 +43,7 @@ volatile static int cpu0_ready = 0;
 
 static void hcr_setup() {
   u64 hcr = HCR_VM | HCR_SWIO | HCR_AMO | HCR_FMO | HCR_IMO |
-            HCR_PTW | HCR_RW | HCR_TSC /* | HCR_TDZ */;
+            HCR_PTW | HCR_RW | HCR_TSC | HCR_TWI | HCR_TWE /* | HCR_TDZ */;
 
   write_sysreg(hcr_el2, hcr);
 
@@ -56,6 +60,8 @@ int vmm_init_secondary() {
 
   arch_timer_init_core();
 
+  pmuprof_init_core();
+
   hcr_setup();
 
   localnode.ctl->startcore();
@@ -94,8 +100,22 @@ int vmm_init_cpu0(void *fdt_phys) {
   arch_timer_init();
   arch_timer_init_core();
 
+  pmuprof_init();
+  pmuprof_init_core();
+
+#ifdef MEMBENCH
+  membench();
+#endif
+
   // virtio_mmio_init();
-  peripheral_device_init();
+  /* devices of a shared machine belong to node0 */
+  if(!partition_is_sub())
+    peripheral_device_init();
+
+  if(partition.enabled) {
+    shmnet_init();
+    partition_boot_nodes();
+  }
 
   hcr_setup();
 
@@ -103,7 +123,7 @@ int vmm_init_cpu0(void *fdt_phys) {
 
   nodectl_init();
 
-  localvm_init(1, 256 * MiB, &virt_dtb);
+  localvm_init(NVCPU_PER_NODE, MEM_PER_NODE, &virt_dtb);
 
   localnode.ctl->init();
   localnode.ctl->startcore();
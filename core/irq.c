@@ -5,7 +5,11 @@
 #include "vcpu.h"
 #include "pcpu.h"
 #include "localnode.h"
+#include "arch-timer.h"
 #include "panic.h"
+#include "sched.h"
+#include "pmuprof.h"
+#include "exit-stat.h"
 
 struct irq irqlist[NIRQ];
 
@@ -32,19 +36,43 @@ static inline void irq_exit() {
   mycpu->irq_depth--;
 }
 
-void irq_entry(int from_guest) {
+void irq_entry(int from_guest, struct hyp_context *ctx) {
+  struct hyp_context *prev_ctx = mycpu->irq_ctx;
+
   if(local_irq_enabled())  
     panic("local irq enabled?");
 
+  if(from_guest) {
+    exit_stat_enter(current, EXIT_IRQ);
+    pmuprof_exit_enter(PMUPROF_EXIT_IRQ);
+  }
+
+  mycpu->irq_ctx = ctx;
+
   irq_enter();
 
   localnode.irqchip->irq_handler(from_guest);
 
   irq_exit();
 
+  /* handlers run with irqs enabled: irq_entry() nests */
+  mycpu->irq_ctx = prev_ctx;
+
+  /* send virqs batched for remote nodes */
+  vgic_flush_remote_virqs();
+
+  /* let wfe waits (vcpu_wfe()) re-check their condition */
+  sevl();
+
   if(!msg_queue_empty(&mycpu->recv_waitq) && !in_interrupt() && local_lazyirq_enabled()) {
     do_recv_waitqueue();
   }
+
+  if(from_guest) {
+    exit_stat_leave(current);
+    sched_preempt();
+    pmuprof_exit_leave();
+  }
 }
 
 void irqstats() {
@@ -56,9 +84,18 @@ void irqstats() {
 
     printf("irq %d: ", irq_no(irq));
 
-    for(int i = 0; i < NCPU_MAX; i++)
+    for(int i = 0; i < NCPU_MAX; i++) {
       printf("CPU%d: %d ", i, irq->nhandle[i]);
 
+      if(!irq->nhandle[i])
+        continue;
+
+      if(irq->handler)
+        printf("(%d ticks/handle) ", irq->handle_ticks[i] / irq->nhandle[i]);
+      else
+        printf("(%d ticks/inject) ", irq->inject_ticks[i] / irq->nhandle[i]);
+    }
+
     printf("\n");
   }
 }
@@ -67,6 +104,7 @@ int handle_irq(u32 irqno) {
   /* interrupt to vmm */
   struct irq *irq = irq_get(irqno);
   int irqret = 0;
+  u64 start = now_cycles();
 
   irq->nhandle[cpuid()]++;
 
@@ -74,14 +112,20 @@ int handle_irq(u32 irqno) {
     irq->handler(irq->arg);
     irqret = 1;
 
+    /* handlers run with irqs enabled: may include nested irqs */
+    irq->handle_ticks[cpuid()] += now_cycles() - start;
+
     goto end;
   }
 
   /* inject irq to guest */
+
   localnode.irqchip->guest_eoi(irqno);
 
   vgic_inject_virq(current, irqno);
 
+  irq->inject_ticks[cpuid()] += now_cycles() - start;
+
 end:
   return irqret;
 }
@@ -1,36 +1,6 @@
 #include "lib.h"
 #include "log.h"
 
-void *memcpy(void *dst, const void *src, u64 n) {
-  return memmove(dst, src, n);
-}
-
-void *memmove(void *dst, const void *src, u64 n) {
-  char *d = dst;
-  const char *s = src;
-
-  if(s > d) {
-    while(n-- > 0)
-      *d++ = *s++;
-  } else {
-    d += n;
-    s += n;
-    while(n-- > 0)
-      *--d = *--s;
-  }
-
-  return dst;
-}
-
-void *memset(void *dst, int c, u64 n) {
-  char *d = dst;
-
-  while(n-- > 0)
-    *d++ = c;
-
-  return dst;
-}
-
 char *strcpy(char *dst, const char *src) {
   char *r = dst;
 
@@ -49,20 +19,6 @@ int strcmp(const char *s1, const char *s2) {
   return *s1 - *s2;
 }
 
-int memcmp(const void *b1, const void *b2, u64 count) {
-  const char *p1 = b1;
-  const char *p2 = b2;
-  while(count > 0) {
-    if(*p1 != *p2)
-      return *p1 - *p2;
-    p1++;
-    p2++;
-    count--;
-  }
-
-  return 0;
-}
-
 char *strchr(const char *s, int c) {
   char *p = (char *)s;
   while(*p) {
@@ -8,6 +8,7 @@
 #include "param.h"
 #include "vcpu.h"
 #include "arch-timer.h"
+#include "sched.h"
 
 struct localnode localnode = {0};    /* me */
 
@@ -26,23 +27,24 @@ void localvm_init(int nvcpu, u64 nalloc, struct guest *guest_fdt) {
   localvm.nvcpu = nvcpu;
   localvm.nalloc = nalloc;
 
-  if(localvm.nvcpu > NCPU_MAX)
+  if(localvm.nvcpu > VCPU_PER_NODE_MAX)
     panic("too vcpu");
-  if(localvm.nalloc != MEM_PER_NODE)
-    panic("localvm.nalloc != MEM_PER_NODE %p", MEM_PER_NODE);
+  if(localvm.nalloc == 0 || localvm.nalloc % (2 * 1024 * 1024))
+    panic("localvm.nalloc must be 2MB aligned %p", localvm.nalloc);
 
-  localvm.pmap = NULL;
+  localvm.npmap = 0;
   spinlock_init(&localvm.lock);
 
   /* TODO: determines vm's device info from fdt file */
   (void)guest_fdt;
 
   vcpu_preinit();
+  sched_init();
 
   s2mmu_init();
   map_guest_peripherals();
   vgic_init();
 
-  // vgic_connect_hwirq(153, 153);
-  // vgic_connect_hwirq(33, 33);
+  // vgic_connect_hwirq(current, 153, 153);
+  // vgic_connect_hwirq(current, 33, 33);
 }
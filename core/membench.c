@@ -0,0 +1,206 @@
+/*
+ *  memcpy/memset/memcmp microbenchmark
+ *  build with MEMBENCH=1 to run at boot
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "lib.h"
+#include "mm.h"
+#include "panic.h"
+#include "allocpage.h"
+#include "arch-timer.h"
+#include "printf.h"
+
+#define BENCH_BUF_ORDER   9     /* 2 MiB */
+
+/* correctness check: all src/dst offsets below CHECK_OFF, sizes up to CHECK_SIZE */
+#define CHECK_OFF     16
+#define CHECK_SIZE    300
+#define CHECK_GUARD   64
+#define CHECK_LEN     (CHECK_GUARD + CHECK_OFF + CHECK_SIZE + CHECK_GUARD)
+
+/* reference byte loops (former lib.c implementation) */
+static void *__attribute__((noinline)) byte_memcpy(void *dst, const void *src, u64 n) {
+  char *d = dst;
+  const char *s = src;
+
+  while(n-- > 0)
+    *d++ = *s++;
+
+  return dst;
+}
+
+static void *__attribute__((noinline)) byte_memset(void *dst, int c, u64 n) {
+  char *d = dst;
+
+  while(n-- > 0)
+    *d++ = c;
+
+  return dst;
+}
+
+static int __attribute__((noinline)) byte_memcmp(const void *b1, const void *b2, u64 n) {
+  const u8 *p1 = b1;
+  const u8 *p2 = b2;
+
+  while(n-- > 0) {
+    if(*p1 != *p2)
+      return *p1 - *p2;
+    p1++;
+    p2++;
+  }
+
+  return 0;
+}
+
+static int sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+static void check_fill(u8 *p, u8 seed) {
+  for(u64 i = 0; i < CHECK_LEN; i++)
+    p[i] = seed + i * 13;
+}
+
+/*
+ *  compare with the byte loops on unaligned buffers:
+ *  the bytes around the destination are compared too (guard)
+ */
+static void membench_check(u8 *buf) {
+  u8 *a = buf;
+  u8 *b = buf + CHECK_LEN;
+  u8 *r = buf + CHECK_LEN * 2;
+  u8 *tmp = buf + CHECK_LEN * 3;
+
+  check_fill(a, 0x11);
+
+  for(u64 so = 0; so < CHECK_OFF; so++) {
+    for(u64 dof = 0; dof < CHECK_OFF; dof++) {
+      for(u64 n = 0; n <= CHECK_SIZE; n++) {
+        u8 *s = a + CHECK_GUARD + so;
+        u64 d = CHECK_GUARD + dof;
+
+        /* memcpy */
+        check_fill(b, 0x5a);
+        check_fill(r, 0x5a);
+        memcpy(b + d, s, n);
+        byte_memcpy(r + d, s, n);
+        if(byte_memcmp(b, r, CHECK_LEN) != 0)
+          panic("membench: memcpy src+%d dst+%d size %d", so, dof, n);
+
+        /* memmove within one buffer: overlaps for small offsets */
+        check_fill(b, 0x5a);
+        check_fill(r, 0x5a);
+        memmove(b + d, b + CHECK_GUARD + so, n);
+        byte_memcpy(tmp, r + CHECK_GUARD + so, n);
+        byte_memcpy(r + d, tmp, n);
+        if(byte_memcmp(b, r, CHECK_LEN) != 0)
+          panic("membench: memmove src+%d dst+%d size %d", so, dof, n);
+
+        /* memcmp: equal, then one byte differs */
+        byte_memcpy(b + d, s, n);
+        if(memcmp(b + d, s, n) != 0)
+          panic("membench: memcmp src+%d dst+%d size %d", so, dof, n);
+
+        for(u64 i = 0; i < n; i += (i < 16 || i + 16 > n) ? 1 : 13) {
+          b[d + i] ^= 0x80;
+          if(sign(memcmp(b + d, s, n)) != sign(byte_memcmp(b + d, s, n)))
+            panic("membench: memcmp src+%d dst+%d size %d at %d", so, dof, n, i);
+          b[d + i] ^= 0x80;
+        }
+      }
+    }
+  }
+
+  for(u64 dof = 0; dof < CHECK_OFF; dof++) {
+    for(u64 n = 0; n <= CHECK_SIZE; n++) {
+      check_fill(b, 0x5a);
+      check_fill(r, 0x5a);
+      memset(b + CHECK_GUARD + dof, 0xc3, n);
+      byte_memset(r + CHECK_GUARD + dof, 0xc3, n);
+      if(byte_memcmp(b, r, CHECK_LEN) != 0)
+        panic("membench: memset dst+%d size %d", dof, n);
+    }
+  }
+
+  printf("membench: unaligned check ok\n");
+}
+
+/* MiB/s */
+static u32 throughput(u64 bytes, u64 ticks) {
+  u64 freq = read_sysreg(cntfrq_el0);
+
+  if(ticks == 0)
+    ticks = 1;
+
+  return (u32)(bytes * freq / ticks / (1024 * 1024));
+}
+
+static void bench_one(const char *name, u64 size, u8 *dst, u8 *src) {
+  u64 iter = (8 * 1024 * 1024) / size;
+  u64 t, i;
+  u64 copy, copy_ref, set, set_ref, cmp, cmp_ref;
+
+  t = now_cycles();
+  for(i = 0; i < iter; i++)
+    memcpy(dst, src, size);
+  copy = now_cycles() - t;
+
+  t = now_cycles();
+  for(i = 0; i < iter; i++)
+    byte_memcpy(dst, src, size);
+  copy_ref = now_cycles() - t;
+
+  t = now_cycles();
+  for(i = 0; i < iter; i++)
+    memset(dst, 0, size);
+  set = now_cycles() - t;
+
+  t = now_cycles();
+  for(i = 0; i < iter; i++)
+    byte_memset(dst, 0, size);
+  set_ref = now_cycles() - t;
+
+  memcpy(dst, src, size);
+
+  t = now_cycles();
+  for(i = 0; i < iter; i++)
+    if(memcmp(dst, src, size) != 0)
+      panic("membench: memcmp");
+  cmp = now_cycles() - t;
+
+  t = now_cycles();
+  for(i = 0; i < iter; i++)
+    if(byte_memcmp(dst, src, size) != 0)
+      panic("membench: byte_memcmp");
+  cmp_ref = now_cycles() - t;
+
+  printf("%s\tmemcpy %u (%u) MiB/s memset %u (%u) MiB/s memcmp %u (%u) MiB/s\n",
+         name,
+         throughput(size * iter, copy), throughput(size * iter, copy_ref),
+         throughput(size * iter, set), throughput(size * iter, set_ref),
+         throughput(size * iter, cmp), throughput(size * iter, cmp_ref));
+}
+
+void membench() {
+  u8 *src = alloc_pages(BENCH_BUF_ORDER);
+  u8 *dst = alloc_pages(BENCH_BUF_ORDER);
+
+  if(!src || !dst)
+    panic("membench: nomem");
+
+  for(u64 i = 0; i < (PAGESIZE << BENCH_BUF_ORDER); i++)
+    src[i] = i * 7;
+
+  membench_check(dst);
+
+  printf("membench: optimized (byte loop)\n");
+
+  bench_one("64B", 64, dst, src);
+  bench_one("4KB", 4096, dst, src);
+  bench_one("2MB", 2 * 1024 * 1024, dst, src);
+
+  free_pages(src, BENCH_BUF_ORDER);
+  free_pages(dst, BENCH_BUF_ORDER);
+}
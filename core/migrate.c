@@ -0,0 +1,371 @@
+/*
+ *  vcpu migration between nodes: a vcpu follows its working set
+ *
+ *  each vcpu counts its remote faults by the node which served the page.
+ *  when one node served most of them in a window, the vcpu moves there
+ *  at the end of the trap:
+ *
+ *    src node                          dst node              other nodes
+ *      save state, update cluster
+ *      table and retarget spis
+ *      ------- MSG_VCPU_MIGRATE ------->
+ *      leave the pcpu                  attach to a pcpu,
+ *                                      update cluster table
+ *      <----------- MSG_VCPU_MIGRATED (broadcast) ----------->
+ *
+ *  until MSG_VCPU_MIGRATED arrives, nodes may still route to the old node:
+ *  sgis and edge spis are forwarded, level spis are EOIed back to their
+ *  origin, mmio is answered with VMMIO_MOVED and psci with ALREADY_ON.
+ */
+
+#include "aarch64.h"
+#include "vcpu.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "node.h"
+#include "vgic.h"
+#include "msg.h"
+#include "sched.h"
+#include "atomic.h"
+#include "allocpage.h"
+#include "lib.h"
+#include "arch-timer.h"
+#include "spinlock.h"
+#include "printf.h"
+#include "log.h"
+#include "panic.h"
+
+/* remote faults are counted per window (usec) */
+#define MIGRATE_WINDOW_US       100000
+/* fewer remote faults in a window are not worth a migration */
+#define MIGRATE_MIN_FAULTS      64
+/* share of remote faults served by one node */
+#define MIGRATE_RATIO_PCT       75
+/* a vcpu stays on a node at least this long (usec) */
+#define MIGRATE_COOLDOWN_US     1000000
+
+int migrate_min_faults = MIGRATE_MIN_FAULTS;
+int migrate_ratio_pct = MIGRATE_RATIO_PCT;
+
+void vcpu_start(void);
+
+struct vcpu_migrate_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 vcpuid;
+  u64 vmpidr;
+  bool last;
+};
+
+struct vcpu_migrate_body {
+  u64 reg[34];      /* vcpu->reg: x0-x30, spsr, elr, sp */
+  struct vcpu_sysregs sys;
+  struct fpsimd_state fp;
+  struct gic_state gic;
+  struct pending_irqs pending;
+  struct vgic_cpu_state vgic;
+};
+
+struct vcpu_migrated_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 vcpuid;
+  u32 nodeid;
+};
+
+static spinlock_t migrate_lock = SPINLOCK_INIT;
+
+static u64 nmigrate_out;
+static u64 nmigrate_in;
+static u64 nmigrate_bounce;
+
+static bool migrate_has_room(int nodeid) {
+  return cluster_node(nodeid)->nvcpu < VCPU_PER_NODE_MAX;
+}
+
+/*
+ *  end of a window: pick the node which served most remote faults
+ */
+static void migrate_policy(struct vcpu *vcpu, u64 now) {
+  struct vcpu_migrate *m = &vcpu->migrate;
+  u64 elapsed = now - m->window_start;
+  u32 max = 0;
+  int dst = -1;
+
+  for(int i = 0; i < nr_cluster_nodes; i++) {
+    if(m->rfaults[i] > max) {
+      max = m->rfaults[i];
+      dst = i;
+    }
+  }
+
+  /* faults of a long idle period do not make a rate */
+  if(elapsed > 2 * usecs_to_ticks(MIGRATE_WINDOW_US))
+    goto reset;
+
+  if(dst < 0 || m->nrfaults < (u32)migrate_min_faults || now < m->cooldown_end)
+    goto reset;
+
+  if((u64)max * 100 < (u64)m->nrfaults * migrate_ratio_pct)
+    goto reset;
+
+  if(!migrate_has_room(dst))
+    goto reset;
+
+  m->dst = dst;
+  m->pending = true;
+
+reset:
+  memset(m->rfaults, 0, sizeof(m->rfaults));
+  m->nrfaults = 0;
+  m->window_start = now;
+}
+
+/*
+ *  vcpu waited for a page served by nodeid
+ */
+void vcpu_migrate_account(struct vcpu *vcpu, int nodeid) {
+  struct vcpu_migrate *m = &vcpu->migrate;
+  u64 now;
+
+  if(in_lazyirq() || nodeid >= NODE_MAX || nodeid == local_nodeid())
+    return;
+
+  m->rfaults[nodeid]++;
+  m->nrfaults++;
+
+  now = now_cycles();
+
+  if(now - m->window_start >= usecs_to_ticks(MIGRATE_WINDOW_US))
+    migrate_policy(vcpu, now);
+}
+
+/*
+ *  move current to dst: the state of vcpu goes with MSG_VCPU_MIGRATE
+ *  and this pcpu never returns to it
+ */
+static void vcpu_migrate(struct vcpu *vcpu, int dst) {
+  struct vcpu_migrate_hdr hdr;
+  struct vcpu_migrate_body *b;
+  struct msg msg;
+  int vcpuid = vcpu->vcpuid;
+
+  b = alloc_page();
+  if(!b)
+    return;
+
+  local_irq_disable();
+
+  vmm_log("migrate: vcpu%d node%d -> node%d\n", vcpuid, local_nodeid(), dst);
+
+  vcpu_save_state(vcpu);
+  vgic_cpu_export(vcpu, &b->vgic);
+
+  /* from now on irqs for vcpuid are routed to dst */
+  vcpu->vcpuid = -1;
+  cluster_move_vcpu(vcpuid, dst);
+  vgic_retarget_spis();
+
+  memcpy(b->reg, &vcpu->reg, sizeof(vcpu->reg));
+  b->sys = vcpu->sys;
+  b->fp = vcpu->fp;
+  b->gic = vcpu->gic;
+
+  for(int i = 0; i < VIRQ_MAX / 64; i++)
+    b->pending.bitmap[i] = atomic_xchg64(&vcpu->pending.bitmap[i], 0);
+
+  hdr.vcpuid = vcpuid;
+  hdr.vmpidr = vcpu->vmpidr;
+  hdr.last = vcpu->last;
+
+  msg_init(&msg, dst, MSG_VCPU_MIGRATE, &hdr, b, sizeof(*b));
+
+  send_msg(&msg);
+
+  free_page(b);
+
+  nmigrate_out++;
+
+  sched_exit();
+}
+
+/*
+ *  called at the end of a trap, before returning to guest
+ */
+void vcpu_migrate_check(struct vcpu *vcpu) {
+  struct vcpu_migrate *m = &vcpu->migrate;
+
+  if(!m->pending)
+    return;
+
+  m->pending = false;
+
+  if(!all_node_is_active() || !migrate_has_room(m->dst) || m->dst == local_nodeid())
+    return;
+
+  m->cooldown_end = now_cycles() + usecs_to_ticks(MIGRATE_COOLDOWN_US);
+
+  vcpu_migrate(vcpu, m->dst);
+}
+
+/* vcpus of this node are spread over pcpus running their scheduler */
+static struct pcpu *migrate_pick_pcpu() {
+  struct pcpu *first = get_cpu(pcpu_base());
+  struct pcpu *best = NULL;
+
+  for(struct pcpu *cpu = first; cpu < &first[nr_online_pcpus]; cpu++) {
+    if(!cpu->wakeup)
+      continue;
+
+    if(!best || cpu->rq.nvcpu < best->rq.nvcpu)
+      best = cpu;
+  }
+
+  return best ? best : first;
+}
+
+/*
+ *  slot left by a migrated vcpu (once it is off its stack), or a new one.
+ *  migrate_lock held.
+ */
+static struct vcpu *migrate_alloc_slot(bool *new) {
+  for(struct vcpu *v = localvm.vcpus; v < &localvm.vcpus[localvm.nvcpu]; v++) {
+    if(v->vcpuid < 0 && !v->initialized) {
+      *new = false;
+      return v;
+    }
+  }
+
+  if(localvm.nvcpu < VCPU_PER_NODE_MAX) {
+    *new = true;
+    return &localvm.vcpus[localvm.nvcpu];
+  }
+
+  return NULL;
+}
+
+/* first run of an arrived vcpu on its new pcpu */
+static void migrate_entry() {
+  vgic_cpu_enable_ppis(current);
+
+  vcpu_start();
+}
+
+static void broadcast_vcpu_migrated(int vcpuid) {
+  struct msg msg;
+  struct vcpu_migrated_hdr hdr;
+
+  hdr.vcpuid = vcpuid;
+  hdr.nodeid = local_nodeid();
+
+  msg_init(&msg, 0, MSG_VCPU_MIGRATED, &hdr, NULL, 0);
+
+  send_msg_bcast(&msg);
+}
+
+static void recv_vcpu_migrate_intr(struct msg *msg) {
+  struct vcpu_migrate_hdr *h = (struct vcpu_migrate_hdr *)msg->hdr;
+  struct vcpu_migrate_body *b = msg->body;
+  struct vcpu *vcpu;
+  u64 flags, now;
+  bool new;
+
+  if(!b || msg->body_len < sizeof(*b))
+    panic("migrate: vcpu%d without state", h->vcpuid);
+  if(node_vcpu(h->vcpuid))
+    panic("migrate: vcpu%d already in this node", h->vcpuid);
+
+  spin_lock_irqsave(&migrate_lock, flags);
+
+  vcpu = migrate_alloc_slot(&new);
+  if(!vcpu) {
+    struct vcpu_migrate_hdr hdr = *h;
+    struct msg m;
+
+    spin_unlock_irqrestore(&migrate_lock, flags);
+
+    /* no room: send it back, its MSG_VCPU_MIGRATED fixes the tables */
+    vmm_warn("migrate: no slot for vcpu%d, bounce to node%d\n", hdr.vcpuid, h->hdr.src_id);
+
+    msg_init(&m, h->hdr.src_id, MSG_VCPU_MIGRATE, &hdr, b, sizeof(*b));
+    send_msg(&m);
+
+    nmigrate_bounce++;
+    goto out;
+  }
+
+  vcpu->pcpu = migrate_pick_pcpu();
+  memset(&vcpu->pending, 0, sizeof(vcpu->pending));
+
+  vcpu->vcpuid = h->vcpuid;
+  vcpu->vmpidr = h->vmpidr;
+  vcpu->last = h->last;
+
+  vgic_cpu_init(vcpu);
+  vgic_cpu_import(vcpu, &b->vgic);
+
+  memcpy(&vcpu->reg, b->reg, sizeof(vcpu->reg));
+  vcpu->sys = b->sys;
+  vcpu->fp = b->fp;
+  vcpu->gic = b->gic;
+
+  /* irqs may have been injected since vcpuid was set */
+  for(int i = 0; i < VIRQ_MAX / 64; i++)
+    atomic_or64(&vcpu->pending.bitmap[i], b->pending.bitmap[i]);
+
+  vcpu->reply_buf = NULL;
+  memset(&vcpu->idle, 0, sizeof(vcpu->idle));
+  memset(&vcpu->migrate, 0, sizeof(vcpu->migrate));
+  memset(&vcpu->flat, 0, sizeof(vcpu->flat));
+  memset(&vcpu->exit, 0, sizeof(vcpu->exit));
+
+  now = now_cycles();
+  vcpu->migrate.window_start = now;
+  vcpu->migrate.cooldown_end = now + usecs_to_ticks(MIGRATE_COOLDOWN_US);
+
+  vcpu->initialized = true;
+  vcpu->online = true;
+
+  if(new) {
+    dsb(ish);
+    localvm.nvcpu++;
+  }
+
+  sched_attach(vcpu, migrate_entry);
+
+  spin_unlock_irqrestore(&migrate_lock, flags);
+
+  vmm_log("migrate: vcpu%d arrived from node%d on cpu%d\n",
+          vcpu->vcpuid, h->hdr.src_id, pcpu_id(vcpu->pcpu));
+
+  nmigrate_in++;
+
+  cluster_move_vcpu(vcpu->vcpuid, local_nodeid());
+  vgic_retarget_spis();
+
+  broadcast_vcpu_migrated(vcpu->vcpuid);
+
+out:
+  free_page(b);
+}
+
+static void recv_vcpu_migrated_intr(struct msg *msg) {
+  struct vcpu_migrated_hdr *h = (struct vcpu_migrated_hdr *)msg->hdr;
+
+  cluster_move_vcpu(h->vcpuid, h->nodeid);
+  vgic_retarget_spis();
+}
+
+void vcpu_migrate_stats() {
+  printf("vcpu migrate stats: out %d in %d bounce %d\n",
+         nmigrate_out, nmigrate_in, nmigrate_bounce);
+
+  for(struct vcpu *vcpu = localvm.vcpus; vcpu < &localvm.vcpus[localvm.nvcpu]; vcpu++) {
+    if(vcpu->vcpuid < 0)
+      continue;
+
+    printf("vcpu%d: remote faults %d in current window\n",
+           vcpu->vcpuid, vcpu->migrate.nrfaults);
+  }
+}
+
+DEFINE_POCV2_MSG(MSG_VCPU_MIGRATE, struct vcpu_migrate_hdr, recv_vcpu_migrate_intr);
+DEFINE_POCV2_MSG(MSG_VCPU_MIGRATED, struct vcpu_migrated_hdr, recv_vcpu_migrated_intr);
@@ -14,6 +14,7 @@
 #include "assert.h"
 #include "fdt.h"
 #include "localnode.h"
+#include "partition.h"
 
 u64 vmm_pagetable[512] __aligned(4096);
 
@@ -201,8 +202,6 @@ void *iomap(u64 pa, u64 size) {
 }
 
 void dump_par_el1(u64 par) {
-  u32 fst;
-
   if(par & 1) {
     u32 fst = (par >> 1) & 0x3f;
 
@@ -218,7 +217,7 @@ void dump_par_el1(u64 par) {
 u64 at_hva2pa(u64 hva) {
   u64 tmp = read_sysreg(par_el1);
 
-  asm volatile ("at s1e2r, %0" :: "r"(hva));
+  do_at_trans(hva, s1, e2, r);
 
   u64 par = read_sysreg(par_el1);
 
@@ -234,7 +233,7 @@ u64 at_hva2pa(u64 hva) {
 
 static void *remap_fdt(u64 fdt_phys) {
   u64 memflags = PTE_NORMAL | PTE_RO | PTE_XN;
-  u64 offset, size, fdt_base;
+  u64 offset, fdt_base;
   int rc;
   void *fdt;
 
@@ -247,14 +246,16 @@ static void *remap_fdt(u64 fdt_phys) {
 
   fdt = (void *)(FDT_SECTION_BASE + offset);
 
+  /* a node in a partition of a shared machine: x0 is its boot block */
+  if(partition_probe(fdt))
+    fdt = (void *)(FDT_SECTION_BASE + (partition.fdt & (BLOCKSIZE_L2 - 1)));
+
   if(fdt_magic(fdt) != FDT_MAGIC)
     return NULL;
 
   if(fdt_version(fdt) != 17)
     return NULL;
 
-  size = fdt_totalsize(fdt);
-
   return fdt;
 }
 
@@ -391,6 +392,7 @@ void *setup_pagetable(u64 fdt_base) {
   virt_fdt = remap_fdt(fdt_base);
 
   device_tree_init(virt_fdt);
+  partition_init(virt_fdt);
   printf("map memory");
   map_memory();
 
@@ -16,14 +16,16 @@
 #include "malloc.h"
 #include "panic.h"
 #include "assert.h"
+#include "sched.h"
+#include "arch-timer.h"
 
 #define USE_SCATTER_GATHER
 
-extern struct msg_size_data __msg_size_data_start[];
-extern struct msg_size_data __msg_size_data_end[];
+extern const struct msg_size_data __msg_size_data_start[];
+extern const struct msg_size_data __msg_size_data_end[];
 
-extern struct msg_handler_data __msg_handler_data_start[];
-extern struct msg_handler_data __msg_handler_data_end[];
+extern const struct msg_handler_data __msg_handler_data_start[];
+extern const struct msg_handler_data __msg_handler_data_end[];
 
 static struct msg_data msg_data[NUM_MSG];
 
@@ -47,6 +49,8 @@ static char *msmap[NUM_MSG] = {
   [MSG_SGI]             "msg:sgi",
   [MSG_PANIC]           "msg:panic",
   [MSG_BOOT_SIG]        "msg:boot_sig",
+  [MSG_VCPU_MIGRATE]    "msg:vcpu_migrate",
+  [MSG_VCPU_MIGRATED]   "msg:vcpu_migrated",
 };
 
 static inline u32 msg_hdr_size(struct msg *msg) {
@@ -91,23 +95,29 @@ static void msg_enqueue(struct msg_queue *q, struct msg *msg) {
   spin_unlock_irqrestore(&q->lock, flags); 
 }
 
-static struct msg *msg_dequeue(struct msg_queue *q) {
+static int msg_queue_depth(struct msg_queue *q) {
+  struct msg *m;
+  int n = 0;
   u64 flags;
 
-  while(msg_queue_empty(q))
-    wfi();
+  spin_lock_irqsave(&q->lock, flags);
 
-  spin_lock_irqsave(&q->lock, flags); 
+  for(m = q->head; m; m = m->next)
+    n++;
+
+  spin_unlock_irqrestore(&q->lock, flags);
 
-  struct msg *msg = q->head;
-  q->head = q->head->next;
+  return n;
+}
 
-  if(!q->head)
-    q->tail = NULL;
+/* msgs received and not handled yet */
+void msg_stats() {
+  struct pcpu *cpu;
 
-  spin_unlock_irqrestore(&q->lock, flags); 
+  printf("msg stats\n");
 
-  return msg;
+  foreach_up_cpu(cpu)
+    printf("cpu%d: recv waitqueue %d\n", cpu - pcpus, msg_queue_depth(&cpu->recv_waitq));
 }
 
 void msg_free(struct msg *msg) {
@@ -118,10 +128,15 @@ void msg_free(struct msg *msg) {
   free(msg);
 }
 
+/* reply to the vcpu which sent the request */
 static void set_reply_buf(struct msg *reply) {
-  assert(!current->reply_buf);
+  struct vcpu *vcpu = local_vcpu(msg_cpu(reply));
 
-  current->reply_buf = reply;
+  assert(!vcpu->reply_buf);
+
+  vcpu->reply_buf = reply;
+
+  sched_wakeup(vcpu);
 }
 
 void do_recv_waitqueue() {
@@ -162,7 +177,7 @@ restart:
     handler = msg_data[type].recv_handler;
 
     if(handler) {     // normal msg type
-      vmm_log("msg handle %p %s %p\n", m, msmap[type], m->hdr->connectionid);
+      vmm_clog(LC_MSG, "msg handle %p %s %p\n", m, msmap[type], m->hdr->connectionid);
       handler(m);
 
       msg_free(m);
@@ -193,6 +208,7 @@ int msg_recv(u8 *src_mac, struct iobuf *buf) {
   struct msg_header *hdr = buf->data;
   msg->hdr = hdr;
   msg->data = buf;
+  msg->recv_stamp = now_cycles();
 
   // printf("msg recv %d %p\n", buf->len);
   // bin_dump(buf->data, 128);
@@ -210,14 +226,13 @@ int msg_recv(u8 *src_mac, struct iobuf *buf) {
   if(body) {
     msg->body_len = body_len;
 
-    vmm_log("recv %d len\n", body_len);
+    vmm_clog(LC_MSG, "recv %d len\n", body_len);
     msg->body = alloc_page();
     memcpy(msg->body, body, body_len);
   }
 
   if(msg_type_is_reply(msg)) {
-    int id = msg_cpu(msg);
-    struct pcpu *cpu = get_cpu(id);
+    struct pcpu *cpu = local_vcpu(msg_cpu(msg))->pcpu;
 
     msg_enqueue(&cpu->recv_waitq, msg);
 
@@ -288,6 +303,10 @@ void __send_msg(struct msg *msg, void (*reply_cb)(struct msg *, void *),
   struct iobuf *buf = alloc_iobuf_headsize(64, sizeof(struct etherheader));
   u16 type = POCV2_MSG_ETH_PROTO | (msg->hdr->type << 8);
 
+  /* route the reply to this vcpu: it may give up the pcpu while waiting */
+  if(reply_cb)
+    msg->hdr->connectionid = (msg_connid(msg) & ~0x7) | vcpu_slot(current);
+
   memcpy((u8 *)buf->data, msg->hdr, msg_hdr_size(msg));
 
   if(msg->body) {
@@ -304,7 +323,7 @@ void __send_msg(struct msg *msg, void (*reply_cb)(struct msg *, void *),
     struct msg *reply;
     
     while((reply = current->reply_buf) == NULL) {
-      wfi();
+      sched_wait();
     }
     current->reply_buf = NULL;
 
@@ -314,8 +333,8 @@ void __send_msg(struct msg *msg, void (*reply_cb)(struct msg *, void *),
 }
 
 void msg_sysinit() {
-  struct msg_size_data *sd;
-  struct msg_handler_data *hd;
+  const struct msg_size_data *sd;
+  const struct msg_handler_data *hd;
 
   for(sd = __msg_size_data_start; sd < __msg_size_data_end; sd++) {
     printf("pocv2-msg found: %s(%d) sizeof %d\n", msmap[sd->type], sd->type, sd->msg_hdr_size);
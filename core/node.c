@@ -69,11 +69,14 @@ static int __node0 alloc_vcpuid() {
 }
 
 static void setup_vsm_memrange(struct memrange *m, u64 alloc) {
-  static u64 ram_start = 0x40000000;
+  static u64 ram_start = GVM_RAM_BASE;
   u64 flags = 0;
 
   irqsave(flags);
 
+  if(ram_start + alloc > GVM_RAM_BASE + GVM_MEMORY_MAX)
+    panic("vsm: too much memory %p", ram_start + alloc - GVM_RAM_BASE);
+
   m->start = ram_start;
   m->size = alloc;
 
@@ -282,6 +285,39 @@ void node_cluster_dump() {
   }
 }
 
+/*
+ *  vcpuid migrated to nodeid: update the cluster table of this node
+ */
+void cluster_move_vcpu(int vcpuid, int nodeid) {
+  static spinlock_t cluster_lock = SPINLOCK_INIT;
+  struct cluster_node *dst = cluster_node(nodeid);
+  struct cluster_node *src;
+  u64 flags;
+
+  spin_lock_irqsave(&cluster_lock, flags);
+
+  src = vcpuid_to_node(vcpuid);
+  if(src == dst)
+    goto out;
+
+  if(src) {
+    for(int i = 0; i < src->nvcpu; i++) {
+      if(src->vcpus[i] == vcpuid) {
+        src->vcpus[i] = src->vcpus[--src->nvcpu];
+        break;
+      }
+    }
+  }
+
+  if(dst->nvcpu < VCPU_PER_NODE_MAX)
+    dst->vcpus[dst->nvcpu++] = vcpuid;
+  else
+    vmm_warn("cluster: node%d has no room for vcpu%d\n", nodeid, vcpuid);
+
+out:
+  spin_unlock_irqrestore(&cluster_lock, flags);
+}
+
 static void __node0 broadcast_init_request() {
   printf("broadcast init request");
   struct msg msg;
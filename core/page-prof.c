@@ -0,0 +1,277 @@
+/*
+ *  per-page vsm hot spots and sharing patterns
+ *
+ *  a side table hashed by ipa counts the faults of each local vcpu (and
+ *  the 64 byte blocks it wrote), the invalidations, ownership moves and
+ *  page copies of this node.  counters are not atomic: a page hit by two
+ *  pcpus at once may lose a count, they only rank pages.
+ *
+ *  the class printed is of this node's view, tools/pageprof merges the
+ *  dumps of all nodes and classifies again with all vcpus:
+ *
+ *    pageprof: begin node <id> npage <n> ndrop <n>
+ *    pp <ipa> <nread> <nwrite> <ninv> <nown_in> <nown_out> <nserve> <sent> <nother> <class>
+ *    ppv <ipa> <vcpuid> <nread> <nwrite> <wblocks>     (hex: ipa wblocks)
+ *    pageprof: end node <id>
+ *
+ *  built with PAGE_PROF only (make PAGEPROF=1).
+ */
+
+#include "aarch64.h"
+#include "page-prof.h"
+#include "vcpu.h"
+#include "localnode.h"
+#include "mm.h"
+#include "atomic.h"
+#include "arch-timer.h"
+#include "log.h"
+#include "printf.h"
+
+#if PAGE_PROF
+
+#define PAGEPROF_TOP_MAX  64
+
+static struct page_prof pprof[PAGEPROF_NENT];
+static u64 npage, ndrop;
+static u64 last_report;
+
+static const char *page_class_name[NR_PAGE_CLASS] = {
+  [PC_PRIVATE]      "private",
+  [PC_READ_SHARED]  "read-shared",
+  [PC_PROD_CONS]    "producer-consumer",
+  [PC_MIGRATORY]    "migratory",
+  [PC_FALSE_SHARED] "false-shared",
+};
+
+static struct page_prof *page_prof_get(u64 ipa) {
+  /* fibonacci hashing of the page number */
+  u64 h = ((ipa >> PAGESHIFT) * 0x9e3779b97f4a7c15ul) >> 32;
+
+  for(int i = 0; i < PAGEPROF_PROBE; i++) {
+    struct page_prof *p = &pprof[(h + i) & (PAGEPROF_NENT - 1)];
+    u64 cur = load_acquire64(&p->ipa);
+
+    if(cur == 0 && (cur = atomic_cmpxchg64(&p->ipa, 0, ipa)) == 0) {
+      npage++;
+      return p;
+    }
+
+    if(cur == ipa)
+      return p;
+  }
+
+  ndrop++;
+  return NULL;
+}
+
+static struct page_prof_vcpu *page_prof_vcpu(struct page_prof *p, int vcpuid) {
+  for(struct page_prof_vcpu *v = p->v; v < &p->v[PAGEPROF_NVCPU]; v++) {
+    u64 cur = load_acquire64(&v->vcpuid);
+
+    if(cur == 0 && (cur = atomic_cmpxchg64(&v->vcpuid, 0, vcpuid + 1)) == 0)
+      return v;
+
+    if(cur == (u64)vcpuid + 1)
+      return v;
+  }
+
+  return NULL;
+}
+
+static u64 page_heat(struct page_prof *p) {
+  return p->nread + p->nwrite + p->ninv + p->nown_in + p->nown_out + p->nserve;
+}
+
+/*
+ *  false sharing: each writer keeps to its own blocks, and wrote one of
+ *  them twice at least (else it may write all over the page).  other
+ *  nodes count as one vcpu each way: a served copy is read there, an
+ *  invalidation or lost ownership is a write there (blocks unknown).
+ */
+static enum page_class page_class(struct page_prof *p) {
+  int nacc = 0, nwriter = 0;
+  bool overlap = false;
+  u64 blocks = 0;
+
+  for(struct page_prof_vcpu *v = p->v; v < &p->v[PAGEPROF_NVCPU] && v->vcpuid; v++) {
+    nacc++;
+
+    if(v->nwrite) {
+      nwriter++;
+      overlap |= !!(blocks & v->wblocks) || v->nwrite <= (u32)__builtin_popcountl(v->wblocks);
+      blocks |= v->wblocks;
+    }
+  }
+
+  if(p->nother)
+    nacc++;
+  if(p->nserve)
+    nacc++;
+  if(p->ninv || p->nown_out) {
+    nacc++;
+    nwriter++;
+    overlap = true;
+  }
+
+  if(nacc <= 1)
+    return PC_PRIVATE;
+  if(nwriter == 0)
+    return PC_READ_SHARED;
+  if(nwriter == 1)
+    return PC_PROD_CONS;
+  if(!overlap)
+    return PC_FALSE_SHARED;
+
+  return PC_MIGRATORY;
+}
+
+static void page_prof_print(struct page_prof *p, int (*pr)(const char *, ...)) {
+  pr("pp %x %u %u %u %u %u %u %d %u %s\n", p->ipa, p->nread, p->nwrite, p->ninv,
+     p->nown_in, p->nown_out, p->nserve, p->sent, p->nother, page_class_name[page_class(p)]);
+
+  for(struct page_prof_vcpu *v = p->v; v < &p->v[PAGEPROF_NVCPU] && v->vcpuid; v++)
+    pr("ppv %x %d %u %u %x\n", p->ipa, (int)v->vcpuid - 1, v->nread, v->nwrite, v->wblocks);
+}
+
+/* n hottest pages, all pages if n <= 0 */
+static void __page_prof_report(int n, int (*pr)(const char *, ...)) {
+  struct page_prof *top[PAGEPROF_TOP_MAX];
+  int ntop = 0;
+
+  pr("pageprof: begin node %d npage %d ndrop %d\n", local_nodeid(), npage, ndrop);
+
+  for(struct page_prof *p = pprof; p < &pprof[PAGEPROF_NENT]; p++) {
+    u64 heat;
+    int i;
+
+    if(!p->ipa)
+      continue;
+
+    if(n <= 0) {
+      page_prof_print(p, pr);
+      continue;
+    }
+
+    /* insertion into top[], hottest first */
+    heat = page_heat(p);
+
+    for(i = ntop; i > 0 && page_heat(top[i - 1]) < heat; i--) {
+      if(i < n)
+        top[i] = top[i - 1];
+    }
+
+    if(i < n) {
+      top[i] = p;
+      if(ntop < n)
+        ntop++;
+    }
+  }
+
+  for(int i = 0; i < ntop; i++)
+    page_prof_print(top[i], pr);
+
+  pr("pageprof: end node %d\n", local_nodeid());
+}
+
+static int page_log(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  log_cat_vprintf(LC_PAGE, LLOG, fmt, ap);
+  va_end(ap);
+
+  return 0;
+}
+
+/* periodic report into the log ring of this pcpu: called by idle pcpus */
+void __page_prof_tick() {
+  u64 now, last;
+
+  if(likely(log_cat_level[LC_PAGE] < LLOG))
+    return;
+
+  now = now_cycles();
+  last = last_report;
+
+  if(now - last < usecs_to_ticks(PAGEPROF_PERIOD_US))
+    return;
+
+  /* one pcpu reports */
+  if(atomic_cmpxchg64(&last_report, last, now) != last)
+    return;
+
+  __page_prof_report(PAGEPROF_TOP, page_log);
+}
+
+/* a vsm fault of vcpu: ipa with offset */
+void __page_prof_fault(struct vcpu *vcpu, u64 ipa, bool wnr) {
+  struct page_prof *p = page_prof_get(PAGE_ADDRESS(ipa));
+  struct page_prof_vcpu *v;
+
+  if(!p)
+    return;
+
+  if(wnr)
+    p->nwrite++;
+  else
+    p->nread++;
+
+  if((v = page_prof_vcpu(p, vcpu->vcpuid)) != NULL) {
+    if(wnr) {
+      v->nwrite++;
+      v->wblocks |= 1ul << (PAGE_OFFSET(ipa) / 64);
+    } else {
+      v->nread++;
+    }
+  } else {
+    p->nother++;
+  }
+}
+
+/* protocol events of a page on this node, sent: page bytes sent */
+void __page_prof_event(u64 ipa, enum page_prof_event ev, u64 sent) {
+  struct page_prof *p = page_prof_get(PAGE_ADDRESS(ipa));
+
+  if(!p)
+    return;
+
+  switch(ev) {
+    case PP_INV:
+      p->ninv++;
+      break;
+    case PP_OWN_IN:
+      p->nown_in++;
+      break;
+    case PP_OWN_OUT:
+      p->nown_out++;
+      break;
+    case PP_SERVE:
+      p->nserve++;
+      break;
+  }
+
+  p->sent += sent;
+}
+
+void page_prof_report(int n) {
+  if(n > PAGEPROF_TOP_MAX)
+    n = PAGEPROF_TOP_MAX;
+
+  __page_prof_report(n, printf);
+}
+
+void page_prof_dump() {
+  __page_prof_report(0, printf);
+}
+
+#else
+
+void page_prof_report(int __unused n) {
+  printf("pageprof: not built in (make PAGEPROF=1)\n");
+}
+
+void page_prof_dump() {
+  page_prof_report(0);
+}
+
+#endif  /* PAGE_PROF */
@@ -9,6 +9,11 @@
 #include "memlayout.h"
 #include "irq.h"
 #include "vsm-log.h"
+#include "fault-lat.h"
+#include "exit-stat.h"
+#include "tlb.h"
+#include "sched.h"
+#include "vmmio.h"
 
 volatile int panicked_context = 0;
 
@@ -68,7 +73,14 @@ void panic(const char *fmt, ...) {
   buddydump();
   system_memory_dump();
 
-  irqstats();
+  exit_stat_dump();
+  tlb_s2_stats_dump();
+  vcpu_idle_stats();
+  sched_stats();
+  vcpu_migrate_stats();
+  vmmio_stats();
+  fault_lat_dump();
+  vsm_trace_dump(64);
 
   vcpu_dump(current);
   node_cluster_dump();
@@ -0,0 +1,216 @@
+/*
+ *  several nodes in one machine
+ *
+ *  node0 is booted by the machine with "pocv2.nodes=<n> pocv2.part=<MB>"
+ *  in /chosen/bootargs.  it keeps the first partition of RAM and the
+ *  first NCPU pcpus, and boots node k on pcpu k * NCPU from the vmm image
+ *  loaded at PARTITION_IMAGE_OFFSET of partition k.  x0 of that pcpu is
+ *  the boot block of node k in shm, found by remap_fdt() (core/mm.c).
+ *  nodes talk through drivers/shmnet.c instead of a nic.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "partition.h"
+#include "shmnet.h"
+#include "memory.h"
+#include "memlayout.h"
+#include "device.h"
+#include "fdt.h"
+#include "psci.h"
+#include "mm.h"
+#include "lib.h"
+#include "log.h"
+#include "panic.h"
+
+struct partition partition;
+
+/* fdt of the machine mapped by remap_fdt() */
+static void *machine_fdt;
+
+static u64 shm_rings_size(int nparts) {
+  return sizeof(struct shmnet_ring) * nparts;
+}
+
+/* "key=<decimal>" in bootargs */
+static bool bootarg_num(const char *args, const char *key, u64 *val) {
+  u64 klen = strlen(key);
+  const char *p = args;
+
+  while(p) {
+    if(strncmp(p, key, klen) == 0 && p[klen] == '=') {
+      u64 n = 0;
+
+      for(p += klen + 1; '0' <= *p && *p <= '9'; p++)
+        n = n * 10 + (*p - '0');
+
+      *val = n;
+      return true;
+    }
+
+    p = strchr(p, ' ');
+    if(p)
+      p++;
+  }
+
+  return false;
+}
+
+static int nr_dt_cpus() {
+  struct device_node *cpu;
+  int n = 0;
+
+  for(cpu = dt_next_cpu_device(NULL); cpu; cpu = dt_next_cpu_device(cpu))
+    n++;
+
+  return n;
+}
+
+static bool node0_layout() {
+  struct device_node *chosen = dt_find_node_path("/chosen");
+  const char *args;
+  u64 nodes, part_mb, part, base, end;
+  int ncpu;
+
+  if(!chosen)
+    return false;
+
+  args = dt_node_props(chosen, "bootargs");
+  if(!args)
+    return false;
+
+  if(!bootarg_num(args, "pocv2.nodes", &nodes) || !bootarg_num(args, "pocv2.part", &part_mb))
+    return false;
+
+  if(nodes < 2 || nodes > PARTITION_MAX)
+    panic("partition: pocv2.nodes=%d", nodes);
+  if(nodes != NR_NODE)
+    panic("partition: %d nodes, built for %d", nodes, NR_NODE);
+
+  part = part_mb << 20;
+  if(part == 0 || part % SZ_2MiB != 0)
+    panic("partition: pocv2.part=%d", part_mb);
+
+  if(system_memory.nslot != 1)
+    panic("partition: %d memory slots", system_memory.nslot);
+
+  ncpu = nr_dt_cpus();
+  /* pcpus[], _stack and per-cpu tables are indexed by cpuid() */
+  if(ncpu > NCPU_MAX)
+    panic("partition: %d cpus, NCPU_MAX %d", ncpu, NCPU_MAX);
+  if(ncpu % nodes != 0)
+    panic("partition: %d cpus for %d nodes", ncpu, nodes);
+
+  base = system_memory_base();
+  end = system_memory_end();
+
+  if(base + nodes * part + PARTITION_SHM_RINGS + shm_rings_size(nodes) > end)
+    panic("partition: no room for shm");
+
+  partition.enabled = true;
+  partition.index = 0;
+  partition.nparts = nodes;
+  partition.cpu_base = 0;
+  partition.ncpu = ncpu / nodes;
+  partition.mem_start = base;
+  partition.mem_size = part;
+  partition.shm_start = base + nodes * part;
+  partition.shm_size = end - partition.shm_start;
+  partition.fdt = partition.shm_start + PARTITION_SHM_FDT;
+
+  return true;
+}
+
+/* called from remap_fdt(): boot points to x0 of this pcpu */
+bool partition_probe(void *boot) {
+  struct partition_boot *b = boot;
+
+  if(b->magic != PARTITION_BOOT_MAGIC)
+    return false;
+
+  /* remap_fdt() maps only the 2MB block of x0 */
+  if(ALIGN_DOWN(b->fdt, SZ_2MiB) != ALIGN_DOWN(b->shm_start, SZ_2MiB))
+    panic("partition: fdt %p out of shm", b->fdt);
+
+  partition.enabled = true;
+  partition.index = b->index;
+  partition.nparts = b->nparts;
+  partition.cpu_base = b->cpu_base;
+  partition.ncpu = b->ncpu;
+  partition.mem_start = b->mem_start;
+  partition.mem_size = b->mem_size;
+  partition.shm_start = b->shm_start;
+  partition.shm_size = b->shm_size;
+  partition.fdt = b->fdt;
+
+  return true;
+}
+
+/* system_memory is of the whole machine here */
+void partition_init(void *fdt) {
+  machine_fdt = fdt;
+
+  if(!partition.enabled && !node0_layout())
+    return;
+
+  system_memory.nslot = 0;
+  system_memory.allsize = 0;
+
+  system_memory_reg(partition.mem_start, partition.mem_size);
+  system_memory_reg(partition.shm_start, partition.shm_size);
+
+  /* never given to the page allocator */
+  system_memory_reserve(partition.shm_start, partition.shm_start + partition.shm_size, "shm");
+
+  vmm_log("partition: node%d/%d cpu%d-%d mem [%p - %p) shm %p\n",
+          partition.index, partition.nparts, partition.cpu_base,
+          partition.cpu_base + partition.ncpu - 1, partition.mem_start,
+          partition.mem_start + partition.mem_size, partition.shm_start);
+}
+
+static void boot_node(int k) {
+  struct partition_boot *b = partition_shm(PARTITION_SHM_BOOT(k));
+  u64 mem_start = partition.mem_start + k * partition.mem_size;
+  u64 image = mem_start + PARTITION_IMAGE_OFFSET;
+  u64 *head;
+  int cpu = k * partition.ncpu;
+
+  head = iomap(image, PAGESIZE);
+  if(!head || head[1] != VMM_IMAGE_MAGIC)
+    panic("partition: no vmm image at %p", image);
+
+  b->magic = PARTITION_BOOT_MAGIC;
+  b->index = k;
+  b->nparts = partition.nparts;
+  b->cpu_base = cpu;
+  b->ncpu = partition.ncpu;
+  b->mem_start = mem_start;
+  b->mem_size = partition.mem_size;
+  b->shm_start = partition.shm_start;
+  b->shm_size = partition.shm_size;
+  b->fdt = partition.fdt;
+
+  vmm_log("partition: boot node%d on cpu%d @%p\n", k, cpu, image);
+
+  if(psci_cpu_on(cpu, image, partition.shm_start + PARTITION_SHM_BOOT(k)) < 0)
+    panic("partition: node%d cpu%d", k, cpu);
+}
+
+/* node0: after psci_init() and shmnet_init() */
+void partition_boot_nodes() {
+  void *fdt = partition_shm(PARTITION_SHM_FDT);
+  u64 size;
+
+  if(!partition.enabled || partition.index != 0)
+    return;
+
+  size = fdt_totalsize(machine_fdt);
+
+  if(PARTITION_SHM_FDT + size > PARTITION_SHM_RINGS)
+    panic("partition: fdt too large %p", size);
+
+  memcpy(fdt, machine_fdt, size);
+
+  for(int k = 1; k < partition.nparts; k++)
+    boot_node(k);
+}
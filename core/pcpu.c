@@ -7,11 +7,13 @@
 #include "panic.h"
 #include "gic.h"
 #include "msg.h"
+#include "shmnet.h"
+#include "partition.h"
 #include "lib.h"
 
 struct pcpu pcpus[NCPU_MAX];
 char _stack[PAGESIZE*NCPU_MAX] __aligned(PAGESIZE);
-static int nr_online_pcpus;
+int nr_online_pcpus;
 static bool disallow_mp;
 
 extern const struct cpu_enable_method psci;
@@ -21,6 +23,7 @@ enum sgi_id {
   SGI_INJECT,
   SGI_STOP,
   SGI_DO_RECVQ,
+  SGI_SHMNET,
 };
 
 static inline void __send_sgi(int sgi_id, int cpu) {
@@ -44,6 +47,21 @@ static inline void __send_sgi_bcast(int sgi_id) {
 }
 
 void cpu_stop_all() {
+  struct pcpu *cpu;
+
+  /* a broadcast would stop the other nodes of a shared machine too */
+  if(partition.enabled) {
+    if(!localnode.irqchip)
+      return;
+
+    foreach_up_cpu(cpu) {
+      if(cpu != mycpu)
+        __send_sgi(SGI_STOP, pcpu_id(cpu));
+    }
+
+    return;
+  }
+
   __send_sgi_bcast(SGI_STOP);
 }
 
@@ -64,6 +82,11 @@ void cpu_send_do_recvq_sgi(struct pcpu *cpu) {
   __send_sgi(SGI_DO_RECVQ, id);
 }
 
+/* cpu may belong to another node of a shared machine */
+void cpu_send_shmnet_sgi(int cpu) {
+  __send_sgi(SGI_SHMNET, cpu);
+}
+
 void cpu_sgi_handler(int sgi_id) {
   switch(sgi_id) {
     case SGI_INJECT:  /* inject guest pending interrupt */
@@ -76,6 +99,9 @@ void cpu_sgi_handler(int sgi_id) {
     case SGI_DO_RECVQ:
       /* do_recv_waitqueue will be called when tail of interrupt handler in irq_entry() */
       break;
+    case SGI_SHMNET:
+      shmnet_rx();
+      break;
     default:
       panic("unknown sgi %d", sgi_id);
   }
@@ -118,12 +144,16 @@ static int cpu_init_enable_method(struct pcpu *c, struct device_node *cpudev) {
   return c->enable_method->init(c);
 }
 
+/* 1: a pcpu of another node of a shared machine */
 static int cpu_prepare(struct device_node *cpudev) {
   u32 mpidr;
   int rc = dt_node_propa(cpudev, "reg", &mpidr);
   if(rc < 0)
     return -1;
 
+  if(!partition_owns_cpu(mpidr))
+    return 1;
+
   struct pcpu *cpu = get_cpu(mpidr);
 
   cpu->online = true;
@@ -148,11 +178,15 @@ void pcpu_init() {
 
   for(cpu = dt_next_cpu_device(NULL); cpu;
       cpu = dt_next_cpu_device(cpu)) {
-    if(nr_online_pcpus++ > NCPU_MAX)
-      panic("too many cpu");
+    int rc = cpu_prepare(cpu);
 
-    if(cpu_prepare(cpu) < 0)
+    if(rc < 0)
       panic("cpu? %s", cpu->name);
+    if(rc > 0)
+      continue;
+
+    if(nr_online_pcpus++ > NCPU_MAX)
+      panic("too many cpu");
   }
 
   if(nr_online_pcpus == 0)
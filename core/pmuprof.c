@@ -0,0 +1,255 @@
+/*
+ *  el2 sampling profiler on the pmu
+ *
+ *  MDCR_EL2.HPMN leaves all event counters but the last one to the guest.
+ *  the last one counts cpu cycles at EL2 and in the guest and interrupts
+ *  every PMUPROF_PERIOD cycles: the handler records the interrupted el2 pc
+ *  and the return address of its frame, or the guest pc when the sample
+ *  hit in the guest.  each sample is tagged with the guest exit its pcpu
+ *  was handling (esr_el2.EC, irq or none).
+ *
+ *  hvc #3 streams the rings as text, tools/pmuprof symbolizes them with
+ *  the symbol map of the image (poc-main.map, poc-sub.map):
+ *
+ *    pmuprof: begin node <id> ncpu <n> period <cycles>
+ *    ps <cpu> <seq> <pc> <callsite> <guest_pc> <exit> <vcpuid>    (hex: pcs)
+ *    pe <cpu> <exit> <nexit> <nsample>                              (hex: counts)
+ *    pmuprof: end node <id>
+ *
+ *  the guest keeps counting with its own counters, but while profiling
+ *  the pmu interrupt belongs to el2: guest overflow interrupts are disabled.
+ *
+ *  built with PMUPROF only, else el2 just hands the pmu to the guest.
+ */
+
+#include "aarch64.h"
+#include "pmuprof.h"
+#include "pcpu.h"
+#include "vcpu.h"
+#include "irq.h"
+#include "gic.h"
+#include "device.h"
+#include "localnode.h"
+#include "memlayout.h"
+#include "mm.h"
+#include "log.h"
+#include "printf.h"
+
+#define MDCR_HPMN(n)      ((n) & 0x1f)
+#define MDCR_HPME         (1ul << 7)
+#define MDCR_HPMD         (1ul << 17)
+
+#define PMCR_N(pmcr)      (((pmcr) >> 11) & 0x1f)
+
+#define PMEVTYPER_NSH     (1ul << 27)   /* count at el2 */
+#define PMU_CPU_CYCLES    0x11
+
+static bool pmu_present() {
+  u64 pmuver = (read_sysreg(id_aa64dfr0_el1) >> 8) & 0xf;
+
+  return pmuver != 0 && pmuver != 0xf;
+}
+
+#ifdef PMUPROF
+
+struct pmuprof_cpu pmuprof_cpu[NCPU_MAX];
+
+static int pmu_irq;
+/* event counter of el2: the last one */
+static int pmu_counter;
+
+/* PMSELR_EL0 is shared with the guest */
+static void pmu_counter_rearm() {
+  u64 sel = read_sysreg(pmselr_el0);
+
+  write_sysreg(pmselr_el0, pmu_counter);
+  isb();
+  write_sysreg(pmxevcntr_el0, (u32)-PMUPROF_PERIOD);
+  write_sysreg(pmselr_el0, sel);
+  isb();
+}
+
+/* return address saved in the frame record of the interrupted function */
+static u64 hyp_callsite(struct hyp_context *ctx) {
+  u64 fp = ctx->x[29];
+  u64 sp = (u64)ctx + sizeof(*ctx);
+  /* pcpu and vcpu stacks are one page */
+  u64 top = PAGE_ADDRESS(ctx) + PAGESIZE;
+  u64 lr;
+
+  if(fp >= sp && fp + 16 <= top) {
+    lr = *(u64 *)(fp + 8);
+
+    if(is_vmm_text(lr - 4))
+      return lr - 4;
+  }
+
+  /* leaf function or prologue */
+  lr = ctx->x[30];
+
+  return is_vmm_text(lr - 4) ? lr - 4 : 0;
+}
+
+static void pmuprof_sample(struct hyp_context *ctx) {
+  struct pmuprof_cpu *p = &pmuprof_cpu[cpuid()];
+  struct vcpu *vcpu = current;
+  struct pmu_sample *s;
+
+  s = &p->ent[p->head & (PMUPROF_NSAMPLE - 1)];
+
+  if(ctx) {
+    s->pc = ctx->elr;
+    s->callsite = hyp_callsite(ctx);
+    p->nsample[p->exit]++;
+  } else {
+    s->pc = 0;
+    s->callsite = 0;
+  }
+
+  s->guest_pc = vcpu ? vcpu->reg.elr : 0;
+  s->vcpuid = vcpu ? vcpu->vcpuid : 0xffff;
+  s->seq = p->head;
+  s->exit = ctx ? p->exit : PMUPROF_EXIT_NONE;
+  s->cpu = cpuid();
+
+  p->head++;
+}
+
+static void pmuprof_intr(void * __unused arg) {
+  u64 ovs = read_sysreg(pmovsset_el0);
+  u64 mine = 1ul << pmu_counter;
+  u64 flags;
+
+  if(ovs & ~mine & 0xffffffff) {
+    /* guest counters: nobody would clear the level while el2 spins on it */
+    write_sysreg(pmintenclr_el1, ovs & ~mine & 0xffffffff);
+    write_sysreg(pmovsclr_el0, ovs & ~mine & 0xffffffff);
+    vmm_warn("pmuprof: guest pmu interrupt disabled\n");
+  }
+
+  if(!(ovs & mine))
+    return;
+
+  /* irq_ctx belongs to this irq until irq_entry() returns */
+  irqsave(flags);
+
+  pmuprof_sample(mycpu->irq_ctx);
+
+  write_sysreg(pmovsclr_el0, mine);
+  pmu_counter_rearm();
+
+  irqrestore(flags);
+}
+
+static void pmuprof_arm() {
+  write_sysreg(mdcr_el2, MDCR_HPMN(pmu_counter) | MDCR_HPME | MDCR_HPMD);
+  isb();
+
+  write_sysreg(pmselr_el0, pmu_counter);
+  isb();
+  write_sysreg(pmxevtyper_el0, PMEVTYPER_NSH | PMU_CPU_CYCLES);
+  write_sysreg(pmxevcntr_el0, (u32)-PMUPROF_PERIOD);
+
+  write_sysreg(pmovsclr_el0, 1ul << pmu_counter);
+  write_sysreg(pmintenset_el1, 1ul << pmu_counter);
+  write_sysreg(pmcntenset_el0, 1ul << pmu_counter);
+  isb();
+
+  /* PPI is banked per cpu */
+  localnode.irqchip->enable_irq(pmu_irq);
+}
+
+#endif  /* PMUPROF */
+
+/* called per cpu */
+void pmuprof_init_core() {
+  u64 n;
+
+#ifdef PMUPROF
+  pmuprof_cpu[cpuid()].exit = PMUPROF_EXIT_NONE;
+#endif
+
+  if(!pmu_present())
+    return;
+
+  n = PMCR_N(read_sysreg(pmcr_el0));
+
+#ifdef PMUPROF
+  if(pmu_irq && n != 0) {
+    pmuprof_arm();
+    return;
+  }
+#endif
+
+  /* the guest owns the whole pmu, but does not count el2 */
+  write_sysreg(mdcr_el2, MDCR_HPMN(n) | MDCR_HPMD);
+  isb();
+}
+
+#ifdef PMUPROF
+
+void pmuprof_init() {
+  struct device_node *pmu;
+  int intid;
+  u64 n;
+
+  if(!pmu_present())
+    return;
+
+  n = PMCR_N(read_sysreg(pmcr_el0));
+  if(n == 0) {
+    vmm_warn("pmuprof: no event counter\n");
+    return;
+  }
+
+  pmu = dt_compatible_child(localnode.device_tree, "arm,armv8-pmuv3");
+  if(!pmu)
+    pmu = dt_compatible_child(localnode.device_tree, "arm,cortex-a72-pmu");
+
+  if(!pmu || dt_node_prop_intr(pmu, 0, &intid, NULL) < 0 || !is_ppi(intid)) {
+    vmm_warn("pmuprof: no pmu ppi\n");
+    return;
+  }
+
+  pmu_counter = n - 1;
+  pmu_irq = intid;
+
+  irq_register(pmu_irq, pmuprof_intr, NULL);
+
+  vmm_log("pmuprof: counter %d irq %d period %d\n", pmu_counter, pmu_irq, PMUPROF_PERIOD);
+}
+
+void pmuprof_dump() {
+  printf("pmuprof: begin node %d ncpu %d period %d\n",
+         local_nodeid(), nr_online_pcpus, PMUPROF_PERIOD);
+
+  for(int cpu = 0; cpu < NCPU_MAX; cpu++) {
+    struct pmuprof_cpu *p = &pmuprof_cpu[cpu];
+    u64 head = p->head;
+    u64 start = head > PMUPROF_NSAMPLE ? head - PMUPROF_NSAMPLE : 0;
+
+    for(u64 i = start; i < head; i++) {
+      struct pmu_sample *s = &p->ent[i & (PMUPROF_NSAMPLE - 1)];
+
+      printf("ps %d %u %x %x %x %d %d\n", s->cpu, s->seq, s->pc, s->callsite,
+             s->guest_pc, s->exit, s->vcpuid);
+    }
+
+    for(int e = 0; e < NR_PMUPROF_EXIT; e++) {
+      if(p->nexit[e] || p->nsample[e])
+        printf("pe %d %d %x %x\n", cpu, e, p->nexit[e], p->nsample[e]);
+    }
+  }
+
+  printf("pmuprof: end node %d\n", local_nodeid());
+}
+
+#else
+
+void pmuprof_init() {}
+
+void pmuprof_dump() {
+  printf("pmuprof: not built in (make PMUPROF=1)\n");
+}
+
+#endif  /* PMUPROF */
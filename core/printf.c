@@ -7,6 +7,8 @@
 #include "localnode.h"
 #include "log.h"
 #include "earlycon.h"
+#include "param.h"
+#include "atomic.h"
 
 #define PRINT_NBUF    (32 * 1024)
 
@@ -15,6 +17,44 @@ static char printbuf[PRINT_NBUF];   /* 32 KB */
 static int pbuf_head = 0;
 static int pbuf_tail = 0;
 
+/* messages above this level go to printbuf only (see logflush()) */
+int loglevel = LLOG;
+
+#define LOGRING_SIZE  (16 * 1024)
+#define LOGLINE_MAX   256
+
+/*
+ *  per-pcpu ring of log_cat_printf(): only its pcpu writes tail, only the
+ *  holder of drainlock moves head
+ */
+struct logring {
+  u64 head;
+  u64 tail;
+  u64 ndrop;
+  u64 ndrop_shown;
+  int linelen;
+  char line[LOGLINE_MAX];
+  char buf[LOGRING_SIZE];
+};
+
+static struct logring logring[NCPU_MAX];
+static u8 drainlock;
+
+static const char *log_cat_name[NR_LOG_CAT] = {
+  [LC_VSM]    "vsm",
+  [LC_MSG]    "msg",
+  [LC_NET]    "net",
+  [LC_TRAP]   "trap",
+  [LC_MMIO]   "mmio",
+  [LC_VGIC]   "vgic",
+  [LC_PAGE]   "page",
+};
+
+/* warnings only: the hot paths are quiet unless asked for */
+int log_cat_level[NR_LOG_CAT] = {
+  [0 ... NR_LOG_CAT - 1] = LWARN,
+};
+
 static int __vprintf(const char *fmt, va_list ap, void (*putc)(char));
 static int __printf(void (*cf)(char), const char *fmt, ...);
 
@@ -183,6 +223,119 @@ void logflush() {
   }
 
   spin_unlock_irqrestore(&prlock, flags);
+
+  log_drain(true);
+}
+
+static void linec(char c) {
+  struct logring *r = &logring[cpuid()];
+
+  if(c && r->linelen < LOGLINE_MAX)
+    r->line[r->linelen++] = c;
+}
+
+/*
+ *  format into the ring of this pcpu, drop the message if it is full.
+ *  never waits: called from vsm faults and msg handlers.
+ */
+int log_cat_vprintf(int cat, int level, const char *fmt, va_list ap) {
+  struct logring *r;
+  u64 flags, tail;
+
+  irqsave(flags);
+
+  r = &logring[cpuid()];
+  r->linelen = 0;
+
+  __printf(linec, "[%s%s]: Node%d:cpu%d: ", log_cat_name[cat],
+           level == LWARN ? " warning" : "", local_nodeid(), cpuid());
+
+  __vprintf(fmt, ap, linec);
+
+  /* truncated */
+  if(r->linelen == LOGLINE_MAX) {
+    r->line[LOGLINE_MAX - 2] = '\r';
+    r->line[LOGLINE_MAX - 1] = '\n';
+  }
+
+  tail = r->tail;
+
+  if(tail + r->linelen - load_acquire64(&r->head) > LOGRING_SIZE) {
+    r->ndrop++;
+  } else {
+    for(int i = 0; i < r->linelen; i++)
+      r->buf[(tail + i) % LOGRING_SIZE] = r->line[i];
+
+    store_release64(&r->tail, tail + r->linelen);
+  }
+
+  irqrestore(flags);
+
+  return 0;
+}
+
+int log_cat_printf(int cat, const char *fmt, ...) {
+  int level = 0;
+  va_list ap;
+
+  if(*fmt == '\001') {
+    level = *++fmt - '0';
+    fmt++;
+  }
+
+  va_start(ap, fmt);
+  log_cat_vprintf(cat, level, fmt, ap);
+  va_end(ap);
+
+  return 0;
+}
+
+static void log_drain_ring(int cpu, struct logring *r, bool wait) {
+  u64 head = r->head;
+  u64 tail = load_acquire64(&r->tail);
+
+  for(; head != tail; head++) {
+    char c = r->buf[head % LOGRING_SIZE];
+
+    if(wait)
+      uart_putc(c);
+    else if(localnode.uart->tryputc(c) < 0)
+      break;
+  }
+
+  store_release64(&r->head, head);
+
+  if(head == tail && r->ndrop != r->ndrop_shown) {
+    __printf(uart_putc, "[log]: cpu%d: %d messages dropped\n", cpu, r->ndrop - r->ndrop_shown);
+    r->ndrop_shown = r->ndrop;
+  }
+}
+
+/*
+ *  write out the rings of all pcpus.  !wait: only as many characters as
+ *  the uart takes without waiting, from idle pcpus (core/idle.c).
+ */
+void log_drain(bool wait) {
+  u64 flags;
+
+  if(!localnode.uart)
+    return;
+
+  irqsave(flags);
+
+  if(wait) {
+    atomic_lock8(&drainlock, 1);
+  } else if(atomic_trylock8(&drainlock, 1)) {
+    irqrestore(flags);
+    return;
+  }
+
+  for(int cpu = 0; cpu < NCPU_MAX; cpu++)
+    log_drain_ring(cpu, &logring[cpu], wait);
+
+  atomic_release8(&drainlock);
+
+  irqrestore(flags);
 }
 
 int vprintf(const char *fmt, va_list ap) {
@@ -239,7 +392,7 @@ int printf(const char *fmt, ...) {
 
   spin_lock_irqsave(&prlock, flags);
 
-  if(level <= LLOG) {
+  if(level <= loglevel) {
     putcf = localnode.uart ? uart_putc : earlycon_putc;
   } else {
     putcf = lputc;
@@ -15,6 +15,7 @@
 #include "panic.h"
 #include "tlb.h"
 #include "assert.h"
+#include "console.h"
 
 int s2_root_level;
 u64 *vttbr;
@@ -23,6 +24,28 @@ static int parange_map[] = {
   32, 36, 40, 42, 44, 48, 52,
 };
 
+/* FEAT_TLBIRANGE: tlbi ripas2e1is is available */
+static bool tlbi_range;
+
+struct tlb_s2_stats {
+  u64 flush[NR_TLBF_REASON];
+  u64 deferred[NR_TLBF_REASON];
+  u64 ntlbi;
+  u64 nfull;
+} __cacheline_aligned;
+
+static struct tlb_s2_stats tlbstats[NCPU_MAX];
+
+static const char *tlbf_reason_str[NR_TLBF_REASON] = {
+  [TLBF_READ_FAULT]     "read-fault",
+  [TLBF_WRITE_FAULT]    "write-fault",
+  [TLBF_READ_SERVER]    "read-server",
+  [TLBF_WRITE_SERVER]   "write-server",
+  [TLBF_INV_SERVER]     "inv-server",
+  [TLBF_SPURIOUS]       "spurious",
+  [TLBF_OTHER]          "other",
+};
+
 void s2_pte_dump(ipa_t ipa) {
   u64 *pte = pagewalk(vttbr, ipa, s2_root_level, 0);
   if(!pte) {
@@ -82,17 +105,29 @@ void vmiomap(ipa_t ipa, u64 pa, u64 size) {
 }
 
 void s2pageunmap(ipa_t ipa, u64 size) {
+  struct tlb_s2_batch batch;
+  u64 *pte;
+
   if(ipa % PAGESIZE != 0 || size % PAGESIZE != 0)
     panic("invalid pageunmap");
 
-  for(u64 p = 0; p < size; p += PAGESIZE, ipa += PAGESIZE) {
-    u64 *pte = pagewalk(vttbr, ipa, s2_root_level, 0);
-    if(*pte == 0)
+  for(u64 p = 0; p < size; p += PAGESIZE) {
+    pte = pagewalk(vttbr, ipa + p, s2_root_level, 0);
+    if(!pte || *pte == 0)
       panic("already unmapped");
 
-    u64 pa = PTE_PA(*pte);
-    free_page(P2V(pa));
+    s2pte_invalidate(pte);
+  }
+
+  /* one flush for the whole range, then free pages */
+  tlb_s2_batch_init(&batch);
+  tlb_s2_batch_add_range(&batch, ipa, size);
+  tlb_s2_batch_flush(&batch, TLBF_OTHER);
+
+  for(u64 p = 0; p < size; p += PAGESIZE) {
+    pte = pagewalk(vttbr, ipa + p, s2_root_level, 0);
 
+    free_page(P2V(PTE_PA(*pte)));
     pte_clear(pte);
   }
 }
@@ -113,11 +148,12 @@ void alloc_guestmem(u64 ipa, u64 size) {
 void map_guest_image(struct guest *img, u64 ipa) {
   printf("map guest image %p - %p\n", ipa, ipa + img->size);
 
-  copy_to_guest(ipa, (char *)img->start, img->size, false);
+  /* home memory may not be populated yet (lazy vsm) */
+  copy_to_guest(ipa, (char *)img->start, img->size, true);
 }
 
 void map_guest_peripherals() {
-  vmiomap_passthrough(0x09000000, PAGESIZE);   // pl011 UART
+  console_guest_uart(0x09000000, PAGESIZE);    // pl011 UART: trapped, see core/console.c
   // vmiomap(0x09000000, 0xfe201000, PAGESIZE);
   vmiomap_passthrough(0x09010000, PAGESIZE);   // RTC
   vmiomap_passthrough(0x09030000, PAGESIZE);   // GPIO
@@ -129,8 +165,9 @@ void map_guest_peripherals() {
   vmiomap_passthrough(0x8000000000ul, 0x100000);         // PCIE HIGH MMIO
 }
 
-void s2_map_page_copyset(ipa_t ipa, physaddr_t pa, u64 copyset) {
-  u64 flags = S2PTE_NORMAL | S2PTE_COPYSET(copyset);
+/* map page without access permission: set permission later */
+void s2_map_page_noaccess(ipa_t ipa, physaddr_t pa) {
+  u64 flags = S2PTE_NORMAL;
 
   return mappages(vttbr, ipa, pa, PAGESIZE, flags, s2_root_level);
 }
@@ -174,6 +211,13 @@ u64 *s2_ro_pte(ipa_t ipa) {
   return NULL;
 }
 
+/* page has (or had) a stage 2 mapping */
+bool s2_page_mapped(ipa_t ipa) {
+  u64 *pte = pagewalk(vttbr, ipa, s2_root_level, 0);
+
+  return pte && *pte != 0;
+}
+
 void s2_page_invalidate(ipa_t ipa) {
   assert(PAGE_ALIGNED(ipa));
 
@@ -184,7 +228,7 @@ void s2_page_invalidate(ipa_t ipa) {
   u64 pa = PTE_PA(*pte);
 
   s2pte_invalidate(pte);
-  tlb_s2_flush_ipa(ipa);
+  tlb_s2_flush_ipa_reason(ipa, TLBF_INV_SERVER);
 
   free_page(P2V(pa));
 }
@@ -200,6 +244,183 @@ void s2_page_ro(ipa_t ipa) {
   tlb_s2_flush_ipa(ipa);
 }
 
+/*
+ *  encode tlbi ripas2e1is operand (4KB granule)
+ *  range = (NUM + 1) << (5 * SCALE + 1) pages from BaseADDR
+ *  return 0 if the range is too big to encode
+ */
+static u64 tlbi_range_operand(ipa_t ipa, u64 npages) {
+  for(int scale = 0; scale < 4; scale++) {
+    u64 unit = 1ul << (5 * scale + 1);
+    u64 num = (npages + unit - 1) / unit - 1;
+
+    if(num < 32)
+      return (1ul << 46) |        /* TG = 4KB */
+             ((u64)scale << 44) |
+             (num << 39) |
+             ((ipa >> PAGESHIFT) & 0x1ffffffffful);
+  }
+
+  return 0;
+}
+
+void tlb_s2_batch_add_range(struct tlb_s2_batch *b, ipa_t ipa, u64 size) {
+  u64 npages = PAGE_ALIGN(size) >> PAGESHIFT;
+
+  assert(PAGE_ALIGNED(ipa));
+
+  if(b->n > 0) {
+    /* merge with the last range if contiguous */
+    ipa_t end = b->range[b->n - 1].ipa + (b->range[b->n - 1].npages << PAGESHIFT);
+
+    if(end == ipa) {
+      b->range[b->n - 1].npages += npages;
+      return;
+    }
+  }
+
+  if(b->n == TLB_BATCH_MAX) {
+    b->overflow = true;
+    return;
+  }
+
+  b->range[b->n].ipa = ipa;
+  b->range[b->n].npages = npages;
+  b->n++;
+}
+
+#ifdef BUILD_QEMU
+
+/* QEMU does not emulate tlbi ipas2e1 ;; */
+
+void tlb_s2_batch_flush(struct tlb_s2_batch *b, enum tlb_flush_reason reason) {
+  struct tlb_s2_stats *st = &tlbstats[cpuid()];
+
+  if(b->n == 0)
+    return;
+
+  st->flush[reason]++;
+  st->nfull++;
+
+  /* one full flush per batch instead of one per ipa */
+  tlb_s2_flush_all_is();
+
+  tlb_s2_batch_init(b);
+}
+
+void tlb_s2_flush_ipa_local(u64 __unused ipa) {
+  tlbstats[cpuid()].flush[TLBF_SPURIOUS]++;
+
+  tlb_s2_flush_all();
+}
+
+#else   /* !BUILD_QEMU */
+
+void tlb_s2_batch_flush(struct tlb_s2_batch *b, enum tlb_flush_reason reason) {
+  struct tlb_s2_stats *st = &tlbstats[cpuid()];
+
+  if(b->n == 0)
+    return;
+
+  st->flush[reason]++;
+
+  if(b->overflow) {
+    st->nfull++;
+    tlb_s2_flush_all_is();
+    tlb_s2_batch_init(b);
+    return;
+  }
+
+  dsb(ishst);
+
+  for(int i = 0; i < b->n; i++) {
+    ipa_t ipa = b->range[i].ipa;
+    u64 npages = b->range[i].npages;
+    u64 op;
+
+    if(npages > 1 && tlbi_range && (op = tlbi_range_operand(ipa, npages)) != 0) {
+      __tlbi_ripas2e1is(op);
+      st->ntlbi++;
+      continue;
+    }
+
+    if(npages > 512) {
+      /* too many pages: full flush is cheaper */
+      st->nfull++;
+      tlb_s2_flush_all_is();
+      tlb_s2_batch_init(b);
+      return;
+    }
+
+    for(u64 p = 0; p < npages; p++, ipa += PAGESIZE) {
+      __tlbi_ipas2e1is(ipa);
+      st->ntlbi++;
+    }
+  }
+
+  /* stage 1 entries may hold combined stage 1+2 translations */
+  dsb(ish);
+  __tlbi_vmalle1is();
+  dsb(ish);
+  isb();
+
+  tlb_s2_batch_init(b);
+}
+
+void tlb_s2_flush_ipa_local(u64 ipa) {
+  tlbstats[cpuid()].flush[TLBF_SPURIOUS]++;
+
+  dsb(nshst);
+  __tlbi_ipas2e1(ipa);
+  dsb(nsh);
+  __tlbi_vmalle1();
+  dsb(nsh);
+  isb();
+}
+
+#endif  /* BUILD_QEMU */
+
+void tlb_s2_flush_ipa_reason(u64 ipa, enum tlb_flush_reason reason) {
+  struct tlb_s2_batch b;
+
+  tlb_s2_batch_init(&b);
+  tlb_s2_batch_add(&b, PAGE_ADDRESS(ipa));
+  tlb_s2_batch_flush(&b, reason);
+}
+
+/*
+ *  permission upgrade (INV -> RO, RO -> RW) need not flush tlb:
+ *  a stale entry only causes a spurious fault, which is fixed up by
+ *  tlb_s2_flush_ipa_local() in the fault handler.
+ */
+void tlb_s2_defer(enum tlb_flush_reason reason) {
+  tlbstats[cpuid()].deferred[reason]++;
+}
+
+void tlb_s2_stats_dump() {
+  printf("stage 2 tlb flush stats (range %s):\n", tlbi_range ? "yes" : "no");
+
+  for(int c = 0; c < NCPU_MAX; c++) {
+    struct tlb_s2_stats *st = &tlbstats[c];
+
+    if(st->ntlbi == 0 && st->nfull == 0 && st->deferred[TLBF_READ_FAULT] == 0 &&
+       st->deferred[TLBF_WRITE_FAULT] == 0)
+      continue;
+
+    printf("\tcpu%d: tlbi %d full %d\n", c, st->ntlbi, st->nfull);
+
+    for(int i = 0; i < NR_TLBF_REASON; i++)
+      printf("\t\t%s: flush %d deferred %d\n",
+             tlbf_reason_str[i], st->flush[i], st->deferred[i]);
+  }
+}
+
+void tlb_s2_init() {
+  u64 isar0 = read_sysreg(id_aa64isar0_el1);
+
+  tlbi_range = ((isar0 >> 56) & 0xf) == 0x2;
+}
+
 void copy_to_guest(ipa_t to_ipa, char *from, u64 len, bool alloc) {
   while(len > 0) {
     void *hva = ipa2hva(to_ipa);
@@ -251,7 +472,7 @@ physaddr_t ipa2pa(ipa_t ipa) {
   u64 *pte = pagewalk(vttbr, ipa, s2_root_level, 0);
   u32 off;
 
-  if(!pte)
+  if(!pte || *pte == 0)
     return 0;
 
   off = PAGE_OFFSET(ipa);
@@ -260,13 +481,15 @@ physaddr_t ipa2pa(ipa_t ipa) {
 }
 
 void *ipa2hva(ipa_t ipa) {
-  return P2V(ipa2pa(ipa));
+  physaddr_t pa = ipa2pa(ipa);
+
+  return pa ? P2V(pa) : NULL;
 }
 
 u64 at_uva2pa(u64 uva) {
   u64 par;
 
-  asm volatile("at s12e1r, %0" :: "r"(uva) : "memory");
+  do_at_trans(uva, s12, e1, r);
 
   par = read_sysreg(par_el1);
 
@@ -282,7 +505,7 @@ u64 at_uva2pa(u64 uva) {
 u64 at_uva2ipa(u64 uva) {
   u64 par;
 
-  asm volatile("at s1e1r, %0" :: "r"(uva) : "memory");
+  do_at_trans(uva, s1, e1, r);
 
   par = read_sysreg(par_el1);
 
@@ -340,6 +563,8 @@ void s2mmu_init() {
 
   vtcr |= VTCR_T0SZ(t0sz) | VTCR_PS_16T | VTCR_SL0(sl0);
 
+  tlb_s2_init();
+
   vttbr = alloc_page();
   if(!vttbr)
     panic("vttbr failed");
@@ -0,0 +1,451 @@
+/*
+ *  vcpu scheduler: multiplex vcpus of this node on its pcpus
+ *
+ *  every pcpu runs a scheduler loop on its boot stack, each vcpu has
+ *  its own hypervisor stack.  a vcpu gives up the pcpu when it waits
+ *  for a msg reply (blocking vsm fetch), executes wfi, or its
+ *  timeslice expires while other vcpus are runnable on the pcpu.
+ *  with one vcpu per pcpu nothing is switched.
+ */
+
+#include "aarch64.h"
+#include "sched.h"
+#include "vcpu.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "allocpage.h"
+#include "arch-timer.h"
+#include "spinlock.h"
+#include "printf.h"
+#include "log.h"
+#include "panic.h"
+
+void vcpu_start(void);
+
+int sched_timeslice_us = SCHED_TIMESLICE_US;
+
+/* virtual timer of a saved vcpu is going to fire */
+static bool vtimer_armed(struct vcpu *vcpu) {
+  u64 ctl = vcpu->sys.cntv_ctl_el0;
+
+  /* ENABLE and !IMASK */
+  return (ctl & 0x3) == 0x1;
+}
+
+static bool vtimer_expired(struct vcpu *vcpu) {
+  return vtimer_armed(vcpu) && vcpu->sys.cntv_cval_el0 <= read_sysreg(cntvct_el0);
+}
+
+/* ticks until the earliest virtual timer of blocked vcpus, 0 if none */
+static u64 rq_next_vtimer(struct runqueue *rq) {
+  u64 now = read_sysreg(cntvct_el0);
+  u64 next = 0;
+
+  for(int i = 0; i < rq->nvcpu; i++) {
+    struct vcpu *v = rq->vcpus[i];
+    u64 t;
+
+    if(v->state != VCPU_BLOCKED || !vtimer_armed(v))
+      continue;
+
+    t = v->sys.cntv_cval_el0 > now ? v->sys.cntv_cval_el0 - now : 1;
+
+    if(!next || t < next)
+      next = t;
+  }
+
+  return next;
+}
+
+static int rq_nrunnable(struct runqueue *rq) {
+  int n = 0;
+
+  for(int i = 0; i < rq->nvcpu; i++) {
+    struct vcpu *v = rq->vcpus[i];
+
+    if(v->online && v->state == VCPU_RUNNABLE)
+      n++;
+  }
+
+  return n;
+}
+
+/* guest timer of a vcpu in wfi fired: rq->lock held */
+static void rq_wakeup_vtimer(struct runqueue *rq) {
+  for(int i = 0; i < rq->nvcpu; i++) {
+    struct vcpu *v = rq->vcpus[i];
+
+    if(v->state == VCPU_BLOCKED && vtimer_expired(v))
+      v->state = VCPU_RUNNABLE;
+  }
+}
+
+/* round-robin from the vcpu next to the last one */
+static struct vcpu *pick_next_vcpu(struct runqueue *rq) {
+  struct vcpu *next = NULL;
+
+  spin_lock(&rq->lock);
+
+  rq_wakeup_vtimer(rq);
+
+  for(int i = 1; i <= rq->nvcpu; i++) {
+    int n = (rq->last + i) % rq->nvcpu;
+    struct vcpu *v = rq->vcpus[n];
+
+    if(v->online && v->state == VCPU_RUNNABLE) {
+      v->state = VCPU_RUNNING;
+      rq->last = n;
+      next = v;
+      break;
+    }
+  }
+
+  rq->need_resched = false;
+
+  spin_unlock(&rq->lock);
+
+  return next;
+}
+
+/*
+ *  timeslice while other vcpus are runnable,
+ *  and wakeup for the guest timer of blocked vcpus
+ */
+static void sched_arm_timer(struct runqueue *rq, bool running) {
+  u64 ticks = rq_next_vtimer(rq);
+
+  if(running && rq_nrunnable(rq) > 0) {
+    u64 slice = usecs_to_ticks(sched_timeslice_us);
+
+    if(!ticks || slice < ticks)
+      ticks = slice;
+  }
+
+  if(ticks)
+    hyp_timer_oneshot(ticks);
+  else
+    hyp_timer_cancel();
+}
+
+static void sched_run(struct runqueue *rq, struct vcpu *vcpu) {
+  set_current_vcpu(vcpu);
+  vcpu_restore_state(vcpu);
+
+  sched_arm_timer(rq, true);
+
+  rq->nswitch++;
+
+  switch_context(&rq->ctx, &vcpu->ctx);
+
+  /* vcpu gave up this pcpu, its state has been saved */
+  hyp_timer_cancel();
+
+  /* migrated vcpu is off its stack now: its slot can be reused */
+  if(vcpu->state == VCPU_EXITED)
+    vcpu->initialized = false;
+}
+
+/*
+ *  scheduler loop of this pcpu
+ */
+void sched_start() {
+  struct runqueue *rq = &mycpu->rq;
+  struct vcpu *vcpu;
+
+  vmm_log("cpu%d: scheduler start (%d vcpus)\n", cpuid(), rq->nvcpu);
+
+  for(;;) {
+    local_irq_disable();
+
+    if((vcpu = pick_next_vcpu(rq)) != NULL) {
+      sched_run(rq, vcpu);
+      continue;
+    }
+
+    /* idle: woken up by sched_wakeup(), msgs or guest timer deadline */
+    sched_arm_timer(rq, false);
+
+    /* pending irq wakes up wfi even if masked */
+    wfi();
+
+    local_irq_enable();
+  }
+}
+
+/*
+ *  give up this pcpu: current->state must be set.
+ *  called with irq disabled, returns when current is picked again.
+ */
+static void sched(void) {
+  struct vcpu *vcpu = current;
+
+  if(local_irq_enabled())
+    panic("sched: irq enabled");
+  if(in_interrupt() || in_lazyirq())
+    panic("sched: in interrupt");
+
+  vcpu_save_state(vcpu);
+
+  switch_context(&vcpu->ctx, &mycpu->rq.ctx);
+}
+
+/* other vcpus share this pcpu */
+bool sched_multiplexed() {
+  return mycpu->rq.nvcpu > 1 && current->state == VCPU_RUNNING;
+}
+
+/*
+ *  wait for sched_wakeup(current): other vcpus run meanwhile,
+ *  or the pcpu halts when current is alone.
+ *  spurious return is possible, callers re-check their condition.
+ */
+void sched_wait() {
+  struct runqueue *rq = &mycpu->rq;
+  struct vcpu *vcpu = current;
+  u64 flags;
+
+  /* msg handlers never switch vcpus */
+  if(!sched_multiplexed() || in_lazyirq()) {
+    wfi();
+    return;
+  }
+
+  irqsave(flags);
+
+  spin_lock(&rq->lock);
+
+  if(vcpu->woken) {
+    vcpu->woken = false;
+    spin_unlock(&rq->lock);
+    goto out;
+  }
+
+  vcpu->state = VCPU_BLOCKED;
+  rq->nblock++;
+
+  spin_unlock(&rq->lock);
+
+  sched();
+
+out:
+  irqrestore(flags);
+}
+
+void sched_yield() {
+  struct runqueue *rq = &mycpu->rq;
+  struct vcpu *vcpu = current;
+  u64 flags;
+
+  if(!sched_multiplexed() || in_lazyirq())
+    return;
+
+  irqsave(flags);
+
+  spin_lock(&rq->lock);
+
+  if(rq_nrunnable(rq) == 0) {
+    spin_unlock(&rq->lock);
+    goto out;
+  }
+
+  vcpu->state = VCPU_RUNNABLE;
+
+  spin_unlock(&rq->lock);
+
+  sched();
+
+out:
+  irqrestore(flags);
+}
+
+/*
+ *  let the scheduler of vcpu's pcpu re-pick:
+ *  vcpu became runnable or came online
+ */
+void sched_kick(struct vcpu *vcpu) {
+  struct pcpu *cpu = vcpu->pcpu;
+
+  cpu->rq.need_resched = true;
+
+  if(cpu != mycpu && cpu->wakeup)
+    cpu_send_inject_sgi(cpu);
+}
+
+/*
+ *  make vcpu runnable if blocked, otherwise its next sched_wait() returns.
+ *  called from any pcpu.
+ */
+void sched_wakeup(struct vcpu *vcpu) {
+  struct runqueue *rq = &vcpu->pcpu->rq;
+  bool kick = false;
+  u64 flags;
+
+  spin_lock_irqsave(&rq->lock, flags);
+
+  if(vcpu->state == VCPU_BLOCKED) {
+    vcpu->state = VCPU_RUNNABLE;
+    kick = true;
+  } else {
+    vcpu->woken = true;
+  }
+
+  spin_unlock_irqrestore(&rq->lock, flags);
+
+  if(kick)
+    sched_kick(vcpu);
+}
+
+/* hyp timer: timeslice expired or guest timer of a blocked vcpu */
+void sched_tick() {
+  struct runqueue *rq = &mycpu->rq;
+
+  if(rq->nvcpu > 1)
+    rq->need_resched = true;
+}
+
+/*
+ *  called before returning to guest
+ */
+void sched_preempt() {
+  struct runqueue *rq = &mycpu->rq;
+  struct vcpu *vcpu = current;
+  u64 flags;
+
+  if(!rq->need_resched || !sched_multiplexed())
+    return;
+
+  irqsave(flags);
+
+  spin_lock(&rq->lock);
+
+  rq->need_resched = false;
+
+  rq_wakeup_vtimer(rq);
+
+  if(rq_nrunnable(rq) == 0) {
+    /* nobody waits: keep running current */
+    spin_unlock(&rq->lock);
+    sched_arm_timer(rq, true);
+    goto out;
+  }
+
+  vcpu->state = VCPU_RUNNABLE;
+  rq->npreempt++;
+
+  spin_unlock(&rq->lock);
+
+  sched();
+
+out:
+  irqrestore(flags);
+}
+
+/* first switch to vcpu jumps to entry on a fresh stack */
+static void sched_init_context(struct vcpu *vcpu, void (*entry)(void)) {
+  /* a slot left by a migrated vcpu keeps its stack */
+  if(!vcpu->stack && !(vcpu->stack = alloc_page()))
+    panic("vcpu stack");
+
+  vcpu->ctx.sp = (u64)vcpu->stack + PAGESIZE;
+  vcpu->ctx.lr = (u64)entry;
+  vcpu->ctx.fp = 0;
+
+  vcpu->state = VCPU_RUNNABLE;
+  vcpu->woken = false;
+}
+
+/* called on pcpu of vcpu */
+void sched_init_vcpu(struct vcpu *vcpu) {
+  sched_init_context(vcpu, vcpu_start);
+}
+
+/*
+ *  vcpu migrated from other node joins the runqueue of vcpu->pcpu.
+ *  called from any pcpu.
+ */
+void sched_attach(struct vcpu *vcpu, void (*entry)(void)) {
+  struct runqueue *rq = &vcpu->pcpu->rq;
+  u64 flags;
+
+  sched_init_context(vcpu, entry);
+
+  spin_lock_irqsave(&rq->lock, flags);
+
+  if(rq->nvcpu == VCPU_PER_NODE_MAX)
+    panic("sched_attach: runqueue full");
+
+  rq->vcpus[rq->nvcpu++] = vcpu;
+
+  spin_unlock_irqrestore(&rq->lock, flags);
+
+  sched_kick(vcpu);
+}
+
+/*
+ *  current migrated to other node: leave this pcpu for good.
+ *  its state has been saved, called with irq disabled.
+ */
+void sched_exit() {
+  struct runqueue *rq = &mycpu->rq;
+  struct vcpu *vcpu = current;
+  int i;
+
+  if(local_irq_enabled())
+    panic("sched_exit: irq enabled");
+
+  spin_lock(&rq->lock);
+
+  for(i = 0; i < rq->nvcpu && rq->vcpus[i] != vcpu; i++)
+    ;
+  if(i == rq->nvcpu)
+    panic("sched_exit: vcpu%d not in runqueue", vcpu->vcpuid);
+
+  for(; i < rq->nvcpu - 1; i++)
+    rq->vcpus[i] = rq->vcpus[i + 1];
+
+  rq->nvcpu--;
+  rq->last = -1;
+
+  vcpu->online = false;
+  vcpu->state = VCPU_EXITED;
+
+  spin_unlock(&rq->lock);
+
+  switch_context(&vcpu->ctx, &rq->ctx);
+
+  panic("sched_exit: vcpu resumed");
+}
+
+/*
+ *  vcpus are distributed to pcpus in vcpu_preinit()
+ */
+void sched_init() {
+  for(struct pcpu *cpu = pcpus; cpu < &pcpus[NCPU_MAX]; cpu++) {
+    struct runqueue *rq = &cpu->rq;
+
+    rq->nvcpu = 0;
+    rq->last = -1;
+    rq->need_resched = false;
+    spinlock_init(&rq->lock);
+  }
+
+  for(struct vcpu *vcpu = localvm.vcpus; vcpu < &localvm.vcpus[localvm.nvcpu]; vcpu++) {
+    struct runqueue *rq = &vcpu->pcpu->rq;
+
+    rq->vcpus[rq->nvcpu++] = vcpu;
+  }
+}
+
+void sched_stats() {
+  printf("sched stats\n");
+
+  for(struct pcpu *cpu = pcpus; cpu < &pcpus[NCPU_MAX]; cpu++) {
+    struct runqueue *rq = &cpu->rq;
+
+    if(!rq->nvcpu)
+      continue;
+
+    printf("cpu%d: %d vcpus switch %d preempt %d block %d\n",
+           pcpu_id(cpu), rq->nvcpu, rq->nswitch, rq->npreempt, rq->nblock);
+  }
+}
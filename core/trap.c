@@ -19,18 +19,19 @@
 #include "compiler.h"
 #include "panic.h"
 #include "memlayout.h"
+#include "sched.h"
+#include "vsm-log.h"
+#include "fault-lat.h"
+#include "page-prof.h"
+#include "irq.h"
+#include "pmuprof.h"
+#include "exit-stat.h"
 
 void vectable(void);
 
 static void dabort_iss_dump(u64 iss);
 static void iabort_iss_dump(u64 iss);
 
-struct hyp_context {
-  u64 x[31];
-  u64 spsr;
-  u64 elr;
-} __packed;
-
 void hyp_sync_handler(struct hyp_context *ctx) {
   u64 esr = read_sysreg(esr_el2);
   u64 elr = read_sysreg(elr_el2);
@@ -101,6 +102,8 @@ static int vm_iabort(struct vcpu *vcpu, u64 iss, u64 far) {
   if(fnv)
     panic("fnv");
 
+  fault_lat_trap(vcpu);
+
   u64 faultpage = faulting_ipa_page();
 
   if(vcpu->reg.elr == 0)
@@ -108,7 +111,8 @@ static int vm_iabort(struct vcpu *vcpu, u64 iss, u64 far) {
 
   if(s1ptw) {
     /* fetch pagetable */
-    vmm_log("\tiabort fetch pagetable ipa %p %p\n", faultpage, vcpu->reg.elr);
+    exit_stat_reason(vcpu, EXIT_IABT_S1PTW);
+    vmm_clog(LC_TRAP, "\tiabort fetch pagetable ipa %p %p\n", faultpage, vcpu->reg.elr);
 
     if(!vsm_read_fetch_page(faultpage))
       panic("vm_iabort: no page");
@@ -117,6 +121,8 @@ static int vm_iabort(struct vcpu *vcpu, u64 iss, u64 far) {
       panic("no page %p %p %p", faultpage, far, vcpu->reg.elr);
   }
 
+  page_prof_fault(vcpu, faultpage | PAGE_OFFSET(far), false);
+
   return 0;
 }
 
@@ -131,6 +137,9 @@ static int vm_dabort(struct vcpu *vcpu, u64 iss, u64 far) {
 
   if(fnv)
     panic("fnv");
+
+  fault_lat_trap(vcpu);
+
   /*
   if(ar)
     vmm_warn("acqrel %p\n", vcpu->reg.elr);
@@ -139,14 +148,15 @@ static int vm_dabort(struct vcpu *vcpu, u64 iss, u64 far) {
 
   if(s1ptw) {
     /* fetch pagetable */
-    vmm_log("\tdabort fetch pagetable ipa %p %p\n", fipa_page, vcpu->reg.elr);
+    exit_stat_reason(vcpu, EXIT_DABT_S1PTW);
+    vmm_clog(LC_TRAP, "\tdabort fetch pagetable ipa %p %p\n", fipa_page, vcpu->reg.elr);
     vsm_read_fetch_page(fipa_page);
+    page_prof_fault(vcpu, fipa_page, false);
 
     return 1;
   }
 
-  printf("VM DABORT !!!! %p %p elr %p\n", far, fipa_page, vcpu->reg.elr);
-
+  vmm_clog(LC_TRAP, "dabort %p %p elr %p\n", far, fipa_page, vcpu->reg.elr);
 
   u64 ipa = fipa_page | (far & (PAGESIZE-1));
   vcpu->dabt.fault_va = far;
@@ -162,17 +172,11 @@ static int vm_dabort(struct vcpu *vcpu, u64 iss, u64 far) {
   else
     pa = vsm_read_fetch_page(fipa_page);
 
-  if(fipa_page == 0x4089b000) {
-    printf("!!!!!!!!!!!!!!!!!!nanda omae %p %p\n", far, fipa_page);
-    dabort_iss_dump(iss);
-    s2_pte_dump(fipa_page);
-    do_at_trans(far, s12, e1, r);
-    u64 par = read_sysreg(par_el1);
-    dump_par_el1(par);
-  }
-
-  if(pa)
+  if(pa) {
+    exit_stat_reason(vcpu, wnr ? EXIT_DABT_VSM_WRITE : EXIT_DABT_VSM_READ);
+    page_prof_fault(vcpu, ipa, wnr);
     return 1;
+  }
 
   /*
   u32 op = *(u32 *)at_uva2pa(vcpu->reg.elr);
@@ -233,11 +237,41 @@ static int hvc_handler(struct vcpu *vcpu, int imm) {
     case 0:
       vpsci_handler(vcpu);
       return 0;
+    case 1:     /* dump vsm trace rings to console */
+      vsm_trace_dump(0);
+      return 0;
+    case 2:     /* fault latency: x0 = buffer ipa (0: console), x1 = size */
+      if(vcpu->reg.x[0])
+        vcpu->reg.x[0] = fault_lat_copy_to_guest(vcpu, vcpu->reg.x[0], vcpu->reg.x[1]);
+      else
+        fault_lat_dump();
+      return 0;
+    case 3:     /* dump pmu samples of this node to console */
+      pmuprof_dump();
+      return 0;
+    case 4:     /* exit stats: x0 = buffer ipa (0: console), x1 = size */
+      if(vcpu->reg.x[0])
+        vcpu->reg.x[0] = exit_stat_copy_to_guest(vcpu, vcpu->reg.x[0], vcpu->reg.x[1]);
+      else
+        exit_stat_dump();
+      return 0;
     default:
       return -1;
   }
 }
 
+/* aborts are refined while handled: a dabort is mmio unless vsm had the page */
+static int exit_reason(u64 ec, u64 iss) {
+  switch(ec) {
+    case 0x1:   return iss & 0x1 ? EXIT_WFE : EXIT_WFI;
+    case 0x16:  return EXIT_HVC;
+    case 0x17:  return EXIT_SMC;
+    case 0x18:  return EXIT_SYSREG;
+    case 0x20:  return EXIT_IABT;
+    default:    return EXIT_DABT_MMIO;
+  }
+}
+
 static void dabort_iss_dump(u64 iss) {
   int dfsc = iss & 0x3f;
 
@@ -285,9 +319,16 @@ void vm_sync_handler() {
   u64 ec = (esr >> 26) & 0x3f;
   u64 iss = esr & 0x1ffffff;
 
+  exit_stat_enter(current, exit_reason(ec, iss));
+  pmuprof_exit_enter(ec);
+
   switch(ec) {
     case 0x1:     /* trap WF* */
-      // vmm_log("wf* trapped\n");
+      if(iss & 0x1)   /* TI: WFE */
+        vcpu_wfe(current);
+      else
+        vcpu_wfi(current);
+
       current->reg.elr += 4;
       break;
     case 0x16:    /* trap hvc */
@@ -301,6 +342,8 @@ void vm_sync_handler() {
 
       break;
     case 0x18:    /* trap system regsiter */
+      exit_stat_sysreg(current, iss);
+
       if(vsysreg_emulate(current, iss) < 0)
         panic("unknown msr/mrs access %p", iss);
 
@@ -331,6 +374,18 @@ void vm_sync_handler() {
       vmm_log("ec %p iss %p elr %p far %p\n", ec, iss, elr, far);
       panic("unknown sync");
   }
+
+  exit_stat_leave(current);
+
+  /* working set lives on other node: follow it */
+  vcpu_migrate_check(current);
+
+  /* timeslice expired or a vcpu woken up during this trap */
+  sched_preempt();
+
+  fault_lat_resume(current);
+
+  pmuprof_exit_leave();
 }
 
 void trapinit() {
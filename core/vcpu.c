@@ -14,6 +14,7 @@
 #include "arch-timer.h"
 #include "memlayout.h"
 #include "s2mm.h"
+#include "sched.h"
 
 struct vcpu *vcpu0;
 
@@ -51,16 +52,15 @@ void vcpuid_init(u32 *vcpuids, int nvcpu) {
   }
 }
 
-void trapret(void);
-
+/*
+ *  enter the scheduler loop of this pcpu
+ */
 void vcpu_entry() {
-  vmm_log("entering vcpu%d\n", current->vmpidr);
+  vmm_log("cpu%d: entering vcpu%d\n", cpuid(), current->vmpidr);
 
   if(!current->initialized)
     panic("maybe current vcpu uninitalized");
 
-  write_sysreg(vmpidr_el2, current->vmpidr);
-  
   u64 vpidr = read_sysreg(midr_el1);
   write_sysreg(vpidr_el2, vpidr);
 
@@ -74,55 +74,175 @@ void vcpu_entry() {
 
   switch_vttbr(vttbr);
 
-  write_sysreg(sctlr_el1, current->sctlr_el1);
-
   isb();
 
   // vcpu_dump(current);
 
-  /* vmentry */
-  trapret();
+  sched_start();
 }
 
+void vcpu_save_state(struct vcpu *vcpu) {
+  struct vcpu_sysregs *sys = &vcpu->sys;
+
+  sys->sctlr_el1 = read_sysreg(sctlr_el1);
+  sys->ttbr0_el1 = read_sysreg(ttbr0_el1);
+  sys->ttbr1_el1 = read_sysreg(ttbr1_el1);
+  sys->tcr_el1 = read_sysreg(tcr_el1);
+  sys->mair_el1 = read_sysreg(mair_el1);
+  sys->amair_el1 = read_sysreg(amair_el1);
+  sys->vbar_el1 = read_sysreg(vbar_el1);
+  sys->contextidr_el1 = read_sysreg(contextidr_el1);
+  sys->cpacr_el1 = read_sysreg(cpacr_el1);
+  sys->elr_el1 = read_sysreg(elr_el1);
+  sys->spsr_el1 = read_sysreg(spsr_el1);
+  sys->esr_el1 = read_sysreg(esr_el1);
+  sys->far_el1 = read_sysreg(far_el1);
+  sys->afsr0_el1 = read_sysreg(afsr0_el1);
+  sys->afsr1_el1 = read_sysreg(afsr1_el1);
+  sys->par_el1 = read_sysreg(par_el1);
+  sys->tpidr_el0 = read_sysreg(tpidr_el0);
+  sys->tpidrro_el0 = read_sysreg(tpidrro_el0);
+  sys->tpidr_el1 = read_sysreg(tpidr_el1);
+  sys->sp_el0 = read_sysreg(sp_el0);
+  sys->sp_el1 = read_sysreg(sp_el1);
+  sys->cntkctl_el1 = read_sysreg(cntkctl_el1);
+  sys->csselr_el1 = read_sysreg(csselr_el1);
+  sys->mdscr_el1 = read_sysreg(mdscr_el1);
+  sys->cntv_ctl_el0 = read_sysreg(cntv_ctl_el0);
+  sys->cntv_cval_el0 = read_sysreg(cntv_cval_el0);
+
+  sys->esr_el2 = read_sysreg(esr_el2);
+  sys->far_el2 = read_sysreg(far_el2);
+  sys->hpfar_el2 = read_sysreg(hpfar_el2);
+  sys->elr_el2 = read_sysreg(elr_el2);
+  sys->spsr_el2 = read_sysreg(spsr_el2);
+
+  /* virtual timer of the outgoing vcpu must not fire on the next one */
+  write_sysreg(cntv_ctl_el0, 0);
+
+  fpsimd_save(&vcpu->fp);
+
+  localnode.irqchip->save_state(&vcpu->gic);
+}
+
+/* called with current = vcpu */
+void vcpu_restore_state(struct vcpu *vcpu) {
+  struct vcpu_sysregs *sys = &vcpu->sys;
+
+  write_sysreg(vmpidr_el2, vcpu->vmpidr);
+
+  write_sysreg(sctlr_el1, sys->sctlr_el1);
+  write_sysreg(ttbr0_el1, sys->ttbr0_el1);
+  write_sysreg(ttbr1_el1, sys->ttbr1_el1);
+  write_sysreg(tcr_el1, sys->tcr_el1);
+  write_sysreg(mair_el1, sys->mair_el1);
+  write_sysreg(amair_el1, sys->amair_el1);
+  write_sysreg(vbar_el1, sys->vbar_el1);
+  write_sysreg(contextidr_el1, sys->contextidr_el1);
+  write_sysreg(cpacr_el1, sys->cpacr_el1);
+  write_sysreg(elr_el1, sys->elr_el1);
+  write_sysreg(spsr_el1, sys->spsr_el1);
+  write_sysreg(esr_el1, sys->esr_el1);
+  write_sysreg(far_el1, sys->far_el1);
+  write_sysreg(afsr0_el1, sys->afsr0_el1);
+  write_sysreg(afsr1_el1, sys->afsr1_el1);
+  write_sysreg(par_el1, sys->par_el1);
+  write_sysreg(tpidr_el0, sys->tpidr_el0);
+  write_sysreg(tpidrro_el0, sys->tpidrro_el0);
+  write_sysreg(tpidr_el1, sys->tpidr_el1);
+  write_sysreg(sp_el0, sys->sp_el0);
+  write_sysreg(sp_el1, sys->sp_el1);
+  write_sysreg(cntkctl_el1, sys->cntkctl_el1);
+  write_sysreg(csselr_el1, sys->csselr_el1);
+  write_sysreg(mdscr_el1, sys->mdscr_el1);
+  write_sysreg(cntv_cval_el0, sys->cntv_cval_el0);
+  write_sysreg(cntv_ctl_el0, sys->cntv_ctl_el0);
+
+  write_sysreg(esr_el2, sys->esr_el2);
+  write_sysreg(far_el2, sys->far_el2);
+  write_sysreg(hpfar_el2, sys->hpfar_el2);
+  write_sysreg(elr_el2, sys->elr_el2);
+  write_sysreg(spsr_el2, sys->spsr_el2);
+
+  isb();
+
+  fpsimd_restore(&vcpu->fp);
+
+  localnode.irqchip->restore_state(&vcpu->gic);
+
+  /* virqs queued while switched out */
+  vgic_inject_pending_irqs();
+}
+
+/*
+ *  initialize vcpus assigned to this pcpu,
+ *  current is the first of them until the scheduler starts.
+ */
 void vcpu_init_core() {
-  int cpu = cpuid();
+  struct runqueue *rq = &mycpu->rq;
 
-  struct vcpu *vcpu = local_vcpu(cpu);
+  for(int i = 0; i < rq->nvcpu; i++) {
+    struct vcpu *vcpu = rq->vcpus[i];
 
-  set_current_vcpu(vcpu);
+    if(vcpu == local_vcpu(0))
+      vcpu0 = vcpu;
 
-  /* current = vcpu */
+    vgic_cpu_init(vcpu);
+    sched_init_vcpu(vcpu);
 
-  if(cpu == 0)
-    vcpu0 = vcpu;
+    vcpu->reg.spsr = PSR_EL1H;     /* EL1h */
+    vcpu->sys.sctlr_el1 = 0xc50838;
 
-  vgic_cpu_init(vcpu);
+    /* vgic of this pcpu is in reset state */
+    localnode.irqchip->save_state(&vcpu->gic);
 
-  vcpu->reg.spsr = PSR_EL1H;     /* EL1h */
-  vcpu->sctlr_el1 = 0xc50838;
+    vcpu->initialized = true;
+  }
 
-  vcpu->initialized = true;
+  if(rq->nvcpu == 0)
+    panic("cpu%d: no vcpu", cpuid());
+
+  set_current_vcpu(rq->vcpus[0]);
 }
 
 void vcpu_shutdown(struct vcpu *vcpu) {
   ;
 }
 
+/*
+ *  wait until one of vcpus on this pcpu is woken up by vpsci,
+ *  and make it current
+ */
 void wait_for_current_vcpu_online() {
+  struct runqueue *rq = &mycpu->rq;
+
   vmm_log("cpu%d: current online: %d\n", cpuid(), current->online);
 
-  while(!current->online)
+  for(;;) {
+    for(int i = 0; i < rq->nvcpu; i++) {
+      if(rq->vcpus[i]->online) {
+        set_current_vcpu(rq->vcpus[i]);
+        return;
+      }
+    }
+
     wfi();
+  }
 }
 
+/*
+ *  vcpus of this node are spread over pcpus,
+ *  a pcpu runs more than one vcpu when vcpus outnumber pcpus
+ */
 void vcpu_preinit() {
   for(int i = 0; i < VCPU_PER_NODE_MAX; i++) {
     struct vcpu *v = &localvm.vcpus[i];
 
     spinlock_init(&v->lock);
-    spinlock_init(&v->pending.lock);
+    memset(&v->pending, 0, sizeof(v->pending));
 
-    v->pcpu = get_cpu(i);
+    v->pcpu = get_cpu(pcpu_base() + i % nr_online_pcpus);
+    v->state = VCPU_RUNNABLE;
   }
 }
 
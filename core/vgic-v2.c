@@ -110,16 +110,7 @@ void vgic_v2_set_targets(struct vcpu *vcpu, int intid, int len, u32 val) {
       irq->target = NULL;
     }
 
-    if(irq->hw) {
-      int t;
-
-      if(irq->target)
-        t = 1 << pcpu_id(irq->target->pcpu);
-      else
-        t = 1 << 0;     // route to 0
-
-      localnode.irqchip->set_targets(irq->hwirq, t);
-    }
+    vgic_route_hwirq(irq);
 
     spin_unlock_irqrestore(&irq->lock, flags);
   }
@@ -155,13 +146,9 @@ static void vgic_v2_icpidr2_read(struct vcpu *vcpu, struct mmio_access *mmio) {
 
 static void vgic_v2_sgir_write(struct vcpu *vcpu, struct mmio_access *mmio) {
   struct gic_sgi sgi;
-  struct vgic_irq *irq;
   u32 sgir = mmio->val;
 
   int virq = sgir & 0xf;
-  irq = vgic_get_irq(vcpu, virq);
-
-  irq->req_cpu = vcpu->vcpuid;
 
   sgi.targets = (sgir >> GICD_SGIR_TargetList_SHIFT) & 0xff;
   sgi.sgi_id = virq;
@@ -136,16 +136,7 @@ static void vgic_v3_iroute_write(struct vcpu *vcpu, struct mmio_access *mmio, u6
 
   vgic_set_irouter(irq, irouter);
 
-  if(irq->hw) {
-    u64 t;
-
-    if(irq->target)
-      t = irq->target->pcpu->mpidr; 
-    else
-      t = 0;
-
-    localnode.irqchip->route_irq(intid, t);
-  }
+  vgic_route_hwirq(irq);
 
   spin_unlock_irqrestore(&irq->lock, flags);
 }
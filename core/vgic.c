@@ -22,15 +22,55 @@
 #include "assert.h"
 #include "vgic-v2.h"
 #include "vgic-v3.h"
+#include "atomic.h"
+#include "arch-timer.h"
+#include "sched.h"
 
 static struct vgic vgic_dist;
 
+/* one MSG_SGI per node: the receiver fans out to its vcpus in targets */
 struct sgi_msg_hdr {
   POCV2_MSG_HDR_STRUCT;
-  int target;
+  u64 targets;      /* bitmap of target vcpuid */
   int sgi_id;
+  int src;          /* requester vcpuid */
+  bool bcast;
 };
 
+/*
+ *  cross-node SPI delivery: several virqs are batched in one MSG_INTERRUPT
+ *  (up to VIRQ_MSG_BATCH)
+ */
+enum virq_msg_type {
+  VIRQ_MSG_INJECT,    /* origin node -> target vcpu's node */
+  VIRQ_MSG_EOI,       /* guest EOIed level irq: target vcpu's node -> origin node */
+};
+
+struct remote_virq {
+  u16 intid: 10;
+  u16 group: 1;
+  u16 level: 1;
+  u8 priority;
+  u8 vcpuid;
+};
+
+struct interrupt_msg_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u8 type;            /* enum virq_msg_type */
+  u8 nirqs;
+  struct remote_virq virqs[VIRQ_MSG_BATCH];
+};
+
+/* per-pcpu batch, flushed at the tail of irq_entry() */
+struct virq_batch {
+  int nodeid;
+  struct interrupt_msg_hdr hdr;
+};
+
+static struct virq_batch virq_batch[NCPU_MAX];
+
+static void vgic_send_sgi_msg(int nodeid, u64 targets, int sgi_id, int src, bool bcast);
+
 void vgic_enable_irq(struct vcpu *vcpu, struct vgic_irq *irq) {
   if(irq->enabled)
     return;
@@ -40,10 +80,16 @@ void vgic_enable_irq(struct vcpu *vcpu, struct vgic_irq *irq) {
 
   vmm_warn("vcpu %d enable irq %d\n", vcpu->vcpuid, intid);
 
-  if(valid_intid(intid))
-    localnode.irqchip->enable_irq(intid);
-  else
+  if(!valid_intid(intid))
     panic("?");
+
+  /* passthrough spi (not owned by vmm): link list register to physical irq */
+  if(is_spi(intid) && !irq->hw && !irq_get(intid)->handler) {
+    vgic_connect_hwirq(vcpu, intid, intid);
+    vgic_route_hwirq(irq);
+  }
+
+  localnode.irqchip->enable_irq(intid);
 }
 
 void vgic_disable_irq(struct vcpu *vcpu, struct vgic_irq *irq) {
@@ -61,29 +107,181 @@ void vgic_disable_irq(struct vcpu *vcpu, struct vgic_irq *irq) {
     panic("?");
 }
 
+static void vgic_set_pending(struct vcpu *vcpu, u32 intid) {
+  atomic_set_bit(intid, vcpu->pending.bitmap);
+}
+
+static int vgic_pending_lr(struct vcpu *vcpu, u32 intid) {
+  struct vgic_irq *irq = vgic_get_irq(vcpu, intid);
+  struct gic_pending_irq pendirq;
+
+  pendirq.virq = intid;
+  pendirq.group = irq->igroup;
+  pendirq.priority = irq->priority;
+  pendirq.req_cpu = irq->req_cpu;     /* for GICv2 SGI */
+
+  pendirq.eoi = false;
+
+  if(is_sgi(intid)) {
+    pendirq.pirq = NULL;
+  } else if(irq->remote) {
+    /* physical irq is on remote node: notify it when the guest EOIs level irq */
+    pendirq.pirq = NULL;
+    pendirq.eoi = irq->cfg == CONFIG_LEVEL;
+  } else if(irq->hw) {
+    /* guest EOI deactivates the physical irq without a vmm exit */
+    pendirq.pirq = irq_get(irq->hwirq);
+  } else {
+    pendirq.pirq = NULL;
+  }
+
+  return localnode.irqchip->inject_guest_irq(&pendirq);
+}
+
+static void vgic_set_underflow_irq(struct vcpu *vcpu, bool enable) {
+  if(vcpu->vgic.lr_underflow == enable)
+    return;
+
+  vcpu->vgic.lr_underflow = enable;
+  localnode.irqchip->set_underflow_irq(enable);
+}
+
+/*
+ *  drain pending bitmap of current vcpu into list registers
+ *  in priority order (lower value first).
+ *  irqs which do not fit stay in the bitmap and the underflow
+ *  maintenance interrupt refills list registers as the guest EOIs them.
+ */
 void vgic_inject_pending_irqs() {
-  u64 flags;
   struct vcpu *vcpu = current;
+  u64 pending[VIRQ_MAX / 64];
+  u64 flags;
+  bool any = false, left = false;
 
-  spin_lock_irqsave(&vcpu->pending.lock, flags);
+  /* list registers are not vcpu's: drained when it is restored */
+  if(vcpu->state != VCPU_RUNNING)
+    return;
 
-  int head = vcpu->pending.head;
+  irqsave(flags);
 
-  while(head != vcpu->pending.tail) {
-    struct gic_pending_irq *pendirq = vcpu->pending.irqs[head];
-    if(localnode.irqchip->inject_guest_irq(pendirq) < 0)
-      ;   /* do nothing */
+  for(int i = 0; i < VIRQ_MAX / 64; i++) {
+    pending[i] = vcpu->pending.bitmap[i] ? atomic_xchg64(&vcpu->pending.bitmap[i], 0) : 0;
+    any |= !!pending[i];
+  }
 
-    head = (head + 1) % 4;
+  if(!any)
+    goto out;
 
-    free(pendirq);
+  for(;;) {
+    int intid = -1, prio = 256;
+
+    for(int i = 0; i < VIRQ_MAX / 64; i++) {
+      for(u64 w = pending[i]; w; w &= w - 1) {
+        int id = i * 64 + __builtin_ctzl(w);
+        int p = vgic_get_irq(vcpu, id)->priority;
+
+        if(p < prio) {
+          prio = p;
+          intid = id;
+        }
+      }
+    }
+
+    if(intid < 0)
+      break;
+
+    if(vgic_pending_lr(vcpu, intid) == GIC_INJECT_NOLR)
+      break;
+
+    /* injected, or already pending in list register */
+    pending[intid / 64] &= ~(1ul << (intid % 64));
+  }
+
+  /* list registers are full: keep the rest pending */
+  for(int i = 0; i < VIRQ_MAX / 64; i++) {
+    if(pending[i]) {
+      atomic_or64(&vcpu->pending.bitmap[i], pending[i]);
+      left = true;
+    }
   }
 
-  vcpu->pending.head = head;
+out:
+  vgic_set_underflow_irq(vcpu, left);
+
+  irqrestore(flags);
+}
+
+static void vgic_flush_batch(struct virq_batch *b) {
+  struct msg msg;
+
+  if(!b->hdr.nirqs)
+    return;
+
+  msg_init(&msg, b->nodeid, MSG_INTERRUPT, &b->hdr, NULL, 0);
+
+  send_msg(&msg);
+
+  b->hdr.nirqs = 0;
+}
+
+void vgic_flush_remote_virqs() {
+  u64 flags;
+
+  irqsave(flags);
+
+  vgic_flush_batch(&virq_batch[cpuid()]);
+
+  irqrestore(flags);
+}
+
+/* virqs per MSG_INTERRUPT: 1 sends them one by one */
+int virq_msg_batch = VIRQ_MSG_BATCH;
+
+static void vgic_queue_remote_virq(int nodeid, enum virq_msg_type type,
+                                   struct remote_virq *v) {
+  struct virq_batch *b;
+  u64 flags;
+
+  irqsave(flags);
+
+  b = &virq_batch[cpuid()];
+
+  if(b->hdr.nirqs &&
+     (b->nodeid != nodeid || b->hdr.type != type || b->hdr.nirqs >= virq_msg_batch))
+    vgic_flush_batch(b);
 
-  spin_unlock_irqrestore(&vcpu->pending.lock, flags);
+  b->nodeid = nodeid;
+  b->hdr.type = type;
+  b->hdr.virqs[b->hdr.nirqs++] = *v;
 
-  dsb(ish);
+  irqrestore(flags);
+
+  /* outside of interrupt context nothing else will join this batch */
+  if(!in_interrupt())
+    vgic_flush_remote_virqs();
+}
+
+static void vgic_remote_eoi(struct vcpu *vcpu, u32 intid) {
+  struct vgic_irq *irq = vgic_get_irq(vcpu, intid);
+  struct remote_virq v = { .intid = intid };
+
+  if(!irq || !irq->remote)
+    return;
+
+  vgic_queue_remote_virq(irq->src_node, VIRQ_MSG_EOI, &v);
+}
+
+static void vgic_maintenance_intr(void * __unused arg) {
+  struct vcpu *vcpu = current;
+  u32 virqs[16];
+  int n;
+
+  n = localnode.irqchip->take_eoi_lrs(virqs, 16);
+  for(int i = 0; i < n; i++)
+    vgic_remote_eoi(vcpu, virqs[i]);
+
+  /* list registers (almost) drained: refill them */
+  vgic_inject_pending_irqs();
 }
 
 bool vgic_irq_pending(struct vgic_irq *irq) {
@@ -97,51 +295,82 @@ void vgic_readonly(struct vcpu * __unused vcpu, struct mmio_access * __unused mm
   return;
 }
 
-static int vgic_inject_virq_local(struct vcpu *target, struct gic_pending_irq *pendirq) {
-  if(target == current) {
-    if(localnode.irqchip->inject_guest_irq(pendirq) < 0)
-      ;   /* do nothing */
-
-    free(pendirq);
-  } else {
-    u64 flags = 0;
+static bool vgic_pending_empty(struct vcpu *vcpu) {
+  for(int i = 0; i < VIRQ_MAX / 64; i++) {
+    if(vcpu->pending.bitmap[i])
+      return false;
+  }
 
-    spin_lock_irqsave(&target->pending.lock, flags);
+  return true;
+}
 
-    int tail = (target->pending.tail + 1) % 4;
+static int vgic_inject_virq_local(struct vcpu *target, u32 virqno) {
+  u64 flags;
 
-    if(tail != target->pending.head) {
-      target->pending.irqs[target->pending.tail] = pendirq;
+  if(target != current || target->state != VCPU_RUNNING) {
+    vgic_set_pending(target, virqno);
+    sched_wakeup(target);
 
-      target->pending.tail = tail;
-    } else {
-      panic("pending queue full %d %d\n", target->vcpuid, tail);
-    }
+    if(target->pcpu != mycpu)
+      cpu_send_inject_sgi(target->pcpu);
 
-    spin_unlock_irqrestore(&target->pending.lock, flags);
+    return 0;
+  }
 
-    dsb(ish);
+  irqsave(flags);
 
-    cpu_send_inject_sgi(target->pcpu);
+  /* fast path (e.g. timer tick): nothing queued, write list register directly */
+  if(!vgic_pending_empty(target) || vgic_pending_lr(target, virqno) == GIC_INJECT_NOLR) {
+    vgic_set_pending(target, virqno);
+    vgic_inject_pending_irqs();
   }
 
+  irqrestore(flags);
+
+  /* current may be about to block in wfi */
+  if(sched_multiplexed())
+    sched_wakeup(target);
+
   return 0;
 }
 
-static int vgic_inject_virq_remote(struct vgic_irq *irq, struct gic_pending_irq *pendirq) {
-  u64 vcpuid = irq->vcpuid;
-  int nodeid = vcpuid_to_nodeid(vcpuid);
-  if(nodeid < 0)
+static int vgic_spi_target_vcpuid(struct vgic_irq *irq) {
+  if(localvm.vgic->version == 2)
+    return irq->targets ? __builtin_ffs(irq->targets) - 1 : -1;
+  else
+    return irq->vcpuid;
+}
+
+/*
+ *  forward spi to the node where its target vcpu is.
+ *  level irq stays active on this node until the remote guest EOIs it,
+ *  deactivation then resamples the line.
+ */
+static int vgic_inject_virq_remote(struct vgic_irq *irq, u32 virqno) {
+  struct remote_virq v;
+  int vcpuid = vgic_spi_target_vcpuid(irq);
+  int nodeid;
+
+  if(vcpuid < 0 || (nodeid = vcpuid_to_nodeid(vcpuid)) < 0)
     return -1;
 
-  // unimpl
-  panic("inject remote Node %d", nodeid);
+  v.intid = virqno;
+  v.group = irq->igroup;
+  v.level = irq->cfg == CONFIG_LEVEL;
+  v.priority = irq->priority;
+  v.vcpuid = vcpuid;
+
+  /* edge irq: remote list register cannot link to our physical irq */
+  if(!v.level)
+    localnode.irqchip->deactive_irq(virqno);
+
+  vgic_queue_remote_virq(nodeid, VIRQ_MSG_INJECT, &v);
 
   return 0;
 }
 
-void vgic_connect_hwirq(int virq_no, int hwirq_no) {
-  struct vgic_irq *virq = vgic_get_irq(current, virq_no);
+void vgic_connect_hwirq(struct vcpu *vcpu, int virq_no, int hwirq_no) {
+  struct vgic_irq *virq = vgic_get_irq(vcpu, virq_no);
 
   if(!virq)
     return;
@@ -150,45 +379,47 @@ void vgic_connect_hwirq(int virq_no, int hwirq_no) {
   virq->hwirq = hwirq_no;
 }
 
+/* route hw-linked spi to the pcpu of its target vcpu */
+void vgic_route_hwirq(struct vgic_irq *irq) {
+  struct gic_irqchip *irqchip = localnode.irqchip;
+
+  if(!irq->hw || !is_spi(irq->hwirq))
+    return;
+
+  if(irqchip->version == 2) {
+    if(irq->target)
+      irqchip->set_targets(irq->hwirq, 1 << pcpu_id(irq->target->pcpu));
+    else
+      irqchip->set_targets(irq->hwirq, 1 << 0);     // route to 0
+  } else {
+    if(irq->target)
+      irqchip->route_irq(irq->hwirq, irq->target->pcpu->mpidr);
+    else
+      irqchip->route_irq(irq->hwirq, 0);
+  }
+}
+
+/*
+ *  mark virq pending on target vcpu: allocation-free and lock-free
+ */
 int vgic_inject_virq(struct vcpu *target, u32 virqno) {
-  int rc;
+  if(virqno >= VIRQ_MAX || !valid_intid(virqno)) {
+    vmm_warn("virq%d not exist\n", virqno);
+    return -1;
+  }
+
   struct vgic_irq *irq = vgic_get_irq(target, virqno);
   if(!irq || !irq->enabled)
     return -1;
 
-  struct gic_pending_irq *pendirq = malloc(sizeof(*pendirq));
-
-  pendirq->virq = virqno;
-  pendirq->group = irq->igroup;       /* irq->igroup */
-  pendirq->priority = irq->priority;
-  pendirq->req_cpu = irq->req_cpu;    /* for GICv2 SGI */
-
-  if(is_sgi(virqno)) {
-    pendirq->pirq = NULL;
-  } else if(is_ppi(virqno)) {
-    /* virq == pirq */
-    pendirq->pirq = irq_get(virqno);
-  } else if(is_spi(virqno)) {
-    pendirq->pirq = irq_get(virqno);
+  if(is_spi(virqno)) {
     target = irq->target;
 
     if(!target)
-      panic("target?");
-  } else {
-    vmm_warn("virq%d not exist\n", virqno);
-    free(pendirq);
-    return -1;
+      return vgic_inject_virq_remote(irq, virqno);
   }
 
-  if(target)
-    rc = vgic_inject_virq_local(target, pendirq);
-  else
-    rc = vgic_inject_virq_remote(irq, pendirq);
-
-  if(rc < 0)
-    free(pendirq);
-
-  return rc;
+  return vgic_inject_virq_local(target, virqno);
 }
 
 struct vgic_irq *vgic_get_irq(struct vcpu *vcpu, int intid) {
@@ -204,21 +435,120 @@ struct vgic_irq *vgic_get_irq(struct vcpu *vcpu, int intid) {
   return NULL;
 }
 
+static void vgic_inject_sgi(struct vcpu *target, int sgi_id, int src) {
+  struct vgic_irq *irq = vgic_get_irq(target, sgi_id);
+
+  irq->req_cpu = src;
+
+  if(vgic_inject_virq(target, sgi_id) < 0)
+    panic("sgi failed");
+}
+
+/* sender's cluster table is stale: pass sgi on to where the vcpus migrated */
+static void vgic_forward_sgi(u64 targets, int sgi_id, int src) {
+  struct cluster_node *node;
+
+  foreach_cluster_node(node) {
+    u64 nodetargets = 0;
+
+    if(node->nodeid == local_nodeid())
+      continue;
+
+    for(int i = 0; i < node->nvcpu; i++) {
+      if(targets & (1ul << node->vcpus[i]))
+        nodetargets |= 1ul << node->vcpus[i];
+    }
+
+    if(nodetargets)
+      vgic_send_sgi_msg(node->nodeid, nodetargets, sgi_id, src, false);
+  }
+}
+
 static void recv_sgi_msg_intr(struct msg *msg) {
   struct sgi_msg_hdr *h = (struct sgi_msg_hdr *)msg->hdr;
-  struct vcpu *target = node_vcpu(h->target);
   int virq = h->sgi_id;
-
-  if(!target)
-    panic("null target");
+  u64 moved = 0;
 
   if(!is_sgi(virq))
     panic("invalid sgi");
 
-  vmm_log("SGI: recv sgi(id=%d) request to vcpu%d\n", virq, target->vcpuid);
+  vmm_clog(LC_VGIC, "SGI: recv sgi(id=%d) request to vcpus %p\n", virq, h->targets);
 
-  if(vgic_inject_virq(target, virq) < 0)
-    panic("sgi failed");
+  /* broadcast frame also carries vcpus of other nodes */
+  for(u64 t = h->targets; t; t &= t - 1) {
+    int vcpuid = __builtin_ctzl(t);
+    struct vcpu *target = node_vcpu(vcpuid);
+
+    if(target)
+      vgic_inject_sgi(target, virq, h->src);
+    else if(!h->bcast)
+      moved |= 1ul << vcpuid;
+  }
+
+  if(moved)
+    vgic_forward_sgi(moved, virq, h->src);
+}
+
+/*
+ *  target vcpu migrated away: level irq is EOIed back to the origin node,
+ *  which samples the line again and routes it with its updated table.
+ *  edge irq is forwarded.
+ */
+static void vgic_bounce_remote_virq(int src_node, struct remote_virq *v) {
+  int nodeid;
+
+  if(v->level) {
+    vgic_queue_remote_virq(src_node, VIRQ_MSG_EOI, v);
+    return;
+  }
+
+  nodeid = vcpuid_to_nodeid(v->vcpuid);
+
+  if(nodeid < 0 || nodeid == local_nodeid()) {
+    vmm_warn("MSG_INTERRUPT: vcpu%d not found, drop virq%d\n", v->vcpuid, v->intid);
+    return;
+  }
+
+  vgic_queue_remote_virq(nodeid, VIRQ_MSG_INJECT, v);
+}
+
+static void recv_interrupt_msg_intr(struct msg *msg) {
+  struct interrupt_msg_hdr *h = (struct interrupt_msg_hdr *)msg->hdr;
+  struct vgic_irq *irq;
+  struct vcpu *target;
+  u64 flags;
+
+  for(int i = 0; i < h->nirqs && i < VIRQ_MSG_BATCH; i++) {
+    struct remote_virq *v = &h->virqs[i];
+
+    if(!is_spi(v->intid))
+      panic("MSG_INTERRUPT: invalid spi %d", v->intid);
+
+    if(h->type == VIRQ_MSG_EOI) {
+      localnode.irqchip->deactive_irq(v->intid);
+      continue;
+    }
+
+    target = node_vcpu(v->vcpuid);
+    if(!target) {
+      vgic_bounce_remote_virq(h->hdr.src_id, v);
+      continue;
+    }
+
+    irq = vgic_get_irq(target, v->intid);
+
+    spin_lock_irqsave(&irq->lock, flags);
+
+    irq->priority = v->priority;
+    irq->igroup = v->group;
+    irq->cfg = v->level ? CONFIG_LEVEL : CONFIG_EDGE;
+    irq->remote = true;
+    irq->src_node = h->hdr.src_id;
+
+    spin_unlock_irqrestore(&irq->lock, flags);
+
+    vgic_inject_virq_local(target, v->intid);
+  }
 }
 
 void vgic_iidr_read(struct vcpu *vcpu, struct mmio_access *mmio) {
@@ -272,20 +602,22 @@ void vgic_igroup_write(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset)
   }
 }
 
+/*
+ *  enable and priority registers are hot at guest boot and on every
+ *  irq affinity change.  reads take no irq lock (a racing write is seen
+ *  either before or after), writes lock only irqs whose state changes.
+ */
 void vgic_ienable_read(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset) {
   struct vgic_irq *irq;
   u32 iser = 0;
   int intid = offset / sizeof(u32) * 32;
-  u64 flags;
 
   for(int i = 0; i < 32; i++) {
     irq = vgic_get_irq(vcpu, intid + i);
     if(!irq)
       return;
 
-    spin_lock_irqsave(&irq->lock, flags);
     iser |= (u32)irq->enabled << i;
-    spin_unlock_irqrestore(&irq->lock, flags);
   }
 
   mmio->val = iser;
@@ -297,16 +629,17 @@ void vgic_isenable_write(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset
   u32 val = mmio->val;
   u64 flags;
 
-  for(int i = 0; i < 32; i++) {
-    irq = vgic_get_irq(vcpu, intid+i);
+  for(u32 v = val; v; v &= v - 1) {
+    irq = vgic_get_irq(vcpu, intid + __builtin_ctz(v));
     if(!irq)
       return;
 
-    if(val & (1 << i)) {
-      spin_lock_irqsave(&irq->lock, flags);
-      vgic_enable_irq(vcpu, irq);
-      spin_unlock_irqrestore(&irq->lock, flags);
-    }
+    if(irq->enabled)
+      continue;
+
+    spin_lock_irqsave(&irq->lock, flags);
+    vgic_enable_irq(vcpu, irq);
+    spin_unlock_irqrestore(&irq->lock, flags);
   }
 }
 
@@ -316,19 +649,17 @@ void vgic_icenable_write(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset
   u32 val = mmio->val;
   u64 flags;
 
-  for(int i = 0; i < 32; i++) {
-    irq = vgic_get_irq(vcpu, intid+i);
+  for(u32 v = val; v; v &= v - 1) {
+    irq = vgic_get_irq(vcpu, intid + __builtin_ctz(v));
     if(!irq)
       return;
 
-    if(val & (1 << i)) {
-      spin_lock_irqsave(&irq->lock, flags);
+    if(!irq->enabled)
+      continue;
 
-      if(irq->enabled)
-        vgic_disable_irq(vcpu, irq);
-
-      spin_unlock_irqrestore(&irq->lock, flags);
-    }
+    spin_lock_irqsave(&irq->lock, flags);
+    vgic_disable_irq(vcpu, irq);
+    spin_unlock_irqrestore(&irq->lock, flags);
   }
 }
 
@@ -351,20 +682,18 @@ void vgic_ipend_read(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset) {
   mmio->val = pendr;
 }
 
+/* priority is a byte of its own: no irq lock */
 void vgic_ipriority_read(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset) {
   struct vgic_irq *irq;
   u32 ipr = 0;
   int intid = offset / sizeof(u32) * 4;
-  u64 flags;
 
   for(int i = 0; i < 4; i++) {
     irq = vgic_get_irq(vcpu, intid + i);
     if(!irq)
       return;
 
-    spin_lock_irqsave(&irq->lock, flags);
     ipr |= (u32)irq->priority << (i * 8);
-    spin_unlock_irqrestore(&irq->lock, flags);
   }
 
   mmio->val = ipr;
@@ -374,16 +703,13 @@ void vgic_ipriority_write(struct vcpu *vcpu, struct mmio_access *mmio, u64 offse
   struct vgic_irq *irq;
   int intid = offset / sizeof(u32) * 4;
   u32 val = mmio->val;
-  u64 flags;
 
   for(int i = 0; i < 4; i++) {
     irq = vgic_get_irq(vcpu, intid+i);
     if(!irq)
       return;
 
-    spin_lock_irqsave(&irq->lock, flags);
     irq->priority = (val >> (i * 8)) & 0xff;
-    spin_unlock_irqrestore(&irq->lock, flags);
   }
 }
 
@@ -433,43 +759,75 @@ void vgic_icfg_write(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset) {
   }
 }
 
+static void vgic_send_sgi_msg(int nodeid, u64 targets, int sgi_id, int src, bool bcast) {
+  struct msg msg;
+  struct sgi_msg_hdr hdr;
+
+  vmm_clog(LC_VGIC, "vgic: route sgi(%d) to remote vcpus %p@%d (%p)\n",
+          sgi_id, targets, bcast ? -1 : nodeid, current->reg.elr);
+
+  hdr.targets = targets;
+  hdr.sgi_id = sgi_id;
+  hdr.src = src;
+  hdr.bcast = bcast;
+
+  msg_init(&msg, nodeid, MSG_SGI, &hdr, NULL, 0);
+
+  if(bcast)
+    send_msg_bcast(&msg);
+  else
+    send_msg(&msg);
+}
+
+/*
+ *  deliver sgi: local vcpus are injected directly, each remote node
+ *  gets one MSG_SGI and "all but self" goes out as one broadcast frame
+ */
 int vgic_emulate_sgi(struct vcpu *vcpu, struct gic_sgi *sgi) {
   int intid = sgi->sgi_id;
-  u16 targets = sgi->targets;
-
+  bool bcast = sgi->mode == SGI_ROUTE_BROADCAST;
+  u64 targets, remote = 0;
   struct cluster_node *node;
-  foreach_cluster_node(node) {
-    for(int i = 0; i < node->nvcpu; i++) {
-      int vcpuid = node->vcpus[i];
 
+  switch(sgi->mode) {
+    case SGI_ROUTE_TARGETS:
       /* TODO: consider Affinity */
-      if((1u << vcpuid) & targets) {
-        // vmm_log("vgic: sgi to vcpu%d\n", vcpuid);
-        struct vcpu *vcpu = node_vcpu(vcpuid);
-
-        if(vcpu) {
-          vmm_log("vgic injection!!!!!!!!!!!!!!!!!%d\n", intid);
-          /* vcpu in localnode */
-          if(vgic_inject_virq(vcpu, intid) < 0)
-            panic("sgi failed");
-        } else {
-          struct msg msg;
-          struct sgi_msg_hdr hdr;
+      targets = sgi->targets;
+      break;
+    case SGI_ROUTE_BROADCAST:
+      targets = ~(1ul << vcpu->vcpuid);
+      break;
+    case SGI_ROUTE_SELF:
+      targets = 1ul << vcpu->vcpuid;
+      break;
+    default:
+      return -1;
+  }
 
-          vmm_log("vgic: route sgi(%d) to remote vcpu%d@%d (%p)\n",
-                  intid, vcpuid, node->nodeid, current->reg.elr);
+  foreach_cluster_node(node) {
+    u64 nodetargets = 0;
 
-          hdr.target = vcpuid;
-          hdr.sgi_id = intid;
+    for(int i = 0; i < node->nvcpu; i++) {
+      int vcpuid = node->vcpus[i];
 
-          msg_init(&msg, node->nodeid, MSG_SGI, &hdr, NULL, 0);
+      if(!((1ul << vcpuid) & targets))
+        continue;
 
-          send_msg(&msg);
-        }
-      }
+      if(node->nodeid == local_nodeid())
+        vgic_inject_sgi(node_vcpu(vcpuid), intid, vcpu->vcpuid);
+      else
+        nodetargets |= 1ul << vcpuid;
     }
+
+    if(nodetargets && !bcast)
+      vgic_send_sgi_msg(node->nodeid, nodetargets, intid, vcpu->vcpuid, false);
+
+    remote |= nodetargets;
   }
 
+  if(remote && bcast)
+    vgic_send_sgi_msg(0, remote, intid, vcpu->vcpuid, true);
+
   return 0;
 }
 
@@ -488,6 +846,7 @@ void vgic_init(void) {
     struct vgic_irq *irq = &vgic->spis[i];
     
     irq->intid = 32 + i;
+    irq->remote = false;
     spinlock_init(&irq->lock);
   }
 
@@ -499,6 +858,8 @@ void vgic_init(void) {
     vgic_v3_init(vgic);
 
   localvm.vgic = vgic;
+
+  irq_register(GIC_MAINTENANCE_IRQ, vgic_maintenance_intr, NULL);
 }
 
 void vgic_cpu_init(struct vcpu *vcpu) {
@@ -530,6 +891,110 @@ void vgic_cpu_init(struct vcpu *vcpu) {
 
     spinlock_init(&irq->lock);
   }
+
+  vgic->lr_underflow = false;
+
+  /* guest EOI of virtual timer deactivates the physical one */
+  vgic_connect_hwirq(vcpu, VTIMER_IRQ, VTIMER_IRQ);
+}
+
+/*
+ *  private irq config and remote level spis of a vcpu leaving this node.
+ *  its list registers travel in struct gic_state.
+ */
+void vgic_cpu_export(struct vcpu *vcpu, struct vgic_cpu_state *s) {
+  struct vgic *vgic = localvm.vgic;
+
+  for(int i = 0; i < GIC_NSGI + GIC_NPPI; i++) {
+    struct vgic_irq *irq = vgic_get_irq(vcpu, i);
+
+    s->irqs[i].priority = irq->priority;
+    s->irqs[i].req_cpu = irq->req_cpu;
+    s->irqs[i].enabled = irq->enabled;
+    s->irqs[i].igroup = irq->igroup;
+    s->irqs[i].cfg = irq->cfg;
+  }
+
+  s->nremote = 0;
+
+  for(int i = 0; i < vgic->nspis; i++) {
+    struct vgic_irq *irq = &vgic->spis[i];
+
+    if(!irq->remote || irq->cfg != CONFIG_LEVEL ||
+       vgic_spi_target_vcpuid(irq) != vcpu->vcpuid)
+      continue;
+
+    if(s->nremote == VGIC_MIGRATE_REMOTE_MAX) {
+      vmm_warn("vgic: vcpu%d too many remote spis\n", vcpu->vcpuid);
+      break;
+    }
+
+    s->remote[s->nremote].intid = irq->intid;
+    s->remote[s->nremote].src_node = irq->src_node;
+    s->nremote++;
+  }
+}
+
+/* called after vgic_cpu_init() on the node the vcpu arrived at */
+void vgic_cpu_import(struct vcpu *vcpu, struct vgic_cpu_state *s) {
+  u64 flags;
+
+  for(int i = 0; i < GIC_NSGI + GIC_NPPI; i++) {
+    struct vgic_irq *irq = vgic_get_irq(vcpu, i);
+
+    irq->priority = s->irqs[i].priority;
+    irq->req_cpu = s->irqs[i].req_cpu;
+    irq->enabled = s->irqs[i].enabled;
+    irq->igroup = s->irqs[i].igroup;
+    irq->cfg = s->irqs[i].cfg;
+  }
+
+  for(int i = 0; i < s->nremote && i < VGIC_MIGRATE_REMOTE_MAX; i++) {
+    struct vgic_irq *irq = vgic_get_irq(vcpu, s->remote[i].intid);
+
+    spin_lock_irqsave(&irq->lock, flags);
+
+    irq->remote = true;
+    irq->src_node = s->remote[i].src_node;
+    irq->cfg = CONFIG_LEVEL;
+
+    spin_unlock_irqrestore(&irq->lock, flags);
+  }
+}
+
+/* enabled ppis are banked per pcpu: called on the new pcpu of vcpu */
+void vgic_cpu_enable_ppis(struct vcpu *vcpu) {
+  for(int i = 0; i < GIC_NPPI; i++) {
+    struct vgic_irq *irq = &vcpu->vgic.ppis[i];
+
+    if(irq->enabled)
+      localnode.irqchip->enable_irq(irq->intid);
+  }
+}
+
+/* a vcpu migrated between nodes: resolve local target of spis again */
+void vgic_retarget_spis() {
+  struct vgic *vgic = localvm.vgic;
+  u64 flags;
+
+  for(int i = 0; i < vgic->nspis; i++) {
+    struct vgic_irq *irq = &vgic->spis[i];
+    struct vcpu *target;
+    int vcpuid;
+
+    spin_lock_irqsave(&irq->lock, flags);
+
+    vcpuid = vgic_spi_target_vcpuid(irq);
+    target = vcpuid < 0 ? NULL : node_vcpu(vcpuid);
+
+    /* leave never-routed spis alone */
+    if(target != irq->target && (irq->target || irq->enabled)) {
+      irq->target = target;
+      vgic_route_hwirq(irq);
+    }
+
+    spin_unlock_irqrestore(&irq->lock, flags);
+  }
 }
 
 static void recv_gic_config_msg_intr(struct msg *msg) {
@@ -556,4 +1021,5 @@ static void recv_gic_config_msg_intr(struct msg *msg) {
 }
 
 DEFINE_POCV2_MSG(MSG_SGI, struct sgi_msg_hdr, recv_sgi_msg_intr);
+DEFINE_POCV2_MSG(MSG_INTERRUPT, struct interrupt_msg_hdr, recv_interrupt_msg_intr);
 DEFINE_POCV2_MSG(MSG_GIC_CONFIG, struct gic_config_msg_hdr, recv_gic_config_msg_intr);
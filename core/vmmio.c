@@ -7,75 +7,132 @@
 #include "vcpu.h"
 #include "msg.h"
 #include "node.h"
-#include "malloc.h"
 #include "spinlock.h"
 #include "log.h"
 #include "panic.h"
 
+struct vmmio_reply_arg {
+  struct mmio_access *mmio;
+  enum vmmio_status status;
+};
+
 static void vmmio_recv_reply(struct msg *reply, void *arg);
 
-static struct mmio_region *alloc_mmio_region(struct mmio_region *prev) {
-  struct mmio_region *m = malloc(sizeof(*m));
+/* binary search in localvm.pmap */
+static struct mmio_region *vmmio_find_region(u64 ipa) {
+  int lo = 0, hi = localvm.npmap - 1;
+
+  while(lo <= hi) {
+    int mid = (lo + hi) / 2;
+    struct mmio_region *m = &localvm.pmap[mid];
 
-  m->next = prev;
+    if(ipa < m->base)
+      hi = mid - 1;
+    else if(ipa >= m->base + m->size)
+      lo = mid + 1;
+    else
+      return m;
+  }
 
-  return m;
+  return NULL;
 }
 
 int vmmio_emulate(struct vcpu *vcpu, struct mmio_access *mmio) {
-  struct mmio_region *map = localvm.pmap;
+  struct mmio_region *m = vmmio_find_region(mmio->ipa);
   int c = -1;
-  u64 ipa = mmio->ipa;
-
-  for(struct mmio_region *m = map; m; m = m->next) {
-    if(m->base <= ipa && ipa < m->base + m->size) {
-      mmio->offset = ipa - m->base;
-      if(mmio->wnr && m->write)
-        c = m->write(vcpu, mmio);
-      else if(m->read)
-        c = m->read(vcpu, mmio);
-      break;
-    }
+
+  if(!m)
+    return -1;
+
+  mmio->offset = mmio->ipa - m->base;
+
+  if(mmio->wnr && m->write) {
+    m->nwrite++;
+    c = m->write(vcpu, mmio);
+  } else if(m->read) {
+    m->nread++;
+    c = m->read(vcpu, mmio);
   }
 
   return c;
 }
 
+/*
+ *  regions are registered at boot: keep them sorted by base
+ *  so that vmmio_emulate() finds one in O(log n)
+ */
 int vmmio_reg_handler(u64 ipa, u64 size,
                      int (*read)(struct vcpu *, struct mmio_access *),
                      int (*write)(struct vcpu *, struct mmio_access *)) {
+  struct mmio_region *new;
+  int i;
+
   if(size == 0)
     return -1;
 
   spin_lock(&localvm.lock);
 
-  struct mmio_region *new = alloc_mmio_region(localvm.pmap);
-  localvm.pmap = new;
+  if(localvm.npmap == VMMIO_REGION_MAX) {
+    spin_unlock(&localvm.lock);
+    vmm_warn("vmmio: too many regions\n");
+    return -1;
+  }
+
+  for(i = localvm.npmap; i > 0 && localvm.pmap[i - 1].base > ipa; i--)
+    localvm.pmap[i] = localvm.pmap[i - 1];
+
+  /* regions must not overlap */
+  if((i > 0 && localvm.pmap[i - 1].base + localvm.pmap[i - 1].size > ipa) ||
+     (i < localvm.npmap && ipa + size > localvm.pmap[i + 1].base))
+    panic("vmmio: region %p-%p overlaps", ipa, ipa + size);
+
+  new = &localvm.pmap[i];
 
   new->base = ipa;
   new->size = size;
   new->read = read;
   new->write = write;
+  new->nread = 0;
+  new->nwrite = 0;
+
+  localvm.npmap++;
 
   spin_unlock(&localvm.lock);
 
   return 0;
 }
 
+void vmmio_stats() {
+  printf("vmmio stats\n");
+
+  for(int i = 0; i < localvm.npmap; i++) {
+    struct mmio_region *m = &localvm.pmap[i];
+
+    printf("%p-%p: read %d write %d\n", m->base, m->base + m->size, m->nread, m->nwrite);
+  }
+}
+
 int vmmio_forward(u32 target_vcpuid, struct mmio_access *mmio) {
   struct msg msg;
   struct mmio_req_hdr hdr;
+  struct vmmio_reply_arg arg = { .mmio = mmio };
+
+  /* target vcpu may be migrating: retry until the cluster table catches up */
+  do {
+    int target_nodeid = vcpuid_to_nodeid(target_vcpuid);
 
-  int target_nodeid = vcpuid_to_nodeid(target_vcpuid);
+    if(target_nodeid < 0)
+      return -1;
 
-  hdr.vcpuid = target_vcpuid;
-  memcpy(&hdr.mmio, mmio, sizeof(*mmio));
+    hdr.vcpuid = target_vcpuid;
+    memcpy(&hdr.mmio, mmio, sizeof(*mmio));
 
-  printf("vmmio forwarding to vcpu%d %p\n", target_vcpuid, mmio->ipa);
+    vmm_clog(LC_MMIO, "vmmio forwarding to vcpu%d %p\n", target_vcpuid, mmio->ipa);
 
-  msg_init(&msg, target_nodeid, MSG_MMIO_REQUEST, &hdr, NULL, 0);
+    msg_init(&msg, target_nodeid, MSG_MMIO_REQUEST, &hdr, NULL, 0);
 
-  send_msg_cb(&msg, vmmio_recv_reply, mmio);
+    send_msg_cb(&msg, vmmio_recv_reply, &arg);
+  } while(arg.status == VMMIO_MOVED);
 
   return 0;
 }
@@ -86,13 +143,13 @@ static void vmmio_req_recv_intr(struct msg *msg) {
   struct mmio_reply_hdr rephdr;
 
   struct vcpu *vcpu = node_vcpu(hdr->vcpuid);
-  if(!vcpu)
-    panic("mmio????????");
 
-  if(vmmio_emulate(vcpu, &hdr->mmio) < 0)
+  if(!vcpu)
+    status = VMMIO_MOVED;
+  else if(vmmio_emulate(vcpu, &hdr->mmio) < 0)
     status = VMMIO_FAILED;
 
-  printf("mmio access %s %p %p\n",
+  vmm_clog(LC_MMIO, "mmio access %s %p %p\n",
           hdr->mmio.wnr ? "write" : "read", hdr->mmio.ipa, hdr->mmio.val);
 
   rephdr.addr = hdr->mmio.ipa;
@@ -104,14 +161,18 @@ static void vmmio_req_recv_intr(struct msg *msg) {
 
 static void vmmio_recv_reply(struct msg *reply, void *arg) {
   struct mmio_reply_hdr *rep = (struct mmio_reply_hdr *)reply->hdr;
-  struct mmio_access *mmio = arg;
+  struct vmmio_reply_arg *a = arg;
+  struct mmio_access *mmio = a->mmio;
 
-  printf("rep!!!!!!!!!!!!!! %p %p %d\n", rep->addr, rep->val, rep->status);
+  vmm_clog(LC_MMIO, "mmio reply %p %p %d\n", rep->addr, rep->val, rep->status);
 
   if(mmio->ipa != rep->addr)
     panic("vmmio? %p %p", mmio->ipa, rep->addr);
 
-  mmio->val = rep->val;
+  a->status = rep->status;
+
+  if(rep->status != VMMIO_MOVED)
+    mmio->val = rep->val;
 }
 
 void vmmio_init() {
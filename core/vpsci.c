@@ -10,6 +10,7 @@
 #include "node.h"
 #include "msg.h"
 #include "pcpu.h"
+#include "sched.h"
 #include "spinlock.h"
 #include "panic.h"
 #include "assert.h"
@@ -117,12 +118,16 @@ static int vpsci_vcpu_wakeup_local(struct vcpu *vcpu, u64 ep) {
         vmm_warn("cpu%d wakeup failed", pcpuid);
         status = PSCI_DENIED;
       } else {
+        /* other vcpus on the pcpu must not boot it again */
+        vcpu->pcpu->wakeup = true;
         status = PSCI_SUCCESS;
       }
     }
 
-    if(status == PSCI_SUCCESS)
+    if(status == PSCI_SUCCESS) {
       vcpu->online = true;
+      sched_kick(vcpu);
+    }
   }
 
   spin_unlock_irqrestore(&vcpu->lock, flags);
@@ -137,9 +142,11 @@ static void cpu_wakeup_recv_intr(struct msg *msg) {
   u64 ep = hdr->entrypoint;
   struct vcpu *target = node_vcpu(vcpuid);
 
-  assert(target);
-
-  ret = vpsci_vcpu_wakeup_local(target, ep);
+  /* only a running vcpu migrates away from here */
+  if(target)
+    ret = vpsci_vcpu_wakeup_local(target, ep);
+  else
+    ret = PSCI_ALREADY_ON;
 
   /* reply ack */
   ackhdr.ret = ret;
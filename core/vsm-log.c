@@ -1,90 +1,71 @@
 /*
- *  logger for vsm
+ *  per-pcpu binary trace rings for vsm events
+ *
+ *  a tracepoint stores one 32 byte record in the ring of its pcpu: no lock,
+ *  no printf on the fault path.  vsm_trace_dump() streams the rings as text
+ *  lines over uart, tools/vsmtrace merges the dumps of all nodes into
+ *  per-fault timelines.
+ *
+ *    vsmtrace: begin node <id> ncpu <n> freq <hz>
+ *    vt <cpu> <seq> <stamp> <type> <from> <to> <ipa> <connid> <aux>   (hex: stamp ipa connid aux)
+ *    vsmtrace: end node <id>
  */
 
+#include "aarch64.h"
 #include "vsm-log.h"
-#include "spinlock.h"
-#include "assert.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "printf.h"
 
-static struct vsmlog vsmlog[4096];
-static int ring_idx = 0;
-static bool loop = false;
-static spinlock_t vloglock = SPINLOCK_INIT;
+static struct vtrace_ring vtrace_ring[NCPU_MAX];
 
-static const char *tyfmt[] = {
-  [READ_SENDER]     "[read-req]",
-  [READ_RECEIVER]   "[read-recv]",
-  [WRITE_SENDER]    "[write-req]",
-  [WRITE_RECEIVER]  "[write-recv]",
-  [INV_SENDER]      "[inv-req]",
-  [INV_RECEIVER]    "[inv-recv]",
-  [VSM_INFO]        "[info]",
-};
-
-void vsm_logdump(int n) {
-  int start;
-  struct vsmlog *vl;
+void __vsm_trace(enum vtrace_type type, int from_node, int to_node, u64 ipa,
+                 u32 connid, u32 aux) {
+  struct vtrace_ring *r = &vtrace_ring[cpuid()];
+  struct vsm_trace *t;
+  u64 flags;
 
-  assert(n < 4096);
+  /* irq handlers on this pcpu are the only other writers */
+  irqsave(flags);
 
-  if(ring_idx < n) {
-    if(loop) {
-      start = ring_idx + 4096 - n;
-    } else {
-      start = 0;
-      n = ring_idx;
-    }
-  } else {
-    start = ring_idx - n;
-  }
+  t = &r->ent[r->head & (VTRACE_NENT - 1)];
 
-  while(n-- > 0) {
-    vl = &vsmlog[start];
+  t->stamp = read_sysreg(cntpct_el0);
+  t->ipa = ipa;
+  t->connid = connid;
+  t->aux = aux;
+  t->seq = r->head;
+  t->type = type;
+  t->cpu = cpuid();
+  t->from_node = from_node;
+  t->to_node = to_node;
 
-    if(!vl->msg)
-      vl->msg = "";
+  r->head++;
 
-    if(vl->type == VSM_INFO || vl->from_node < 0) {
-      printf("%s:cpu%d @%p %s %p\n", tyfmt[vl->type], vl->cpu, vl->ipa, vl->msg, vl->daif);
-    } else {
-      printf("%s:cpu%d from: Node %d to: Node %d @%p %s %p\n",
-             tyfmt[vl->type], vl->cpu, vl->from_node, vl->to_node, vl->ipa, vl->msg, vl->daif);
-    }
-
-    start = (start + 1) % 4096;
-  }
+  irqrestore(flags);
 }
 
-void vsm_logging(int type, int from_node, int to_node, u64 ipa, const char *msg) {
-  u64 flags;
-
-  spin_lock_irqsave(&vloglock, flags);
+/* last n records of each pcpu, all of them if n <= 0 */
+void vsm_trace_dump(int n) {
+  if(n <= 0 || n > VTRACE_NENT)
+    n = VTRACE_NENT;
 
-  struct vsmlog *vl = &vsmlog[ring_idx];
+  printf("vsmtrace: begin node %d ncpu %d freq %d\n",
+         local_nodeid(), nr_online_pcpus, read_sysreg(cntfrq_el0));
 
-  ring_idx = (ring_idx + 1) % 4096;
-  if(ring_idx == 0)
-    loop = true;
+  for(int cpu = 0; cpu < NCPU_MAX; cpu++) {
+    struct vtrace_ring *r = &vtrace_ring[cpu];
+    u64 head = r->head;
+    u64 start = head > (u64)n ? head - n : 0;
 
-  vl->type = type;
-  vl->from_node = from_node;
-  vl->cpu = cpuid();
-  vl->to_node = to_node;
-  vl->ipa = ipa;
-  vl->msg = msg;
-  vl->daif = flags;
-
-  spin_unlock_irqrestore(&vloglock, flags);
-}
+    for(u64 i = start; i < head; i++) {
+      struct vsm_trace *t = &r->ent[i & (VTRACE_NENT - 1)];
 
-void vsm_log_out(int type, int from_node, int to_node, u64 ipa, const char *msg) {
-  if(!msg)
-    msg = "";
-
-  if(type == VSM_INFO || from_node < 0) {
-    printf("%s:cpu%d @%p %s\n", tyfmt[type], cpuid(), ipa, msg);
-  } else {
-    printf("%s:cpu%d from: Node %d to: Node %d "
-           "@%p %s\n", tyfmt[type], cpuid(), from_node, to_node, ipa, msg);
+      printf("vt %d %u %x %d %d %d %x %x %x\n",
+             t->cpu, t->seq, t->stamp, t->type, t->from_node, t->to_node,
+             t->ipa, (u64)t->connid, (u64)t->aux);
+    }
   }
+
+  printf("vsmtrace: end node %d\n", local_nodeid());
 }
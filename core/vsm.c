@@ -22,20 +22,79 @@
 #include "assert.h"
 #include "compiler.h"
 #include "vsm-log.h"
+#include "fault-lat.h"
+#include "page-prof.h"
 #include "memlayout.h"
 #include "cache.h"
+#include "sched.h"
+#include "atomic.h"
 
-#define ipa_to_pfn(ipa)       (((ipa) - 0x40000000) >> PAGESHIFT)
-#define ipa_to_desc(ipa)      (&ptable[ipa_to_pfn(ipa)])
+/*
+ *  sparse vsm metadata
+ *  page descriptors and manager pages are allocated per 2MB chunk on first use:
+ *    dir[1GB] --> chunk table (1 page) --> chunk[2MB]
+ */
+#define VSM_CHUNK_SHIFT       21
+#define VSM_CHUNK_NPAGES      (1 << (VSM_CHUNK_SHIFT - PAGESHIFT))
+#define VSM_DIR_SHIFT         30
+#define VSM_DIR_NCHUNKS       (1 << (VSM_DIR_SHIFT - VSM_CHUNK_SHIFT))
+#define VSM_DIR_MAX           (GVM_MEMORY_MAX >> VSM_DIR_SHIFT)
+
+#define ipa_to_offset(ipa)    ((ipa) - GVM_RAM_BASE)
+#define chunk_index(ipa)      ((ipa_to_offset(ipa) >> PAGESHIFT) & (VSM_CHUNK_NPAGES - 1))
+
+struct desc_chunk {
+  struct page_desc desc[VSM_CHUNK_NPAGES];
+};
+
+struct manager_chunk {
+  struct manager_page page[VSM_CHUNK_NPAGES];
+};
 
-#define page_desc_addr(page)  ((((page) - ptable) << PAGESHIFT) + 0x40000000)
+static void **desc_dir[VSM_DIR_MAX];
+static void **manager_dir[VSM_DIR_MAX];
+static spinlock_t vsm_dir_lock = SPINLOCK_INIT;
+
+static bool vsm_lazy_home = false;
+
+static u64 nr_desc_chunks = 0;
+static u64 nr_manager_chunks = 0;
+
+/* fault and protocol counters per pcpu, summed up by vsm_stats() */
+enum vsm_stat {
+  VS_READ_HIT,        /* readable already (other pcpu) */
+  VS_READ_ZERO,       /* first touch of a home page */
+  VS_READ_REMOTE,
+  VS_WRITE_HIT,
+  VS_WRITE_ZERO,
+  VS_WRITE_UPGRADE,   /* owner of a read-shared page */
+  VS_WRITE_REMOTE,
+  VS_INV_SEND,
+  VS_INV_RECV,
+  VS_SERVE_READ,
+  VS_SERVE_WRITE,
+  NR_VSM_STAT,
+};
+
+static const char *vsm_stat_name[NR_VSM_STAT] = {
+  [VS_READ_HIT]       "read hit",
+  [VS_READ_ZERO]      "read zero",
+  [VS_READ_REMOTE]    "read remote",
+  [VS_WRITE_HIT]      "write hit",
+  [VS_WRITE_ZERO]     "write zero",
+  [VS_WRITE_UPGRADE]  "write upgrade",
+  [VS_WRITE_REMOTE]   "write remote",
+  [VS_INV_SEND]       "inv send",
+  [VS_INV_RECV]       "inv recv",
+  [VS_SERVE_READ]     "serve read",
+  [VS_SERVE_WRITE]    "serve write",
+};
 
-static struct manager_page manager[NR_MANAGER_PAGES];
-static struct page_desc ptable[GVM_MEMORY / PAGESIZE];
+static struct {
+  u64 n[NR_VSM_STAT];
+} __cacheline_aligned vsmstat[NCPU_MAX];
 
-static u64 w_copyset = 0;
-static u64 w_roowner = 0;
-static u64 w_inv = 0;
+#define vsm_stat_inc(s)   (vsmstat[cpuid()].n[s]++)
 
 static const char *pte_state[4] = {
   [0]   "INV",
@@ -61,10 +120,10 @@ struct vsm_rw_data {
   u64 size;
 };
 
-static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *d);
-static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d);
+static void *__vsm_write_fetch_page(u64 page_ipa, struct vsm_rw_data *d);
+static void *__vsm_read_fetch_page(u64 page_ipa, struct vsm_rw_data *d);
 static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type,
-                           bool waitreply, int req_cpu);
+                           bool waitreply, int req_cpu, u32 fwd);
 
 static void vsm_read_server_process(struct vsm_server_proc *proc);
 static void vsm_write_server_process(struct vsm_server_proc *proc);
@@ -87,13 +146,20 @@ struct fetch_req_hdr {
   u64 ipa;
   u8 req_nodeid;
   enum fetch_type type;
+  u32 fwd;      // ticks spent on forwarding (manager) nodes
 };
 
 struct fetch_reply_hdr {
   POCV2_MSG_HDR_STRUCT;
   u64 ipa;
-  u64 copyset;
+  copyset_t copyset;
   bool wnr;     // 0 read 1 write fetch
+  bool zero;    // never touched page: no body, requester fills zero
+  /* remote part of fault latency (ticks) */
+  u32 fwd;
+  u32 rxq;
+  u32 wq;
+  u32 serve;
 };
 
 struct fetch_reply_body {
@@ -103,28 +169,128 @@ struct fetch_reply_body {
 struct invalidate_hdr {
   POCV2_MSG_HDR_STRUCT;
   u64 ipa;
-  u64 copyset;
+  copyset_t copyset;
   u8 from_nodeid;
 };
 
 static inline void send_read_fetch_req(int from_node, int to_node,
                                        ipa_t page_ipa) {
-  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH, true, cpuid());
+  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH, true, cpuid(), 0);
 }
 
 static inline void send_write_fetch_req(int from_node, int to_node,
                                         ipa_t page_ipa) {
-  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, true, cpuid());
+  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, true, cpuid(), 0);
 }
 
-static inline void forward_read_fetch_req(int from_node, int to_node,
-                                          ipa_t page_ipa, int req_cpu) {
-  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH, false, req_cpu);
+/* time spent on this node (and earlier forwarders) for proc */
+static inline u32 proc_fwd_ticks(struct vsm_server_proc *proc) {
+  return proc->fwd + (now_cycles() - proc->recv_stamp);
 }
 
-static inline void forward_write_fetch_req(int from_node, int to_node,
-                                           ipa_t page_ipa, int req_cpu) {
-  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, false, req_cpu);
+static inline void forward_read_fetch_req(int from_node, int to_node, ipa_t page_ipa,
+                                          struct vsm_server_proc *proc) {
+  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH, false, proc->req_cpu,
+                 proc_fwd_ticks(proc));
+}
+
+static inline void forward_write_fetch_req(int from_node, int to_node, ipa_t page_ipa,
+                                           struct vsm_server_proc *proc) {
+  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, false, proc->req_cpu,
+                 proc_fwd_ticks(proc));
+}
+
+static void *alloc_desc_chunk() {
+  struct desc_chunk *c = alloc_pages(1);
+  if(!c)
+    panic("vsm: desc chunk");
+
+  nr_desc_chunks++;
+
+  return c;
+}
+
+static void *alloc_manager_chunk() {
+  struct manager_chunk *c = malloc(sizeof(*c));
+  if(!c)
+    panic("vsm: manager chunk");
+
+  for(int i = 0; i < VSM_CHUNK_NPAGES; i++) {
+    /* owner is me (home node) */
+    c->page[i].owner = local_nodeid();
+    c->page[i].zero = vsm_lazy_home;
+  }
+
+  nr_manager_chunks++;
+
+  return c;
+}
+
+/*
+ *  look up 2MB chunk of ipa; NULL if not used yet (no allocation)
+ */
+static void *vsm_chunk_lookup(void **dir[], u64 ipa) {
+  u64 off = ipa_to_offset(ipa);
+  u64 d = off >> VSM_DIR_SHIFT;
+  void **tbl;
+
+  if(ipa < GVM_RAM_BASE || d >= VSM_DIR_MAX)
+    return NULL;
+
+  tbl = dir[d];
+
+  return tbl ? tbl[(off >> VSM_CHUNK_SHIFT) & (VSM_DIR_NCHUNKS - 1)] : NULL;
+}
+
+/*
+ *  look up 2MB chunk of ipa; allocate it on first use
+ */
+static void *vsm_chunk(void **dir[], u64 ipa, void *(*alloc_chunk)(void)) {
+  u64 off = ipa_to_offset(ipa);
+  u64 d = off >> VSM_DIR_SHIFT;
+  u64 c = (off >> VSM_CHUNK_SHIFT) & (VSM_DIR_NCHUNKS - 1);
+  void **tbl, *chunk;
+  u64 flags;
+
+  if(ipa < GVM_RAM_BASE || d >= VSM_DIR_MAX)
+    panic("vsm: ipa out of range %p", ipa);
+
+  tbl = dir[d];
+  if(likely(tbl && (chunk = tbl[c])))
+    return chunk;
+
+  spin_lock_irqsave(&vsm_dir_lock, flags);
+
+  if(!dir[d]) {
+    tbl = alloc_page();
+    if(!tbl)
+      panic("vsm: chunk table");
+
+    dsb(ishst);
+    dir[d] = tbl;
+  }
+
+  tbl = dir[d];
+
+  if(!tbl[c]) {
+    chunk = alloc_chunk();
+
+    /* publish after chunk is initialized */
+    dsb(ishst);
+    tbl[c] = chunk;
+  }
+
+  chunk = tbl[c];
+
+  spin_unlock_irqrestore(&vsm_dir_lock, flags);
+
+  return chunk;
+}
+
+static inline struct page_desc *ipa_to_desc(u64 ipa) {
+  struct desc_chunk *c = vsm_chunk(desc_dir, ipa, alloc_desc_chunk);
+
+  return &c->desc[chunk_index(ipa)];
 }
 
 /*
@@ -132,20 +298,9 @@ static inline void forward_write_fetch_req(int from_node, int to_node,
  *  else:    return 1
  */
 static inline int page_trylock(struct page_desc *page) {
-  u8 *lock = &page->lock;
-  u8 r, l = cpuid() + 1;
-
-  vmm_log("%p page trylock\n", page_desc_addr(page));
-
-  asm volatile(
-    "ldaxrb %w0, [%1]\n"
-    "cbnz   %w0, 1f\n"
-    "stxrb  %w0, %w2, [%1]\n"
-    "1:\n"
-    : "=&r"(r) : "r"(lock), "r"(l) : "memory"
-  );
+  vmm_clog(LC_VSM, "%p page trylock\n", page);
 
-  return r;
+  return atomic_trylock8(&page->lock, cpuid() + 1);
 }
 
 static inline bool page_locked(struct page_desc *page) {
@@ -153,76 +308,49 @@ static inline bool page_locked(struct page_desc *page) {
 }
 
 static inline void page_spinlock(struct page_desc *page) {
-  u8 *lock = &page->lock;
-  u8 r, l = cpuid() + 1;
+  vmm_clog(LC_VSM, "%p page spinlock\n", page);
 
-  vmm_log("%p page spinlock\n", page_desc_addr(page));
+  /* holder may be a vcpu blocked in a fetch on this pcpu */
+  if(sched_multiplexed()) {
+    while(page_trylock(page))
+      sched_yield();
+    return;
+  }
 
-  asm volatile(
-    "sevl\n"
-    "1: wfe\n"
-    "2: ldaxrb %w0, [%1]\n"
-    "cbnz   %w0, 1b\n"
-    "stxrb  %w0, %w2, [%1]\n"
-    "cbnz   %w0, 2b\n"
-    : "=&r"(r) : "r"(lock), "r"(l) : "memory"
-  );
+  atomic_lock8(&page->lock, cpuid() + 1);
 
-  vmm_log("%p page spinlock OK\n", page_desc_addr(page));
+  vmm_clog(LC_VSM, "%p page spinlock OK\n", page);
 }
 
 /*
  *  cpu that locked page and cpu that unlocked page must be the same
  */
 static inline void page_unlock(struct page_desc *page) {
-  u16 *l = &page->ll;
-
-  asm volatile("stlrh wzr, [%0]" :: "r"(l) : "memory");
-  vmm_log("%p page unlock\n", page_desc_addr(page));
+  atomic_release16(&page->ll);
+  vmm_clog(LC_VSM, "%p page unlock\n", page);
 }
 
 /*
  *  lock page and vsm_waitqueue
  */
 static inline void page_vwq_lock(struct page_desc *page) {
-  u16 tmp, l = 0x0100 | ((cpuid() + 1) & 0xff);
-
-  vmm_log("page_vwq_lock %p %p\n", page_desc_addr(page), page->ll);
+  vmm_clog(LC_VSM, "page_vwq_lock %p %p\n", page, page->ll);
 
-  asm volatile(
-    "sevl\n"
-    "1: wfe\n"
-    "2: ldaxrh %w0, [%1]\n"
-    "cbnz   %w0, 1b\n"
-    "stxrh  %w0, %w2, [%1]\n"
-    "cbnz   %w0, 2b\n"
-    : "=&r"(tmp) : "r"(&page->ll), "r"(l) : "memory"
-  );
+  atomic_lock16(&page->ll, 0x0100 | ((cpuid() + 1) & 0xff));
 }
 
 /*
  *  lock vsm_waitqueue; if page is unlocked, re-lock page and return 1
  */
 static inline bool vwq_lock(struct page_desc *page) {
-  u16 tmp, lk, wlk, l = 0x0101;
+  /* wait for wqlock only, then take both */
+  u16 old = atomic_lock16_mask(&page->ll, 0xff00, 0x0101);
 
-  asm volatile(
-    "sevl\n"
-    "1: wfe\n"
-    "2: ldaxrh %w0, [%3]\n"
-    "and    %w1, %w0, #0x00ff\n"    // w1 = page->lock
-    "and    %w2, %w0, #0xff00\n"    // w2 = page->wqlock
-    "cbnz   %w2, 1b\n"
-    "stxrh  %w0, %w4, [%3]\n"
-    "cbnz   %w0, 2b\n"
-    : "=&r"(tmp), "=&r"(lk), "=&r"(wlk) : "r"(&page->ll), "r"(l) : "memory"
-  );
-
-  return !lk;
+  return !(old & 0x00ff);
 }
 
 static inline void vwq_unlock(struct page_desc *page) {
-  asm volatile("stlrb wzr, [%0]" :: "r"(&page->wqlock) : "memory");
+  atomic_release8(&page->wqlock);
 }
 
 static inline bool vwq_locked(struct page_desc *page) {
@@ -276,7 +404,7 @@ static bool vsm_enqueue_proc(struct vsm_server_proc *p) {
 
   irqsave(flags);
 
-  vmm_log("enquuuuuuuuuuuuu %p %p\n", p, page_desc_addr(page));
+  vmm_clog(LC_VSM, "enquuuuuuuuuuuuu %p %p\n", p, page);
 
   bool punlocked = vwq_lock(page);
   
@@ -311,14 +439,14 @@ reprocess:
   local_irq_enable();
 
   for(p = head; p; p = p_next) {
-    vmm_log("processing queue..... %p %p\n", p, page_desc_addr(page));
+    vmm_clog(LC_VSM, "processing queue..... %p %p\n", p, page);
     p->do_process(p);
 
     p_next = p->next;
     free(p);
   }
 
-  vmm_log("processing doneeeeeeeee..... %p\n", page_desc_addr(page));
+  vmm_clog(LC_VSM, "processing doneeeeeeeee..... %p\n", page);
 
   local_irq_disable();
 
@@ -354,9 +482,13 @@ static void vsm_process_waitqueue(struct page_desc *page) {
 }
 
 static inline struct manager_page *ipa_manager_page(u64 ipa) {
+  struct manager_chunk *c;
+
   assert(in_memrange(&cluster_me()->mem, ipa));
 
-  return manager + ((ipa - cluster_me()->mem.start) >> PAGESHIFT);
+  c = vsm_chunk(manager_dir, ipa, alloc_manager_chunk);
+
+  return &c->page[chunk_index(ipa)];
 }
 
 /* determine manager's node of page by ipa */
@@ -370,6 +502,50 @@ static inline int page_manager(u64 ipa) {
   return -1;
 }
 
+/*
+ *  never touched home page (lazy allocation)
+ *  must be held page->lock
+ */
+static bool vsm_page_is_zero(u64 page_ipa) {
+  struct manager_page *p;
+
+  if(!in_memrange(&cluster_me()->mem, page_ipa))
+    return false;
+
+  p = ipa_manager_page(page_ipa);
+  if(!p->zero)
+    return false;
+
+  if(s2_page_mapped(page_ipa)) {
+    /* populated by copy_to_guest() */
+    p->zero = 0;
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ *  allocate a zeroed page for never touched home page
+ *  must be held page->lock
+ */
+static u64 *vsm_zero_fill(u64 page_ipa) {
+  char *page = alloc_page();
+  u64 *pte;
+
+  if(!page)
+    panic("vsm: zero fill %p", page_ipa);
+
+  /* unmapped before: no need to flush */
+  s2_map_page_noaccess(page_ipa, V2P(page));
+  ipa_to_desc(page_ipa)->copyset = 0;
+  pte = s2_accessible_pte(page_ipa);
+
+  ipa_manager_page(page_ipa)->zero = 0;
+
+  return pte;
+}
+
 static inline u64 *vsm_wait_for_recv_timeout(u64 page_ipa) {
   int timeout_us = 3000000;   // wait for 3s
   u64 *pte;
@@ -411,27 +587,46 @@ int vsm_fetch_and_cache_dummy(u64 page_ipa) {
 
   pagemap(node->vttbr, page_ipa, (u64)page, PAGESIZE, PTE_NORMAL|S2PTE_RW);
   
-  vmm_log("dummy cache %p elr %p va %p\n", page_ipa, vcpu->reg.elr, vcpu->dabt.fault_va);
+  vmm_clog(LC_VSM, "dummy cache %p elr %p va %p\n", page_ipa, vcpu->reg.elr, vcpu->dabt.fault_va);
 
   return 0;
 }
 */
 
-static void vsm_set_cache_fast(u64 ipa_page, u8 copyset, u8 *page) {
+static void vsm_set_cache_fast(u64 ipa_page, copyset_t copyset, u8 *page) {
   u64 page_phys = V2P(page);
 
   vmm_bug_on(!PAGE_ALIGNED(ipa_page), "pagealign");
 
   // printf("vsm: cache @%p(%p) copyset: %p\n", ipa_page, page_phys, copyset);
 
+  /* received copyset from previous owner (write fetch) */
+  ipa_to_desc(ipa_page)->copyset = copyset;
+
   /* set access permission later */
-  s2_map_page_copyset(ipa_page, page_phys, copyset);
+  s2_map_page_noaccess(ipa_page, page_phys);
+}
+
+/*
+ *  I am owner of page: RW, or RO with read copies in other nodes
+ *  must be held page->lock
+ */
+static u64 *vsm_owner_pte(struct page_desc *page, u64 ipa) {
+  u64 *pte;
+
+  if((pte = s2_rwable_pte(ipa)) != NULL)
+    return pte;
+
+  if((pte = s2_ro_pte(ipa)) != NULL && page->copyset != 0)
+    return pte;
+
+  return NULL;
 }
 
 /*
- *  already has ptable[ipa].lock
+ *  already has page lock
  */
-static void vsm_invalidate(u64 ipa, u64 copyset) {
+static void vsm_invalidate(u64 ipa, copyset_t copyset) {
   if(copyset == 0)
     return;
 
@@ -442,26 +637,25 @@ static void vsm_invalidate(u64 ipa, u64 copyset) {
   hdr.copyset = copyset;
   hdr.from_nodeid = local_nodeid();
 
-  int node = 0;
-  do {
-    if((copyset & 1) && (node != local_nodeid())) {
-      vmm_log("invalidate request %p %d -> %d\n", ipa, local_nodeid(), node);
- 
+  for(int node = 0; node < nr_cluster_nodes; node++) {
+    if(copyset_has(copyset, node) && (node != local_nodeid())) {
+      vmm_clog(LC_VSM, "invalidate request %p %d -> %d\n", ipa, local_nodeid(), node);
+
       msg_init(&msg, node, MSG_INVALIDATE, &hdr, NULL, 0);
 
+      vsm_stat_inc(VS_INV_SEND);
+
+      vsm_trace(VT_INV_SEND, local_nodeid(), node, ipa, msg_connid(&msg), 0);
+
       send_msg(&msg);
     }
-
-    copyset >>= 1;
-    node++;
-  } while(copyset);
+  }
 }
 
 static void vsm_invalidate_server_process(struct vsm_server_proc *proc) {
   u64 ipa = proc->page_ipa;
   struct page_desc *page = ipa_to_desc(ipa);
   u64 from_nodeid = proc->req_nodeid;
-  u64 *pte;
 
   assert(page_locked(page));
 
@@ -470,64 +664,85 @@ static void vsm_invalidate_server_process(struct vsm_server_proc *proc) {
     return;
   }
 
-  if((pte = s2_rwable_pte(ipa)) != NULL ||
-      (((pte = s2_ro_pte(ipa)) != NULL) && s2pte_copyset(pte) != 0)) {
+  if(vsm_owner_pte(page, ipa) != NULL) {
     /* I'm already owner, ignore invalidate request */
     return;
   }
 
-  vmm_log("inv server %p: from %d -> %d\n", ipa, from_nodeid, local_nodeid()); 
+  vmm_clog(LC_VSM, "inv server %p: from %d -> %d\n", ipa, from_nodeid, local_nodeid()); 
 
   s2_page_invalidate(ipa);
-}
 
-void *vsm_read_fetch_page_imm(u64 page_ipa, u64 offset, char *buf, u64 size)  {
-  struct page_desc *page = ipa_to_desc(page_ipa);
+  vcpu_wfe_wake(ipa);
+}
 
+void *vsm_read_fetch_page_imm(u64 page_ipa, u64 offset, char *buf, u64 size) {
   struct vsm_rw_data d = {
     .offset = offset,
     .buf = buf,
     .size = size,
   };
 
-  return __vsm_read_fetch_page(page, &d);
+  return __vsm_read_fetch_page(page_ipa, &d);
 }
 
 void *vsm_read_fetch_page(u64 page_ipa) {
-  struct page_desc *page = ipa_to_desc(page_ipa);
-
-  return __vsm_read_fetch_page(page, NULL);
+  return __vsm_read_fetch_page(page_ipa, NULL);
 }
 
 void *vsm_read_fetch_instr(u64 page_ipa) {
   void *p;
-  struct page_desc *page = ipa_to_desc(page_ipa);
 
-  p = __vsm_read_fetch_page(page, NULL);
+  p = __vsm_read_fetch_page(page_ipa, NULL);
+  if(p)
+    cache_sync_pou_range(p, PAGESIZE);
 
-  cache_sync_pou_range(p, PAGESIZE);
+  return p;
 }
 
 /* read fault handler */
-static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d) {
+static void *__vsm_read_fetch_page(u64 page_ipa, struct vsm_rw_data *d) {
+  struct page_desc *page;
   u64 *pte;
   u64 page_pa = 0;
   int manager = -1;
-  u64 page_ipa = page_desc_addr(page);
 
   manager = page_manager(page_ipa);
   if(manager < 0)
     return NULL;
 
+  page = ipa_to_desc(page_ipa);
+
   page_spinlock(page);
 
-  vmm_log("read request occured: %p %p\n", page_ipa, read_sysreg(elr_el2));
+  current->flat.lock = now_cycles();
+
+  vmm_clog(LC_VSM, "read request occured: %p %p\n", page_ipa, read_sysreg(elr_el2));
 
   /*
    * may other cpu has readable page already
    */
   if((pte = s2_readable_pte(page_ipa)) != NULL) {
+    /* this cpu may hold a stale tlb entry (upgrade was deferred) */
+    tlb_s2_flush_ipa_local(page_ipa);
+    page_pa = PTE_PA(*pte);
+    vsm_stat_inc(VS_READ_HIT);
+    goto end;
+  }
+
+  if(manager == local_nodeid() && vsm_page_is_zero(page_ipa)) {
+    /* first touch: I am owner */
+    vmm_clog(LC_VSM, "read req %p: zero fill\n", page_ipa);
+    vsm_stat_inc(VS_READ_ZERO);
+
+    pte = vsm_zero_fill(page_ipa);
+    s2pte_rw(pte);
+
     page_pa = PTE_PA(*pte);
+
+    if(unlikely(d))
+      memset(d->buf, 0, d->size);
+
     goto end;
   }
 
@@ -536,12 +751,12 @@ static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d
     struct manager_page *p = ipa_manager_page(page_ipa);
     int owner = p->owner;
 
-    vmm_log("read req %p: %d -> %d request to owner\n", page_ipa, local_nodeid(), owner);
+    vmm_clog(LC_VSM, "read req %p: %d -> %d request to owner\n", page_ipa, local_nodeid(), owner);
 
     send_read_fetch_req(local_nodeid(), owner, page_ipa);
   } else {
     /* ask manager for read access to page and a copy of page */
-    vmm_log("read req %p: %d -> %d request to owner\n", page_ipa, local_nodeid(), manager);
+    vmm_clog(LC_VSM, "read req %p: %d -> %d request to owner\n", page_ipa, local_nodeid(), manager);
 
     send_read_fetch_req(local_nodeid(), manager, page_ipa);
   }
@@ -551,14 +766,23 @@ static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d
 
   page_pa = PTE_PA(*pte);
 
-  vmm_log("read req %p: get remote page! %p\n", page_ipa, page_pa);
+  vsm_stat_inc(VS_READ_REMOTE);
+  vmm_clog(LC_VSM, "read req %p: get remote page! %p\n", page_ipa, page_pa);
 
   /* read data */
   if(unlikely(d))
     memcpy(d->buf, P2V(page_pa + d->offset), d->size);
 
+  /* no access -> RO is a permission upgrade: no need to flush */
   s2pte_ro(pte);
-  tlb_s2_flush_all(page_ipa);
+  tlb_s2_defer(TLBF_READ_FAULT);
+
+  vsm_trace(VT_MAP, local_nodeid(), local_nodeid(), page_ipa, 0,
+            VT_AUX(READ_FETCH, 0, cpuid()));
+
+  /* a following trapped wfe may be a spin on this page */
+  current->idle.rfault_ipa = page_ipa;
+  current->idle.rfault_stamp = now_cycles();
 
 end:
   vsm_process_waitqueue(page);
@@ -567,57 +791,61 @@ end:
 }
 
 void *vsm_write_fetch_page_imm(u64 page_ipa, u64 offset, char *buf, u64 size) {
-  struct page_desc *page = ipa_to_desc(page_ipa);
-
   struct vsm_rw_data d = {
     .offset = offset,
     .buf = buf,
     .size = size,
   };
 
-  return __vsm_write_fetch_page(page, &d);
+  return __vsm_write_fetch_page(page_ipa, &d);
 }
 
 void *vsm_write_fetch_page(u64 page_ipa) {
-  struct page_desc *page = ipa_to_desc(page_ipa);
-
-  return __vsm_write_fetch_page(page, NULL);
+  return __vsm_write_fetch_page(page_ipa, NULL);
 }
 
 /* write fault handler */
-static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *d) {
+static void *__vsm_write_fetch_page(u64 page_ipa, struct vsm_rw_data *d) {
+  struct page_desc *page;
   u64 *pte;
   u64 page_pa = 0;
   int manager = -1;
-  u64 page_ipa = page_desc_addr(page);
-  u8 copyset;
+  copyset_t copyset;
 
   manager = page_manager(page_ipa);
   if(manager < 0)
     return NULL;
 
+  page = ipa_to_desc(page_ipa);
+
   page_spinlock(page);
 
-  vmm_log("write request occured: %p %p\n", page_ipa, read_sysreg(elr_el2));
+  current->flat.lock = now_cycles();
+
+  vmm_clog(LC_VSM, "write request occured: %p %p\n", page_ipa, read_sysreg(elr_el2));
 
   /*
    * may other cpu has readable/writable page already
    */
   if((pte = s2_rwable_pte(page_ipa)) != NULL) {
+    /* this cpu may hold a stale tlb entry (upgrade was deferred) */
+    tlb_s2_flush_ipa_local(page_ipa);
     page_pa = PTE_PA(*pte);
+    vsm_stat_inc(VS_WRITE_HIT);
     goto end;
   }
 
   assert(local_irq_enabled());
 
   if((pte = s2_ro_pte(page_ipa)) != NULL) {
-    if((copyset = s2pte_copyset(pte)) != 0) {
+    if((copyset = page->copyset) != 0) {
       /* I am owner */
-      vmm_log("write request %p: write to owner ro page %p\n", page_ipa, copyset);
+      vmm_clog(LC_VSM, "write request %p: write to owner ro page %p\n", page_ipa, copyset);
 
       /* Invalidate copyset */
       vsm_invalidate(page_ipa, copyset);
-      s2pte_clear_copyset(pte);
+      page->copyset = 0;
+      vsm_stat_inc(VS_WRITE_UPGRADE);
 
       goto page_acquired;
     }
@@ -625,27 +853,37 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
     /*
      *  no need to fetch page from remote node
      */
-    vmm_log("write request %p: write to copyset\n", page_ipa);
+    vmm_clog(LC_VSM, "write request %p: write to copyset\n", page_ipa);
 
     u64 pa = PTE_PA(*pte);
 
     s2pte_invalidate(pte);
-    tlb_s2_flush_all();
+    tlb_s2_flush_ipa_reason(page_ipa, TLBF_WRITE_FAULT);
 
     free_page(P2V(pa));
   }
 
+  if(manager == local_nodeid() && vsm_page_is_zero(page_ipa)) {
+    /* first touch: I am owner */
+    vmm_clog(LC_VSM, "write request %p: zero fill\n", page_ipa);
+    vsm_stat_inc(VS_WRITE_ZERO);
+
+    pte = vsm_zero_fill(page_ipa);
+
+    goto page_acquired;
+  }
+
   if(manager == local_nodeid()) {   /* I am manager */
     /* receive page from owner of page */
     struct manager_page *page = ipa_manager_page(page_ipa);
     int owner = page->owner;
 
-    vmm_log("write request %p: %d -> %d request to owner\n", page_ipa, local_nodeid(), owner);
+    vmm_clog(LC_VSM, "write request %p: %d -> %d request to owner\n", page_ipa, local_nodeid(), owner);
 
     send_write_fetch_req(local_nodeid(), owner, page_ipa);
   } else {
     /* ask manager for write access to page and a copy of page */
-    vmm_log("write request %p: %d -> %d request to manager\n", page_ipa, local_nodeid(), manager);
+    vmm_clog(LC_VSM, "write request %p: %d -> %d request to manager\n", page_ipa, local_nodeid(), manager);
 
     send_write_fetch_req(local_nodeid(), manager, page_ipa);
   }
@@ -653,20 +891,29 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
   pte = s2_accessible_pte(page_ipa);
   assert(pte);
 
-  vmm_log("write request %p: get remote page!\n", page_ipa);
+  vsm_stat_inc(VS_WRITE_REMOTE);
+  page_prof_event(page_ipa, PP_OWN_IN, 0);
+  vmm_clog(LC_VSM, "write request %p: get remote page!\n", page_ipa);
 
-  vsm_invalidate(page_ipa, s2pte_copyset(pte));
-  s2pte_clear_copyset(pte);
+  vsm_invalidate(page_ipa, page->copyset);
+  page->copyset = 0;
 
 page_acquired:
   page_pa = PTE_PA(*pte);
-  vmm_log("write request: page_pa %p\n", page_pa);
+  vmm_clog(LC_VSM, "write request: page_pa %p\n", page_pa);
 
   /* write data */
   if(unlikely(d))
     memcpy(P2V(page_pa + d->offset), d->buf, d->size);
 
+  /* RO -> RW is a permission upgrade: no need to flush */
   s2pte_rw(pte);
+  tlb_s2_defer(TLBF_WRITE_FAULT);
+
+  vsm_trace(VT_MAP, local_nodeid(), local_nodeid(), page_ipa, 0,
+            VT_AUX(WRITE_FETCH, 0, cpuid()));
+
+  vcpu_wfe_wake(page_ipa);
 
 end:
   vsm_process_waitqueue(page);
@@ -690,20 +937,49 @@ int vsm_access(struct vcpu *vcpu, char *buf, u64 ipa, u64 size, bool wr) {
   return pa_page ? 0 : -1;
 }
 
+/* hvc buffers: return copied bytes or -1 */
+int vsm_copy_to_guest(struct vcpu *vcpu, u64 ipa, void *buf, u64 size) {
+  u64 copied = 0;
+
+  /* vsm_access() does not cross a page */
+  while(copied < size) {
+    u64 n = min(size - copied, PAGESIZE - PAGE_OFFSET(ipa + copied));
+
+    if(vsm_access(vcpu, (char *)buf + copied, ipa + copied, n, true) < 0)
+      return -1;
+
+    copied += n;
+  }
+
+  return copied;
+}
+
 static void recv_fetch_reply(struct msg *reply, void * __unused arg) {
   struct fetch_reply_hdr *a = (struct fetch_reply_hdr *)reply->hdr;
   struct fetch_reply_body *b = reply->body;
   // vmm_log("recv remote ipa %p ----> pa %p\n", a->ipa, b->page);
 
-  if(b) {       // recv page (and ownership)
-    if(a->ipa == 0x404e1000)
-      bin_dump(b->page, 1024);
+  vsm_trace(VT_FETCH_REPLY, local_nodeid(), reply->hdr->src_id, a->ipa, msg_connid(reply),
+            VT_AUX(a->wnr, a->zero, cpuid()));
+
+  fault_lat_reply(current, reply->recv_stamp, a->fwd, a->rxq, a->wq, a->serve);
+
+  vcpu_migrate_account(current, reply->hdr->src_id);
 
+  if(a->zero) {   // never touched page: no data
+    u8 *page = alloc_page();
+    if(!page)
+      panic("vsm: recv zero page");
+
+    vsm_set_cache_fast(a->ipa, a->copyset, page);
+  } else if(b) {       // recv page (and ownership)
     vsm_set_cache_fast(a->ipa, a->copyset, b->page);
   } else {      // recv ownership only
     assert(a->wnr);
     panic("get ownership only\n");
   }
+
+  current->flat.map = now_cycles();
 }
 
 /*
@@ -711,45 +987,70 @@ static void recv_fetch_reply(struct msg *reply, void * __unused arg) {
  *  @dst: fetch request destination
  */
 static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type,
-                           bool waitreply, int req_cpu) {
+                           bool waitreply, int req_cpu, u32 fwd) {
   struct msg msg;
   struct fetch_req_hdr hdr;
 
   hdr.ipa = ipa;
   hdr.req_nodeid = req;
   hdr.type = type;
+  hdr.fwd = fwd;
 
   msg_init_reqcpu(&msg, dst, MSG_FETCH, &hdr, NULL, 0, req_cpu);
 
+  vsm_trace(waitreply ? VT_FETCH_REQ : VT_FETCH_FWD, req, dst, ipa, msg_connid(&msg),
+            VT_AUX(type, 0, req_cpu));
+
   if(waitreply) {
+    current->flat.issue = now_cycles();
     send_msg_cb(&msg, recv_fetch_reply, NULL);
   } else {
     send_msg(&msg);
   }
 }
 
-static void send_read_fetch_reply(u8 dst_nodeid, u64 ipa, void *page, int req_cpu) {
+/* remote part of fault latency, just before the reply is sent */
+static void fetch_reply_lat(struct fetch_reply_hdr *hdr, struct vsm_server_proc *proc) {
+  hdr->fwd = proc->fwd;
+  hdr->rxq = proc->intr_stamp - proc->recv_stamp;
+  hdr->wq = proc->proc_stamp - proc->intr_stamp;
+  hdr->serve = now_cycles() - proc->proc_stamp;
+}
+
+static void send_read_fetch_reply(u8 dst_nodeid, u64 ipa, void *page,
+                                  struct vsm_server_proc *proc) {
   struct msg msg;
   struct fetch_reply_hdr hdr;
+  int req_cpu = proc->req_cpu;
 
   hdr.ipa = ipa;
   hdr.wnr = 0;
   hdr.copyset = 0;
+  hdr.zero = false;
+  fetch_reply_lat(&hdr, proc);
 
   msg_init_reqcpu(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, page, PAGESIZE, req_cpu);
-  vmm_log("send read fetch reply %p\n", page);
+  vmm_clog(LC_VSM, "send read fetch reply %p\n", page);
+
+  page_prof_event(ipa, PP_SERVE, PAGESIZE);
+
+  vsm_trace(VT_SERVER_REPLY, dst_nodeid, dst_nodeid, ipa, msg_connid(&msg),
+            VT_AUX(0, 0, req_cpu));
 
   send_msg(&msg);
 }
 
-static void send_write_fetch_reply(u8 dst_nodeid, u64 ipa, void *page,
-                                   bool send_page, u8 copyset, int req_cpu) {
+static void send_write_fetch_reply(u8 dst_nodeid, u64 ipa, void *page, bool send_page,
+                                   copyset_t copyset, struct vsm_server_proc *proc) {
   struct msg msg;
   struct fetch_reply_hdr hdr;
+  int req_cpu = proc->req_cpu;
 
   hdr.ipa = ipa;
   hdr.wnr = 1;
   hdr.copyset = copyset;
+  hdr.zero = false;
+  fetch_reply_lat(&hdr, proc);
 
   /*
   if(ipa == 0x406c2000) {
@@ -763,6 +1064,34 @@ static void send_write_fetch_reply(u8 dst_nodeid, u64 ipa, void *page,
   else
     msg_init_reqcpu(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, NULL, 0, req_cpu);
 
+  page_prof_event(ipa, PP_OWN_OUT, send_page ? PAGESIZE : 0);
+
+  vsm_trace(VT_SERVER_REPLY, dst_nodeid, dst_nodeid, ipa, msg_connid(&msg),
+            VT_AUX(1, 0, req_cpu));
+
+  send_msg(&msg);
+}
+
+/* reply for never touched page: header only */
+static void send_zero_fetch_reply(u8 dst_nodeid, u64 ipa, bool wnr,
+                                  struct vsm_server_proc *proc) {
+  struct msg msg;
+  struct fetch_reply_hdr hdr;
+  int req_cpu = proc->req_cpu;
+
+  hdr.ipa = ipa;
+  hdr.wnr = wnr;
+  hdr.copyset = 0;
+  hdr.zero = true;
+  fetch_reply_lat(&hdr, proc);
+
+  msg_init_reqcpu(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, NULL, 0, req_cpu);
+
+  page_prof_event(ipa, wnr ? PP_OWN_OUT : PP_SERVE, 0);
+
+  vsm_trace(VT_SERVER_REPLY, dst_nodeid, dst_nodeid, ipa, msg_connid(&msg),
+            VT_AUX(wnr, 1, req_cpu));
+
   send_msg(&msg);
 }
 
@@ -775,36 +1104,51 @@ static void vsm_read_server_process(struct vsm_server_proc *proc) {
 
   assert(page_locked(page));
 
+  vsm_stat_inc(VS_SERVE_READ);
+
   int manager = page_manager(page_ipa);
   if(manager < 0)
     panic("dare");
 
-  if((pte = s2_rwable_pte(page_ipa)) != NULL ||
-      (((pte = s2_ro_pte(page_ipa)) != NULL) && s2pte_copyset(pte) != 0)) {
+  proc->proc_stamp = now_cycles();
+
+  vsm_trace(VT_SERVER_PROC, req_nodeid, local_nodeid(), page_ipa, 0,
+            VT_AUX(READ_FETCH, 0, proc->req_cpu));
+
+  if((pte = vsm_owner_pte(page, page_ipa)) != NULL) {
     s2pte_ro(pte);
-    tlb_s2_flush_ipa(page_ipa);
+    tlb_s2_flush_ipa_reason(page_ipa, TLBF_READ_SERVER);
 
     /* copyset = copyset | request node */
-    s2pte_add_copyset(pte, req_nodeid);
+    copyset_add(&page->copyset, req_nodeid);
 
     /* I am owner */
     u64 pa = PTE_PA(*pte);
 
-    vmm_log("read server %p: %d -> %d: I am owner!\n", page_ipa, req_nodeid, local_nodeid());
+    vmm_clog(LC_VSM, "read server %p: %d -> %d: I am owner!\n", page_ipa, req_nodeid, local_nodeid());
 
     /* send p */
-    send_read_fetch_reply(req_nodeid, page_ipa, P2V(pa), proc->req_cpu);
+    send_read_fetch_reply(req_nodeid, page_ipa, P2V(pa), proc);
+  } else if(local_nodeid() == manager && vsm_page_is_zero(page_ipa)) {
+    /* never touched: I am owner, but no need to send the page */
+    vmm_clog(LC_VSM, "read server %p: %d -> %d: zero page\n", page_ipa, req_nodeid, local_nodeid());
+
+    pte = vsm_zero_fill(page_ipa);
+    s2pte_ro(pte);
+    copyset_add(&page->copyset, req_nodeid);
+
+    send_zero_fetch_reply(req_nodeid, page_ipa, false, proc);
   } else if(local_nodeid() == manager) {  /* I am manager */
     struct manager_page *p = ipa_manager_page(page_ipa);
     int p_owner = p->owner;
 
-    vmm_log("read server %p: %d -> %d: forward read request\n", page_ipa, req_nodeid, p_owner);
+    vmm_clog(LC_VSM, "read server %p: %d -> %d: forward read request\n", page_ipa, req_nodeid, p_owner);
 
     if(req_nodeid == p_owner)
       panic("read server: req_nodeid(%d) == p_owner(%d)", req_nodeid, p_owner);
 
     /* forward request to p's owner */
-    forward_read_fetch_req(req_nodeid, p_owner, page_ipa, proc->req_cpu);
+    forward_read_fetch_req(req_nodeid, p_owner, page_ipa, proc);
   } else {
     printf("read server: read %p (manager %d) from Node %d", page_ipa, manager, req_nodeid);
     panic("unreachable");
@@ -821,30 +1165,39 @@ static void vsm_write_server_process(struct vsm_server_proc *proc) {
 
   assert(page_locked(page));
 
+  vsm_stat_inc(VS_SERVE_WRITE);
+
   int manager = page_manager(page_ipa);
   if(manager < 0)
     panic("dare w");
 
-  if((pte = s2_rwable_pte(page_ipa)) != NULL ||
-      (((pte = s2_ro_pte(page_ipa)) != NULL) && s2pte_copyset(pte) != 0)) {
+  proc->proc_stamp = now_cycles();
+
+  vsm_trace(VT_SERVER_PROC, req_nodeid, local_nodeid(), page_ipa, 0,
+            VT_AUX(WRITE_FETCH, 0, proc->req_cpu));
+
+  if((pte = vsm_owner_pte(page, page_ipa)) != NULL) {
     /* I am owner */
     u64 pa = PTE_PA(*pte);
-    u64 copyset = s2pte_copyset(pte);
+    copyset_t copyset = page->copyset;
+
+    page->copyset = 0;
 
     s2pte_invalidate(pte);
-    tlb_s2_flush_ipa(page_ipa);
+    tlb_s2_flush_ipa_reason(page_ipa, TLBF_WRITE_SERVER);
 
-    vmm_log("write server %p %d -> %d I am owner! copyset %p\n",
+    vcpu_wfe_wake(page_ipa);
+
+    vmm_clog(LC_VSM, "write server %p %d -> %d I am owner! copyset %p\n",
             page_ipa, req_nodeid, local_nodeid(), copyset);
 
     /*
     vsm_invalidate(page_ipa, copyset);
-    s2pte_clear_copyset(pte);
     */
 
     // send p and copyset;
     send_write_fetch_reply(req_nodeid, page_ipa, P2V(pa), send_page,
-                           copyset, proc->req_cpu);
+                           copyset, proc);
 
     free_page(P2V(pa));
 
@@ -853,18 +1206,28 @@ static void vsm_write_server_process(struct vsm_server_proc *proc) {
 
       p->owner = req_nodeid;
     }
+  } else if(local_nodeid() == manager && vsm_page_is_zero(page_ipa)) {
+    struct manager_page *p = ipa_manager_page(page_ipa);
+
+    /* never touched: hand over ownership without page data */
+    vmm_clog(LC_VSM, "write server %p %d -> %d zero page\n", page_ipa, req_nodeid, local_nodeid());
+
+    send_zero_fetch_reply(req_nodeid, page_ipa, true, proc);
+
+    p->zero = 0;
+    p->owner = req_nodeid;
   } else if(local_nodeid() == manager) {
     struct manager_page *p = ipa_manager_page(page_ipa);
     int p_owner = p->owner;
 
-    vmm_log("write server %p %d -> %d forward write request\n", page_ipa, req_nodeid, p_owner);
+    vmm_clog(LC_VSM, "write server %p %d -> %d forward write request\n", page_ipa, req_nodeid, p_owner);
 
     if(req_nodeid == p_owner)
       panic("write server: req_nodeid(%d) == p_owner(%d) fetch request from owner!",
               req_nodeid, p_owner);
 
     /* forward request to p's owner */
-    forward_write_fetch_req(req_nodeid, p_owner, page_ipa, proc->req_cpu);
+    forward_write_fetch_req(req_nodeid, p_owner, page_ipa, proc);
 
     /* now owner is request node */
     p->owner = req_nodeid;
@@ -878,6 +1241,13 @@ static void recv_fetch_request_intr(struct msg *msg) {
   struct vsm_server_proc *p = new_vsm_server_proc(a->ipa, a->req_nodeid,
                                                   a->type, msg_cpu(msg));
 
+  p->recv_stamp = msg->recv_stamp;
+  p->intr_stamp = now_cycles();
+  p->fwd = a->fwd;
+
+  vsm_trace(VT_SERVER_RECV, a->req_nodeid, local_nodeid(), a->ipa, msg_connid(msg),
+            VT_AUX(a->type, 0, msg_cpu(msg)));
+
   struct page_desc *page = ipa_to_desc(a->ipa);
 
   if(page_trylock(page)) {
@@ -897,6 +1267,10 @@ static void recv_invalidate_intr(struct msg *msg) {
   struct invalidate_hdr *h = (struct invalidate_hdr *)msg->hdr;
   struct vsm_server_proc *p = new_vsm_inv_server_proc(h->ipa, h->from_nodeid, h->copyset);
 
+  vsm_trace(VT_INV_RECV, h->from_nodeid, local_nodeid(), h->ipa, msg_connid(msg), 0);
+  vsm_stat_inc(VS_INV_RECV);
+  page_prof_event(h->ipa, PP_INV, 0);
+
   struct page_desc *page = ipa_to_desc(h->ipa);
 
   if(page_trylock(page)) {
@@ -912,8 +1286,76 @@ static void recv_invalidate_intr(struct msg *msg) {
   vsm_process_waitqueue(page);
 }
 
+void vsm_stats() {
+  printf("vsm stats: node %d desc chunks %d manager chunks %d\n", local_nodeid(),
+         nr_desc_chunks, nr_manager_chunks);
+
+  for(int s = 0; s < NR_VSM_STAT; s++) {
+    u64 n = 0;
+
+    for(int cpu = 0; cpu < NCPU_MAX; cpu++)
+      n += vsmstat[cpu].n[s];
+
+    printf("%s\t%d\n", vsm_stat_name[s], n);
+  }
+}
+
+/* protocol state of the page of ipa on this node */
+void vsm_page_dump(u64 ipa) {
+  u64 page_ipa = PAGE_ADDRESS(ipa);
+  int manager = page_manager(page_ipa);
+  struct desc_chunk *dc;
+  int st = 0;
+
+  if(manager < 0) {
+    printf("vsm: %p is not guest ram\n", ipa);
+    return;
+  }
+
+  if(s2_rwable_pte(page_ipa))
+    st = 3;
+  else if(s2_readable_pte(page_ipa))
+    st = 1;
+
+  printf("vsm: page %p %s manager node%d", page_ipa, pte_state[st], manager);
+
+  /* a query: chunks of a page never touched are not allocated here */
+  if(manager == local_nodeid()) {
+    struct manager_chunk *mc = vsm_chunk_lookup(manager_dir, page_ipa);
+
+    if(mc) {
+      struct manager_page *p = &mc->page[chunk_index(page_ipa)];
+
+      printf(" owner node%d%s", p->owner, p->zero ? " (zero)" : "");
+    } else {
+      printf(" owner: no metadata");
+    }
+  }
+
+  if((dc = vsm_chunk_lookup(desc_dir, page_ipa)) != NULL) {
+    struct page_desc *page = &dc->desc[chunk_index(page_ipa)];
+
+    printf(" copyset %p lock %d wqlock %d\n", page->copyset, page->lock, page->wqlock);
+  } else {
+    printf(" no metadata\n");
+  }
+
+  s2_pte_dump(page_ipa);
+}
+
 void vsm_node_init(struct memrange *mem) {
   u64 start = mem->start, size = mem->size;
+
+  if(start % (1 << VSM_CHUNK_SHIFT) || size % (1 << VSM_CHUNK_SHIFT))
+    panic("vsm: memrange must be 2MB aligned [%p - %p]", start, start+size);
+
+  /* manager pages are set up on first use: owner is me */
+#ifdef CONFIG_VSM_LAZY_HOME
+  /* pages are allocated on first touch */
+  vsm_lazy_home = true;
+
+  vmm_log("Node %d lazy: [%p - %p]\n", local_nodeid(), start, start+size);
+#else
   u64 p;
 
   for(p = 0; p < size; p += PAGESIZE) {
@@ -925,12 +1367,7 @@ void vsm_node_init(struct memrange *mem) {
   }
 
   vmm_log("Node %d mapped: [%p - %p]\n", local_nodeid(), start, start+p);
-
-  struct manager_page *page;
-  for(page = manager; page < &manager[NR_MANAGER_PAGES]; page++) {
-    /* now owner is me */
-    page->owner = local_nodeid();
-  }
+#endif
 }
 
 DEFINE_POCV2_MSG(MSG_FETCH, struct fetch_req_hdr, recv_fetch_request_intr);
@@ -6,6 +6,9 @@
 #include "aarch64.h"
 #include "printf.h"
 #include "irq.h"
+#include "localnode.h"
+#include "gic.h"
+#include "sched.h"
 
 #define CNTHP_CTL_EL2_ENABLE    (1ul << 0)
 #define CNTHP_CTL_EL2_IMASK     (1ul << 1)
@@ -13,8 +16,28 @@
 
 static u64 cpu_hz;
 
+void hyp_timer_oneshot(u64 ticks) {
+  write_sysreg(cnthp_tval_el2, ticks);
+  write_sysreg(cnthp_ctl_el2, CNTHP_CTL_EL2_ENABLE);
+
+  isb();
+}
+
+void hyp_timer_cancel() {
+  write_sysreg(cnthp_ctl_el2, CNTHP_CTL_EL2_IMASK | CNTHP_CTL_EL2_ENABLE);
+}
+
 static void hyp_timer_intr(void *arg) {
   (void)arg;
+
+  /* one-shot: mask until rearmed */
+  hyp_timer_cancel();
+
+  sched_tick();
+}
+
+u64 usecs_to_ticks(u64 us) {
+  return cpu_hz * us / 1000000;
 }
 
 void usleep(int us) {
@@ -28,11 +51,14 @@ void arch_timer_init_core() {
   u64 ctl = CNTHP_CTL_EL2_IMASK | CNTHP_CTL_EL2_ENABLE;
 
   write_sysreg(cnthp_ctl_el2, ctl);
+
+  /* PPI is banked per cpu */
+  localnode.irqchip->enable_irq(HYP_TIMER_IRQ);
 }
 
 void arch_timer_init() {
   cpu_hz = read_sysreg(cntfrq_el0);
   printf("CPU %d Hz\n", cpu_hz);
 
-  irq_register(26, hyp_timer_intr, NULL);
+  irq_register(HYP_TIMER_IRQ, hyp_timer_intr, NULL);
 }
@@ -271,7 +271,7 @@ static void bcmgenet_xmit(struct nic *nic, struct iobuf *iobuf) {
   spin_lock_irqsave(&m_tx_lock, flags);
 
   if (ring->free_bds < 2) { // is there room for this frame?
-    printf("TX frame dropped!!!!!!!!\r\n");
+    vmm_cwarn(LC_NET, "bcmgenet: tx frame dropped\n");
     spin_unlock_irqrestore(&m_tx_lock, flags);
     return;
   }
@@ -282,7 +282,7 @@ static void bcmgenet_xmit(struct nic *nic, struct iobuf *iobuf) {
 
   void *tx_header_buffer = iobuf->data;
   length = iobuf->len;
-  printf("bcmgenet: xmit: iobuf->len %d", length);
+  vmm_clog(LC_NET, "bcmgenet: xmit: iobuf->len %d\n", length);
 
   struct bcmgenet_cb *tx_cb_ptr =
       get_txcb(ring);  // get Tx control block from ring
@@ -387,7 +387,7 @@ static int bcmgenet_rxintr(void) {
 
   struct bcmgenet_rx_ring *ring = &m_rx_rings[GENET_DESC_INDEX]; // the only supported Rx queue
 
-  printf("bcmgenet: rxintr\n");
+  vmm_clog(LC_NET, "bcmgenet: rxintr\n");
 
   bcmgenet_intrl2_0_writel(UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_CLEAR);
 
@@ -418,7 +418,7 @@ static int bcmgenet_rxintr(void) {
 
     struct iobuf *pRxBuffer = rx_refill(cb);
     if (!pRxBuffer) {
-      printf("Missing RX buffer!");
+      vmm_cwarn(LC_NET, "bcmgenet: missing rx buffer\n");
       goto out;
     }
 
@@ -427,7 +427,7 @@ static int bcmgenet_rxintr(void) {
     nLength = dma_length_status >> DMA_BUFLENGTH_SHIFT;
 
     if (!(dma_flag & DMA_EOP) || !(dma_flag & DMA_SOP)) {
-      printf("Dropping fragmented RX packet!");
+      vmm_cwarn(LC_NET, "bcmgenet: dropping fragmented rx packet\n");
       free_iobuf(pRxBuffer);
 
       goto out;
@@ -435,7 +435,7 @@ static int bcmgenet_rxintr(void) {
 
     // report errors
     if (dma_flag & (DMA_RX_CRC_ERROR | DMA_RX_OV | DMA_RX_NO | DMA_RX_LG | DMA_RX_RXER)) {
-      printf("RX error (0x%x)", (unsigned)dma_flag);
+      vmm_cwarn(LC_NET, "bcmgenet: rx error (%p)\n", (u64)dma_flag);
       free_iobuf(pRxBuffer);
 
       goto out;
@@ -523,7 +523,7 @@ static void bcmgenet_intr_irq1(void *arg) {
   }
 
   if (status & UMAC_IRQ_RXDMA_DONE) {
-    printf("Received! #1\n");
+    vmm_clog(LC_NET, "bcmgenet: rxdma done\n");
   }
 
   spin_unlock(&m_tx_lock);
@@ -31,7 +31,7 @@ void ethernet_recv_intr(struct nic *nic, struct iobuf *iobuf) {
 
   iobuf->eth = eth;
 
-  vmm_log("ether: recv intr from %m %p %p\n", eth->src, eth->type, read_sysreg(elr_el2));
+  vmm_clog(LC_NET, "ether: recv intr from %m %p %p\n", eth->src, eth->type, read_sysreg(elr_el2));
 
   if(memcmp(eth->dst, bcast_mac, 6) == 0 || memcmp(eth->dst, nic->mac, 6) == 0) {
     if((eth->type & 0xff) == 0x19) {
@@ -88,6 +88,8 @@ static u32 gicv2_pending_lr(struct gic_pending_irq *irq) {
     lr |= (irq_no(irq->pirq) & 0x3ff) << GICH_LR_PID_SHIFT;
   } else if(is_sgi(irq->virq)) {
     lr |= (irq->req_cpu & 0x7) << GICH_LR_CPUID_SHIFT;
+  } else if(irq->eoi) {
+    lr |= GICH_LR_EOI;
   }
 
   return lr;
@@ -108,6 +110,23 @@ static bool gicv2_guest_irq_pending(u32 virq) {
   return false;
 }
 
+/* any irq in pending state in list registers? */
+static bool gicv2_guest_lr_pending() {
+  u32 elsr0 = gich_read(GICH_ELSR0);
+  u32 elsr1 = gich_read(GICH_ELSR1);
+  u64 elsr = ((u64)elsr1 << 32) | elsr0;
+
+  for(int i = 0; i <= gicv2_irqchip.max_lr; i++) {
+    if((elsr >> i) & 0x1)
+      continue;
+
+    if(gicv2_read_lr(i) & (LR_PENDING << GICH_LR_State_SHIFT))
+      return true;
+  }
+
+  return false;
+}
+
 static int gicv2_inject_guest_irq(struct gic_pending_irq *irq) {
   u32 virq = irq->virq;
 
@@ -120,7 +139,7 @@ static int gicv2_inject_guest_irq(struct gic_pending_irq *irq) {
   int freelr = -1;
   u64 lr;
 
-  for(int i = 0; i < gicv2_irqchip.max_lr; i++) {
+  for(int i = 0; i <= gicv2_irqchip.max_lr; i++) {
     if((elsr >> i) & 0x1) {
       if(freelr < 0)
         freelr = i;
@@ -128,12 +147,12 @@ static int gicv2_inject_guest_irq(struct gic_pending_irq *irq) {
       continue;
     }
 
-    if(((gicv2_read_lr(i) >> GICH_LR_PID_SHIFT) & 0x3ff) == virq)
-      return -1;    // busy
+    if((gicv2_read_lr(i) & 0x3ff) == virq)
+      return GIC_INJECT_BUSY;
   }
 
   if(freelr < 0)
-    return -1;    // no entry
+    return GIC_INJECT_NOLR;
 
   lr = gicv2_pending_lr(irq);
 
@@ -142,6 +161,38 @@ static int gicv2_inject_guest_irq(struct gic_pending_irq *irq) {
   return 0;
 }
 
+/*
+ *  maintenance interrupt when at most one list register is valid
+ */
+static void gicv2_set_underflow_irq(bool enable) {
+  u32 hcr = gich_read(GICH_HCR);
+
+  if(enable)
+    hcr |= GICH_HCR_UIE;
+  else
+    hcr &= ~GICH_HCR_UIE;
+
+  gich_write(GICH_HCR, hcr);
+}
+
+/*
+ *  collect virqs the guest has EOIed in list registers with EOI bit,
+ *  and free those list registers
+ */
+static int gicv2_take_eoi_lrs(u32 *virqs, int max) {
+  u64 eisr = ((u64)gich_read(GICH_EISR1) << 32) | gich_read(GICH_EISR0);
+  int n = 0;
+
+  for(; eisr && n < max; eisr &= eisr - 1) {
+    int i = __builtin_ctzl(eisr);
+
+    virqs[n++] = gicv2_read_lr(i) & 0x3ff;
+    gicv2_write_lr(i, 0);
+  }
+
+  return n;
+}
+
 static u32 gicv2_read_iar() {
   return gicc_read(GICC_IAR);
 }
@@ -163,6 +214,41 @@ static void gicv2_guest_eoi(u32 iar) {
   gicv2_eoi(iar);
 }
 
+/*
+ *  save vgic state of the outgoing vcpu and leave list registers empty.
+ *  hw-linked irqs are detached: the physical irq is deactivated so that
+ *  it can fire for the next vcpu (e.g. its virtual timer).
+ */
+static void gicv2_save_state(struct gic_state *gic) {
+  gic->hcr = gich_read(GICH_HCR);
+  gic->vmcr = gich_read(GICH_VMCR);
+  gic->apr[0] = gich_read(GICH_APR);
+
+  for(int i = 0; i <= gicv2_irqchip.max_lr; i++) {
+    u32 lr = gicv2_read_lr(i);
+
+    if(lr & GICH_LR_HW) {
+      gicv2_deactive_irq((lr >> GICH_LR_PID_SHIFT) & 0x3ff);
+      lr &= ~(GICH_LR_HW | (0x3ff << GICH_LR_PID_SHIFT));
+    }
+
+    gic->lr[i] = lr;
+    gicv2_write_lr(i, 0);
+  }
+
+  /* no maintenance interrupt while no vcpu is loaded */
+  gich_write(GICH_HCR, GICH_HCR_EN);
+}
+
+static void gicv2_restore_state(struct gic_state *gic) {
+  for(int i = 0; i <= gicv2_irqchip.max_lr; i++)
+    gicv2_write_lr(i, gic->lr[i]);
+
+  gich_write(GICH_APR, gic->apr[0]);
+  gich_write(GICH_VMCR, gic->vmcr);
+  gich_write(GICH_HCR, gic->hcr);
+}
+
 static void gicv2_send_sgi(struct gic_sgi *sgi) {
   u32 sgir = (sgi->mode << GICD_SGIR_TargetListFilter_SHIFT) |
              ((sgi->targets & 0xff) << GICD_SGIR_TargetList_SHIFT) |
@@ -214,7 +300,7 @@ static void gicv2_set_targets(u32 irq, u8 targets) {
 
 static void gicv2_setup_irq(u32 irq) {
   if(is_spi(irq)) {
-    gicv2_set_targets(irq, 1 << 0);    // route to 0
+    gicv2_set_targets(irq, 1 << pcpu_base());    // route to the first pcpu of this node
   }
 
   gicv2_enable_irq(irq);
@@ -256,6 +342,9 @@ static void gicv2_h_init() {
 
   // gich_write(GICH_VMCR, GICH_VMCR_VMG0En);
   gich_write(GICH_HCR, GICH_HCR_EN);
+
+  /* maintenance interrupt is banked per cpu */
+  gicv2_enable_irq(GIC_MAINTENANCE_IRQ);
 }
 
 static void gicv2_c_init() {
@@ -272,13 +361,17 @@ static void gicv2_c_init() {
 }
 
 static void gicv2_d_init() {
-  gicd_write(GICD_CTLR, 0);
-
   u32 lines = gicd_read(GICD_TYPER) & 0x1f;
   u32 nirqs = 32 * (lines + 1);
 
   gicv2_irqchip.nirqs = nirqs < 1020 ? nirqs : 1020;
 
+  /* node0 set up the distributor of a shared machine */
+  if(partition_is_sub())
+    return;
+
+  gicd_write(GICD_CTLR, 0);
+
   /* all interrupts are group 0 */
   for(int i = 0; i < nirqs; i += 4)
     gicd_write(GICD_IGROUPR(i / 4), 0);
@@ -346,8 +439,13 @@ static struct gic_irqchip gicv2_irqchip = {
 
   .initcore           = gicv2_init_cpu,
   .inject_guest_irq   = gicv2_inject_guest_irq,
+  .set_underflow_irq  = gicv2_set_underflow_irq,
+  .take_eoi_lrs       = gicv2_take_eoi_lrs,
   .irq_pending        = gicv2_irq_pending,
   .guest_irq_pending  = gicv2_guest_irq_pending,
+  .guest_lr_pending   = gicv2_guest_lr_pending,
+  .save_state         = gicv2_save_state,
+  .restore_state      = gicv2_restore_state,
   .host_eoi           = gicv2_host_eoi,
   .guest_eoi          = gicv2_guest_eoi,
   .deactive_irq       = gicv2_deactive_irq,
@@ -95,50 +95,6 @@ static void gicv3_write_lr(int n, u64 val) {
   }
 }
 
-/*
-static void gicv3_restore_lr(struct gic_state *gic) {
-  switch(gic_lr_max-1) {
-    case 15:  write_sysreg(ich_lr15_el2, gic->lr[15]); __fallthrough;
-    case 14:  write_sysreg(ich_lr14_el2, gic->lr[14]); __fallthrough;
-    case 13:  write_sysreg(ich_lr13_el2, gic->lr[13]); __fallthrough;
-    case 12:  write_sysreg(ich_lr12_el2, gic->lr[12]); __fallthrough;
-    case 11:  write_sysreg(ich_lr11_el2, gic->lr[11]); __fallthrough;
-    case 10:  write_sysreg(ich_lr10_el2, gic->lr[10]); __fallthrough;
-    case 9:   write_sysreg(ich_lr9_el2, gic->lr[9]); __fallthrough;
-    case 8:   write_sysreg(ich_lr8_el2, gic->lr[8]); __fallthrough;
-    case 7:   write_sysreg(ich_lr7_el2, gic->lr[7]); __fallthrough;
-    case 6:   write_sysreg(ich_lr6_el2, gic->lr[6]); __fallthrough;
-    case 5:   write_sysreg(ich_lr5_el2, gic->lr[5]); __fallthrough;
-    case 4:   write_sysreg(ich_lr4_el2, gic->lr[4]); __fallthrough;
-    case 3:   write_sysreg(ich_lr3_el2, gic->lr[3]); __fallthrough;
-    case 2:   write_sysreg(ich_lr2_el2, gic->lr[2]); __fallthrough;
-    case 1:   write_sysreg(ich_lr1_el2, gic->lr[1]); __fallthrough;
-    case 0:   write_sysreg(ich_lr0_el2, gic->lr[0]);
-  }
-}
-
-static void gicv3_save_lr(struct gic_state *gic) {
-  switch(gic_lr_max-1) {
-    case 15:  gic->lr[15] = read_sysreg(ich_lr15_el2); __fallthrough;
-    case 14:  gic->lr[14] = read_sysreg(ich_lr14_el2); __fallthrough;
-    case 13:  gic->lr[13] = read_sysreg(ich_lr13_el2); __fallthrough;
-    case 12:  gic->lr[12] = read_sysreg(ich_lr12_el2); __fallthrough;
-    case 11:  gic->lr[11] = read_sysreg(ich_lr11_el2); __fallthrough;
-    case 10:  gic->lr[10] = read_sysreg(ich_lr10_el2); __fallthrough;
-    case 9:   gic->lr[9] = read_sysreg(ich_lr9_el2); __fallthrough;
-    case 8:   gic->lr[8] = read_sysreg(ich_lr8_el2); __fallthrough;
-    case 7:   gic->lr[7] = read_sysreg(ich_lr7_el2); __fallthrough;
-    case 6:   gic->lr[6] = read_sysreg(ich_lr6_el2); __fallthrough;
-    case 5:   gic->lr[5] = read_sysreg(ich_lr5_el2); __fallthrough;
-    case 4:   gic->lr[4] = read_sysreg(ich_lr4_el2); __fallthrough;
-    case 3:   gic->lr[3] = read_sysreg(ich_lr3_el2); __fallthrough;
-    case 2:   gic->lr[2] = read_sysreg(ich_lr2_el2); __fallthrough;
-    case 1:   gic->lr[1] = read_sysreg(ich_lr1_el2); __fallthrough;
-    case 0:   gic->lr[0] = read_sysreg(ich_lr0_el2);
-  }
-}
-*/
-
 static u64 gicv3_pending_lr(struct gic_pending_irq *irq) {
   u64 lr = irq->virq;
 
@@ -153,11 +109,28 @@ static u64 gicv3_pending_lr(struct gic_pending_irq *irq) {
     /* this is hw irq */
     lr |= ICH_LR_HW;
     lr |= ((u64)irq_no(irq->pirq) & 0x3ff) << ICH_LR_PINTID_SHIFT;
+  } else if(irq->eoi) {
+    lr |= ICH_LR_EOI;
   }
 
   return lr;
 }
 
+/* any irq in pending state in list registers? */
+static bool gicv3_guest_lr_pending() {
+  u64 elsr = read_sysreg(ich_elsr_el2);
+
+  for(int i = 0; i <= gicv3_irqchip.max_lr; i++) {
+    if((elsr >> i) & 0x1)
+      continue;
+
+    if(gicv3_read_lr(i) & (LR_PENDING << ICH_LR_STATE_SHIFT))
+      return true;
+  }
+
+  return false;
+}
+
 static int gicv3_inject_guest_irq(struct gic_pending_irq *irq) {
   u32 virq = irq->virq;
 
@@ -168,7 +141,7 @@ static int gicv3_inject_guest_irq(struct gic_pending_irq *irq) {
   int freelr = -1;
   u64 lr;
 
-  for(int i = 0; i < gicv3_irqchip.max_lr; i++) {
+  for(int i = 0; i <= gicv3_irqchip.max_lr; i++) {
     if((elsr >> i) & 0x1) {   // free area in lr
       if(freelr < 0)
         freelr = i;
@@ -177,11 +150,11 @@ static int gicv3_inject_guest_irq(struct gic_pending_irq *irq) {
     }
 
     if((u32)gicv3_read_lr(i) == virq)
-      return -1;
+      return GIC_INJECT_BUSY;
   }
 
   if(freelr < 0)
-    panic("busy");
+    return GIC_INJECT_NOLR;
 
   lr = gicv3_pending_lr(irq);
 
@@ -190,6 +163,39 @@ static int gicv3_inject_guest_irq(struct gic_pending_irq *irq) {
   return 0;
 }
 
+/*
+ *  maintenance interrupt when at most one list register is valid
+ */
+static void gicv3_set_underflow_irq(bool enable) {
+  u64 hcr = read_sysreg(ich_hcr_el2);
+
+  if(enable)
+    hcr |= ICH_HCR_UIE;
+  else
+    hcr &= ~ICH_HCR_UIE;
+
+  write_sysreg(ich_hcr_el2, hcr);
+  isb();
+}
+
+/*
+ *  collect virqs the guest has EOIed in list registers with EOI bit,
+ *  and free those list registers
+ */
+static int gicv3_take_eoi_lrs(u32 *virqs, int max) {
+  u64 eisr = read_sysreg(ich_eisr_el2);
+  int n = 0;
+
+  for(; eisr && n < max; eisr &= eisr - 1) {
+    int i = __builtin_ctzl(eisr);
+
+    virqs[n++] = (u32)gicv3_read_lr(i);
+    gicv3_write_lr(i, 0);
+  }
+
+  return n;
+}
+
 static u32 gicv3_read_iar() {
   return read_sysreg(icc_iar1_el1);
 }
@@ -211,6 +217,47 @@ static void gicv3_guest_eoi(u32 iar) {
   gicv3_eoi(iar);
 }
 
+/*
+ *  save vgic state of the outgoing vcpu and leave list registers empty.
+ *  hw-linked irqs are detached: the physical irq is deactivated so that
+ *  it can fire for the next vcpu (e.g. its virtual timer).
+ */
+static void gicv3_save_state(struct gic_state *gic) {
+  gic->hcr = read_sysreg(ich_hcr_el2);
+  gic->vmcr = read_sysreg(ich_vmcr_el2);
+  gic->apr[0] = read_sysreg(ich_ap0r0_el2);
+  gic->apr[1] = read_sysreg(ich_ap1r0_el2);
+
+  for(int i = 0; i <= gicv3_irqchip.max_lr; i++) {
+    u64 lr = gicv3_read_lr(i);
+
+    if(lr & ICH_LR_HW) {
+      gicv3_deactive_irq((lr >> ICH_LR_PINTID_SHIFT) & 0x3ff);
+      lr &= ~(ICH_LR_HW | (0x3fful << ICH_LR_PINTID_SHIFT));
+    }
+
+    gic->lr[i] = lr;
+    gicv3_write_lr(i, 0);
+  }
+
+  /* no maintenance interrupt while no vcpu is loaded */
+  write_sysreg(ich_hcr_el2, ICH_HCR_EN);
+
+  isb();
+}
+
+static void gicv3_restore_state(struct gic_state *gic) {
+  for(int i = 0; i <= gicv3_irqchip.max_lr; i++)
+    gicv3_write_lr(i, gic->lr[i]);
+
+  write_sysreg(ich_ap0r0_el2, gic->apr[0]);
+  write_sysreg(ich_ap1r0_el2, gic->apr[1]);
+  write_sysreg(ich_vmcr_el2, gic->vmcr);
+  write_sysreg(ich_hcr_el2, gic->hcr);
+
+  isb();
+}
+
 static void gicv3_send_sgi(struct gic_sgi *sgi) {
   u64 sgir = (sgi->sgi_id & 0xf) << ICC_SGI1R_INTID_SHIFT;
 
@@ -304,28 +351,6 @@ static void gicv3_disable_irq(u32 irq) {
   }
 }
 
-/*
-void gic_init_state(struct gic_state *gic) {
-  gic->vmcr = read_sysreg(ich_vmcr_el2);
-}
-
-void gic_restore_state(struct gic_state *gic) {
-  write_sysreg(ich_vmcr_el2, gic->vmcr);
-
-  u32 sre = read_sysreg(icc_sre_el1);
-  write_sysreg(icc_sre_el1, sre | gic->sre_el1);
-
-  gic_restore_lr(gic);
-}
-
-void gic_save_state(struct gic_state *gic) {
-  gic->vmcr = read_sysreg(ich_vmcr_el2);
-  gic->sre_el1 = read_sysreg(icc_sre_el1);
-
-  gic_save_lr(gic);
-}
-*/
-
 static bool gicv3_guest_irq_pending(u32 virq) {
   for(int i = 0; i <= gicv3_irqchip.max_lr; i++) {
     u64 lr = gicv3_read_lr(i);
@@ -343,7 +368,7 @@ static bool gicv3_guest_irq_pending(u32 virq) {
 
 static void gicv3_setup_irq(u32 irq) {
   if(is_spi(irq))
-    gicv3_route_irq(irq, 0);
+    gicv3_route_irq(irq, pcpu_base());    /* first pcpu of this node */
 
   gicv3_enable_irq(irq);
 }
@@ -400,10 +425,6 @@ static inline bool security_disabled() {
 static void gicv3_d_init(void) {
   u32 ctlr;
 
-  /* disabled gicd */
-  gicd_w(GICD_CTLR, 0);
-  gicv3_d_wait_for_rwp();
-
   u32 pidr2 = gicd_r(GICD_PIDR2);
   u32 archrev = GICD_PIDR2_ArchRev(pidr2);
   if(archrev != 0x3)
@@ -416,6 +437,14 @@ static void gicv3_d_init(void) {
 
   gicv3_irqchip.nirqs = nirqs < 1020 ? nirqs : 1020;
 
+  /* node0 set up the distributor of a shared machine */
+  if(partition_is_sub())
+    return;
+
+  /* disabled gicd */
+  gicd_w(GICD_CTLR, 0);
+  gicv3_d_wait_for_rwp();
+
   for(int i = 0; i < nirqs; i += 4)
     gicd_w(GICD_IGROUPR(i / 4), ~0);
 
@@ -465,6 +494,9 @@ static void gicv3_h_init(void) {
   write_sysreg(ich_hcr_el2, ICH_HCR_EN);
 
   isb();
+
+  /* maintenance interrupt is banked per cpu */
+  gicv3_enable_irq(GIC_MAINTENANCE_IRQ);
 }
 
 static void gicv3_init_cpu() {
@@ -508,8 +540,13 @@ static struct gic_irqchip gicv3_irqchip = {
 
   .initcore           = gicv3_init_cpu,
   .inject_guest_irq   = gicv3_inject_guest_irq,
+  .set_underflow_irq  = gicv3_set_underflow_irq,
+  .take_eoi_lrs       = gicv3_take_eoi_lrs,
   .irq_pending        = gicv3_irq_pending,
   .guest_irq_pending  = gicv3_guest_irq_pending,
+  .guest_lr_pending   = gicv3_guest_lr_pending,
+  .save_state         = gicv3_save_state,
+  .restore_state      = gicv3_restore_state,
   .host_eoi           = gicv3_host_eoi,
   .guest_eoi          = gicv3_guest_eoi,
   .deactive_irq       = gicv3_deactive_irq,
@@ -30,6 +30,14 @@ static inline void pl011_putc(char c) {
   pl011_write(DR, c);
 }
 
+static int pl011_tryputc(char c) {
+  if(pl011_read(FR) & FR_TXFF)
+    return -1;
+
+  pl011_write(DR, c);
+  return 0;
+}
+
 static void pl011_puts(char *s) {
   char c;
 
@@ -44,6 +52,14 @@ static int pl011_getc() {
     return pl011_read(DR);
 }
 
+static u32 pl011_reg_read(u64 offset) {
+  return pl011_read(offset);
+}
+
+static void pl011_reg_write(u64 offset, u32 val) {
+  pl011_write(offset, val);
+}
+
 static void pl011_set_baudrate(int baud) {
   u64 bauddiv = (UART_FREQ * 1000) / (16 * baud);
 
@@ -74,7 +90,12 @@ static void pl011_intr(__unused void *arg) {
 static struct uartchip pl011 = {
   .name = "pl011",
   .putc = pl011_putc,
+  .tryputc = pl011_tryputc,
   .puts = pl011_puts,
+  .getc = pl011_getc,
+  .reg_read = pl011_reg_read,
+  .reg_write = pl011_reg_write,
+  .rx_reg = DR,
 };
 
 static int pl011_dt_init(struct device_node *dev) {
@@ -48,18 +48,23 @@ static char *psci_status_map(int status) {
   }
 }
 
-static int psci_cpu_boot(struct pcpu *cpu, physaddr_t ep_phys) {
-  int id = pcpu_id(cpu);
-  i64 status = psci_call(psci_info.cpu_on, id, ep_phys, 0);
+/* ctxid is x0 of the cpu at ep_phys */
+int psci_cpu_on(int cpu, physaddr_t ep_phys, u64 ctxid) {
+  i64 status = psci_call(psci_info.cpu_on, cpu, ep_phys, ctxid);
 
   if(status == PSCI_SUCCESS) {
     return 0;
   } else {
-    vmm_warn("psci: cpu%d wakeup failed: %d(=%s)", id, status, psci_status_map(status));
+    vmm_warn("psci: cpu%d wakeup failed: %d(=%s)", cpu, status, psci_status_map(status));
     return -1;
   }
 }
 
+static int psci_cpu_boot(struct pcpu *cpu, physaddr_t ep_phys) {
+  /* x0 = 0: a secondary pcpu of this node (boot/boot.S) */
+  return psci_cpu_on(pcpu_id(cpu), ep_phys, 0);
+}
+
 static int em_psci_init(struct pcpu * __unused cpu) {
   return 0;
 }
@@ -0,0 +1,173 @@
+/*
+ *  shmnet: nic between the nodes of a shared machine (core/partition.c)
+ *
+ *  the ring of a node is a bounded mpsc queue in shm: a producer claims
+ *  slot pos with a cas on enqueue, fills it and publishes seq = pos + 1,
+ *  the consumer frees it with seq = pos + SHMNET_NSLOT.  the producer
+ *  which sets kick 0 -> 1 sends an sgi to the first pcpu of the node.
+ *  shmnet_rx() only queues msgs, so it never waits for a slot itself.
+ */
+
+#include "aarch64.h"
+#include "atomic.h"
+#include "shmnet.h"
+#include "partition.h"
+#include "pcpu.h"
+#include "net.h"
+#include "ethernet.h"
+#include "allocpage.h"
+#include "lib.h"
+#include "log.h"
+#include "panic.h"
+
+/* 02:70:6f:63:00:<node> */
+static u8 shmnet_mac[5] = {0x02, 0x70, 0x6f, 0x63, 0x00};
+
+static struct shmnet_ring *shmnet_ring(int node) {
+  return partition_shm(PARTITION_SHM_RINGS + node * sizeof(struct shmnet_ring));
+}
+
+/* all partitions have the same number of pcpus */
+static int shmnet_node_cpu(int node) {
+  return node * partition.ncpu;
+}
+
+static void shmnet_ring_init(struct shmnet_ring *r) {
+  r->enqueue = 0;
+  r->dequeue = 0;
+  /* the consumer drains once it is up */
+  r->kick = 1;
+
+  for(int i = 0; i < SHMNET_NSLOT; i++)
+    r->slots[i].seq = i;
+}
+
+static void shmnet_put(int node, struct iobuf *buf) {
+  struct shmnet_ring *r = shmnet_ring(node);
+  struct shmnet_slot *s;
+  u64 pos, seq, flags;
+
+  /* an irq must not wait for a slot claimed by this cpu */
+  irqsave(flags);
+
+  for(;;) {
+    pos = load_acquire64(&r->enqueue);
+    s = &r->slots[pos % SHMNET_NSLOT];
+    seq = load_acquire64(&s->seq);
+
+    if(seq == pos) {
+      if(atomic_cmpxchg64(&r->enqueue, pos, pos + 1) == pos)
+        break;
+    } else if(seq < pos) {
+      /*
+       *  ring is full: the consumer sends an event per freed slot.
+       *  the consumer of this node drains its own ring meanwhile, its
+       *  sgi is masked and the node waited for may wait for this ring.
+       */
+      if(cpuid() == pcpu_base())
+        shmnet_rx();
+      else
+        wfe();
+    }
+  }
+
+  s->len = buf->len;
+  memcpy(s->frame, buf->data, buf->len);
+
+  if(buf->body) {
+    s->body_len = buf->body_len;
+    memcpy(s->body, buf->body, buf->body_len);
+  } else {
+    s->body_len = 0;
+  }
+
+  store_release64(&s->seq, pos + 1);
+
+  if(atomic_xchg64(&r->kick, 1) == 0)
+    cpu_send_shmnet_sgi(shmnet_node_cpu(node));
+
+  irqrestore(flags);
+}
+
+static void shmnet_xmit(struct nic * __unused nic, struct iobuf *buf) {
+  u8 *dst = buf->eth->dst;
+
+  if(buf->len > SHMNET_FRAME_MAX || (buf->body && buf->body_len > PAGESIZE))
+    panic("shmnet: frame %d body %d", buf->len, buf->body_len);
+
+  if(memcmp(dst, bcast_mac, 6) == 0) {
+    for(int node = 0; node < partition.nparts; node++) {
+      if(node != partition.index)
+        shmnet_put(node, buf);
+    }
+  } else if(memcmp(dst, shmnet_mac, 5) == 0 && dst[5] < partition.nparts) {
+    shmnet_put(dst[5], buf);
+  } else {
+    vmm_warn("shmnet: no node %m\n", dst);
+  }
+
+  free_iobuf(buf);
+}
+
+static void shmnet_recv(struct shmnet_slot *s) {
+  struct iobuf *buf = alloc_iobuf(s->len);
+  if(!buf)
+    panic("shmnet: iobuf");
+
+  memcpy(buf->data, s->frame, s->len);
+
+  if(s->body_len) {
+    buf->body = alloc_page();
+    if(!buf->body)
+      panic("shmnet: body");
+
+    memcpy(buf->body, s->body, s->body_len);
+    buf->body_len = s->body_len;
+  }
+
+  netdev_recv(buf);
+}
+
+/* SGI_SHMNET: on the first pcpu of this node, the only consumer */
+void shmnet_rx() {
+  struct shmnet_ring *r = shmnet_ring(partition.index);
+
+  /* a slot published after this is kicked again */
+  atomic_xchg64(&r->kick, 0);
+
+  for(;;) {
+    u64 pos = r->dequeue;
+    struct shmnet_slot *s = &r->slots[pos % SHMNET_NSLOT];
+
+    if(load_acquire64(&s->seq) != pos + 1)
+      break;
+
+    shmnet_recv(s);
+
+    r->dequeue = pos + 1;
+    store_release64(&s->seq, pos + SHMNET_NSLOT);
+    sev();
+  }
+}
+
+static struct nic_ops shmnet_ops = {
+  .xmit = shmnet_xmit,
+};
+
+void shmnet_init() {
+  u8 mac[6];
+
+  /* node0 runs first: nodes may send to a node before it boots */
+  if(partition.index == 0) {
+    for(int node = 0; node < partition.nparts; node++)
+      shmnet_ring_init(shmnet_ring(node));
+  }
+
+  memcpy(mac, shmnet_mac, 5);
+  mac[5] = partition.index;
+
+  net_init("shmnet", mac, SHMNET_FRAME_MAX + PAGESIZE, NULL, &shmnet_ops);
+
+  /* drain what was queued before this node was up */
+  cpu_send_shmnet_sgi(pcpu_base());
+}
@@ -17,7 +17,11 @@
 static struct virtio_net vtnet_dev;
 
 static inline void virtio_net_get_mac(struct virtio_net *dev, u8 *buf) {
-  memcpy(buf, dev->cfg->mac, sizeof(u8)*6);
+  volatile u8 *mac = dev->cfg->mac;
+
+  /* byte reads: config space is device memory */
+  for(int i = 0; i < 6; i++)
+    buf[i] = mac[i];
 }
 
 static struct virtio_tx_hdr *virtio_tx_hdr_alloc(void *p) {
@@ -0,0 +1,401 @@
+/*
+ *  vsm microbenchmarks
+ *
+ *  vcpu0 (node 0) drives the suite, the other vcpus are workers on the
+ *  other nodes and run commands posted in their mailbox.  data lives in
+ *  memory managed by node 1, so every miss is a protocol round trip.
+ *
+ *  results are printed one per line:
+ *    vsmtest: bench=<name> <key>=<value> ...
+ *  times are cntvct_el0 ticks, ns are derived from cntfrq_el0.
+ */
+
+#include "vsmtest.h"
+
+/* benchmark regions (managed by node 1) */
+#define R_MISS        (NODE_RAM(1) + 0x000000)
+#define R_PINGPONG    (NODE_RAM(1) + 0x100000)
+#define R_FANOUT      (NODE_RAM(1) + 0x200000)
+#define R_FALSE       (NODE_RAM(1) + 0x300000)
+#define R_ATOMIC      (NODE_RAM(1) + 0x400000)
+#define R_SCAN        (NODE_RAM(1) + 0x800000)
+#define R_RAND        (NODE_RAM(1) + 0x1000000)
+
+#define NMISS         64
+#define NPINGPONG     256
+#define NFANOUT       32
+#define NFALSE        1024
+#define NATOMIC       1024
+#define NSCAN_PAGES   1024
+#define NRAND_PAGES   256
+#define NRAND         8192
+#define NSGI          256
+
+#define SGI_BENCH     1
+
+enum cmd {
+  CMD_NONE,
+  CMD_WRITE_PAGES,    /* arg0: base, arg1: npages */
+  CMD_READ_PAGE,      /* arg0: addr */
+  CMD_PINGPONG,       /* arg0: addr, arg1: rounds */
+  CMD_INC,            /* arg0: addr, arg1: count */
+  CMD_ATOMIC_INC,     /* arg0: addr, arg1: count */
+  CMD_SGI_ECHO,       /* arg0: count */
+};
+
+/* one page per worker: only vcpu0 and the worker touch it */
+struct mailbox {
+  volatile u64 seq;     /* posted by vcpu0 */
+  volatile u64 cmd;
+  volatile u64 arg[2];
+  volatile u64 done;    /* seq of the finished command */
+} __attribute__((aligned(PAGESIZE)));
+
+static struct mailbox mbox[NCPU_MAX];
+
+static u64 freq;
+
+static void post(int cpu, enum cmd cmd, u64 a0, u64 a1) {
+  struct mailbox *m = &mbox[cpu];
+
+  m->cmd = cmd;
+  m->arg[0] = a0;
+  m->arg[1] = a1;
+  dmb(ish);
+  m->seq = m->seq + 1;
+}
+
+static void wait_done(int cpu) {
+  struct mailbox *m = &mbox[cpu];
+
+  while(m->done != m->seq)
+    cpu_relax();
+}
+
+static void post_all(enum cmd cmd, u64 a0, u64 a1) {
+  for(int cpu = 1; cpu < NCPU; cpu++)
+    post(cpu, cmd, a0, a1);
+}
+
+static void wait_all() {
+  for(int cpu = 1; cpu < NCPU; cpu++)
+    wait_done(cpu);
+}
+
+static u64 ticks_to_ns(u64 ticks) {
+  return ticks * 1000000000ul / freq;
+}
+
+static void report_kv(char *key, u64 val) {
+  uart_puts(" ");
+  uart_puts(key);
+  uart_puts("=");
+  uart_put64(val, 10);
+}
+
+static void report_begin(char *name) {
+  uart_puts("vsmtest: bench=");
+  uart_puts(name);
+}
+
+/* n operations took ticks */
+static void report(char *name, u64 n, u64 ticks) {
+  report_begin(name);
+  report_kv("n", n);
+  report_kv("ticks", ticks);
+  report_kv("ticks_per_op", n ? ticks / n : 0);
+  report_kv("ns_per_op", n ? ticks_to_ns(ticks) / n : 0);
+  uart_puts("\n");
+}
+
+static void write_pages(u64 base, u64 npages, u64 val) {
+  for(u64 i = 0; i < npages; i++)
+    *(volatile u64 *)(base + i * PAGESIZE) = val;
+}
+
+static void pingpong(volatile u64 *p, u64 rounds, u64 parity) {
+  for(u64 i = 0; i < rounds; i++) {
+    while((*p & 1) != parity)
+      cpu_relax();
+
+    *p = *p + 1;
+  }
+}
+
+static inline void atomic_inc(volatile u64 *p) {
+  u64 tmp;
+  u32 fail;
+
+  asm volatile(
+    "1: ldxr  %0, [%2]\n"
+    "   add   %0, %0, #1\n"
+    "   stxr  %w1, %0, [%2]\n"
+    "   cbnz  %w1, 1b\n"
+    : "=&r"(tmp), "=&r"(fail) : "r"(p) : "memory");
+}
+
+static void sgi_echo(u64 count) {
+  for(u64 i = 0; i < count; i++) {
+    while(gic_poll_sgi() != SGI_BENCH)
+      cpu_relax();
+
+    gic_send_sgi(0, SGI_BENCH);
+  }
+}
+
+/* the other node owns pages, vcpu0 read-faults and write-faults them */
+static void bench_miss() {
+  u64 start, t;
+  u64 sum = 0;
+
+  post(1, CMD_WRITE_PAGES, R_MISS, NMISS);
+  wait_done(1);
+
+  start = now();
+  for(int i = 0; i < NMISS; i++)
+    sum += *(volatile u64 *)(R_MISS + i * PAGESIZE);
+  t = now() - start;
+
+  report("read_miss", NMISS, t);
+
+  /* read copies of vcpu0 are invalidated by the worker's writes */
+  post(1, CMD_WRITE_PAGES, R_MISS, NMISS);
+  wait_done(1);
+
+  start = now();
+  write_pages(R_MISS, NMISS, sum);
+  t = now() - start;
+
+  report("write_miss", NMISS, t);
+}
+
+/* one word bounces between vcpu0 and vcpu1 */
+static void bench_pingpong() {
+  volatile u64 *p = (volatile u64 *)R_PINGPONG;
+  u64 start, t;
+
+  *p = 0;
+
+  post(1, CMD_PINGPONG, R_PINGPONG, NPINGPONG);
+
+  start = now();
+  pingpong(p, NPINGPONG, 0);
+  wait_done(1);
+  t = now() - start;
+
+  report("pingpong", NPINGPONG, t);
+}
+
+/* vcpu0 writes a page, all workers read it, vcpu0 writes it again */
+static void bench_fanout() {
+  u64 rd = 0, inv = 0;
+
+  for(int i = 0; i < NFANOUT; i++) {
+    u64 start;
+
+    *(volatile u64 *)R_FANOUT = i;
+
+    start = now();
+    post_all(CMD_READ_PAGE, R_FANOUT, 0);
+    wait_all();
+    rd += now() - start;
+
+    /* invalidates NCPU - 1 read copies */
+    start = now();
+    *(volatile u64 *)R_FANOUT = i + 1;
+    inv += now() - start;
+  }
+
+  report_begin("read_fanout");
+  report_kv("readers", NCPU - 1);
+  report_kv("n", NFANOUT);
+  report_kv("ticks_per_op", rd / NFANOUT);
+  report_kv("ns_per_op", ticks_to_ns(rd) / NFANOUT);
+  uart_puts("\n");
+
+  report_begin("write_invalidate");
+  report_kv("readers", NCPU - 1);
+  report_kv("n", NFANOUT);
+  report_kv("ticks_per_op", inv / NFANOUT);
+  report_kv("ns_per_op", ticks_to_ns(inv) / NFANOUT);
+  uart_puts("\n");
+}
+
+/* vcpu0 and vcpu1 update different words: on the same page, then on separate pages */
+static void bench_false_sharing() {
+  volatile u64 *mine = (volatile u64 *)R_FALSE;
+  u64 start, t;
+
+  for(int shared = 1; shared >= 0; shared--) {
+    u64 other = shared ? R_FALSE + 64 : R_FALSE + PAGESIZE;
+
+    *mine = 0;
+
+    start = now();
+    post(1, CMD_INC, other, NFALSE);
+    for(int i = 0; i < NFALSE; i++)
+      *mine = *mine + 1;
+    wait_done(1);
+    t = now() - start;
+
+    report(shared ? "false_sharing" : "no_sharing", NFALSE, t);
+  }
+}
+
+/* sequential read of pages owned by the other node */
+static void bench_scan() {
+  u64 bytes = NSCAN_PAGES * PAGESIZE;
+  u64 start, t;
+  u64 sum = 0;
+
+  post(1, CMD_WRITE_PAGES, R_SCAN, NSCAN_PAGES);
+  wait_done(1);
+
+  start = now();
+  for(u64 off = 0; off < bytes; off += sizeof(u64))
+    sum += *(volatile u64 *)(R_SCAN + off);
+  t = now() - start;
+
+  report_begin("seq_scan");
+  report_kv("bytes", bytes);
+  report_kv("ticks", t);
+  report_kv("kib_per_sec", t ? bytes * freq / t / 1024 : 0);
+  report_kv("sum", sum);
+  uart_puts("\n");
+}
+
+/* random reads over pages owned by the other node */
+static void bench_random() {
+  u64 x = 0x9e3779b97f4a7c15ul;
+  u64 start, t;
+  u64 sum = 0;
+
+  post(1, CMD_WRITE_PAGES, R_RAND, NRAND_PAGES);
+  wait_done(1);
+
+  start = now();
+  for(int i = 0; i < NRAND; i++) {
+    /* xorshift64 */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    sum += *(volatile u64 *)(R_RAND + (x % (NRAND_PAGES * PAGESIZE) & ~7ul));
+  }
+  t = now() - start;
+
+  report_begin("random_read");
+  report_kv("pages", NRAND_PAGES);
+  report_kv("n", NRAND);
+  report_kv("ticks", t);
+  report_kv("ops_per_sec", t ? NRAND * freq / t : 0);
+  report_kv("sum", sum);
+  uart_puts("\n");
+}
+
+/* all vcpus increment one word with ldxr/stxr */
+static void bench_atomic() {
+  volatile u64 *p = (volatile u64 *)R_ATOMIC;
+  u64 start, t;
+
+  *p = 0;
+
+  start = now();
+  post_all(CMD_ATOMIC_INC, R_ATOMIC, NATOMIC);
+  for(int i = 0; i < NATOMIC; i++)
+    atomic_inc(p);
+  wait_all();
+  t = now() - start;
+
+  report_begin("atomic_contention");
+  report_kv("cpus", NCPU);
+  report_kv("n", NATOMIC * NCPU);
+  report_kv("ticks", t);
+  report_kv("ns_per_op", ticks_to_ns(t) / (NATOMIC * NCPU));
+  report_kv("ok", *p == NATOMIC * NCPU);
+  uart_puts("\n");
+}
+
+/* vcpu0 -> sgi -> vcpu1 -> sgi -> vcpu0 */
+static void bench_sgi() {
+  u64 start, t;
+
+  post(1, CMD_SGI_ECHO, NSGI, 0);
+
+  start = now();
+  for(int i = 0; i < NSGI; i++) {
+    gic_send_sgi(1, SGI_BENCH);
+
+    while(gic_poll_sgi() != SGI_BENCH)
+      cpu_relax();
+  }
+  wait_done(1);
+  t = now() - start;
+
+  report("sgi_roundtrip", NSGI, t);
+}
+
+void bench_worker(int cpu) {
+  struct mailbox *m = &mbox[cpu];
+  u64 seq = m->done;
+
+  for(;;) {
+    while(m->seq == seq)
+      cpu_relax();
+
+    seq = m->seq;
+    dmb(ish);
+
+    switch(m->cmd) {
+      case CMD_WRITE_PAGES:
+        write_pages(m->arg[0], m->arg[1], seq);
+        break;
+      case CMD_READ_PAGE:
+        (void)*(volatile u64 *)m->arg[0];
+        break;
+      case CMD_PINGPONG:
+        pingpong((volatile u64 *)m->arg[0], m->arg[1], 1);
+        break;
+      case CMD_INC:
+        for(u64 i = 0; i < m->arg[1]; i++)
+          *(volatile u64 *)m->arg[0] += 1;
+        break;
+      case CMD_ATOMIC_INC:
+        for(u64 i = 0; i < m->arg[1]; i++)
+          atomic_inc((volatile u64 *)m->arg[0]);
+        break;
+      case CMD_SGI_ECHO:
+        sgi_echo(m->arg[0]);
+        break;
+    }
+
+    dmb(ish);
+    m->done = seq;
+  }
+}
+
+void bench_run() {
+  freq = read_sysreg(cntfrq_el0);
+
+  uart_puts("vsmtest: begin");
+  report_kv("ncpu", NCPU);
+  report_kv("freq", freq);
+  uart_puts("\n");
+
+  /* every benchmark needs a worker on node 1 */
+  if(NCPU < 2) {
+    uart_puts("vsmtest: error=ncpu\n");
+    return;
+  }
+
+  bench_miss();
+  bench_pingpong();
+  bench_fanout();
+  bench_false_sharing();
+  bench_atomic();
+  bench_sgi();
+  bench_scan();
+  bench_random();
+
+  uart_puts("vsmtest: end\n");
+}
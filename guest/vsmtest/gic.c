@@ -0,0 +1,98 @@
+/*
+ *  minimal gic driver: polling sgis with irqs masked
+ */
+
+#include "vsmtest.h"
+
+#define GICDBASE    0x08000000
+#define GICCBASE    0x08010000
+
+#define D(reg)      (volatile u32 *)(GICDBASE + (reg))
+#define C(reg)      (volatile u32 *)(GICCBASE + (reg))
+
+#define GICD_CTLR       0x0
+#define GICD_ISENABLER  0x100
+#define GICD_SGIR       0xf00
+
+#define GICC_CTLR       0x0
+#define GICC_PMR        0x4
+#define GICC_IAR        0xc
+#define GICC_EOIR       0x10
+
+#define SPURIOUS        1023
+
+#if GIC_VERSION == 2
+
+void gic_init() {
+  *D(GICD_CTLR) = 1;
+}
+
+void gic_init_percpu() {
+  /* sgis of this cpu */
+  *D(GICD_ISENABLER) = 0xffff;
+
+  *C(GICC_PMR) = 0xff;
+  *C(GICC_CTLR) = 1;
+}
+
+void gic_send_sgi(int cpu, int sgi) {
+  dsb(ish);
+  *D(GICD_SGIR) = (1 << (16 + cpu)) | (sgi & 0xf);
+}
+
+/* pending sgi id, or -1 */
+int gic_poll_sgi() {
+  u32 iar = *C(GICC_IAR);
+  u32 irq = iar & 0x3ff;
+
+  if(irq == SPURIOUS)
+    return -1;
+
+  *C(GICC_EOIR) = iar;
+
+  return irq;
+}
+
+#else   /* GIC_VERSION == 3 */
+
+#define GICRBASE    0x080a0000
+#define GICR_SGI(cpu, reg)  (volatile u32 *)(GICRBASE + (cpu) * 0x20000 + 0x10000 + (reg))
+
+#define GICR_ISENABLER0     0x100
+
+void gic_init() {
+  *D(GICD_CTLR) = 0x12;   /* ARE, EnableGrp1NS */
+}
+
+void gic_init_percpu() {
+  write_sysreg(S3_0_C12_C12_5, read_sysreg(S3_0_C12_C12_5) | 1);   /* ICC_SRE_EL1.SRE */
+  isb();
+
+  *GICR_SGI(cpuid(), GICR_ISENABLER0) = 0xffff;
+
+  write_sysreg(S3_0_C4_C6_0, 0xff);    /* ICC_PMR_EL1 */
+  write_sysreg(S3_0_C12_C12_7, 1);     /* ICC_IGRPEN1_EL1 */
+  isb();
+}
+
+void gic_send_sgi(int cpu, int sgi) {
+  dsb(ish);
+  /* aff1-3 are 0 for NCPU_MAX vcpus */
+  write_sysreg(S3_0_C12_C11_5, ((u64)(sgi & 0xf) << 24) | (1 << cpu));  /* ICC_SGI1R_EL1 */
+  isb();
+}
+
+int gic_poll_sgi() {
+  u64 iar = read_sysreg(S3_0_C12_C12_0);   /* ICC_IAR1_EL1 */
+  u32 irq = iar & 0xffffff;
+
+  if(irq == SPURIOUS)
+    return -1;
+
+  write_sysreg(S3_0_C12_C12_1, iar);        /* ICC_EOIR1_EL1 */
+  isb();
+
+  return irq;
+}
+
+#endif
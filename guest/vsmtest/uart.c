@@ -0,0 +1,35 @@
+#include "vsmtest.h"
+
+#define UARTBASE    0x09000000
+
+#define R(reg)  (volatile u32 *)(UARTBASE+reg)
+
+#define DR  0x00
+#define FR  0x18
+#define FR_TXFF (1<<5)  // transmit fifo full
+
+void uart_putc(char c) {
+  while(*R(FR) & FR_TXFF)
+    ;
+  *R(DR) = c;
+}
+
+void uart_puts(char *s) {
+  char c;
+  while((c = *s++))
+    uart_putc(c);
+}
+
+void uart_put64(u64 num, int base) {
+  char buf[sizeof(num) * 8 + 1];
+  char *end = buf + sizeof(buf);
+  char *cur = end - 1;
+
+  *cur = '\0';
+
+  do {
+    *--cur = "0123456789abcdef"[num % base];
+  } while(num /= base);
+
+  uart_puts(cur);
+}
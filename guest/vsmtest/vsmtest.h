@@ -0,0 +1,76 @@
+#ifndef VSMTEST_H
+#define VSMTEST_H
+
+typedef unsigned long u64;
+typedef long i64;
+typedef unsigned int u32;
+typedef signed int i32;
+typedef unsigned short u16;
+typedef signed short i16;
+typedef unsigned char u8;
+typedef signed char i8;
+
+#define NULL ((void *)0)
+
+typedef _Bool bool;
+
+#define true 1
+#define false 0
+
+#define PAGESIZE    4096
+
+/* vcpus of the guest: vcpu n runs on node n with 1 vcpu per node */
+#ifndef NCPU
+#define NCPU        2
+#endif
+
+#define NCPU_MAX    8
+
+#define RAM_BASE    0x40000000ul
+
+/* memory contributed by each node: must match the hypervisor */
+#ifndef MEM_PER_NODE
+#define MEM_PER_NODE    (256ul*1024*1024)
+#endif
+
+/* guest memory managed by node n */
+#define NODE_RAM(n)     (RAM_BASE + (n) * MEM_PER_NODE)
+
+#ifndef GIC_VERSION
+#define GIC_VERSION     2
+#endif
+
+#define read_sysreg(reg)  ({ u64 _x; asm volatile("mrs %0, " #reg : "=r"(_x)); _x; })
+#define write_sysreg(reg, val)  \
+  do { u64 _x = (u64)(val); asm volatile("msr " #reg ", %0" : : "r"(_x)); } while(0)
+
+#define isb()       asm volatile("isb" ::: "memory")
+#define dmb(ty)     asm volatile("dmb " #ty ::: "memory")
+#define dsb(ty)     asm volatile("dsb " #ty ::: "memory")
+#define cpu_relax() asm volatile("yield" ::: "memory")
+
+static inline u64 now() {
+  isb();
+  return read_sysreg(cntvct_el0);
+}
+
+static inline int cpuid() {
+  return read_sysreg(mpidr_el1) & 0xff;
+}
+
+/* uart.c */
+void uart_putc(char c);
+void uart_puts(char *s);
+void uart_put64(u64 num, int base);
+
+/* gic.c */
+void gic_init(void);
+void gic_init_percpu(void);
+void gic_send_sgi(int cpu, int sgi);
+int gic_poll_sgi(void);
+
+/* bench.c */
+void bench_run(void);
+void bench_worker(int cpu);
+
+#endif
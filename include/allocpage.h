@@ -12,4 +12,6 @@ void free_pages(void *pages, int order);
 
 #define free_page(p)  free_pages(p, 0)
 
+void buddydump(void);
+
 #endif
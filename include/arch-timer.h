@@ -4,12 +4,20 @@
 #include "types.h"
 #include "aarch64.h"
 
+#define HYP_TIMER_IRQ 26    /* EL2 physical timer PPI */
+#define VTIMER_IRQ    27    /* EL1 virtual timer PPI */
+
 void arch_timer_init_core(void);
 
 void arch_timer_init(void);
 
 void usleep(int us);
 
+u64 usecs_to_ticks(u64 us);
+
+void hyp_timer_oneshot(u64 ticks);
+void hyp_timer_cancel(void);
+
 static inline u64 now_cycles() {
   return read_sysreg(cntpct_el0);
 }
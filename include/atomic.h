@@ -0,0 +1,151 @@
+#ifndef CORE_ATOMIC_H
+#define CORE_ATOMIC_H
+
+#include "types.h"
+
+/*
+ *  atomic operations (ldxr/stxr, armv8.0)
+ */
+
+static inline void atomic_or64(u64 *p, u64 val) {
+  u64 tmp;
+  u32 fail;
+
+  asm volatile(
+    "1: ldxr  %0, [%2]\n"
+    "orr      %0, %0, %3\n"
+    "stlxr    %w1, %0, [%2]\n"
+    "cbnz     %w1, 1b\n"
+    : "=&r"(tmp), "=&r"(fail) : "r"(p), "r"(val) : "memory"
+  );
+}
+
+static inline void atomic_andnot64(u64 *p, u64 val) {
+  u64 tmp;
+  u32 fail;
+
+  asm volatile(
+    "1: ldxr  %0, [%2]\n"
+    "bic      %0, %0, %3\n"
+    "stlxr    %w1, %0, [%2]\n"
+    "cbnz     %w1, 1b\n"
+    : "=&r"(tmp), "=&r"(fail) : "r"(p), "r"(val) : "memory"
+  );
+}
+
+static inline u64 atomic_xchg64(u64 *p, u64 val) {
+  u64 old;
+  u32 fail;
+
+  asm volatile(
+    "1: ldaxr %0, [%2]\n"
+    "stlxr    %w1, %3, [%2]\n"
+    "cbnz     %w1, 1b\n"
+    : "=&r"(old), "=&r"(fail) : "r"(p), "r"(val) : "memory"
+  );
+
+  return old;
+}
+
+/* store new if *p == old; return the value of *p before */
+static inline u64 atomic_cmpxchg64(u64 *p, u64 old, u64 new) {
+  u64 cur;
+  u32 fail;
+
+  asm volatile(
+    "1: ldaxr %0, [%2]\n"
+    "cmp      %0, %3\n"
+    "b.ne     2f\n"
+    "stlxr    %w1, %4, [%2]\n"
+    "cbnz     %w1, 1b\n"
+    "2:\n"
+    : "=&r"(cur), "=&r"(fail) : "r"(p), "r"(old), "r"(new) : "memory", "cc"
+  );
+
+  return cur;
+}
+
+static inline u64 load_acquire64(u64 *p) {
+  u64 val;
+
+  asm volatile("ldar %0, [%1]" : "=r"(val) : "r"(p) : "memory");
+
+  return val;
+}
+
+static inline void store_release64(u64 *p, u64 val) {
+  asm volatile("stlr %0, [%1]" :: "r"(val), "r"(p) : "memory");
+}
+
+static inline void atomic_set_bit(int nr, u64 *bitmap) {
+  atomic_or64(&bitmap[nr / 64], 1ul << (nr % 64));
+}
+
+static inline void atomic_clear_bit(int nr, u64 *bitmap) {
+  atomic_andnot64(&bitmap[nr / 64], 1ul << (nr % 64));
+}
+
+/*
+ *  byte/halfword locks: wfe while held, acquire on lock, release on unlock
+ */
+
+/* return 0 if *p was free and now holds val */
+static inline u8 atomic_trylock8(u8 *p, u8 val) {
+  u32 r;
+
+  asm volatile(
+    "ldaxrb   %w0, [%1]\n"
+    "cbnz     %w0, 1f\n"
+    "stxrb    %w0, %w2, [%1]\n"
+    "1:\n"
+    : "=&r"(r) : "r"(p), "r"(val) : "memory"
+  );
+
+  return r;
+}
+
+static inline void atomic_lock8(u8 *p, u8 val) {
+  u32 tmp;
+
+  asm volatile(
+    "sevl\n"
+    "1: wfe\n"
+    "2: ldaxrb %w0, [%1]\n"
+    "cbnz     %w0, 1b\n"
+    "stxrb    %w0, %w2, [%1]\n"
+    "cbnz     %w0, 2b\n"
+    : "=&r"(tmp) : "r"(p), "r"(val) : "memory"
+  );
+}
+
+/* wait until (*p & busy) == 0, then store val; return the old value */
+static inline u16 atomic_lock16_mask(u16 *p, u16 busy, u16 val) {
+  u32 old, fail;
+
+  asm volatile(
+    "sevl\n"
+    "1: wfe\n"
+    "2: ldaxrh %w0, [%2]\n"
+    "tst      %w0, %w3\n"
+    "b.ne     1b\n"
+    "stxrh    %w1, %w4, [%2]\n"
+    "cbnz     %w1, 2b\n"
+    : "=&r"(old), "=&r"(fail) : "r"(p), "r"((u32)busy), "r"(val) : "memory", "cc"
+  );
+
+  return old;
+}
+
+static inline void atomic_lock16(u16 *p, u16 val) {
+  atomic_lock16_mask(p, 0xffff, val);
+}
+
+static inline void atomic_release8(u8 *p) {
+  asm volatile("stlrb wzr, [%0]" :: "r"(p) : "memory");
+}
+
+static inline void atomic_release16(u16 *p) {
+  asm volatile("stlrh wzr, [%0]" :: "r"(p) : "memory");
+}
+
+#endif  /* CORE_ATOMIC_H */
@@ -0,0 +1,12 @@
+#ifndef CORE_CONSOLE_H
+#define CORE_CONSOLE_H
+
+#include "types.h"
+
+/* ctrl-a three times in a row in guest input enters the console */
+#define CONSOLE_ESCAPE        0x01
+#define CONSOLE_ESCAPE_COUNT  3
+
+void console_guest_uart(u64 ipa, u64 size);
+
+#endif
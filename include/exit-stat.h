@@ -0,0 +1,73 @@
+#ifndef EXIT_STAT_H
+#define EXIT_STAT_H
+
+#include "types.h"
+#include "param.h"
+
+/*
+ *  guest exits per vcpu (core/exit-stat.c): count and ticks (cntpct)
+ *  from trap entry to the end of its handling, by reason
+ */
+enum exit_reason {
+  EXIT_WFI,
+  EXIT_WFE,
+  EXIT_HVC,
+  EXIT_SMC,
+  EXIT_SYSREG,
+  EXIT_IABT,            /* instruction fetch */
+  EXIT_IABT_S1PTW,      /* stage 1 walk of an instruction fetch */
+  EXIT_DABT_VSM_READ,   /* vsm read fault */
+  EXIT_DABT_VSM_WRITE,  /* vsm write fault */
+  EXIT_DABT_S1PTW,      /* stage 1 walk of a data access */
+  EXIT_DABT_MMIO,       /* emulated mmio */
+  EXIT_IRQ,
+  NR_EXIT_REASON,
+};
+
+/* distinct msr/mrs encodings per vcpu, the rest is summed up in "other" */
+#define EXIT_SYSREG_MAX   16
+
+/* irqs with a handled count in the hvc report */
+#define EXIT_IRQ_MAX      32
+
+struct exit_count {
+  u64 count;
+  u64 ticks;
+};
+
+struct exit_sysreg {
+  u32 iss;              /* op0, op1, crn, crm, op2 and direction of esr_el2.ISS */
+  u32 pad;
+  struct exit_count c;
+};
+
+/* copied to guest by hvc #4 */
+struct exit_stat_report {
+  u64 freq;             /* cntfrq_el0 */
+  u32 nvcpu;
+  u32 nirq;
+  struct {
+    int vcpuid;
+    u32 pad;
+    struct exit_count reason[NR_EXIT_REASON];
+    struct exit_sysreg sysreg[EXIT_SYSREG_MAX];
+    struct exit_count sysreg_other;
+  } vcpu[VCPU_PER_NODE_MAX];
+  /* summed over pcpus: handled by vmm or injected into guest */
+  struct {
+    u32 irq;
+    u32 pad;
+    struct exit_count c;
+  } irq[EXIT_IRQ_MAX];
+};
+
+struct vcpu;
+
+void exit_stat_enter(struct vcpu *vcpu, int reason);
+void exit_stat_reason(struct vcpu *vcpu, int reason);
+void exit_stat_sysreg(struct vcpu *vcpu, u64 iss);
+void exit_stat_leave(struct vcpu *vcpu);
+int exit_stat_copy_to_guest(struct vcpu *vcpu, u64 ipa, u64 size);
+void exit_stat_dump(void);
+
+#endif  /* EXIT_STAT_H */
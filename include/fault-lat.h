@@ -0,0 +1,54 @@
+#ifndef FAULT_LAT_H
+#define FAULT_LAT_H
+
+#include "types.h"
+#include "aarch64.h"
+
+/*
+ *  stages of a remote fault:
+ *
+ *    trap -> lock -> issue ------------------------------> recv -> cb -> map -> resume
+ *                        \  remote: rxq -> wq -> serve  /
+ *                         (+ fwd on manager)
+ */
+enum fault_lat_stage {
+  FL_LOCK,      /* trap entry -> page lock acquired */
+  FL_ISSUE,     /* page lock -> fetch request issued */
+  FL_NET,       /* request issued -> reply received, minus remote time */
+  FL_FWD,       /* manager: request received -> forwarded to owner */
+  FL_RXQ,       /* remote: msg_recv -> request handler */
+  FL_WQ,        /* remote: request handler -> served (page waitqueue) */
+  FL_SERVE,     /* remote: served -> reply transmitted */
+  FL_WAKE,      /* reply received -> reply handled by vcpu */
+  FL_MAP,       /* reply handled -> mapped by vsm_set_cache_fast */
+  FL_RESUME,    /* mapped -> guest resumed */
+  FL_TOTAL,     /* trap entry -> guest resumed */
+  NR_FL_STAGE,
+};
+
+/* log2 usec: [0] < 1us, [i] < 2^i us, last one is everything above */
+#define FL_NBUCKET    16
+
+struct fault_lat_hist {
+  u64 count;
+  u64 sum;            /* ticks */
+  u64 max;            /* ticks */
+  u64 bucket[FL_NBUCKET];
+};
+
+/* copied to guest by hvc #2 */
+struct fault_lat_report {
+  u64 freq;           /* cntfrq_el0 */
+  u64 nfault;
+  struct fault_lat_hist stage[NR_FL_STAGE];
+};
+
+struct vcpu;
+
+void fault_lat_trap(struct vcpu *vcpu);
+void fault_lat_reply(struct vcpu *vcpu, u64 recv, u32 fwd, u32 rxq, u32 wq, u32 serve);
+void fault_lat_resume(struct vcpu *vcpu);
+int fault_lat_copy_to_guest(struct vcpu *vcpu, u64 ipa, u64 size);
+void fault_lat_dump(void);
+
+#endif  /* FAULT_LAT_H */
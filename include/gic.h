@@ -16,6 +16,8 @@
 #define is_spi(intid)       (32 <= (intid) && (intid) < 1020)
 #define valid_intid(intid)  (0 <= (intid) && (intid) < 1020)
 
+#define GIC_MAINTENANCE_IRQ 25
+
 #define LR_INACTIVE         0L
 #define LR_PENDING          1L
 #define LR_ACTIVE           2L
@@ -69,8 +71,15 @@ struct gic_pending_irq {
   int group;
   int priority;
   int req_cpu;        // only sgi
+  bool eoi;           // maintenance interrupt on guest EOI (only sw irq)
 };
 
+/* inject_guest_irq() errors */
+#define GIC_INJECT_BUSY     -1    /* same virq is already in list register */
+#define GIC_INJECT_NOLR     -2    /* no free list register */
+
+struct gic_state;
+
 struct gic_irqchip {
   int version;      // 2 or 3
   int nirqs;
@@ -78,8 +87,13 @@ struct gic_irqchip {
 
   void (*initcore)(void);
   int (*inject_guest_irq)(struct gic_pending_irq *irq);
+  void (*set_underflow_irq)(bool enable);
+  int (*take_eoi_lrs)(u32 *virqs, int max);
   bool (*irq_pending)(u32 irq);
   bool (*guest_irq_pending)(u32 irq);
+  bool (*guest_lr_pending)(void);
+  void (*save_state)(struct gic_state *gic);
+  void (*restore_state)(struct gic_state *gic);
   void (*host_eoi)(u32 iar);
   void (*guest_eoi)(u32 iar);
   void (*deactive_irq)(u32 irq);
@@ -99,6 +113,8 @@ struct gic_state {
   u64 lr[16];
   u64 vmcr;
   u32 sre_el1;
+  u32 hcr;
+  u32 apr[2];     /* active priorities (group 0, group 1) */
 };
 
 void irqchip_init(void);
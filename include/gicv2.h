@@ -31,17 +31,22 @@
 #define GICH_VTR      0x4
 #define GICH_VMCR     0x8
 #define GICH_MISR     0x10
+#define GICH_EISR0    0x20
+#define GICH_EISR1    0x24
 #define GICH_ELSR0    0x30
 #define GICH_ELSR1    0x34
+#define GICH_APR      0xf0
 #define GICH_LR(n)    (0x100 + ((n) * 4))
 
 #define GICH_HCR_EN               (1 << 0)
+#define GICH_HCR_UIE              (1 << 1)
 
 #define GICH_VMCR_VMG0En          (1 << 0)
 #define GICH_VMCR_VMG1En          (1 << 1)
 
 #define GICH_LR_PID_SHIFT         10
 #define GICH_LR_CPUID_SHIFT       10
+#define GICH_LR_EOI               (1u << 19)
 #define GICH_LR_Priority_SHIFT    23
 #define GICH_LR_State_SHIFT       28
 #define GICH_LR_Grp1              (1u << 30)
@@ -18,8 +18,11 @@
 
 #define GICD_IROUTER_IRM        (1u << 31)
 
+#define ich_ap0r0_el2           arm_sysreg(4, c12, c8, 0)
+#define ich_ap1r0_el2           arm_sysreg(4, c12, c9, 0)
 #define ich_hcr_el2             arm_sysreg(4, c12, c11, 0)
 #define ich_vtr_el2             arm_sysreg(4, c12, c11, 1)
+#define ich_eisr_el2            arm_sysreg(4, c12, c11, 3)
 #define ich_elsr_el2            arm_sysreg(4, c12, c11, 5)
 #define ich_vmcr_el2            arm_sysreg(4, c12, c11, 7)
 #define ich_lr0_el2             arm_sysreg(4, c12, c12, 0)
@@ -60,11 +63,13 @@
 #define ICC_SGI1R_IRM(v)        (((v)>>40) & 0x1)
 
 #define ICH_HCR_EN              (1<<0)
+#define ICH_HCR_UIE             (1<<1)
 
 #define ICH_VMCR_VENG0          (1<<0)
 #define ICH_VMCR_VENG1          (1<<1)
 
 #define ICH_LR_PINTID_SHIFT     32
+#define ICH_LR_EOI              (1ul << 41)
 #define ICH_LR_Priority_SHIFT   48
 #define ICH_LR_GROUP1           (1ul << 60)
 #define ICH_LR_HW               (1ul << 61)
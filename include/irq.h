@@ -3,14 +3,24 @@
 
 #include "types.h"
 #include "param.h"
+#include "compiler.h"
 
 #define NIRQ        256
 
+/* frame of an exception taken from el2 (hyp_save_reg in core/vector.S) */
+struct hyp_context {
+  u64 x[31];
+  u64 spsr;
+  u64 elr;
+} __packed;
+
 struct irq {
   int count;
   void (*handler)(void *);
   void *arg;
   int nhandle[NCPU_MAX];
+  u64 inject_ticks[NCPU_MAX];   /* time spent injecting into guest */
+  u64 handle_ticks[NCPU_MAX];   /* time spent in handler */
 };
 
 extern struct irq irqlist[NIRQ];
@@ -23,6 +33,7 @@ static inline unsigned int irq_no(struct irq *irq) {
   return irq - irqlist;
 }
 
+void irq_entry(int from_guest, struct hyp_context *ctx);
 int handle_irq(u32 pirq);
 void irq_register(u32 pirq, void (*handler)(void *), void *arg);
 
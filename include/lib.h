@@ -17,6 +17,8 @@ int strchrlen(const char *s, int c);
 
 void bin_dump(void *p, u64 size);
 
+void membench(void);
+
 #define BIT(n)          (1u << (n))
 #define get_bit(x, n)   (((x) & BIT(n)) >> n)
 
@@ -8,6 +8,7 @@
 #include "uart.h"
 #include "lib.h"
 #include "device.h"
+#include "vmmio.h"
 #include "compiler.h"
 
 /* localvm */
@@ -21,10 +22,10 @@ struct vm {
   u64 vtcr;
   /* virtual interrupt controller */
   struct vgic *vgic;
-  /* guest mmio */
-  struct mmio_region *pmap;
-  spinlock_t lock;
+  /* guest mmio: sorted by base */
+  struct mmio_region pmap[VMMIO_REGION_MAX];
   int npmap;
+  spinlock_t lock;
   /* device tree blob */
   // struct guest_fdt *fdt;
 };
@@ -77,6 +78,11 @@ static inline struct vcpu *local_vcpu(int localcpuid) {
   return &localvm.vcpus[localcpuid];
 }
 
+/* index of vcpu in this node */
+static inline int vcpu_slot(struct vcpu *vcpu) {
+  return vcpu - localvm.vcpus;
+}
+
 static inline bool node_macaddr_is_me(u8 *mac) {
   return memcmp(localnode.nic->mac, mac, 6) == 0;
 }
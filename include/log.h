@@ -1,13 +1,17 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include "types.h"
 #include "printf.h"
+#include "compiler.h"
 
 // #define NDEBUG
 
 #define LWARN     1
 #define LLOG      2
 
+extern int loglevel;
+
 #define LOGPREFIX(l)    "\001" #l
 
 #define WARN      LOGPREFIX(1)
@@ -25,6 +29,54 @@
 
 #endif  /* NDEBUG */
 
+/*
+ *  log categories of the hot paths (vsm faults, msgs, nic, traps, mmio
+ *  forwarding, cross-node virqs).
+ *  a category left out of VLOG_CATS (make VLOG_CATS=<mask>) compiles to
+ *  nothing, the others cost one load and a not-taken branch until
+ *  log_cat_level[] is raised at runtime (console "set log_<cat>").
+ *  messages go to a ring of the calling pcpu, drained to the uart by
+ *  idle pcpus (log_drain()): a fault never waits for the uart.
+ */
+enum log_cat {
+  LC_VSM,
+  LC_MSG,
+  LC_NET,
+  LC_TRAP,
+  LC_MMIO,
+  LC_VGIC,
+  LC_PAGE,      /* periodic report of core/page-prof.c */
+  NR_LOG_CAT,
+};
+
+#ifndef VLOG_CATS
+#define VLOG_CATS   ((1 << NR_LOG_CAT) - 1)
+#endif
+
+extern int log_cat_level[NR_LOG_CAT];
+
+int log_cat_printf(int cat, const char *fmt, ...);
+int log_cat_vprintf(int cat, int level, const char *fmt, va_list ap);
+void log_drain(bool wait);
+
+#define __vmm_clog(cat, level, ...)   \
+  do {    \
+    if(((VLOG_CATS) & (1 << (cat))) && unlikely(log_cat_level[cat] >= (level)))   \
+      log_cat_printf(cat, __VA_ARGS__);   \
+  } while(0)
+
+#define vmm_cwarn(cat, ...) __vmm_clog(cat, LWARN, WARN __VA_ARGS__)
+
+#ifdef NDEBUG
+
+#define vmm_clog(cat, ...)  (void)0
+
+#else   /* !NDEBUG */
+
+#define vmm_clog(cat, ...)  __vmm_clog(cat, LLOG, LOG __VA_ARGS__)
+
+#endif  /* NDEBUG */
+
 #define vmm_warn_on(cond, ...)  \
   do {    \
     if((cond))    \
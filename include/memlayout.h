@@ -23,6 +23,9 @@
 #define FDT_SECTION_SIZE      0x400000
 #define IOMEM_SECTION_SIZE    (VMM_SECTION_BASE - IOMEM_SECTION_BASE)
 
+/* at offset 8 of the vmm image: "pocv2vmm" (boot/boot.S) */
+#define VMM_IMAGE_MAGIC       0x6d6d763276636f70
+
 #ifndef __ASSEMBLER__
 
 extern char vmm_start[], vmm_end[];
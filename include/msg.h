@@ -27,6 +27,8 @@ enum msgtype {
   MSG_SGI             = 0x10,
   MSG_PANIC           = 0x11,
   MSG_BOOT_SIG        = 0x12,
+  MSG_VCPU_MIGRATE    = 0x13,
+  MSG_VCPU_MIGRATED   = 0x14,
   NUM_MSG,
 };
 
@@ -41,7 +43,7 @@ enum msgtype {
 struct msg_header {
   u16 src_id;         /* msg src */
   u16 type;           /* enum msgtype */
-  u32 connectionid;   /* lower 3 bit is cpuid */
+  u32 connectionid;   /* lower 3 bit is requester (vcpu slot if waiting reply) */
 } __aligned(8);
 
 #define POCV2_MSG_HDR_STRUCT      struct msg_header hdr
@@ -58,6 +60,7 @@ struct msg {
   /* private */
   struct msg *next;       /* msg_queue */
   struct iobuf *data;     /* raw data */
+  u64 recv_stamp;         /* cntpct at msg_recv() */
 };
 
 #define M_BCAST             (1 << 0)    /* broadcast msg */
@@ -98,37 +101,37 @@ struct msg_data {
 };
 
 #define DEFINE_POCV2_MSG(ty, hdr_struct, handler)       \
-  static struct msg_size_data _msdata_##ty        \
-  __used __section(".rodata.msg") = {             \
+  static const struct msg_size_data _msdata_##ty  \
+  __used __section(".msg") = {             \
     .type = (ty),                                       \
     .msg_hdr_size = sizeof(hdr_struct),                 \
   };                                                    \
-  static struct msg_handler_data _mhdata_##ty     \
-  __used __section(".rodata.msg.common") = {      \
+  static const struct msg_handler_data _mhdata_##ty     \
+  __used __section(".msg.common") = {      \
     .type = (ty),                                       \
     .recv_handler = handler,                            \
   };
 
 #define DEFINE_POCV2_MSG_RECV_NODE0(ty, hdr_struct, handler)  \
-  static struct msg_size_data _msdata_##ty              \
-  __used __section(".rodata.msg") = {                   \
+  static const struct msg_size_data _msdata_##ty        \
+  __used __section(".msg") = {                   \
     .type = (ty),                                             \
     .msg_hdr_size = sizeof(hdr_struct),                       \
   };                                                          \
-  static struct msg_handler_data _mhdata_##ty           \
-  __used __section(".rodata.msg.node0") = {             \
+  static const struct msg_handler_data _mhdata_##ty     \
+  __used __section(".msg.node0") = {             \
     .type = (ty),                                             \
     .recv_handler = handler,                                  \
   };
 
 #define DEFINE_POCV2_MSG_RECV_SUBNODE(ty, hdr_struct, handler)  \
-  static struct msg_size_data _msdata_##ty                \
-  __used __section(".rodata.msg") = {                     \
+  static const struct msg_size_data _msdata_##ty          \
+  __used __section(".msg") = {                     \
     .type = (ty),                                               \
     .msg_hdr_size = sizeof(hdr_struct),                         \
   };                                                            \
-  static struct msg_handler_data _mhdata_##ty             \
-  __used __section(".rodata.msg.subnode") = {             \
+  static const struct msg_handler_data _mhdata_##ty       \
+  __used __section(".msg.subnode") = {             \
     .type = (ty),                                               \
     .recv_handler = handler,                                    \
   };
@@ -166,5 +169,6 @@ struct msg *pocv2_recv_reply(struct msg *msg);
 void free_recv_msg(struct msg *msg);
 
 void do_recv_waitqueue(void);
+void msg_stats(void);
 
 #endif
@@ -61,6 +61,17 @@ static inline struct cluster_node *cluster_me() {
   return localnode.node;
 }
 
+/* guest RAM size: sum of memory contributed by all nodes */
+static inline u64 cluster_memory_size() {
+  struct cluster_node *node;
+  u64 size = 0;
+
+  foreach_cluster_node(node)
+    size += node->mem.size;
+
+  return size;
+}
+
 static inline int cluster_me_nodeid() {
   struct cluster_node *me = cluster_me();
 
@@ -212,6 +223,7 @@ struct cluster_info_body {
 };
 
 void node_cluster_dump(void);
+void cluster_move_vcpu(int vcpuid, int nodeid);
 void __node0 cluster_init(void);
 void __subnode subnode_cluster_init(void);
 
@@ -0,0 +1,79 @@
+#ifndef PAGE_PROF_H
+#define PAGE_PROF_H
+
+#include "types.h"
+
+/* 1: counters built in (make PAGEPROF=1) */
+#ifndef PAGE_PROF
+#define PAGE_PROF   0
+#endif
+
+/* pages tracked per node (power of 2), the rest is counted in ndrop */
+#define PAGEPROF_NENT     4096
+/* slots probed before a page is dropped */
+#define PAGEPROF_PROBE    8
+/* vcpus per page, faults of further vcpus are counted in nother */
+#define PAGEPROF_NVCPU    4
+/* pages in the periodic report */
+#define PAGEPROF_TOP      16
+/* report period while log_cat_level[LC_PAGE] >= LLOG */
+#define PAGEPROF_PERIOD_US  (1000 * 1000)
+
+/* keep in sync with tools/pageprof.c */
+enum page_class {
+  PC_PRIVATE,         /* one vcpu */
+  PC_READ_SHARED,     /* several vcpus, nobody writes */
+  PC_PROD_CONS,       /* one writer, others read */
+  PC_MIGRATORY,       /* several writers on the same data, in turn */
+  PC_FALSE_SHARED,    /* several writers on disjoint 64 byte blocks */
+  NR_PAGE_CLASS,
+};
+
+struct page_prof_vcpu {
+  u64 vcpuid;         /* vcpuid + 1, 0: free */
+  u32 nread;
+  u32 nwrite;
+  u64 wblocks;        /* bit n: wrote to 64 byte block n */
+};
+
+/* 144 byte per page */
+struct page_prof {
+  u64 ipa;            /* 0: free */
+  u32 nread;          /* faults of local vcpus */
+  u32 nwrite;
+  u32 ninv;           /* invalidations received */
+  u32 nown_in;        /* ownership moved to this node */
+  u32 nown_out;       /* ownership moved away */
+  u32 nserve;         /* read copies served */
+  u64 sent;           /* page bytes sent */
+  u32 nother;
+  u32 pad;
+  struct page_prof_vcpu v[PAGEPROF_NVCPU];
+};
+
+enum page_prof_event {
+  PP_INV,
+  PP_OWN_IN,
+  PP_OWN_OUT,
+  PP_SERVE,
+};
+
+struct vcpu;
+
+void __page_prof_fault(struct vcpu *vcpu, u64 ipa, bool wnr);
+void __page_prof_event(u64 ipa, enum page_prof_event ev, u64 sent);
+void __page_prof_tick(void);
+void page_prof_report(int n);
+void page_prof_dump(void);
+
+#if PAGE_PROF
+#define page_prof_fault(...)    __page_prof_fault(__VA_ARGS__)
+#define page_prof_event(...)    __page_prof_event(__VA_ARGS__)
+#define page_prof_tick()        __page_prof_tick()
+#else
+#define page_prof_fault(...)    ((void)0)
+#define page_prof_event(...)    ((void)0)
+#define page_prof_tick()        ((void)0)
+#endif
+
+#endif  /* PAGE_PROF_H */
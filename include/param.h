@@ -1,11 +1,16 @@
 #ifndef CORE_PARAM_H
 #define CORE_PARAM_H
 
-/* 256 MiB per Node */
-#define MEM_PER_NODE        (256*1024*1024)
+/* guest RAM base address */
+#define GVM_RAM_BASE        0x40000000ul
 
-/* global vm memory size = 512 MB */
-#define GVM_MEMORY          (512*1024*1024)
+/* upper limit of global vm memory size = 64 GB */
+#define GVM_MEMORY_MAX      (64ul*1024*1024*1024)
+
+/* default memory contribution per Node (2MB aligned) */
+#ifndef MEM_PER_NODE
+#define MEM_PER_NODE        (256ul*1024*1024)
+#endif
 
 /* max physical cpu in this node */
 #define NCPU_MAX            8
@@ -13,6 +18,11 @@
 /* max vcpu per node */
 #define VCPU_PER_NODE_MAX   8
 
+/* vcpus of this node (may exceed pcpus) */
+#ifndef NVCPU_PER_NODE
+#define NVCPU_PER_NODE      1
+#endif
+
 /* max vcpu */
 #define VCPU_MAX  4096
 
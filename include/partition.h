@@ -0,0 +1,77 @@
+#ifndef CORE_PARTITION_H
+#define CORE_PARTITION_H
+
+#include "types.h"
+#include "memlayout.h"
+
+/*
+ *  several nodes in one machine (core/partition.c)
+ *
+ *    RAM: | node0 | node1 | ... | shm: boot blocks + fdt | msg rings |
+ *
+ *  a node owns NCPU consecutive pcpus and one partition of RAM.
+ *  shm is shared by all nodes and never given to a page allocator.
+ */
+
+#define PARTITION_MAX           8
+
+/* sub-node images are loaded at this offset of their partition */
+#define PARTITION_IMAGE_OFFSET  0x80000
+
+/* shm: boot blocks and the fdt copy share the first 2MB (one fdt mapping) */
+#define PARTITION_SHM_BOOT(k)   ((k) * sizeof(struct partition_boot))
+#define PARTITION_SHM_FDT       0x1000
+#define PARTITION_SHM_RINGS     0x200000
+
+#define PARTITION_BOOT_MAGIC    0x746f6f6232766f70    /* "pov2boot" */
+
+/* x0 of the first pcpu of a sub-node */
+struct partition_boot {
+  u64 magic;
+  u32 index;
+  u32 nparts;
+  u32 cpu_base;
+  u32 ncpu;
+  u64 mem_start;
+  u64 mem_size;
+  u64 shm_start;
+  u64 shm_size;
+  u64 fdt;
+};
+
+struct partition {
+  bool enabled;
+  int index;            /* 0: node0, booted by the machine */
+  int nparts;
+  int cpu_base;         /* first pcpu (mpidr aff0) */
+  int ncpu;
+  u64 mem_start;
+  u64 mem_size;
+  u64 shm_start;
+  u64 shm_size;
+  u64 fdt;              /* pa of the fdt copy in shm */
+};
+
+extern struct partition partition;
+
+static inline bool partition_owns_cpu(int cpu) {
+  if(!partition.enabled)
+    return true;
+
+  return partition.cpu_base <= cpu && cpu < partition.cpu_base + partition.ncpu;
+}
+
+/* a sub-node must not reinitialize what node0 set up for the machine */
+static inline bool partition_is_sub() {
+  return partition.enabled && partition.index != 0;
+}
+
+static inline void *partition_shm(u64 offset) {
+  return P2V(partition.shm_start + offset);
+}
+
+bool partition_probe(void *boot);
+void partition_init(void *fdt);
+void partition_boot_nodes(void);
+
+#endif
@@ -9,6 +9,8 @@
 #include "msg.h"
 #include "spinlock.h"
 #include "compiler.h"
+#include "sched.h"
+#include "partition.h"
 
 extern char _stack[PAGESIZE*NCPU_MAX] __aligned(PAGESIZE);
 
@@ -33,10 +35,15 @@ struct pcpu {
   struct msg_queue recv_waitq;
 
   int irq_depth;
+  /* el2 frame of the irq being handled, NULL: taken from guest */
+  struct hyp_context *irq_ctx;
   bool lazyirq_enabled;
   int lazyirq_depth;
   u64 nirq;
 
+  /* vcpus running on this pcpu */
+  struct runqueue rq;
+
   union {
     struct {
       void *gicr_base;
@@ -48,11 +55,13 @@ struct pcpu {
 } __cacheline_aligned;
 
 extern struct pcpu pcpus[NCPU_MAX];
+extern int nr_online_pcpus;
 
 void cpu_stop_local(void) __noreturn;
 void cpu_stop_all(void);
 void cpu_send_inject_sgi(struct pcpu *cpu);
 void cpu_send_do_recvq_sgi(struct pcpu *cpu);
+void cpu_send_shmnet_sgi(int cpu);
 void cpu_sgi_handler(int sgi_id);
 
 int cpu_boot(struct pcpu *cpu, u64 entrypoint);
@@ -73,6 +82,11 @@ static inline int pcpu_id(struct pcpu *cpu) {
   return cpu - pcpus;
 }
 
+/* first pcpu of this node: not 0 in a partition of a shared machine */
+static inline int pcpu_base() {
+  return partition.cpu_base;
+}
+
 #define local_lazyirq_enable()      (mycpu->lazyirq_enabled = true)
 #define local_lazyirq_disable()     (mycpu->lazyirq_enabled = false)
 #define local_lazyirq_enabled()     (mycpu->lazyirq_enabled)
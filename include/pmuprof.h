@@ -0,0 +1,66 @@
+#ifndef PMUPROF_H
+#define PMUPROF_H
+
+#include "types.h"
+#include "aarch64.h"
+#include "param.h"
+
+/* samples per pcpu ring (power of 2) */
+#define PMUPROF_NSAMPLE   2048
+
+/* cpu cycles between samples */
+#ifndef PMUPROF_PERIOD
+#define PMUPROF_PERIOD    (1 << 20)
+#endif
+
+/* exit being handled: esr_el2.EC of a guest sync exception, or */
+#define PMUPROF_EXIT_IRQ      0x40    /* irq taken from guest */
+#define PMUPROF_EXIT_NONE     0x41    /* not handling a guest exit */
+#define NR_PMUPROF_EXIT       0x42
+
+/* 32 byte record */
+struct pmu_sample {
+  u64 pc;           /* el2 pc, 0: sample hit in guest */
+  u64 callsite;     /* return address of the frame of pc */
+  u64 guest_pc;     /* elr of the vcpu on this pcpu */
+  u32 seq;
+  u8 exit;
+  u8 cpu;
+  u16 vcpuid;
+};
+
+struct pmuprof_cpu {
+  u64 head;
+  u8 exit;          /* PMUPROF_EXIT_* */
+  u64 nexit[NR_PMUPROF_EXIT];
+  u64 nsample[NR_PMUPROF_EXIT];   /* el2 samples while handling an exit */
+  struct pmu_sample ent[PMUPROF_NSAMPLE];
+} __cacheline_aligned;
+
+#ifdef PMUPROF
+
+extern struct pmuprof_cpu pmuprof_cpu[NCPU_MAX];
+
+static inline void pmuprof_exit_enter(int exit) {
+  struct pmuprof_cpu *p = &pmuprof_cpu[cpuid()];
+
+  p->exit = exit;
+  p->nexit[exit]++;
+}
+
+static inline void pmuprof_exit_leave() {
+  pmuprof_cpu[cpuid()].exit = PMUPROF_EXIT_NONE;
+}
+
+#else
+
+#define pmuprof_exit_enter(exit)  ((void)(exit))
+#define pmuprof_exit_leave()      ((void)0)
+
+#endif  /* PMUPROF */
+
+void pmuprof_init(void);
+void pmuprof_init_core(void);
+void pmuprof_dump(void);
+
+#endif  /* PMUPROF_H */
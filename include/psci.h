@@ -24,5 +24,6 @@
 #define PSCI_INVALID_ADDRESS    -9
 
 void psci_init(void);
+int psci_cpu_on(int cpu, physaddr_t ep_phys, u64 ctxid);
 
 #endif
@@ -63,10 +63,6 @@ extern u64 *vttbr;
 
 #define S2PTE_DBM             (1ul << 51)
 
-/* use bit[58:55] to keep page's copyset  */
-#define S2PTE_COPYSET_SHIFT   55
-#define S2PTE_COPYSET(c)      (((u64)(c) & 0xf) << S2PTE_COPYSET_SHIFT)
-#define S2PTE_COPYSET_MASK    S2PTE_COPYSET(0xf)
 
 void switch_vttbr(physaddr_t vttbr);
 ipa_t faulting_ipa_page(void);
@@ -79,6 +75,7 @@ ipa_t at_uva2ipa(u64 uva);
 u64 *s2_rwable_pte(ipa_t ipa);
 u64 *s2_readable_pte(ipa_t ipa);
 u64 *s2_ro_pte(ipa_t ipa);
+bool s2_page_mapped(ipa_t ipa);
 void s2_page_invalidate(ipa_t ipa);
 void s2_page_ro(ipa_t ipa);
 
@@ -88,7 +85,7 @@ void copy_from_guest(char *to, ipa_t from_ipa, u64 len);
 void guest_map_page(ipa_t ipa, physaddr_t pa, enum pageflag flags);
 void map_guest_image(struct guest *img, ipa_t ipa);
 void alloc_guestmem(ipa_t ipa, u64 size);
-void s2_map_page_copyset(ipa_t ipa, physaddr_t pa, u64 copyset);
+void s2_map_page_noaccess(ipa_t ipa, physaddr_t pa);
 
 void map_guest_peripherals(void);
 
@@ -124,16 +121,4 @@ static inline void s2pte_rw(u64 *pte) {
   *pte |= S2PTE_RW;
 }
 
-static inline int s2pte_copyset(u64 *pte) {
-  return (*pte & S2PTE_COPYSET_MASK) >> S2PTE_COPYSET_SHIFT;
-}
-
-static inline void s2pte_add_copyset(u64 *pte, int nodeid) {
-  *pte |= S2PTE_COPYSET(1 << nodeid);
-}
-
-static inline void s2pte_clear_copyset(u64 *pte) {
-  *pte &= ~S2PTE_COPYSET_MASK;
-}
-
 #endif  /* CORE_S2MM_H */
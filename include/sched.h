@@ -0,0 +1,78 @@
+#ifndef CORE_SCHED_H
+#define CORE_SCHED_H
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "compiler.h"
+
+struct vcpu;
+
+/* timeslice while other vcpus wait for this pcpu (usec) */
+#define SCHED_TIMESLICE_US    4000
+
+extern int sched_timeslice_us;
+
+enum vcpu_state {
+  VCPU_RUNNABLE,
+  VCPU_RUNNING,     /* its context is loaded on its pcpu */
+  VCPU_BLOCKED,     /* waits for sched_wakeup() */
+  VCPU_EXITED,      /* migrated to other node */
+};
+
+/* callee-saved registers of hypervisor context (switch.S) */
+struct cpu_context {
+  u64 x19;
+  u64 x20;
+  u64 x21;
+  u64 x22;
+  u64 x23;
+  u64 x24;
+  u64 x25;
+  u64 x26;
+  u64 x27;
+  u64 x28;
+  u64 fp;
+  u64 lr;
+  u64 sp;
+};
+
+/*
+ *  vcpus assigned to a pcpu.
+ *  vcpus never move to other pcpus of the node, so a vcpu is always
+ *  saved and restored by the same scheduler loop.  a vcpu migrating
+ *  to other node leaves with sched_exit(), one arriving joins with
+ *  sched_attach().
+ */
+struct runqueue {
+  struct vcpu *vcpus[VCPU_PER_NODE_MAX];
+  int nvcpu;
+  int last;               /* round-robin cursor */
+  bool need_resched;
+  /* scheduler loop (on boot stack of pcpu) */
+  struct cpu_context ctx;
+  spinlock_t lock;
+
+  u64 nswitch;
+  u64 npreempt;
+  u64 nblock;
+};
+
+void switch_context(struct cpu_context *prev, struct cpu_context *next);
+
+void sched_init(void);
+void sched_init_vcpu(struct vcpu *vcpu);
+void sched_start(void) __noreturn;
+void sched_attach(struct vcpu *vcpu, void (*entry)(void));
+void sched_exit(void) __noreturn;
+
+bool sched_multiplexed(void);
+void sched_wait(void);
+void sched_yield(void);
+void sched_wakeup(struct vcpu *vcpu);
+void sched_kick(struct vcpu *vcpu);
+void sched_tick(void);
+void sched_preempt(void);
+void sched_stats(void);
+
+#endif
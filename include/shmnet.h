@@ -0,0 +1,37 @@
+#ifndef SHMNET_H
+#define SHMNET_H
+
+#include "types.h"
+#include "aarch64.h"
+#include "mm.h"
+
+/*
+ *  nic of a partition of a shared machine (drivers/shmnet.c)
+ *
+ *  one ring per destination node in shm, any cpu of any node enqueues,
+ *  the first pcpu of the destination node dequeues on an sgi.
+ */
+
+#define SHMNET_NSLOT      64
+#define SHMNET_FRAME_MAX  64    /* ethernet header + msg header */
+
+struct shmnet_slot {
+  u64 seq;          /* pos: free, pos + 1: filled */
+  u32 len;
+  u32 body_len;
+  u8 frame[SHMNET_FRAME_MAX];
+  u8 body[PAGESIZE];
+};
+
+struct shmnet_ring {
+  u64 enqueue __cacheline_aligned;
+  u64 dequeue __cacheline_aligned;
+  /* 1: an sgi is on the way or the consumer is not up yet */
+  u64 kick __cacheline_aligned;
+  struct shmnet_slot slots[SHMNET_NSLOT] __cacheline_aligned;
+};
+
+void shmnet_init(void);
+void shmnet_rx(void);
+
+#endif
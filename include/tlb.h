@@ -19,23 +19,90 @@ static inline void tlb_s2_flush_all() {
   isb();
 }
 
-#ifdef BUILD_QEMU
+static inline void tlb_s2_flush_all_is() {
+  dsb(ishst);
+  asm volatile("tlbi  vmalls12e1is" ::: "memory");
+  dsb(ish);
+  isb();
+}
+
+/*
+ *  raw tlbi operations (no barrier)
+ *  sys #4, c8, c0, #1 = tlbi ipas2e1is
+ *  sys #4, c8, c0, #2 = tlbi ripas2e1is (FEAT_TLBIRANGE)
+ *  sys #4, c8, c4, #1 = tlbi ipas2e1
+ */
+static inline void __tlbi_ipas2e1is(u64 ipa) {
+  asm volatile("sys #4, c8, c0, #1, %0" :: "r"(ipa >> PAGESHIFT) : "memory");
+}
 
-/* QEMU does not emulate tlbi ipas2e1 ;; */
+static inline void __tlbi_ripas2e1is(u64 arg) {
+  asm volatile("sys #4, c8, c0, #2, %0" :: "r"(arg) : "memory");
+}
 
-static inline void tlb_s2_flush_ipa(u64 __unused ipa) {
-  tlb_s2_flush_all();
+static inline void __tlbi_ipas2e1(u64 ipa) {
+  asm volatile("sys #4, c8, c4, #1, %0" :: "r"(ipa >> PAGESHIFT) : "memory");
 }
 
-#else   /* !BUILD_QEMU */
+static inline void __tlbi_vmalle1is() {
+  asm volatile("tlbi  vmalle1is" ::: "memory");
+}
 
-static inline void tlb_s2_flush_ipa(u64 ipa) {
-  dsb(ishst);
-  asm volatile("tlbi  ipas2e1, %0" :: "r"(ipa >> PAGESHIFT) : "memory");
-  dsb(ish);
-  isb();
+static inline void __tlbi_vmalle1() {
+  asm volatile("tlbi  vmalle1" ::: "memory");
 }
 
-#endif  /* BUILD_QEMU */
+/*
+ *  why stage 2 tlb flushes happened (per fault type)
+ */
+enum tlb_flush_reason {
+  TLBF_READ_FAULT,
+  TLBF_WRITE_FAULT,
+  TLBF_READ_SERVER,
+  TLBF_WRITE_SERVER,
+  TLBF_INV_SERVER,
+  TLBF_SPURIOUS,
+  TLBF_OTHER,
+  NR_TLBF_REASON,
+};
+
+/*
+ *  batch of stage 2 invalidations.
+ *  collect ipa ranges, then issue tlbi ipas2e1is (or ripas2e1is) per range
+ *  and only one vmalle1is at tlb_s2_batch_flush().
+ */
+#define TLB_BATCH_MAX     16
+
+struct tlb_s2_batch {
+  struct {
+    ipa_t ipa;
+    u64 npages;
+  } range[TLB_BATCH_MAX];
+  int n;
+  bool overflow;
+};
+
+static inline void tlb_s2_batch_init(struct tlb_s2_batch *b) {
+  b->n = 0;
+  b->overflow = false;
+}
+
+void tlb_s2_batch_add_range(struct tlb_s2_batch *b, ipa_t ipa, u64 size);
+void tlb_s2_batch_flush(struct tlb_s2_batch *b, enum tlb_flush_reason reason);
+
+static inline void tlb_s2_batch_add(struct tlb_s2_batch *b, ipa_t ipa) {
+  tlb_s2_batch_add_range(b, ipa, PAGESIZE);
+}
+
+void tlb_s2_flush_ipa_reason(u64 ipa, enum tlb_flush_reason reason);
+void tlb_s2_flush_ipa_local(u64 ipa);
+void tlb_s2_defer(enum tlb_flush_reason reason);
+
+void tlb_s2_stats_dump(void);
+void tlb_s2_init(void);
+
+static inline void tlb_s2_flush_ipa(u64 ipa) {
+  tlb_s2_flush_ipa_reason(ipa, TLBF_OTHER);
+}
 
 #endif  /* CORE_TLB_H */
@@ -9,7 +9,13 @@ struct uartchip {
   int intid;
   void (*init)(struct device_node *);
   void (*putc)(char c);
+  int (*tryputc)(char c);   /* -1: tx fifo full */
   void (*puts)(char *s);
+  int (*getc)(void);      /* -1: no input */
+  /* guest accesses forwarded by the console (core/console.c) */
+  u32 (*reg_read)(u64 offset);
+  void (*reg_write)(u64 offset, u32 val);
+  u64 rx_reg;             /* offset of the rx data register */
 };
 
 void uart_putc(char c);
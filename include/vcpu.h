@@ -7,6 +7,8 @@
 #include "gic.h"
 #include "aarch64.h"
 #include "mm.h"
+#include "sched.h"
+#include "exit-stat.h"
 
 struct pcpu;
 
@@ -14,14 +16,112 @@ struct cpu_features {
   u64 pfr0;
 };
 
-struct pending_queue {
-  struct gic_pending_irq *irqs[4];
-  int head;
-  int tail;  
+/*
+ *  pending virtual interrupts: 1 bit per intid (SGI/PPI/SPI)
+ *  set by any cpu with atomic operation, drained by owner cpu
+ */
+#define VIRQ_MAX      1024
 
-  spinlock_t lock;
+struct pending_irqs {
+  u64 bitmap[VIRQ_MAX / 64];
+};
+
+/* trapped wfi/wfe: statistics and adaptive halt-polling state */
+struct vcpu_idle {
+  u64 poll_ticks;     /* current halt-polling window */
+  u64 nwfi;
+  u64 nwfe;
+  u64 npoll_wakeup;   /* woken up while polling */
+  u64 nhalt;          /* halted pcpu with wfi */
+  u64 idle_ticks;     /* time spent in polling and halting */
+  u64 npark;          /* wfe parked on a remote page */
+  u64 npark_wakeup;   /* parked wfe woken up by invalidation */
+
+  /* page most recently read-faulted from remote node */
+  u64 rfault_ipa;
+  u64 rfault_stamp;
+  /* page which parked wfe waits for */
+  volatile u64 wfe_wait_ipa;
+};
+
+/* remote faults by serving node: decides migration to other node */
+struct vcpu_migrate {
+  u32 rfaults[NODE_MAX];    /* in current window */
+  u32 nrfaults;
+  u64 window_start;
+  u64 cooldown_end;         /* no migration until then */
+  int dst;                  /* chosen node */
+  bool pending;             /* migrate at the end of this trap */
+};
+
+/* stamps (cntpct) of the remote fault being handled */
+struct vcpu_fault_lat {
+  u64 trap;
+  u64 lock;
+  u64 issue;
+  u64 recv;         /* reply arrived in msg_recv() */
+  u64 cb;           /* reply handled */
+  u64 map;
+  /* remote durations carried back in the reply (ticks) */
+  u32 fwd;
+  u32 rxq;
+  u32 wq;
+  u32 serve;
+  bool remote;      /* this trap waited for a reply */
 };
 
+/* guest exits of this vcpu on this node */
+struct vcpu_exit_stat {
+  u64 start;        /* trap entry */
+  int cur;          /* reason of the exit being handled */
+  u32 cur_sysreg;
+  struct exit_count reason[NR_EXIT_REASON];
+  struct exit_sysreg sysreg[EXIT_SYSREG_MAX];
+  struct exit_count sysreg_other;
+};
+
+/* EL1 system registers switched with vcpu */
+struct vcpu_sysregs {
+  u64 sctlr_el1;
+  u64 ttbr0_el1;
+  u64 ttbr1_el1;
+  u64 tcr_el1;
+  u64 mair_el1;
+  u64 amair_el1;
+  u64 vbar_el1;
+  u64 contextidr_el1;
+  u64 cpacr_el1;
+  u64 elr_el1;
+  u64 spsr_el1;
+  u64 esr_el1;
+  u64 far_el1;
+  u64 afsr0_el1;
+  u64 afsr1_el1;
+  u64 par_el1;
+  u64 tpidr_el0;
+  u64 tpidrro_el0;
+  u64 tpidr_el1;
+  u64 sp_el0;
+  u64 sp_el1;
+  u64 cntkctl_el1;
+  u64 csselr_el1;
+  u64 mdscr_el1;
+  u64 cntv_ctl_el0;
+  u64 cntv_cval_el0;
+  /* syndrome of the trap being handled when switched out */
+  u64 esr_el2;
+  u64 far_el2;
+  u64 hpfar_el2;
+  u64 elr_el2;
+  u64 spsr_el2;
+};
+
+struct fpsimd_state {
+  u64 q[64];    /* q0-q31 */
+  u64 fpsr;
+  u64 fpcr;
+} __aligned(16);
+
 struct msg;
 
 struct vcpu {
@@ -44,15 +144,30 @@ struct vcpu {
   /* msg reply manager */
   struct msg * volatile reply_buf;
 
-  u64 sctlr_el1;
-
   struct vgic_cpu vgic;
   /* pending irqs */
-  struct pending_queue pending;
+  struct pending_irqs pending;
 
   /* when dabort occurs on vCPU, informations will save here */
   struct dabort_info dabt;
 
+  struct vcpu_idle idle;
+
+  struct vcpu_migrate migrate;
+
+  struct vcpu_fault_lat flat;
+
+  struct vcpu_exit_stat exit;
+
+  /* scheduler */
+  enum vcpu_state state;
+  bool woken;       /* sched_wakeup() while not blocked */
+  struct cpu_context ctx;
+  void *stack;      /* hypervisor stack */
+  struct vcpu_sysregs sys;
+  struct fpsimd_state fp;
+  struct gic_state gic;
+
   spinlock_t lock;
 
   bool initialized;
@@ -74,6 +189,26 @@ void wait_for_current_vcpu_online(void);
 
 void vcpu_dump(struct vcpu *vcpu);
 
+void vcpu_save_state(struct vcpu *vcpu);
+void vcpu_restore_state(struct vcpu *vcpu);
+
+void fpsimd_save(struct fpsimd_state *fp);
+void fpsimd_restore(struct fpsimd_state *fp);
+
+void vcpu_wfi(struct vcpu *vcpu);
+void vcpu_wfe(struct vcpu *vcpu);
+void vcpu_wfe_wake(u64 page_ipa);
+void vcpu_idle_stats(void);
+
+/* runtime knobs (core/console.c) */
+extern int halt_poll_max_us;
+extern int migrate_min_faults;
+extern int migrate_ratio_pct;
+
+void vcpu_migrate_account(struct vcpu *vcpu, int nodeid);
+void vcpu_migrate_check(struct vcpu *vcpu);
+void vcpu_migrate_stats(void);
+
 #define current   ((struct vcpu *)read_sysreg(tpidr_el2))
 
 static inline void set_current_vcpu(struct vcpu *vcpu) {
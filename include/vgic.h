@@ -31,9 +31,12 @@ struct vgic_irq {
 
   bool enabled: 1;
   bool hw: 1;
+  bool remote: 1;         /* injected by src_node: physical irq lives there */
   u8 igroup: 1;
   u8 cfg: 1;
 
+  u8 src_node;
+
   int hwirq;
 
   spinlock_t lock;
@@ -65,6 +68,8 @@ struct vgic_cpu {
 
   struct vgic_irq sgis[GIC_NSGI];
   struct vgic_irq ppis[GIC_NPPI];
+
+  bool lr_underflow;    /* underflow maintenance interrupt armed */
 };
 
 enum gic_config_type {
@@ -83,7 +88,31 @@ struct gic_config_msg_hdr {
   u32 value;
 };
 
+/* level spis injected by other nodes which a migrating vcpu may still EOI */
+#define VGIC_MIGRATE_REMOTE_MAX   64
+
+/* vgic state of a vcpu moving to another node */
+struct vgic_cpu_state {
+  struct {
+    u8 priority;
+    u8 req_cpu;
+    bool enabled: 1;
+    u8 igroup: 1;
+    u8 cfg: 1;
+  } irqs[GIC_NSGI + GIC_NPPI];
+
+  int nremote;
+  struct {
+    u16 intid;
+    u8 src_node;
+  } remote[VGIC_MIGRATE_REMOTE_MAX];
+};
+
 void vgic_cpu_init(struct vcpu *vcpu);
+void vgic_cpu_export(struct vcpu *vcpu, struct vgic_cpu_state *s);
+void vgic_cpu_import(struct vcpu *vcpu, struct vgic_cpu_state *s);
+void vgic_cpu_enable_ppis(struct vcpu *vcpu);
+void vgic_retarget_spis(void);
 int vgic_inject_virq(struct vcpu *vcpu, u32 intid);
 int vgic_emulate_sgi1r(struct vcpu *vcpu, int rt, int wr);
 
@@ -92,9 +121,16 @@ int vgic_emulate_sgi(struct vcpu *vcpu, struct gic_sgi *sgi);
 void vgic_enable_irq(struct vcpu *vcpu, struct vgic_irq *irq);
 void vgic_disable_irq(struct vcpu *vcpu, struct vgic_irq *irq);
 void vgic_inject_pending_irqs(void);
+void vgic_flush_remote_virqs(void);
+
+/* virqs per cross-node MSG_INTERRUPT */
+#define VIRQ_MSG_BATCH    8
+
+extern int virq_msg_batch;
 
 struct vgic_irq *vgic_get_irq(struct vcpu *vcpu, int intid);
-void vgic_connect_hwirq(int virq_no, int hwirq_no);
+void vgic_connect_hwirq(struct vcpu *vcpu, int virq_no, int hwirq_no);
+void vgic_route_hwirq(struct vgic_irq *irq);
 
 void vgic_iidr_read(struct vcpu *vcpu, struct mmio_access *mmio);
 void vgic_igroup_read(struct vcpu *vcpu, struct mmio_access *mmio, u64 offset);
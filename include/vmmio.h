@@ -14,15 +14,21 @@ struct mmio_access {
   bool wnr;
 };
 
+/* max guest mmio regions of localvm */
+#define VMMIO_REGION_MAX    16
+
 struct mmio_region {
-  struct mmio_region *next;
   u64 base;
   u64 size;
   int (*read)(struct vcpu *, struct mmio_access *);
   int (*write)(struct vcpu *, struct mmio_access *);
+
+  u64 nread;
+  u64 nwrite;
 };
 
 int vmmio_emulate(struct vcpu *vcpu, struct mmio_access *mmio);
+void vmmio_stats(void);
 
 int vmmio_reg_handler(u64 ipa, u64 size,
                      int (*read_handler)(struct vcpu *, struct mmio_access *),
@@ -31,6 +37,7 @@ int vmmio_reg_handler(u64 ipa, u64 size,
 enum vmmio_status {
   VMMIO_OK,
   VMMIO_FAILED,
+  VMMIO_MOVED,      /* target vcpu migrated to other node */
 };
 
 /*
@@ -2,45 +2,65 @@
 #define VSM_LOG_H
 
 #include "types.h"
+#include "aarch64.h"
 
-#define VLOG_LEVEL  2
+/* 0: tracepoints compiled out */
+#ifndef VSM_TRACE
+#define VSM_TRACE   1
+#endif
 
-enum {
-  READ_SENDER,
-  READ_RECEIVER,
-  WRITE_SENDER,
-  WRITE_RECEIVER,
-  INV_SENDER,
-  INV_RECEIVER,
-  VSM_INFO,
-};
+/* records per pcpu ring (power of 2) */
+#define VTRACE_NENT   1024
 
-struct vsmlog {
-  int type;     // read or write or invalidate
-  int cpu;
-  u64 ipa;
-  const char *msg;
-  int from_node;
-  int to_node;
-  u64 daif;
+enum vtrace_type {
+  VT_FETCH_REQ,       /* requester sent fetch request */
+  VT_FETCH_FWD,       /* manager forwarded fetch request to owner */
+  VT_FETCH_REPLY,     /* requester received page or ownership */
+  VT_SERVER_RECV,     /* fetch request arrived */
+  VT_SERVER_PROC,     /* server processes request (page locked) */
+  VT_SERVER_REPLY,    /* owner sent page or ownership */
+  VT_INV_SEND,
+  VT_INV_RECV,
+  VT_MAP,             /* faulting page mapped to guest */
+  NR_VTRACE_TYPE,
 };
 
-void vsm_logdump(int n);
-void vsm_logging(int type, int from_node, int to_node, u64 ipa, const char *msg);
-void vsm_log_out(int type, int from_node, int to_node, u64 ipa, const char *msg);
-
-#if VLOG_LEVEL == 0
-
-#define vsm_log(...)  ((void)0)
+/*
+ *  32 byte binary record.
+ *  from_node is the node which requests (or invalidates) the page,
+ *  to_node is the other side of the event: destination of a request,
+ *  the node served a reply, ...
+ */
+/* aux of fetch events: fetch type, zero page reply and requester cpu */
+#define VT_AUX(wnr, zero, req_cpu)  \
+  ((u32)(wnr) | (u32)(zero) << 1 | ((u32)(req_cpu) & 0xff) << 8)
 
-#elif VLOG_LEVEL == 1
-
-#define vsm_log       vsm_logging
+struct vsm_trace {
+  u64 stamp;        /* cntpct_el0 */
+  u64 ipa;
+  u32 connid;       /* pocv2-msg connection id */
+  u32 aux;          /* type dependent: fetch type, reply flags, ... */
+  u32 seq;          /* per pcpu sequence number */
+  u8 type;          /* enum vtrace_type */
+  u8 cpu;
+  u8 from_node;
+  u8 to_node;
+};
 
-#elif VLOG_LEVEL == 2
+/* single writer (its pcpu) per ring */
+struct vtrace_ring {
+  u64 head;         /* records written so far */
+  struct vsm_trace ent[VTRACE_NENT];
+} __cacheline_aligned;
 
-#define vsm_log       vsm_log_out
+void __vsm_trace(enum vtrace_type type, int from_node, int to_node, u64 ipa,
+                 u32 connid, u32 aux);
+void vsm_trace_dump(int n);
 
-#endif  /* VLOG_LEVEL */
+#if VSM_TRACE
+#define vsm_trace(...)    __vsm_trace(__VA_ARGS__)
+#else
+#define vsm_trace(...)    ((void)0)
+#endif
 
 #endif  /* VSM_LOG_H */
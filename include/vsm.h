@@ -11,13 +11,36 @@ struct vcpu;
 
 #define CONFIG_PAGE_CACHE
 
+/* allocate home pages on first touch */
+#define CONFIG_VSM_LAZY_HOME
+
 /*
  *  manager page
  */
 struct manager_page {
   u8 owner;
+  u8 zero;    /* never touched: unmapped, zero-filled and owned by me */
 };
 
+/*
+ *  copyset: nodes that have a read copy of page, kept by the owner.
+ *  bit n = Node n.  if NODE_MAX exceeds the bitmap, it becomes
+ *  a coarse vector: one bit covers COPYSET_COARSE nodes.
+ */
+typedef u32 copyset_t;
+
+#define COPYSET_BITS            (sizeof(copyset_t) * 8)
+#define COPYSET_COARSE          ((NODE_MAX + COPYSET_BITS - 1) / COPYSET_BITS)
+#define COPYSET_NODE(n)         ((copyset_t)1 << ((n) / COPYSET_COARSE))
+
+static inline void copyset_add(copyset_t *c, int nodeid) {
+  *c |= COPYSET_NODE(nodeid);
+}
+
+static inline bool copyset_has(copyset_t c, int nodeid) {
+  return !!(c & COPYSET_NODE(nodeid));
+}
+
 struct vsm_waitqueue {
   struct vsm_server_proc *head;
   struct vsm_server_proc *tail;
@@ -33,6 +56,7 @@ struct page_desc {
       u8 wqlock;
     };
   };
+  copyset_t copyset;    /* valid while I am owner */
 };
 
 struct vsm_server_proc {
@@ -43,16 +67,23 @@ struct vsm_server_proc {
   int type;
   int req_cpu;
   void (*do_process)(struct vsm_server_proc *);
-};
 
-#define NR_MANAGER_PAGES        (MEM_PER_NODE >> PAGESHIFT)
+  /* fault latency: cntpct of msg_recv, request handler and processing */
+  u64 recv_stamp;
+  u64 intr_stamp;
+  u64 proc_stamp;
+  u32 fwd;            /* ticks spent on forwarding nodes before */
+};
 
 int vsm_access(struct vcpu *vcpu, char *buf, u64 ipa, u64 size, bool wr);
+int vsm_copy_to_guest(struct vcpu *vcpu, u64 ipa, void *buf, u64 size);
 void *vsm_read_fetch_page(u64 page_ipa);
 void *vsm_write_fetch_page(u64 page_ipa);
 void *vsm_read_fetch_instr(u64 page_ipa);
 
 void vsm_init(void);
 void vsm_node_init(struct memrange *mem);
+void vsm_stats(void);
+void vsm_page_dump(u64 ipa);
 
 #endif    /* VSM_H */
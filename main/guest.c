@@ -1,6 +1,19 @@
 #include "types.h"
 #include "guest.h"
 
+#ifdef VSMTEST
+
+extern char _binary_guest_vsmtest_img_start[];
+extern char _binary_guest_vsmtest_img_size[];
+
+struct guest vsmtest_img = {
+  .name = "vsmtest",
+  .start = (u64)_binary_guest_vsmtest_img_start,
+  .size = (u64)_binary_guest_vsmtest_img_size,
+};
+
+#else
+
 // extern char _binary_guest_xv6_kernel_img_start[];
 // extern char _binary_guest_xv6_kernel_img_size[];
 extern char _binary_guest_linux_Image_start[];
@@ -28,6 +41,8 @@ struct guest rootfs_img = {
   .size = (u64)_binary_guest_linux_rootfs_img_size,
 };
 
+#endif  /* VSMTEST */
+
 #if 0
 
 extern char _binary_guest_hello_hello_img_start[];
@@ -19,19 +19,35 @@
 #define MiB   (1024 * 1024)
 #define GiB   (1024 * 1024 * 1024)
 
+#ifdef VSMTEST
+
+/* bare-metal vsm benchmarks (guest/vsmtest) */
+static struct vm_desc vm_desc = {
+  .os_img = &vsmtest_img,
+  .fdt_img = &virt_dtb,
+  .initrd_img = NULL,
+  .nvcpu = 2,
+  .ram_start = GVM_RAM_BASE,
+  .entrypoint = 0x40000000,
+  .fdt_base = 0x48400000,
+};
+
+#else
+
 static struct vm_desc vm_desc = {
   .os_img = &linux_img,
   .fdt_img = &virt_dtb,
   .initrd_img = &rootfs_img,
   /* TODO: determine parameters by fdt file */
   .nvcpu = 2,
-  .nallocate = 512 * MiB,
-  .ram_start = 0x40000000,
+  .ram_start = GVM_RAM_BASE,
   .entrypoint = 0x40200000,
   .fdt_base = 0x48400000,
   .initrd_base = 0x48000000,
 };
 
+#endif  /* VSMTEST */
+
 static void initvm(struct vm_desc *desc) {
   struct guest *os = desc->os_img;
   struct guest *fdt = desc->fdt_img;
@@ -45,7 +61,7 @@ static void initvm(struct vm_desc *desc) {
 
   printf("initvm: create vm `%s`\n", os->name);
   printf("initvm: use %d vcpu(s)\n", desc->nvcpu);
-  printf("initvm: allocated ram: %d (%d M) byte\n", desc->nallocate, desc->nallocate >> 20);
+  printf("initvm: allocated ram: %p (%d M) byte\n", desc->nallocate, desc->nallocate >> 20);
   printf("initvm: img_start %p img_size %p byte\n", os->start, os->size);
 
   map_guest_image(os, desc->entrypoint);
@@ -78,6 +94,9 @@ static void node0_init() {
 
   cluster_init();
 
+  /* sum of memory contributed by all nodes */
+  vm_desc.nallocate = cluster_memory_size();
+
   initvm(&vm_desc);
 }
 
@@ -0,0 +1,451 @@
+/*
+ *  pageprof: hottest vsm pages of the cluster and their sharing pattern
+ *
+ *    $ pageprof [-n top] [-g System.map [-k ipa]] node0.log node1.log ...
+ *
+ *  each log is a console output containing "pageprof: begin" ... "end"
+ *  (console "pageprof"/"pages", the periodic report of "set log_page 2"
+ *  or vsmsim -d page).  the last dump of each node is used; the pages of
+ *  all nodes are merged by ipa and classified with the vcpus of every node.
+ *  with -g, the written 64 byte blocks are symbolized with the System.map
+ *  of the guest kernel, loaded at ipa -k (main/node.c: 0x40200000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+#define NODE_MAX      32
+#define VCPU_MAX      64    /* per page */
+#define SYM_PER_PAGE  4
+
+/* keep in sync with include/page-prof.h */
+enum page_class {
+  PC_PRIVATE,
+  PC_READ_SHARED,
+  PC_PROD_CONS,
+  PC_MIGRATORY,
+  PC_FALSE_SHARED,
+  NR_PAGE_CLASS,
+};
+
+static const char *classname[NR_PAGE_CLASS] = {
+  [PC_PRIVATE] =      "private",
+  [PC_READ_SHARED] =  "read-shared",
+  [PC_PROD_CONS] =    "producer-consumer",
+  [PC_MIGRATORY] =    "migratory",
+  [PC_FALSE_SHARED] = "false-shared",
+};
+
+struct pvcpu {
+  int vcpuid;
+  u64 nread, nwrite;
+  u64 wblocks;
+};
+
+struct page {
+  int node;           /* -1: merged or replaced by a later dump */
+  u64 ipa;
+  u64 nread, nwrite, ninv, nown_in, nown_out, nserve, sent, nother;
+  int nvcpu;
+  struct pvcpu v[VCPU_MAX];
+  int class;
+};
+
+struct sym {
+  u64 addr;
+  char name[64];
+};
+
+static struct page *pages;
+static int npages, pagecap;
+
+static struct sym *syms;
+static int nsyms, symcap;
+static u64 kbase = 0x40200000, ktext;
+
+static int dumps[NODE_MAX];
+
+static void *grow(void *p, int *cap, size_t size) {
+  *cap = *cap ? *cap * 2 : 4096;
+  p = realloc(p, size * *cap);
+  if(!p) {
+    perror("realloc");
+    exit(1);
+  }
+
+  return p;
+}
+
+/* "nm -n" output: text and data */
+static void load_map(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while(fgets(line, sizeof(line), f)) {
+    unsigned long long addr;
+    char type;
+    char name[64];
+
+    if(sscanf(line, "%llx %c %63s", &addr, &type, name) != 3)
+      continue;
+    if(!strchr("tTdDbBrR", type))
+      continue;
+
+    if(!strcmp(name, "_text"))
+      ktext = addr;
+
+    if(nsyms == symcap)
+      syms = grow(syms, &symcap, sizeof(*syms));
+
+    syms[nsyms].addr = addr;
+    strcpy(syms[nsyms].name, name);
+    nsyms++;
+  }
+
+  fclose(f);
+}
+
+/* ipa to guest symbol: kernel image only, a map without _text is of ipas */
+static const char *symbolize(u64 ipa) {
+  u64 addr = ktext ? ktext + ipa - kbase : ipa;
+  int lo = 0, hi = nsyms - 1;
+
+  if(!nsyms || addr < syms[0].addr || (ktext && ipa < kbase))
+    return NULL;
+
+  while(lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+
+    if(syms[mid].addr <= addr)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return syms[lo].name;
+}
+
+static struct pvcpu *page_vcpu(struct page *p, int vcpuid) {
+  for(int i = 0; i < p->nvcpu; i++) {
+    if(p->v[i].vcpuid == vcpuid)
+      return &p->v[i];
+  }
+
+  if(p->nvcpu == VCPU_MAX)
+    return NULL;
+
+  p->v[p->nvcpu].vcpuid = vcpuid;
+  return &p->v[p->nvcpu++];
+}
+
+static struct page *find_page(int node, u64 ipa) {
+  for(int i = npages - 1; i >= 0; i--) {
+    if(pages[i].node == node && pages[i].ipa == ipa)
+      return &pages[i];
+  }
+
+  return NULL;
+}
+
+static void parse(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+  int node = -1;
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while(fgets(line, sizeof(line), f)) {
+    unsigned long long ipa, nread, nwrite, ninv, nown_in, nown_out, nserve, sent, nother, wblocks;
+    char *p;
+    int n, vcpuid;
+
+    if((p = strstr(line, "pageprof: begin node")) != NULL) {
+      if(sscanf(p, "pageprof: begin node %d", &n) == 1 && n >= 0 && n < NODE_MAX) {
+        node = n;
+        dumps[node]++;
+
+        /* counters are cumulative: a later dump replaces the former */
+        for(int i = 0; i < npages; i++) {
+          if(pages[i].node == node)
+            pages[i].node = -1;
+        }
+      }
+      continue;
+    }
+
+    if(strstr(line, "pageprof: end")) {
+      node = -1;
+      continue;
+    }
+
+    if(node < 0)
+      continue;
+
+    if((p = strstr(line, "ppv ")) != NULL) {
+      struct page *pg;
+      struct pvcpu *v;
+
+      if(sscanf(p, "ppv %llx %d %llu %llu %llx", &ipa, &vcpuid, &nread, &nwrite, &wblocks) != 5)
+        continue;
+      if(!(pg = find_page(node, ipa)) || !(v = page_vcpu(pg, vcpuid)))
+        continue;
+
+      v->nread += nread;
+      v->nwrite += nwrite;
+      v->wblocks |= wblocks;
+      continue;
+    }
+
+    if((p = strstr(line, "pp ")) != NULL &&
+       sscanf(p, "pp %llx %llu %llu %llu %llu %llu %llu %llu %llu", &ipa, &nread, &nwrite,
+              &ninv, &nown_in, &nown_out, &nserve, &sent, &nother) == 9) {
+      struct page *pg;
+
+      if(npages == pagecap)
+        pages = grow(pages, &pagecap, sizeof(*pages));
+
+      pg = &pages[npages++];
+      *pg = (struct page){ node, ipa, nread, nwrite, ninv, nown_in, nown_out, nserve, sent, nother };
+    }
+  }
+
+  fclose(f);
+}
+
+static int ipa_cmp(const void *a, const void *b) {
+  const struct page *x = a, *y = b;
+
+  if(x->node < 0 || y->node < 0)
+    return (x->node < 0) - (y->node < 0);
+  if(x->ipa != y->ipa)
+    return x->ipa < y->ipa ? -1 : 1;
+  return 0;
+}
+
+/* pages of all nodes into the first record of each ipa */
+static void merge() {
+  int n = 0;
+
+  qsort(pages, npages, sizeof(*pages), ipa_cmp);
+
+  for(int i = 0; i < npages && pages[i].node >= 0; i++) {
+    struct page *p = &pages[i], *m;
+
+    if(n > 0 && pages[n - 1].ipa == p->ipa) {
+      m = &pages[n - 1];
+
+      m->nread += p->nread;
+      m->nwrite += p->nwrite;
+      m->ninv += p->ninv;
+      m->nown_in += p->nown_in;
+      m->nown_out += p->nown_out;
+      m->nserve += p->nserve;
+      m->sent += p->sent;
+      m->nother += p->nother;
+
+      for(int j = 0; j < p->nvcpu; j++) {
+        struct pvcpu *v = page_vcpu(m, p->v[j].vcpuid);
+
+        if(!v) {
+          m->nother += p->v[j].nread + p->v[j].nwrite;
+          continue;
+        }
+
+        v->nread += p->v[j].nread;
+        v->nwrite += p->v[j].nwrite;
+        v->wblocks |= p->v[j].wblocks;
+      }
+    } else {
+      if(n != i)
+        pages[n] = *p;
+      n++;
+    }
+  }
+
+  npages = n;
+}
+
+/*
+ *  as page_class() of core/page-prof.c, but the vcpus of all nodes are
+ *  known: protocol counters only stand in for nodes without a dump
+ */
+static int classify(struct page *p) {
+  int nacc = p->nvcpu + !!p->nother, nwriter = 0;
+  int overlap = 0;
+  u64 blocks = 0;
+
+  for(int i = 0; i < p->nvcpu; i++) {
+    if(p->v[i].nwrite) {
+      nwriter++;
+      overlap |= !!(blocks & p->v[i].wblocks) ||
+                 p->v[i].nwrite <= (u64)__builtin_popcountll(p->v[i].wblocks);
+      blocks |= p->v[i].wblocks;
+    }
+  }
+
+  if(nacc <= 1 && p->nserve)
+    nacc++;
+  if(nwriter == 0 && (p->ninv || p->nown_out)) {
+    nacc++;
+    nwriter++;
+  }
+
+  if(nacc <= 1)
+    return PC_PRIVATE;
+  if(nwriter == 0)
+    return PC_READ_SHARED;
+  if(nwriter == 1)
+    return PC_PROD_CONS;
+  if(!overlap)
+    return PC_FALSE_SHARED;
+
+  return PC_MIGRATORY;
+}
+
+static u64 heat(struct page *p) {
+  return p->nread + p->nwrite + p->ninv + p->nown_in + p->nown_out + p->nserve;
+}
+
+static int heat_cmp(const void *a, const void *b) {
+  u64 x = heat((struct page *)a), y = heat((struct page *)b);
+
+  if(x < y)
+    return 1;
+  if(x > y)
+    return -1;
+  return 0;
+}
+
+/* distinct symbols of the written blocks, or of the page */
+static void print_syms(u64 ipa, u64 wblocks) {
+  const char *seen[SYM_PER_PAGE];
+  int n = 0;
+
+  if(!wblocks)
+    wblocks = 1;
+
+  for(int b = 0; b < 64; b++) {
+    const char *s;
+    int i;
+
+    if(!(wblocks & (1ull << b)) || !(s = symbolize(ipa + b * 64)))
+      continue;
+
+    for(i = 0; i < n && seen[i] != s; i++)
+      ;
+    if(i < n)
+      continue;
+
+    if(n == SYM_PER_PAGE) {
+      printf(" ...");
+      break;
+    }
+
+    seen[n++] = s;
+    printf(" %s", s);
+  }
+}
+
+static void report(int top) {
+  u64 total = 0, cheat[NR_PAGE_CLASS] = {0};
+  int cpages[NR_PAGE_CLASS] = {0};
+
+  for(int i = 0; i < npages; i++) {
+    pages[i].class = classify(&pages[i]);
+    total += heat(&pages[i]);
+    cheat[pages[i].class] += heat(&pages[i]);
+    cpages[pages[i].class]++;
+  }
+
+  qsort(pages, npages, sizeof(*pages), heat_cmp);
+
+  printf("# %d pages, %llu faults and protocol events\n", npages, (unsigned long long)total);
+  printf("\n# %-12s %6s %8s %8s %6s %6s %6s %9s  %-17s %s\n", "ipa", "heat%", "rfault",
+         "wfault", "inv", "own", "serve", "sent(KB)", "class", nsyms ? "symbols" : "");
+
+  for(int i = 0; i < npages && i < top; i++) {
+    struct page *p = &pages[i];
+
+    printf("  %-12llx %6.2f %8llu %8llu %6llu %6llu %6llu %9llu  %-17s",
+           (unsigned long long)p->ipa, total ? 100.0 * heat(p) / total : 0.0,
+           (unsigned long long)p->nread, (unsigned long long)p->nwrite,
+           (unsigned long long)p->ninv, (unsigned long long)p->nown_in,
+           (unsigned long long)p->nserve, (unsigned long long)p->sent >> 10,
+           classname[p->class]);
+    if(nsyms)
+      print_syms(p->ipa, 0);
+    printf("\n");
+
+    if(p->class == PC_PRIVATE)
+      continue;
+
+    /* what to pad or relocate: who touches which blocks */
+    for(int j = 0; j < p->nvcpu; j++) {
+      struct pvcpu *v = &p->v[j];
+
+      printf("      vcpu%-3d r %-6llu w %-6llu blocks %016llx", v->vcpuid,
+             (unsigned long long)v->nread, (unsigned long long)v->nwrite,
+             (unsigned long long)v->wblocks);
+      if(nsyms && v->wblocks)
+        print_syms(p->ipa, v->wblocks);
+      printf("\n");
+    }
+  }
+
+  printf("\n# class              pages   heat%%\n");
+
+  for(int c = 0; c < NR_PAGE_CLASS; c++)
+    printf("  %-17s %7d %7.2f\n", classname[c], cpages[c],
+           total ? 100.0 * cheat[c] / total : 0.0);
+}
+
+int main(int argc, char **argv) {
+  int top = 30;
+  int i, ndump = 0;
+
+  for(i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if(!strcmp(argv[i], "-n"))
+      top = atoi(argv[i + 1]);
+    else if(!strcmp(argv[i], "-g"))
+      load_map(argv[i + 1]);
+    else if(!strcmp(argv[i], "-k"))
+      kbase = strtoull(argv[i + 1], NULL, 0);
+    else
+      break;
+  }
+
+  if(i == argc) {
+    fprintf(stderr, "usage: %s [-n top] [-g System.map [-k ipa]] node.log ...\n", argv[0]);
+    return 1;
+  }
+
+  for(; i < argc; i++)
+    parse(argv[i]);
+
+  for(int n = 0; n < NODE_MAX; n++)
+    ndump += !!dumps[n];
+
+  if(!ndump) {
+    fprintf(stderr, "no pageprof dumps\n");
+    return 1;
+  }
+
+  merge();
+  printf("# %d nodes\n", ndump);
+  report(top);
+
+  return 0;
+}
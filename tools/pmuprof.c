@@ -0,0 +1,315 @@
+/*
+ *  pmuprof: symbolize an el2 pmu profile dump
+ *
+ *    $ pmuprof [-g System.map] poc-main.map node0.log
+ *
+ *  the log is a console output containing "pmuprof: begin" ... "end"
+ *  (hvc #3).  the map is "nm -n" of the image that produced it (the build
+ *  writes poc-*.map next to each image); with -g the guest pcs are
+ *  symbolized with the System.map of the guest kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+/* keep in sync with include/pmuprof.h */
+#define PMUPROF_EXIT_IRQ    0x40
+#define PMUPROF_EXIT_NONE   0x41
+#define NR_PMUPROF_EXIT     0x42
+
+#define TOP_MAX     30
+
+static const char *exitname[NR_PMUPROF_EXIT] = {
+  [0x00] =  "unknown",
+  [0x01] =  "wfx",
+  [0x07] =  "fp",
+  [0x16] =  "hvc",
+  [0x17] =  "smc",
+  [0x18] =  "sysreg",
+  [0x20] =  "iabort",
+  [0x24] =  "dabort",
+  [PMUPROF_EXIT_IRQ] =  "irq",
+  [PMUPROF_EXIT_NONE] = "none",
+};
+
+struct sym {
+  u64 addr;
+  char name[64];
+};
+
+struct symtab {
+  struct sym *s;
+  int n, cap;
+};
+
+struct sample {
+  u64 pc;
+  u64 callsite;
+  u64 guest_pc;
+  int exit;
+};
+
+struct count {
+  const char *name;
+  const char *caller;
+  u64 n;
+};
+
+static struct symtab vmm, guest;
+
+static struct sample *samples;
+static int nsamples, samplecap;
+
+static u64 nexit[NR_PMUPROF_EXIT], nsample_exit[NR_PMUPROF_EXIT];
+static u64 period;
+
+static void *grow(void *p, int *cap, size_t size) {
+  *cap = *cap ? *cap * 2 : 4096;
+  p = realloc(p, size * *cap);
+  if(!p) {
+    perror("realloc");
+    exit(1);
+  }
+
+  return p;
+}
+
+/* "nm -n" output: text symbols only */
+static void load_map(struct symtab *t, const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while(fgets(line, sizeof(line), f)) {
+    unsigned long long addr;
+    char type;
+    char name[64];
+
+    if(sscanf(line, "%llx %c %63s", &addr, &type, name) != 3)
+      continue;
+    if(type != 't' && type != 'T')
+      continue;
+
+    if(t->n == t->cap)
+      t->s = grow(t->s, &t->cap, sizeof(*t->s));
+
+    t->s[t->n].addr = addr;
+    strcpy(t->s[t->n].name, name);
+    t->n++;
+  }
+
+  fclose(f);
+}
+
+static const char *symbolize(struct symtab *t, u64 addr) {
+  int lo = 0, hi = t->n - 1;
+
+  if(!t->n || addr < t->s[0].addr)
+    return NULL;
+
+  while(lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+
+    if(t->s[mid].addr <= addr)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return t->s[lo].name;
+}
+
+static void parse(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+  int in = 0;
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while(fgets(line, sizeof(line), f)) {
+    char *p;
+    unsigned long long pc, callsite, guest_pc, ne, ns, per;
+    int node, ncpu, cpu, exit, vcpuid;
+    unsigned int seq;
+
+    if((p = strstr(line, "pmuprof: begin node")) != NULL) {
+      if(sscanf(p, "pmuprof: begin node %d ncpu %d period %llu", &node, &ncpu, &per) == 3) {
+        period = per;
+        in = 1;
+      }
+      continue;
+    }
+
+    if(strstr(line, "pmuprof: end")) {
+      in = 0;
+      continue;
+    }
+
+    if(!in)
+      continue;
+
+    if((p = strstr(line, "ps ")) != NULL &&
+       sscanf(p, "ps %d %u %llx %llx %llx %d %d", &cpu, &seq, &pc, &callsite,
+              &guest_pc, &exit, &vcpuid) == 7) {
+      if(exit < 0 || exit >= NR_PMUPROF_EXIT)
+        continue;
+
+      if(nsamples == samplecap)
+        samples = grow(samples, &samplecap, sizeof(*samples));
+
+      samples[nsamples++] = (struct sample){ pc, callsite, guest_pc, exit };
+      continue;
+    }
+
+    if((p = strstr(line, "pe ")) != NULL &&
+       sscanf(p, "pe %d %d %llx %llx", &cpu, &exit, &ne, &ns) == 4) {
+      if(exit < 0 || exit >= NR_PMUPROF_EXIT)
+        continue;
+
+      nexit[exit] += ne;
+      nsample_exit[exit] += ns;
+    }
+  }
+
+  fclose(f);
+}
+
+/* linear: a profile has a few hundred distinct functions at most */
+static void count(struct count **c, int *n, int *cap, const char *name, const char *caller) {
+  for(int i = 0; i < *n; i++) {
+    if(!strcmp((*c)[i].name, name) && (*c)[i].caller == caller) {
+      (*c)[i].n++;
+      return;
+    }
+  }
+
+  if(*n == *cap)
+    *c = grow(*c, cap, sizeof(**c));
+
+  (*c)[(*n)++] = (struct count){ strdup(name), caller, 1 };
+}
+
+static int count_cmp(const void *a, const void *b) {
+  const struct count *x = a, *y = b;
+
+  if(x->n < y->n)
+    return 1;
+  if(x->n > y->n)
+    return -1;
+  return 0;
+}
+
+static void print_top(const char *title, struct count *c, int n, u64 total) {
+  qsort(c, n, sizeof(*c), count_cmp);
+
+  printf("\n# %s\n", title);
+
+  for(int i = 0; i < n && i < TOP_MAX; i++) {
+    printf("  %6.2f%% %8llu  %s", 100.0 * c[i].n / total,
+           (unsigned long long)c[i].n, c[i].name);
+    if(c[i].caller)
+      printf("  <- %s", c[i].caller);
+    printf("\n");
+  }
+}
+
+static void report() {
+  struct count *fn = NULL, *site = NULL, *gfn = NULL;
+  int nfn = 0, fncap = 0, nsite = 0, sitecap = 0, ngfn = 0, gfncap = 0;
+  u64 nel2 = 0;
+
+  for(int i = 0; i < nsamples; i++) {
+    struct sample *s = &samples[i];
+    const char *name, *caller;
+
+    if(s->pc == 0) {
+      char buf[24];
+
+      name = guest.n ? symbolize(&guest, s->guest_pc) : NULL;
+      if(!name) {
+        snprintf(buf, sizeof(buf), "%#llx", (unsigned long long)s->guest_pc);
+        name = buf;
+      }
+      count(&gfn, &ngfn, &gfncap, name, NULL);
+      continue;
+    }
+
+    nel2++;
+
+    name = symbolize(&vmm, s->pc);
+    caller = s->callsite ? symbolize(&vmm, s->callsite) : NULL;
+
+    count(&fn, &nfn, &fncap, name ? name : "?", NULL);
+    count(&site, &nsite, &sitecap, name ? name : "?", caller ? caller : "?");
+  }
+
+  printf("# %d samples, period %llu cycles: %llu el2, %llu guest\n", nsamples,
+         (unsigned long long)period, (unsigned long long)nel2,
+         (unsigned long long)(nsamples - nel2));
+
+  if(nel2) {
+    print_top("el2 functions", fn, nfn, nel2);
+    print_top("el2 call sites", site, nsite, nel2);
+  }
+
+  if(nsamples - nel2)
+    print_top(guest.n ? "guest functions" : "guest pcs", gfn, ngfn, nsamples - nel2);
+
+  printf("\n# exits      count   el2 samples\n");
+
+  for(int e = 0; e < NR_PMUPROF_EXIT; e++) {
+    char buf[16];
+
+    if(!nexit[e] && !nsample_exit[e])
+      continue;
+
+    if(!exitname[e])
+      snprintf(buf, sizeof(buf), "ec%#x", e);
+
+    printf("  %-8s %9llu %9llu %6.2f%%\n", exitname[e] ? exitname[e] : buf,
+           (unsigned long long)nexit[e], (unsigned long long)nsample_exit[e],
+           nel2 ? 100.0 * nsample_exit[e] / nel2 : 0.0);
+  }
+
+  free(fn);
+  free(site);
+  free(gfn);
+}
+
+int main(int argc, char **argv) {
+  int i = 1;
+
+  if(argc > 2 && !strcmp(argv[1], "-g")) {
+    load_map(&guest, argv[2]);
+    i += 2;
+  }
+
+  if(argc - i != 2) {
+    fprintf(stderr, "usage: %s [-g System.map] poc-main.map node.log\n", argv[0]);
+    return 1;
+  }
+
+  load_map(&vmm, argv[i]);
+  parse(argv[i + 1]);
+
+  if(!nsamples) {
+    fprintf(stderr, "no pmuprof samples\n");
+    return 1;
+  }
+
+  report();
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ *  vsmsim: host replacement of include/aarch64.h
+ *
+ *  system registers are fields of sim_sysreg (one node per process),
+ *  counters run on CLOCK_MONOTONIC in ns.  barriers are compiler barriers.
+ */
+
+#ifndef CORE_AARCH64_H
+#define CORE_AARCH64_H
+
+#include "types.h"
+#include "compiler.h"
+
+#define HPFAR_FIPA_MASK   0xffffffffffful
+
+#define MPIDR_AFFINITY_LEVEL0(m)    ((m) & 0xff)
+#define MPIDR_AFFINITY_LEVEL1(m)    (((m) >> 8) & 0xff)
+#define MPIDR_AFFINITY_LEVEL2(m)    (((m) >> 16) & 0xff)
+#define MPIDR_AFFINITY_LEVEL3(m)    (((m) >> 32) & 0xff)
+
+#define PSR_EL1H      (5)
+
+#define SPSR_EL(spsr) (((spsr) & 0xf) >> 2)
+
+#define __cacheline_aligned   __aligned(64)
+
+#define SIM_CNTFRQ    1000000000ul
+
+struct sim_sysregs {
+  u64 tpidr_el2;
+  u64 mpidr_el1;
+  u64 daif;
+  u64 elr_el2;
+  u64 hpfar_el2;
+  u64 par_el1;
+  u64 mair_el1;
+  u64 mair_el2;
+  u64 id_aa64isar0_el1;
+  u64 id_aa64mmfr0_el1;
+};
+
+extern struct sim_sysregs sim_sysreg;
+
+u64 sim_cntpct(void);
+
+#define sim_read_cntpct_el0()   sim_cntpct()
+#define sim_read_cntvct_el0()   sim_cntpct()
+#define sim_read_cntfrq_el0()   SIM_CNTFRQ
+
+#define read_sysreg(reg)        __sim_read_sysreg_##reg
+#define write_sysreg(reg, val)  (sim_sysreg.reg = (u64)(val))
+
+#define __sim_read_sysreg_cntpct_el0      sim_read_cntpct_el0()
+#define __sim_read_sysreg_cntvct_el0      sim_read_cntvct_el0()
+#define __sim_read_sysreg_cntfrq_el0      sim_read_cntfrq_el0()
+#define __sim_read_sysreg_tpidr_el2       sim_sysreg.tpidr_el2
+#define __sim_read_sysreg_mpidr_el1       sim_sysreg.mpidr_el1
+#define __sim_read_sysreg_daif            sim_sysreg.daif
+#define __sim_read_sysreg_elr_el2         sim_sysreg.elr_el2
+#define __sim_read_sysreg_hpfar_el2       sim_sysreg.hpfar_el2
+#define __sim_read_sysreg_par_el1         sim_sysreg.par_el1
+#define __sim_read_sysreg_mair_el1        sim_sysreg.mair_el1
+#define __sim_read_sysreg_mair_el2        sim_sysreg.mair_el2
+#define __sim_read_sysreg_id_aa64isar0_el1  sim_sysreg.id_aa64isar0_el1
+#define __sim_read_sysreg_id_aa64mmfr0_el1  sim_sysreg.id_aa64mmfr0_el1
+
+#define barrier()     asm volatile("" ::: "memory")
+
+#define intr_enable()         (sim_sysreg.daif &= ~0x3c0ul)
+#define intr_disable()        (sim_sysreg.daif |= 0x3c0ul)
+
+#define local_irq_enable()    (sim_sysreg.daif &= ~0x80ul)
+#define local_irq_disable()   (sim_sysreg.daif |= 0x80ul)
+
+#define isb()     barrier();
+#define dsb(ty)   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+/* a node waits for msgs from the fabric */
+void sim_idle(void);
+
+#define wfi()     sim_idle();
+#define wfe()     barrier();
+
+#define sev()     barrier();
+#define sevl()    barrier();
+
+static inline int cpuid() {
+  return sim_sysreg.mpidr_el1 & 0xf;
+}
+
+/* no stage 1 in the simulator: translation fails */
+#define do_at_trans(ipa, stage, el, rw)   \
+  do { (void)(ipa); sim_sysreg.par_el1 = 1; } while(0)
+
+static inline bool local_irq_enabled() {
+  return !((read_sysreg(daif) >> 7) & 0x1);
+}
+
+static inline bool local_irq_disabled() {
+  return (read_sysreg(daif) >> 7) & 0x1;
+}
+
+static inline u64 __irqsave() {
+  u64 flags = read_sysreg(daif);
+
+  local_irq_disable();
+
+  return flags;
+}
+
+static inline void __irqrestore(u64 flags) {
+  write_sysreg(daif, flags);
+}
+
+#define irqsave(flags)      do { flags = __irqsave(); } while(0)
+#define irqrestore(flags)   __irqrestore(flags)
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ *  vsmsim: host replacement of include/atomic.h
+ */
+
+#ifndef CORE_ATOMIC_H
+#define CORE_ATOMIC_H
+
+#include "types.h"
+
+static inline void atomic_or64(u64 *p, u64 val) {
+  __atomic_fetch_or(p, val, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_andnot64(u64 *p, u64 val) {
+  __atomic_fetch_and(p, ~val, __ATOMIC_SEQ_CST);
+}
+
+static inline u64 atomic_xchg64(u64 *p, u64 val) {
+  return __atomic_exchange_n(p, val, __ATOMIC_SEQ_CST);
+}
+
+/* store new if *p == old; return the value of *p before */
+static inline u64 atomic_cmpxchg64(u64 *p, u64 old, u64 new) {
+  __atomic_compare_exchange_n(p, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+  return old;
+}
+
+static inline u64 load_acquire64(u64 *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release64(u64 *p, u64 val) {
+  __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+static inline void atomic_set_bit(int nr, u64 *bitmap) {
+  atomic_or64(&bitmap[nr / 64], 1ul << (nr % 64));
+}
+
+static inline void atomic_clear_bit(int nr, u64 *bitmap) {
+  atomic_andnot64(&bitmap[nr / 64], 1ul << (nr % 64));
+}
+
+/* a node is single threaded: a lock held here is never released */
+void sim_deadlock(void *lock) __noreturn;
+
+static inline u8 atomic_trylock8(u8 *p, u8 val) {
+  u8 old = 0;
+
+  if(__atomic_compare_exchange_n(p, &old, val, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 0;
+
+  return old;
+}
+
+static inline void atomic_lock8(u8 *p, u8 val) {
+  if(atomic_trylock8(p, val))
+    sim_deadlock(p);
+}
+
+static inline u16 atomic_lock16_mask(u16 *p, u16 busy, u16 val) {
+  u16 old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+  if(old & busy)
+    sim_deadlock(p);
+
+  __atomic_store_n(p, val, __ATOMIC_RELEASE);
+
+  return old;
+}
+
+static inline void atomic_lock16(u16 *p, u16 val) {
+  atomic_lock16_mask(p, 0xffff, val);
+}
+
+static inline void atomic_release8(u8 *p) {
+  __atomic_store_n(p, 0, __ATOMIC_RELEASE);
+}
+
+static inline void atomic_release16(u16 *p) {
+  __atomic_store_n(p, 0, __ATOMIC_RELEASE);
+}
+
+#endif  /* CORE_ATOMIC_H */
@@ -0,0 +1,30 @@
+/*
+ *  vsmsim: host replacement of include/cache.h (coherent host memory)
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "types.h"
+#include "aarch64.h"
+
+static inline void dcache_flush_poc(void *va_start, void *va_end) {
+  (void)va_start; (void)va_end;
+}
+
+static inline void cache_sync_pou(void *va_start, void *va_end) {
+  (void)va_start; (void)va_end;
+}
+
+static inline void dcache_flush_poc_range(void *va, u64 size) {
+  (void)va; (void)size;
+}
+
+static inline void cache_sync_pou_range(void *va, u64 size) {
+  (void)va; (void)size;
+}
+
+static inline void icache_flush_all_pou() {
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *  vsmsim: host replacement of include/spinlock.h
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "aarch64.h"
+#include "atomic.h"
+#include "types.h"
+#include "log.h"
+#include "panic.h"
+
+typedef u8 spinlock_t;
+
+static inline void __spinlock_init(spinlock_t *lk) {
+  *lk = 0;
+}
+
+#define spinlock_init(lk) __spinlock_init(lk)
+#define SPINLOCK_INIT     0
+
+#define spin_lock_irqsave(lk, flags)  \
+  do {    \
+    flags = __spin_lock_irqsave(lk);    \
+  } while(0)
+
+#define spin_unlock_irqrestore(lk, flags)   \
+  do {    \
+    __spin_unlock_irqrestore(lk, flags);    \
+  } while(0)
+
+static inline void spin_lock(spinlock_t *lk) {
+  atomic_lock8(lk, 1);
+}
+
+static inline u64 __spin_lock_irqsave(spinlock_t *lk) {
+  u64 flags = read_sysreg(daif);
+
+  local_irq_disable();
+
+  spin_lock(lk);
+
+  return flags;
+}
+
+static inline void spin_unlock(spinlock_t *lk) {
+  atomic_release8(lk);
+}
+
+static inline void __spin_unlock_irqrestore(spinlock_t *lk, u64 flags) {
+  spin_unlock(lk);
+
+  write_sysreg(daif, flags);
+}
+
+#endif    /* SPINLOCK_H */
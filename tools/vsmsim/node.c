@@ -0,0 +1,376 @@
+/*
+ *  vsmsim: one pocv2 node
+ *
+ *  linked with core/vsm.c, msg.c, s2mm.c, mm.c, vsm-log.c and fault-lat.c
+ *  into node<n>.o; all its symbols except sim_node_ops<n> are local,
+ *  so each node has its own localnode, stage 2 table and vsm state.
+ *  the node has one pcpu running nvcpu vcpus, a nic sends to the fabric.
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "node.h"
+#include "vcpu.h"
+#include "msg.h"
+#include "net.h"
+#include "mm.h"
+#include "s2mm.h"
+#include "vsm.h"
+#include "vsm-log.h"
+#include "fault-lat.h"
+#include "page-prof.h"
+#include "arch-timer.h"
+#include "allocpage.h"
+#include "malloc.h"
+#include "memlayout.h"
+#include "printf.h"
+#include "panic.h"
+#include "sched.h"
+#include "lib.h"
+#include "sim.h"
+
+struct sim_sysregs sim_sysreg;
+
+struct localnode localnode;
+struct pcpu pcpus[NCPU_MAX];
+int nr_online_pcpus;
+
+struct cluster_node cluster[NODE_MAX];
+int nr_cluster_nodes;
+int nr_cluster_vcpus;
+
+u64 node_online_map;
+u64 node_active_map;
+
+u8 bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static struct nic simnic = {
+  .name = "vsmsim",
+  .mtu = 9000,
+};
+
+static const char *sim_msg_name[NUM_MSG] = {
+  [MSG_FETCH]           "fetch",
+  [MSG_FETCH_REPLY]     "fetch_reply",
+  [MSG_INVALIDATE]      "invalidate",
+};
+
+int vprintf(const char *fmt, va_list ap) {
+  sim_vlog(local_nodeid(), fmt, ap);
+
+  return 0;
+}
+
+int printf(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  sim_vlog(local_nodeid(), fmt, ap);
+  va_end(ap);
+
+  return 0;
+}
+
+/* logged as is, the simulator filters by its verbosity */
+int log_cat_level[NR_LOG_CAT] = {
+  [0 ... NR_LOG_CAT - 1] = LLOG,
+};
+
+int log_cat_vprintf(int __unused cat, int __unused level, const char *fmt, va_list ap) {
+  sim_vlog(local_nodeid(), fmt, ap);
+
+  return 0;
+}
+
+int log_cat_printf(int __unused cat, const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  sim_vlog(local_nodeid(), fmt, ap);
+  va_end(ap);
+
+  return 0;
+}
+
+void panic(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  sim_vpanic(local_nodeid(), fmt, ap);
+}
+
+void sim_deadlock(void *lock) {
+  panic("lock %p is held: deadlock", lock);
+}
+
+void sim_idle() {
+  panic("wfi");
+}
+
+void bin_dump(void *p, u64 size) {
+  u8 *b = p;
+
+  for(u64 i = 0; i < size; i++)
+    printf("%c%x", i % 16 ? ' ' : '\n', (u64)b[i]);
+
+  printf("\n");
+}
+
+u64 usecs_to_ticks(u64 us) {
+  return SIM_CNTFRQ * us / 1000000;
+}
+
+void *alloc_pages(int order) {
+  return sim_alloc_pages(order);
+}
+
+void free_pages(void *pages, int order) {
+  sim_free_pages(pages, order);
+}
+
+void *malloc(u32 size) {
+  return sim_malloc(size);
+}
+
+void free(void *p) {
+  sim_free(p);
+}
+
+struct iobuf *alloc_iobuf_headsize(u32 size, u32 headsize) {
+  struct iobuf *buf = malloc(sizeof(*buf));
+
+  buf->head = malloc(size);
+  buf->data = (u8 *)buf->head + headsize;
+  buf->tail = (u8 *)buf->head + size;
+  buf->len = size - headsize;
+  buf->eth = NULL;
+  buf->body = NULL;
+  buf->body_len = 0;
+  buf->npages = 0;
+
+  return buf;
+}
+
+void free_iobuf(struct iobuf *buf) {
+  if(buf->body)
+    free_page(buf->body);
+
+  free(buf->head);
+  free(buf);
+}
+
+void ether_send_packet(struct nic *nic, u8 *dst_mac, u16 type, struct iobuf *buf) {
+  int dst = -1;
+
+  if(memcmp(dst_mac, bcast_mac, 6) != 0) {
+    struct cluster_node *node = macaddr_to_node(dst_mac);
+    if(!node)
+      panic("no node %m", dst_mac);
+
+    dst = node->nodeid;
+  }
+
+  sim_send(local_nodeid(), dst, type >> 8, buf->data, buf->len, buf->body, buf->body_len);
+
+  free_iobuf(buf);
+}
+
+/* the only pcpu of the node runs all vcpus */
+void cpu_send_do_recvq_sgi(struct pcpu *cpu) {
+  panic("sgi to cpu%d", pcpu_id(cpu));
+}
+
+bool sched_multiplexed() {
+  return localvm.nvcpu > 1;
+}
+
+/* vcpu context is kept across the switch to the simulator */
+void sched_wait() {
+  struct vcpu *vcpu = current;
+  u64 daif = read_sysreg(daif);
+
+  sim_wait(local_nodeid(), vcpu_slot(vcpu));
+
+  set_current_vcpu(vcpu);
+  write_sysreg(daif, daif);
+}
+
+void sched_yield() {
+  struct vcpu *vcpu = current;
+  u64 daif = read_sysreg(daif);
+
+  sim_yield(local_nodeid(), vcpu_slot(vcpu));
+
+  set_current_vcpu(vcpu);
+  write_sysreg(daif, daif);
+}
+
+void sched_wakeup(struct vcpu *vcpu) {
+  sim_wakeup(local_nodeid(), vcpu_slot(vcpu));
+}
+
+/* no guest: no wfe to wake up, no vcpu migration */
+void vcpu_wfe_wake(u64 __unused page_ipa) {
+  ;
+}
+
+void vcpu_migrate_account(struct vcpu * __unused vcpu, int __unused nodeid) {
+  ;
+}
+
+static void node_init(int nodeid, int nnodes, int nvcpu, u64 mem_per_node) {
+  sim_sysreg.mpidr_el1 = 0;
+  sim_sysreg.id_aa64mmfr0_el1 = 5;    /* 48 bit */
+
+  nr_cluster_nodes = nnodes;
+  nr_cluster_vcpus = nnodes * nvcpu;
+
+  for(int n = 0; n < nnodes; n++) {
+    struct cluster_node *c = &cluster[n];
+
+    c->nodeid = n;
+    c->mac[0] = 0x02;
+    c->mac[5] = n;
+    c->mem.start = GVM_RAM_BASE + n * mem_per_node;
+    c->mem.size = mem_per_node;
+    c->nvcpu = nvcpu;
+
+    for(int i = 0; i < nvcpu; i++)
+      c->vcpus[i] = n * nvcpu + i;
+
+    node_set_online(n, true);
+    node_set_active(n, true);
+  }
+
+  localnode.nodeid = nodeid;
+  localnode.node = &cluster[nodeid];
+  localnode.nic = &simnic;
+  localnode.acked = true;
+  memcpy(simnic.mac, cluster[nodeid].mac, 6);
+
+  nr_online_pcpus = 1;
+  pcpus[0].online = true;
+  pcpus[0].wakeup = true;
+  msg_queue_init(&pcpus[0].recv_waitq);
+
+  localvm.nvcpu = nvcpu;
+  for(int i = 0; i < nvcpu; i++) {
+    struct vcpu *vcpu = &localvm.vcpus[i];
+
+    vcpu->vcpuid = nodeid * nvcpu + i;
+    vcpu->pcpu = &pcpus[0];
+    vcpu->initialized = true;
+    vcpu->online = true;
+  }
+
+  set_current_vcpu(&localvm.vcpus[0]);
+
+  s2mmu_init();
+  msg_sysinit();
+  vsm_node_init(&localnode.node->mem);
+}
+
+static void node_recv(void *hdr, u32 len, void *body, u32 body_len) {
+  struct iobuf *buf = alloc_iobuf_headsize(len, 0);
+  u64 flags;
+
+  memcpy(buf->data, hdr, len);
+
+  /* msg_recv() copies the body: lend it the packet's */
+  buf->body = body;
+  buf->body_len = body_len;
+
+  irqsave(flags);
+
+  msg_recv(NULL, buf);
+  buf->body = NULL;
+  buf->body_len = 0;
+
+  do_recv_waitqueue();
+
+  irqrestore(flags);
+}
+
+/* a stage 2 permission fault: dabort handler without a guest */
+static enum sim_access_result node_access(u64 ipa, bool wr, u64 *ns) {
+  u64 page_ipa = PAGE_ADDRESS(ipa);
+  struct vcpu *vcpu = current;
+  u64 start;
+  bool remote;
+  void *p;
+
+  if(wr ? s2_rwable_pte(page_ipa) : s2_readable_pte(page_ipa))
+    return SIM_HIT;
+
+  start = now_cycles();
+  fault_lat_trap(vcpu);
+
+  if(wr)
+    p = vsm_write_fetch_page(page_ipa);
+  else
+    p = vsm_read_fetch_page(page_ipa);
+
+  if(!p)
+    return SIM_BAD_ADDRESS;
+
+  *ns = now_cycles() - start;
+  remote = vcpu->flat.remote;
+
+  page_prof_fault(vcpu, ipa, wr);
+
+  fault_lat_resume(vcpu);
+
+  return remote ? SIM_REMOTE_FAULT : SIM_LOCAL_FAULT;
+}
+
+static void node_vcpu_entry(int slot) {
+  u64 ipa, ns;
+  int wr;
+
+  while(sim_next_access(local_nodeid(), slot, &ipa, &wr)) {
+    enum sim_access_result r;
+
+    /* other vcpus of this node ran in the think time */
+    set_current_vcpu(&localvm.vcpus[slot]);
+    local_irq_enable();
+
+    ns = 0;
+    r = node_access(ipa, wr, &ns);
+
+    sim_access_done(local_nodeid(), slot, wr, r, ns);
+  }
+}
+
+static void node_dump(enum sim_dump what) {
+  switch(what) {
+    case SIM_DUMP_TLB:
+      tlb_s2_stats_dump();
+      break;
+    case SIM_DUMP_FAULT_LAT:
+      fault_lat_dump();
+      break;
+    case SIM_DUMP_TRACE:
+      vsm_trace_dump(0);
+      break;
+    case SIM_DUMP_PAGE:
+      page_prof_dump();
+      break;
+  }
+}
+
+static const char *node_msg_name(int type) {
+  if(type < 0 || type >= NUM_MSG)
+    return NULL;
+
+  return sim_msg_name[type];
+}
+
+struct sim_node_ops sim_node_ops = {
+  .init = node_init,
+  .recv = node_recv,
+  .vcpu_entry = node_vcpu_entry,
+  .dump = node_dump,
+  .msg_name = node_msg_name,
+};
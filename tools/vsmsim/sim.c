@@ -0,0 +1,977 @@
+/*
+ *  vsmsim: host-side multi-node vsm protocol simulator
+ *
+ *    $ vsmsim [-N nodes] [-c vcpus] [-w workload] [-n accesses] ...
+ *
+ *  core/vsm.c, msg.c and the stage 2 helpers run unmodified against a
+ *  user space shim (node.c, include/).  every node is a separate copy
+ *  of that code, every vcpu a coroutine which replays synthetic or
+ *  recorded accesses.  a miss on the stage 2 table of its node is a
+ *  fault handled by vsm_{read,write}_fetch_page().
+ *
+ *  time is virtual (ns, also cntpct_el0 of all nodes).  the fabric
+ *  delivers a packet after its serialization on the link (FIFO per
+ *  node pair) plus the one-way latency; a node handles one packet at
+ *  a time and is busy for msg_ns after each.  the protocol code itself
+ *  takes no virtual time.
+ *
+ *  policy is a build-time variant: make POLICY=name POLICY_CFLAGS=-D...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <ucontext.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+#include "sim.h"
+
+#ifndef SIM_POLICY
+#define SIM_POLICY    "default"
+#endif
+
+#define PAGESIZE          4096ul
+#define RAM_BASE          0x40000000ul    /* GVM_RAM_BASE */
+#define VCPU_STACK_SIZE   (256 * 1024)
+#define ARENA_SIZE        (64ul << 30)
+#define ORDER_MAX         8
+/* a vcpu switch: a yielding vcpu runs again after this */
+#define YIELD_NS          500
+
+enum workload {
+  WL_PRIVATE,
+  WL_SHARED,
+  WL_HOTSPOT,
+  WL_MIGRATORY,
+  WL_PRODCONS,
+  WL_TRACE,
+  NR_WORKLOAD,
+};
+
+static const char *wlname[NR_WORKLOAD] = {
+  [WL_PRIVATE] =    "private",
+  [WL_SHARED] =     "shared",
+  [WL_HOTSPOT] =    "hotspot",
+  [WL_MIGRATORY] =  "migratory",
+  [WL_PRODCONS] =   "prodcons",
+  [WL_TRACE] =      "trace",
+};
+
+struct access {
+  u64 ipa;
+  int wr;
+};
+
+enum vstate {
+  V_READY,
+  V_RUNNING,
+  V_BLOCKED,
+  V_DONE,
+};
+
+struct simvcpu {
+  int node;
+  int slot;
+  int gid;
+  enum vstate state;
+  int pending_wakeup;
+  int started;
+  ucontext_t ctx;         /* first entry only */
+  jmp_buf jb;
+  void *stack;
+
+  /* workload */
+  u64 rng;
+  u64 n;
+  struct access last;
+  struct access *trace;
+  u64 ntrace;
+  u64 trace_cap;
+};
+
+enum evtype {
+  EV_RUN,       /* vcpu runs */
+  EV_MSG,       /* packet arrives at its node */
+  EV_RX,        /* node is done with a packet */
+};
+
+struct packet {
+  struct packet *next;
+  int src;
+  int dst;
+  u32 len;
+  u32 body_len;
+  unsigned char data[];   /* hdr, then body */
+};
+
+struct event {
+  u64 t;
+  u64 seq;
+  enum evtype type;
+  struct simvcpu *vcpu;    /* EV_RUN */
+  struct packet *pkt;       /* EV_MSG */
+  int node;                 /* EV_RX */
+};
+
+struct msgstat {
+  u64 n;
+  u64 bytes;
+};
+
+struct latvec {
+  u64 *v;
+  u64 n;
+  u64 cap;
+};
+
+static struct sim_node_ops *node_ops[SIM_NODE_MAX] = {
+  &sim_node_ops0, &sim_node_ops1, &sim_node_ops2, &sim_node_ops3,
+  &sim_node_ops4, &sim_node_ops5, &sim_node_ops6, &sim_node_ops7,
+};
+
+/* parameters */
+static int nnodes = 2;
+static int nvcpu = 1;
+static enum workload workload = WL_SHARED;
+static u64 naccess = 100000;
+static u64 npages = 1024;
+static int write_pct = 30;
+static u64 latency_ns = 10000;
+static u64 bw_mbps = 1000;
+static u64 msg_ns = 2000;
+static u64 think_ns = 100;
+static u64 mem_per_node = 64ul << 20;
+static u64 seed = 1;
+static int verbose;
+static int dump_tlb, dump_lat, dump_trace, dump_page;
+
+/* state */
+static u64 now;
+static u64 evseq;
+static struct event *heap;
+static u64 nheap, heapcap;
+
+static struct simvcpu vcpus[SIM_NODE_MAX][SIM_VCPU_MAX];
+static struct simvcpu *running;
+static jmp_buf sched_jb;
+
+/* packets arrived while the node handles another, in arrival order */
+static struct packet *rxq_head[SIM_NODE_MAX], *rxq_tail[SIM_NODE_MAX];
+static int node_busy[SIM_NODE_MAX];
+static u64 link_free[SIM_NODE_MAX][SIM_NODE_MAX];
+static int dumping;
+
+/* stats */
+static struct msgstat msgstat[SIM_NODE_MAX][SIM_MSG_MAX];
+static u64 nrecv[SIM_NODE_MAX];
+static u64 result[2][SIM_BAD_ADDRESS + 1];
+static struct latvec remote_lat[2];
+static u64 local_lat_sum[2];
+
+/* page arena: P2V/V2P of the nodes need addresses above VIRT_BASE */
+static char *arena, *arena_brk;
+static void *freelist[ORDER_MAX + 1];
+
+void *sim_alloc_pages(int order) {
+  u64 size = PAGESIZE << order;
+  void *p;
+
+  if(order > ORDER_MAX)
+    return NULL;
+
+  if((p = freelist[order]) != NULL) {
+    freelist[order] = *(void **)p;
+  } else {
+    if(arena_brk + size > arena + ARENA_SIZE)
+      return NULL;
+
+    p = arena_brk;
+    arena_brk += size;
+  }
+
+  memset(p, 0, size);
+
+  return p;
+}
+
+void sim_free_pages(void *p, int order) {
+  *(void **)p = freelist[order];
+  freelist[order] = p;
+}
+
+void *sim_malloc(u64 size) {
+  return calloc(1, size);
+}
+
+void sim_free(void *p) {
+  free(p);
+}
+
+u64 sim_cntpct() {
+  return now;
+}
+
+/*
+ *  printf of the hypervisor: %x is u64, %d i32, %u u32, %m mac address.
+ *  "\001<level>" prefixed msgs are vmm_warn()/vmm_log()
+ */
+static void hv_vprintf(FILE *out, const char *fmt, va_list ap) {
+  char spec[16];
+
+  for(; *fmt; fmt++) {
+    int n = 0;
+
+    if(*fmt != '%') {
+      fputc(*fmt, out);
+      continue;
+    }
+
+    spec[n++] = '%';
+    fmt++;
+
+    while((*fmt == '-' || *fmt == '0' || (*fmt >= '1' && *fmt <= '9')) && n < 12)
+      spec[n++] = *fmt++;
+
+    switch(*fmt) {
+      case 'd':
+        spec[n++] = 'd'; spec[n] = 0;
+        fprintf(out, spec, va_arg(ap, int32_t));
+        break;
+      case 'u':
+        spec[n++] = 'u'; spec[n] = 0;
+        fprintf(out, spec, va_arg(ap, uint32_t));
+        break;
+      case 'x':
+        spec[n++] = 'l'; spec[n++] = 'x'; spec[n] = 0;
+        fprintf(out, spec, va_arg(ap, u64));
+        break;
+      case 'p':
+        fprintf(out, "0x%lx", (u64)va_arg(ap, void *));
+        break;
+      case 'c':
+        fputc(va_arg(ap, int), out);
+        break;
+      case 's':
+        spec[n++] = 's'; spec[n] = 0;
+        fprintf(out, spec, va_arg(ap, char *));
+        break;
+      case 'm': {
+        unsigned char *m = va_arg(ap, unsigned char *);
+        fprintf(out, "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+        break;
+      }
+      case '%':
+        fputc('%', out);
+        break;
+      case 0:
+        return;
+      default:
+        fputc(*fmt, out);
+        break;
+    }
+  }
+}
+
+void sim_vlog(int node, const char *fmt, va_list ap) {
+  int level = 0;
+
+  if(*fmt == '\001') {
+    level = fmt[1] - '0';
+    fmt += 2;
+  }
+
+  /* dumps are printed as is, logs only if asked for */
+  if(!dumping) {
+    if(verbose < (level ? level : 3))
+      return;
+
+    printf("[%lu node%d] ", now, node);
+  }
+
+  hv_vprintf(stdout, fmt, ap);
+}
+
+void sim_vpanic(int node, const char *fmt, va_list ap) {
+  fflush(stdout);
+
+  fprintf(stderr, "vsmsim: node%d panic at %lu ns: ", node, now);
+  hv_vprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+
+  exit(1);
+}
+
+static void fatal(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "vsmsim: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+
+  exit(1);
+}
+
+/* event queue: binary heap by (t, seq) */
+static int ev_before(struct event *a, struct event *b) {
+  return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void ev_push(u64 t, enum evtype type, struct simvcpu *v, struct packet *pkt, int node) {
+  struct event e = { .t = t, .seq = evseq++, .type = type, .vcpu = v, .pkt = pkt, .node = node };
+  u64 i;
+
+  if(nheap == heapcap) {
+    heapcap = heapcap ? heapcap * 2 : 1024;
+    heap = realloc(heap, sizeof(*heap) * heapcap);
+    if(!heap)
+      fatal("event queue");
+  }
+
+  for(i = nheap++; i > 0; i = (i - 1) / 2) {
+    struct event *parent = &heap[(i - 1) / 2];
+
+    if(!ev_before(&e, parent))
+      break;
+
+    heap[i] = *parent;
+  }
+
+  heap[i] = e;
+}
+
+static struct event ev_pop() {
+  struct event top = heap[0];
+  struct event last = heap[--nheap];
+  u64 i = 0;
+
+  for(;;) {
+    u64 c = 2 * i + 1;
+
+    if(c >= nheap)
+      break;
+    if(c + 1 < nheap && ev_before(&heap[c + 1], &heap[c]))
+      c++;
+    if(!ev_before(&heap[c], &last))
+      break;
+
+    heap[i] = heap[c];
+    i = c;
+  }
+
+  if(nheap)
+    heap[i] = last;
+
+  return top;
+}
+
+/*
+ *  vcpus: a vcpu starts on its stack with setcontext(), then switches
+ *  with _setjmp/_longjmp.  swapcontext() saves the signal mask, a
+ *  syscall per switch which cost more than the faults themselves.
+ */
+static void vcpu_switch_out(struct simvcpu *v) {
+  if(v != running)
+    fatal("node%d vcpu%d: wait outside of its context", v->node, v->slot);
+
+  running = NULL;
+  if(!_setjmp(v->jb))
+    _longjmp(sched_jb, 1);
+  running = v;
+}
+
+void sim_wait(int node, int slot) {
+  struct simvcpu *v = &vcpus[node][slot];
+
+  if(v->pending_wakeup) {
+    v->pending_wakeup = 0;
+    return;
+  }
+
+  v->state = V_BLOCKED;
+  vcpu_switch_out(v);
+}
+
+void sim_wakeup(int node, int slot) {
+  struct simvcpu *v = &vcpus[node][slot];
+
+  if(v->state == V_BLOCKED) {
+    v->state = V_READY;
+    ev_push(now, EV_RUN, v, NULL, -1);
+  } else {
+    v->pending_wakeup = 1;
+  }
+}
+
+void sim_yield(int node, int slot) {
+  struct simvcpu *v = &vcpus[node][slot];
+
+  v->state = V_READY;
+  ev_push(now + YIELD_NS, EV_RUN, v, NULL, -1);
+  vcpu_switch_out(v);
+}
+
+static void vcpu_trampoline(int node, int slot) {
+  struct simvcpu *v = &vcpus[node][slot];
+
+  node_ops[node]->vcpu_entry(slot);
+
+  v->state = V_DONE;
+  running = NULL;
+  _longjmp(sched_jb, 1);
+}
+
+static void vcpu_resume(struct simvcpu *v) {
+  v->state = V_RUNNING;
+  running = v;
+
+  if(!_setjmp(sched_jb)) {
+    if(v->started)
+      _longjmp(v->jb, 1);
+
+    v->started = 1;
+    setcontext(&v->ctx);
+  }
+
+  running = NULL;
+}
+
+/* fabric */
+void sim_send(int src, int dst, int type, void *hdr, u32 len, void *body, u32 body_len) {
+  u64 wire = 14 + len + body_len;   /* ethernet header + pocv2 msg */
+
+  if(dst < 0) {
+    for(int n = 0; n < nnodes; n++) {
+      if(n != src)
+        sim_send(src, n, type, hdr, len, body, body_len);
+    }
+    return;
+  }
+
+  if(dst >= nnodes || dst == src)
+    fatal("node%d: send to node%d", src, dst);
+
+  struct packet *p = malloc(sizeof(*p) + len + body_len);
+  if(!p)
+    fatal("packet");
+
+  p->next = NULL;
+  p->src = src;
+  p->dst = dst;
+  p->len = len;
+  p->body_len = body_len;
+  memcpy(p->data, hdr, len);
+  if(body)
+    memcpy(p->data + len, body, body_len);
+
+  /* serialized on the link in order, then the wire latency */
+  u64 *lf = &link_free[src][dst];
+
+  if(*lf < now)
+    *lf = now;
+  *lf += wire * 8000 / bw_mbps;
+
+  ev_push(*lf + latency_ns, EV_MSG, NULL, p, -1);
+
+  if(type >= 0 && type < SIM_MSG_MAX) {
+    msgstat[src][type].n++;
+    msgstat[src][type].bytes += wire;
+  }
+}
+
+static void handle(int n, struct packet *p) {
+  node_busy[n] = 1;
+  nrecv[n]++;
+
+  node_ops[n]->recv(p->data, p->len, p->body_len ? p->data + p->len : NULL, p->body_len);
+
+  free(p);
+
+  ev_push(now + msg_ns, EV_RX, NULL, NULL, n);
+}
+
+/* the node handles one packet at a time */
+static void deliver(struct packet *p) {
+  int n = p->dst;
+
+  if(!node_busy[n]) {
+    handle(n, p);
+    return;
+  }
+
+  if(rxq_tail[n])
+    rxq_tail[n]->next = p;
+  else
+    rxq_head[n] = p;
+  rxq_tail[n] = p;
+}
+
+static void rx_done(int n) {
+  struct packet *p = rxq_head[n];
+
+  node_busy[n] = 0;
+
+  if(!p)
+    return;
+
+  if(!(rxq_head[n] = p->next))
+    rxq_tail[n] = NULL;
+
+  handle(n, p);
+}
+
+/* workloads */
+static u64 xorshift(u64 *x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 7;
+  *x ^= *x << 17;
+
+  return *x;
+}
+
+/* page p of the working set: homes interleaved over the nodes */
+static u64 page_ipa(u64 p) {
+  return RAM_BASE + (p % nnodes) * mem_per_node + (p / nnodes) * PAGESIZE;
+}
+
+static int rand_write(struct simvcpu *v) {
+  return (int)(xorshift(&v->rng) % 100) < write_pct;
+}
+
+static void gen_access(struct simvcpu *v, struct access *a) {
+  int nv = nnodes * nvcpu;
+  u64 r = xorshift(&v->rng);
+  u64 p;
+
+  switch(workload) {
+    case WL_PRIVATE: {
+      /* pages managed by the node of the vcpu */
+      u64 share = npages / nv ? npages / nv : 1;
+
+      p = (v->slot * share + r % share) * nnodes + v->node;
+      a->wr = rand_write(v);
+      break;
+    }
+    case WL_SHARED:
+      p = r % npages;
+      a->wr = rand_write(v);
+      break;
+    case WL_HOTSPOT:
+      /* 90% of accesses on 10% of pages */
+      if(r % 10)
+        p = (r >> 8) % (npages / 10 ? npages / 10 : 1);
+      else
+        p = (r >> 8) % npages;
+      a->wr = rand_write(v);
+      break;
+    case WL_MIGRATORY:
+      /* read-modify-write of a page, then the next one */
+      if(v->n % 2) {
+        *a = v->last;
+        a->wr = 1;
+        return;
+      }
+      p = r % npages;
+      a->wr = 0;
+      break;
+    case WL_PRODCONS:
+      /* vcpu0 of node0 writes pages in turn, others read them */
+      p = (v->n / 4) % npages;
+      a->wr = v->gid == 0;
+      break;
+    default:
+      fatal("workload %d", workload);
+  }
+
+  a->ipa = page_ipa(p) + (r >> 20) % (PAGESIZE / 8) * 8;
+  v->last = *a;
+}
+
+int sim_next_access(int node, int slot, u64 *ipa, int *wr) {
+  struct simvcpu *v = &vcpus[node][slot];
+  struct access a;
+
+  if(workload == WL_TRACE ? v->n >= v->ntrace : v->n >= naccess)
+    return 0;
+
+  /* think time: other vcpus and the fabric make progress */
+  v->state = V_READY;
+  ev_push(now + think_ns, EV_RUN, v, NULL, -1);
+  vcpu_switch_out(v);
+
+  if(workload == WL_TRACE)
+    a = v->trace[v->n];
+  else
+    gen_access(v, &a);
+
+  v->n++;
+
+  *ipa = a.ipa;
+  *wr = a.wr;
+
+  return 1;
+}
+
+static void latvec_add(struct latvec *l, u64 ns) {
+  if(l->n == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 4096;
+    l->v = realloc(l->v, sizeof(u64) * l->cap);
+    if(!l->v)
+      fatal("latency samples");
+  }
+
+  l->v[l->n++] = ns;
+}
+
+void sim_access_done(int node, int slot, int wr, enum sim_access_result r, u64 ns) {
+  (void)node;
+  (void)slot;
+
+  result[!!wr][r]++;
+
+  if(r == SIM_REMOTE_FAULT)
+    latvec_add(&remote_lat[!!wr], ns);
+  else if(r == SIM_LOCAL_FAULT)
+    local_lat_sum[!!wr] += ns;
+}
+
+/*
+ *  recorded accesses:
+ *    "<node> <vcpu> r|w <ipa>", or
+ *    vsmtrace dumps (hvc #1 / panic): fetch requests are replayed
+ */
+static void trace_add(int node, int slot, u64 ipa, int wr) {
+  struct simvcpu *v;
+
+  if(node < 0 || node >= SIM_NODE_MAX || slot < 0 || slot >= SIM_VCPU_MAX)
+    return;
+
+  if(node + 1 > nnodes)
+    nnodes = node + 1;
+  if(slot + 1 > nvcpu)
+    nvcpu = slot + 1;
+
+  v = &vcpus[node][slot];
+
+  if(v->ntrace == v->trace_cap) {
+    v->trace_cap = v->trace_cap ? v->trace_cap * 2 : 4096;
+    v->trace = realloc(v->trace, sizeof(*v->trace) * v->trace_cap);
+    if(!v->trace)
+      fatal("trace");
+  }
+
+  v->trace[v->ntrace].ipa = ipa;
+  v->trace[v->ntrace].wr = wr;
+  v->ntrace++;
+}
+
+static void load_trace(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+  int node = -1;
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  nnodes = nvcpu = 1;
+
+  while(fgets(line, sizeof(line), f)) {
+    unsigned long long ipa, stamp;
+    unsigned int seq, connid, aux;
+    int n, slot, type, from, to;
+    char rw;
+    char *p;
+
+    if((p = strstr(line, "vsmtrace: begin node")) != NULL) {
+      if(sscanf(p, "vsmtrace: begin node %d", &n) == 1)
+        node = n;
+      continue;
+    }
+
+    if(strstr(line, "vsmtrace: end")) {
+      node = -1;
+      continue;
+    }
+
+    if(node >= 0) {
+      /*
+       *  keep in sync with include/vsm-log.h: VT_FETCH_REQ is 0.
+       *  the vcpu slot is the lower 3 bits of the connection id.
+       */
+      if((p = strstr(line, "vt ")) != NULL &&
+         sscanf(p, "vt %d %u %llx %d %d %d %llx %x %x", &slot, &seq, &stamp,
+                &type, &from, &to, &ipa, &connid, &aux) == 9 && type == 0)
+        trace_add(node, connid & 0x7, ipa, aux & 1);
+      continue;
+    }
+
+    if(sscanf(line, "%d %d %c %llx", &n, &slot, &rw, &ipa) == 4)
+      trace_add(n, slot, ipa, rw == 'w' || rw == 'W');
+  }
+
+  fclose(f);
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void report_lat(const char *name, struct latvec *l) {
+  u64 sum = 0;
+
+  if(!l->n)
+    return;
+
+  qsort(l->v, l->n, sizeof(u64), u64_cmp);
+
+  for(u64 i = 0; i < l->n; i++)
+    sum += l->v[i];
+
+  printf("vsmsim: fault=%s n=%lu avg_ns=%lu p50_ns=%lu p99_ns=%lu max_ns=%lu\n",
+         name, l->n, sum / l->n, l->v[l->n / 2], l->v[l->n * 99 / 100], l->v[l->n - 1]);
+}
+
+static void report(double wall) {
+  u64 total_n = 0, total_bytes = 0;
+  u64 hits = result[0][SIM_HIT] + result[1][SIM_HIT];
+  u64 lfault = result[0][SIM_LOCAL_FAULT] + result[1][SIM_LOCAL_FAULT];
+  u64 rfault = result[0][SIM_REMOTE_FAULT] + result[1][SIM_REMOTE_FAULT];
+  u64 bad = result[0][SIM_BAD_ADDRESS] + result[1][SIM_BAD_ADDRESS];
+
+  printf("vsmsim: policy=%s workload=%s nodes=%d vcpus=%d pages=%lu write_pct=%d "
+         "latency_ns=%lu bw_mbps=%lu msg_ns=%lu think_ns=%lu\n",
+         SIM_POLICY, wlname[workload], nnodes, nvcpu, npages, write_pct,
+         latency_ns, bw_mbps, msg_ns, think_ns);
+
+  printf("vsmsim: accesses=%lu hits=%lu local_faults=%lu remote_faults=%lu bad=%lu\n",
+         hits + lfault + rfault + bad, hits, lfault, rfault, bad);
+
+  report_lat("read", &remote_lat[0]);
+  report_lat("write", &remote_lat[1]);
+
+  if(lfault)
+    printf("vsmsim: fault=local n=%lu avg_ns=%lu\n", lfault,
+           (local_lat_sum[0] + local_lat_sum[1]) / lfault);
+
+  for(int t = 0; t < SIM_MSG_MAX; t++) {
+    u64 n = 0, bytes = 0;
+
+    for(int i = 0; i < nnodes; i++) {
+      n += msgstat[i][t].n;
+      bytes += msgstat[i][t].bytes;
+    }
+
+    if(!n)
+      continue;
+
+    const char *name = node_ops[0]->msg_name(t);
+
+    if(name)
+      printf("vsmsim: msg=%s n=%lu bytes=%lu\n", name, n, bytes);
+    else
+      printf("vsmsim: msg=%d n=%lu bytes=%lu\n", t, n, bytes);
+
+    total_n += n;
+    total_bytes += bytes;
+  }
+
+  if(verbose) {
+    for(int i = 0; i < nnodes; i++) {
+      u64 n = 0, bytes = 0;
+
+      for(int t = 0; t < SIM_MSG_MAX; t++) {
+        n += msgstat[i][t].n;
+        bytes += msgstat[i][t].bytes;
+      }
+
+      printf("vsmsim: node=%d sent=%lu sent_bytes=%lu recv=%lu busy_pct=%lu\n", i, n, bytes,
+             nrecv[i], now ? nrecv[i] * msg_ns * 100 / now : 0);
+    }
+  }
+
+  printf("vsmsim: msgs=%lu bytes=%lu msgs_per_fault=%.2f bytes_per_fault=%.0f\n",
+         total_n, total_bytes, rfault ? (double)total_n / rfault : 0.0,
+         rfault ? (double)total_bytes / rfault : 0.0);
+
+  printf("vsmsim: sim_time_us=%lu wall_ms=%.0f faults_per_sec=%.0f\n",
+         now / 1000, wall * 1000, wall > 0 ? (lfault + rfault) / wall : 0.0);
+}
+
+static void dump_nodes(enum sim_dump what) {
+  dumping = 1;
+
+  for(int n = 0; n < nnodes; n++) {
+    if(what != SIM_DUMP_TRACE && what != SIM_DUMP_PAGE)
+      printf("vsmsim: node%d\n", n);
+
+    node_ops[n]->dump(what);
+  }
+
+  dumping = 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -N nodes        nodes (%d)\n"
+    "  -c vcpus        vcpus per node (%d)\n"
+    "  -w workload     private, shared, hotspot, migratory, prodcons (%s)\n"
+    "  -f trace        replay a trace instead (\"node vcpu r|w ipa\" or vsmtrace dumps)\n"
+    "  -n accesses     accesses per vcpu (%lu)\n"
+    "  -p pages        working set in pages (%lu)\n"
+    "  -W percent      writes (%d)\n"
+    "  -l ns           one-way latency (%lu)\n"
+    "  -b mbps         link bandwidth (%lu)\n"
+    "  -m ns           per msg handling time of a node (%lu)\n"
+    "  -t ns           think time between accesses (%lu)\n"
+    "  -M mb           memory per node (%lu)\n"
+    "  -s seed         random seed (%lu)\n"
+    "  -d tlb|lat|trace|page  dump tlb stats, fault latency stages, vsm trace rings\n"
+    "                  or page profile (tools/pageprof)\n"
+    "  -v              more output (-vv: vmm_warn, -vvv: everything)\n",
+    prog, nnodes, nvcpu, wlname[workload], naccess, npages, write_pct,
+    latency_ns, bw_mbps, msg_ns, think_ns, mem_per_node >> 20, seed);
+
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  struct timespec t0, t1;
+  int opt;
+
+  while((opt = getopt(argc, argv, "N:c:w:f:n:p:W:l:b:m:t:M:s:d:vh")) != -1) {
+    switch(opt) {
+      case 'N': nnodes = atoi(optarg); break;
+      case 'c': nvcpu = atoi(optarg); break;
+      case 'w':
+        for(workload = 0; workload < WL_TRACE; workload++) {
+          if(!strcmp(optarg, wlname[workload]))
+            break;
+        }
+        if(workload == WL_TRACE)
+          usage(argv[0]);
+        break;
+      case 'f': workload = WL_TRACE; load_trace(optarg); break;
+      case 'n': naccess = strtoul(optarg, NULL, 0); break;
+      case 'p': npages = strtoul(optarg, NULL, 0); break;
+      case 'W': write_pct = atoi(optarg); break;
+      case 'l': latency_ns = strtoul(optarg, NULL, 0); break;
+      case 'b': bw_mbps = strtoul(optarg, NULL, 0); break;
+      case 'm': msg_ns = strtoul(optarg, NULL, 0); break;
+      case 't': think_ns = strtoul(optarg, NULL, 0); break;
+      case 'M': mem_per_node = strtoul(optarg, NULL, 0) << 20; break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'd':
+        if(!strcmp(optarg, "tlb"))
+          dump_tlb = 1;
+        else if(!strcmp(optarg, "lat"))
+          dump_lat = 1;
+        else if(!strcmp(optarg, "trace"))
+          dump_trace = 1;
+        else if(!strcmp(optarg, "page"))
+          dump_page = 1;
+        else
+          usage(argv[0]);
+        break;
+      case 'v': verbose++; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if(nnodes < 2 || nnodes > SIM_NODE_MAX || nvcpu < 1 || nvcpu > SIM_VCPU_MAX)
+    fatal("2-%d nodes, 1-%d vcpus per node", SIM_NODE_MAX, SIM_VCPU_MAX);
+  if(!npages || !bw_mbps || mem_per_node % (2 << 20))
+    fatal("bad parameter");
+  if(npages / nnodes * PAGESIZE > mem_per_node)
+    fatal("%lu pages do not fit in %lu MB per node", npages, mem_per_node >> 20);
+
+  arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(arena == MAP_FAILED)
+    fatal("page arena");
+  arena_brk = arena;
+
+  for(int n = 0; n < nnodes; n++)
+    node_ops[n]->init(n, nnodes, nvcpu, mem_per_node);
+
+  for(int n = 0; n < nnodes; n++) {
+    for(int s = 0; s < nvcpu; s++) {
+      struct simvcpu *v = &vcpus[n][s];
+
+      v->node = n;
+      v->slot = s;
+      v->gid = n * nvcpu + s;
+      v->rng = (seed * 0x9e3779b97f4a7c15ul) ^ (v->gid + 1) * 0xbf58476d1ce4e5b9ul;
+      if(!v->rng)
+        v->rng = 1;
+
+      v->stack = malloc(VCPU_STACK_SIZE);
+      if(!v->stack)
+        fatal("vcpu stack");
+
+      getcontext(&v->ctx);
+      v->ctx.uc_stack.ss_sp = v->stack;
+      v->ctx.uc_stack.ss_size = VCPU_STACK_SIZE;
+      v->ctx.uc_link = NULL;
+      makecontext(&v->ctx, (void (*)(void))vcpu_trampoline, 2, n, s);
+
+      v->state = V_READY;
+      ev_push(0, EV_RUN, v, NULL, -1);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  while(nheap) {
+    struct event e = ev_pop();
+
+    now = e.t;
+
+    switch(e.type) {
+      case EV_RUN:
+        vcpu_resume(e.vcpu);
+        break;
+      case EV_MSG:
+        deliver(e.pkt);
+        break;
+      case EV_RX:
+        rx_done(e.node);
+        break;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  for(int n = 0; n < nnodes; n++) {
+    for(int s = 0; s < nvcpu; s++) {
+      if(vcpus[n][s].state != V_DONE)
+        fatal("node%d vcpu%d never woken up (state %d)", n, s, vcpus[n][s].state);
+    }
+  }
+
+  report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+
+  if(dump_tlb)
+    dump_nodes(SIM_DUMP_TLB);
+  if(dump_lat)
+    dump_nodes(SIM_DUMP_FAULT_LAT);
+  if(dump_trace)
+    dump_nodes(SIM_DUMP_TRACE);
+  if(dump_page)
+    dump_nodes(SIM_DUMP_PAGE);
+
+  return 0;
+}
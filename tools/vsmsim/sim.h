@@ -0,0 +1,73 @@
+/*
+ *  vsmsim: interface between the simulator (sim.c, host libc) and
+ *  the nodes (node.c + core/, pocv2 headers)
+ *
+ *  the includer defines u64 and u32.
+ */
+
+#ifndef VSMSIM_SIM_H
+#define VSMSIM_SIM_H
+
+/* node objects linked into vsmsim (node0.o .. node7.o) */
+#define SIM_NODE_MAX      8
+
+/* vcpus per node: lower 3 bits of the msg connectionid */
+#define SIM_VCPU_MAX      8
+
+/* msg types counted by the simulator (enum msgtype) */
+#define SIM_MSG_MAX       32
+
+enum sim_dump {
+  SIM_DUMP_TLB,
+  SIM_DUMP_FAULT_LAT,
+  SIM_DUMP_TRACE,
+  SIM_DUMP_PAGE,
+};
+
+/* one copy per node: everything else of a node object is local */
+struct sim_node_ops {
+  void (*init)(int nodeid, int nnodes, int nvcpu, u64 mem_per_node);
+  /* a packet from the fabric: msg_recv() + do_recv_waitqueue() */
+  void (*recv)(void *hdr, u32 len, void *body, u32 body_len);
+  /* vcpu coroutine: run accesses until the workload ends */
+  void (*vcpu_entry)(int slot);
+  void (*dump)(enum sim_dump what);
+  const char *(*msg_name)(int type);
+};
+
+extern struct sim_node_ops sim_node_ops0, sim_node_ops1, sim_node_ops2, sim_node_ops3,
+                           sim_node_ops4, sim_node_ops5, sim_node_ops6, sim_node_ops7;
+
+/* provided by sim.c */
+u64 sim_cntpct(void);
+
+void *sim_alloc_pages(int order);
+void sim_free_pages(void *p, int order);
+
+/* zeroed, as malloc() of core/malloc.c */
+void *sim_malloc(u64 size);
+void sim_free(void *p);
+
+/* dst < 0: broadcast */
+void sim_send(int src, int dst, int type, void *hdr, u32 len, void *body, u32 body_len);
+
+void sim_wait(int node, int slot);
+void sim_wakeup(int node, int slot);
+void sim_yield(int node, int slot);
+
+/* next access of a vcpu (after its think time), 0 at the end */
+int sim_next_access(int node, int slot, u64 *ipa, int *wr);
+
+enum sim_access_result {
+  SIM_HIT,
+  SIM_LOCAL_FAULT,      /* zero fill, owner upgrade */
+  SIM_REMOTE_FAULT,     /* waited for a fetch reply */
+  SIM_BAD_ADDRESS,
+};
+
+void sim_access_done(int node, int slot, int wr, enum sim_access_result r, u64 ns);
+
+void sim_vlog(int node, const char *fmt, __builtin_va_list ap);
+void sim_vpanic(int node, const char *fmt, __builtin_va_list ap) __attribute__((noreturn));
+
+#endif  /* VSMSIM_SIM_H */
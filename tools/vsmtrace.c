@@ -0,0 +1,342 @@
+/*
+ *  vsmtrace: merge vsm trace dumps of all nodes into per-fault timelines
+ *
+ *    $ vsmtrace node0.log node1.log ...
+ *
+ *  each log is a console output containing "vsmtrace: begin" ... "end"
+ *  (hvc #1 or panic).  counters of nodes are not synchronized: the offset
+ *  of each node against node 0 is estimated from the minimal one-way
+ *  delays of msgs in both directions (send and recv of the same connection).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+#define NODE_MAX    8
+
+/* keep in sync with include/vsm-log.h */
+enum vtrace_type {
+  VT_FETCH_REQ,
+  VT_FETCH_FWD,
+  VT_FETCH_REPLY,
+  VT_SERVER_RECV,
+  VT_SERVER_PROC,
+  VT_SERVER_REPLY,
+  VT_INV_SEND,
+  VT_INV_RECV,
+  VT_MAP,
+  NR_VTRACE_TYPE,
+};
+
+static const char *vtname[NR_VTRACE_TYPE] = {
+  [VT_FETCH_REQ] =      "fetch-req",
+  [VT_FETCH_FWD] =      "fetch-fwd",
+  [VT_FETCH_REPLY] =    "fetch-reply",
+  [VT_SERVER_RECV] =    "server-recv",
+  [VT_SERVER_PROC] =    "server-proc",
+  [VT_SERVER_REPLY] =   "server-reply",
+  [VT_INV_SEND] =       "inv-send",
+  [VT_INV_RECV] =       "inv-recv",
+  [VT_MAP] =            "map",
+};
+
+struct ev {
+  int node;
+  int cpu;
+  u32 seq;
+  u64 stamp;
+  double t;         /* ns on node 0 time base */
+  int type;
+  int from;
+  int to;
+  u64 ipa;
+  u32 connid;
+  u32 aux;
+};
+
+static struct ev *evs;
+static int nevs, evcap;
+
+static u64 freq[NODE_MAX];
+static double offset[NODE_MAX];   /* ns, add to local time */
+static int nnodes;
+
+static void add_ev(struct ev *e) {
+  if(nevs == evcap) {
+    evcap = evcap ? evcap * 2 : 4096;
+    evs = realloc(evs, sizeof(*evs) * evcap);
+    if(!evs) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+
+  evs[nevs++] = *e;
+}
+
+static void parse(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+  int node = -1;
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  while(fgets(line, sizeof(line), f)) {
+    char *p;
+    unsigned long long fr;
+    int n, ncpu;
+
+    if((p = strstr(line, "vsmtrace: begin node")) != NULL) {
+      if(sscanf(p, "vsmtrace: begin node %d ncpu %d freq %llu", &n, &ncpu, &fr) == 3 &&
+         n >= 0 && n < NODE_MAX) {
+        node = n;
+        freq[node] = fr;
+        if(node + 1 > nnodes)
+          nnodes = node + 1;
+      }
+      continue;
+    }
+
+    if(strstr(line, "vsmtrace: end")) {
+      node = -1;
+      continue;
+    }
+
+    if(node < 0 || (p = strstr(line, "vt ")) == NULL)
+      continue;
+
+    struct ev e = { .node = node };
+    unsigned long long stamp, ipa;
+    unsigned int connid, aux, seq;
+
+    if(sscanf(p, "vt %d %u %llx %d %d %d %llx %x %x", &e.cpu, &seq, &stamp,
+              &e.type, &e.from, &e.to, &ipa, &connid, &aux) != 9)
+      continue;
+    if(e.type < 0 || e.type >= NR_VTRACE_TYPE)
+      continue;
+
+    e.seq = seq;
+    e.stamp = stamp;
+    e.ipa = ipa;
+    e.connid = connid;
+    e.aux = aux;
+
+    add_ev(&e);
+  }
+
+  fclose(f);
+}
+
+static double local_ns(struct ev *e) {
+  u64 fr = freq[e->node] ? freq[e->node] : 62500000;
+
+  return (double)e->stamp * 1e9 / (double)fr;
+}
+
+/* recv matches send: same connection of the same sender */
+static int msg_pair(struct ev *s, struct ev *r) {
+  switch(s->type) {
+    case VT_FETCH_REQ:
+    case VT_FETCH_FWD:
+      if(r->type != VT_SERVER_RECV || r->node != s->to)
+        return 0;
+      break;
+    case VT_SERVER_REPLY:
+      if(r->type != VT_FETCH_REPLY || r->node != s->to || r->to != s->node)
+        return 0;
+      break;
+    case VT_INV_SEND:
+      if(r->type != VT_INV_RECV || r->node != s->to || r->from != s->node)
+        return 0;
+      break;
+    default:
+      return 0;
+  }
+
+  return s->ipa == r->ipa && (s->connid >> 3) == (r->connid >> 3);
+}
+
+/*
+ *  true time = local time + off:
+ *    d(a->b) = delay + off(a) - off(b),  d(b->a) = delay + off(b) - off(a)
+ *  with symmetric minimal delay: off(b) = off(a) - (d(a->b) - d(b->a)) / 2
+ */
+static void estimate_offsets() {
+  static double dmin[NODE_MAX][NODE_MAX];
+  static int have[NODE_MAX][NODE_MAX];
+  int done[NODE_MAX] = { 0 };
+
+  for(int i = 0; i < nevs; i++) {
+    struct ev *s = &evs[i];
+
+    if(s->type != VT_FETCH_REQ && s->type != VT_FETCH_FWD &&
+       s->type != VT_SERVER_REPLY && s->type != VT_INV_SEND)
+      continue;
+
+    for(int j = 0; j < nevs; j++) {
+      struct ev *r = &evs[j];
+
+      if(r->node == s->node || !msg_pair(s, r))
+        continue;
+
+      double d = local_ns(r) - local_ns(s);
+
+      if(!have[s->node][r->node] || d < dmin[s->node][r->node]) {
+        dmin[s->node][r->node] = d;
+        have[s->node][r->node] = 1;
+      }
+    }
+  }
+
+  /* node 0 is the time base, others are reached over measured pairs */
+  done[0] = 1;
+  offset[0] = 0;
+
+  for(int round = 0; round < nnodes; round++) {
+    for(int a = 0; a < nnodes; a++) {
+      if(!done[a])
+        continue;
+
+      for(int b = 0; b < nnodes; b++) {
+        if(done[b] || !have[a][b] || !have[b][a])
+          continue;
+
+        offset[b] = offset[a] - (dmin[a][b] - dmin[b][a]) / 2;
+        done[b] = 1;
+
+        printf("# node%d: offset %.0f ns to node0 (min delay %.0f/%.0f ns via node%d)\n",
+               b, offset[b], dmin[a][b], dmin[b][a], a);
+      }
+    }
+  }
+
+  for(int n = 1; n < nnodes; n++) {
+    if(!done[n])
+      printf("# node%d: no msg pair in both directions, offset unknown\n", n);
+  }
+}
+
+static int ev_cmp(const void *a, const void *b) {
+  const struct ev *x = a, *y = b;
+
+  if(x->t < y->t)
+    return -1;
+  if(x->t > y->t)
+    return 1;
+  return 0;
+}
+
+static void print_ev(struct ev *e, double base) {
+  printf("  %+10.1f us  node%d cpu%d  %-12s %d -> %d",
+         (e->t - base) / 1000.0, e->node, e->cpu, vtname[e->type], e->from, e->to);
+
+  if(e->type == VT_FETCH_REPLY || e->type == VT_SERVER_REPLY)
+    printf("  %s%s", e->aux & 1 ? "write" : "read", e->aux & 2 ? " zero" : "");
+
+  printf("\n");
+}
+
+/*
+ *  a fault: fetch-req on node R .. fetch-reply on the same cpu of R,
+ *  with events of the other nodes for the page requested by R in between
+ */
+static void timelines(int verbose) {
+  double sum[2] = { 0 }, max[2] = { 0 };
+  int cnt[2] = { 0 };
+
+  for(int i = 0; i < nevs; i++) {
+    struct ev *req = &evs[i];
+    struct ev *reply = NULL;
+    int j;
+
+    if(req->type != VT_FETCH_REQ)
+      continue;
+
+    for(j = i + 1; j < nevs; j++) {
+      struct ev *e = &evs[j];
+
+      if(e->node == req->node && e->cpu == req->cpu && e->ipa == req->ipa &&
+         e->type == VT_FETCH_REPLY) {
+        reply = e;
+        break;
+      }
+    }
+
+    if(!reply)
+      continue;
+
+    int wr = req->aux & 1;
+    double lat = reply->t - req->t;
+
+    sum[wr] += lat;
+    cnt[wr]++;
+    if(lat > max[wr])
+      max[wr] = lat;
+
+    if(!verbose)
+      continue;
+
+    printf("fault %s ipa %llx node%d cpu%d: %.1f us\n", wr ? "write" : "read",
+           (unsigned long long)req->ipa, req->node, req->cpu, lat / 1000.0);
+
+    for(int k = i; k <= j; k++) {
+      struct ev *e = &evs[k];
+
+      if(e->ipa != req->ipa)
+        continue;
+      if(k == i || k == j || (e->node != req->node && e->from == req->node) ||
+         e->type == VT_INV_SEND || e->type == VT_INV_RECV)
+        print_ev(e, req->t);
+    }
+  }
+
+  for(int wr = 0; wr < 2; wr++) {
+    if(!cnt[wr])
+      continue;
+
+    printf("# %s faults: %d avg %.1f us max %.1f us\n", wr ? "write" : "read",
+           cnt[wr], sum[wr] / cnt[wr] / 1000.0, max[wr] / 1000.0);
+  }
+}
+
+int main(int argc, char **argv) {
+  int verbose = 1;
+  int i = 1;
+
+  if(argc > 1 && !strcmp(argv[1], "-s")) {
+    verbose = 0;
+    i++;
+  }
+
+  if(i >= argc) {
+    fprintf(stderr, "usage: %s [-s] node0.log [node1.log ...]\n", argv[0]);
+    return 1;
+  }
+
+  for(; i < argc; i++)
+    parse(argv[i]);
+
+  if(!nevs) {
+    fprintf(stderr, "no trace records\n");
+    return 1;
+  }
+
+  estimate_offsets();
+
+  for(int k = 0; k < nevs; k++)
+    evs[k].t = local_ns(&evs[k]) + offset[evs[k].node];
+
+  qsort(evs, nevs, sizeof(*evs), ev_cmp);
+
+  timelines(verbose);
+
+  return 0;
+}